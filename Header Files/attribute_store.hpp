@@ -0,0 +1,117 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* attribute_store.hpp
+* This file contains the definition of the attributes of the vectors and of the filters over
+* them. Every vector may carry integer attributes (a tenant, a date, a category), read from a
+* text file next to the dataset and stored column by column in the order of the IDs of the
+* index. A filter is a conjunction of ranges over the attributes; before a query is run, it is
+* compiled into the set of IDs that satisfy it and into the blocks of IDs that hold at least
+* one of them, so the scans skip the blocks without any vector of the filter.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__attribute_store__
+#define __Heidi__attribute_store__
+
+#include "constants.hpp"
+#include "id_set.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of consecutive IDs of a block skipped by a filter */
+#define ATTRIBUTE_BLOCK_SIZE        4096
+
+/* maximum number of attributes of a vector */
+#define ATTRIBUTE_MAX_COLUMNS       64
+
+/* magic number written at the beginning of an attribute file */
+#define ATTRIBUTE_MAGIC             0x52545441
+
+/* attributes of the vectors of the index. Vector v has the ID v + 1 */
+typedef struct
+{
+	int num_attributes;
+	long num_vectors;
+	long long *values;			/* num_attributes x num_vectors, one attribute after the other */
+} attribute_store;
+
+/* range of values of one attribute */
+typedef struct
+{
+	int attribute;
+	long long min;
+	long long max;
+} attribute_condition;
+
+/* filter compiled for the current index */
+typedef struct
+{
+	id_set *ids;				/* IDs of the vectors that satisfy every condition */
+	long long num_ids;
+	char *block_predicate;		/* predicate over the ID column that selects the blocks holding
+								 * at least one of the IDs */
+} attribute_filter;
+
+/*
+* attribute_store_build: reads the attributes of the dataset from the text file
+*				<DATASET_PATH>.attr, one line per vector in the order of the dataset file with
+*				the same number of integers on every line, and saves them in the order of the
+*				IDs of the index, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.attr
+*				Without a text file, the attributes of a previous index are removed
+*/
+void attribute_store_build();
+
+/*
+* get_attribute_store: returns the attributes of the current index, read from the file the
+*				first time they are needed. Returns NULL if the vectors have no attributes
+*/
+attribute_store *get_attribute_store();
+
+/*
+* attribute_filter_compile: returns the filter that keeps the vectors whose attributes are
+*				within every range
+*
+*		* store - attributes of the index
+*		* conditions - ranges of the attributes
+*		* num_conditions - number of ranges
+*/
+attribute_filter *attribute_filter_compile(const attribute_store *store, const attribute_condition *conditions, int num_conditions);
+
+/*
+* attribute_filter_load: reads the filter of a query from the text file <query_path>.filter,
+*				one condition per line in the form <attribute> <min> <max>, and compiles it.
+*				Returns NULL if the query has no filter or the index has no attributes
+*
+*		* query_path - path of the query
+*/
+attribute_filter *attribute_filter_load(const char *query_path);
+
+/*
+* attribute_filter_free: deallocates a filter
+*
+*		* filter - the filter to deallocate
+*/
+void attribute_filter_free(attribute_filter *filter);
+
+/*
+* attribute_filter_contains: returns 1 if the vector satisfies the filter and 0 otherwise.
+*				Every vector satisfies a NULL filter
+*
+*		* filter - a compiled filter, or NULL
+*		* id - ID of the vector in the tables of the index
+*/
+int attribute_filter_contains(const attribute_filter *filter, long long id);
+
+#endif /* defined(__Heidi__attribute_store__) */
@@ -0,0 +1,126 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* cascade_planner.hpp
+* This file contains the definition of the cascade planner. For each query, the planner
+* chooses the level that is scanned first and the levels that refine its candidates, using
+* the selectivity observed at each level by previous queries or estimated from the statistics
+* of the index, and the cost of reading a vector at each level. Scanning the original data directly (brute force) is one of the plans.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__cascade_planner__
+#define __Heidi__cascade_planner__
+
+#include "constants.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_matrix.h>
+
+/* cost of reading a row, independent of its dimension, in number of values read */
+#define CASCADE_ROW_COST            8.0
+
+/* extra cost of reading a candidate by ID and joining it with the previous level, compared
+ * with a sequential scan */
+#define CASCADE_LOOKUP_FACTOR       2.0
+
+/* with more levels than this, every subset is not enumerated and the full cascade is used */
+#define CASCADE_PLANNER_MAX_LEVELS  16
+
+/* number of past observations averaged with a new one, so that the statistics follow changes
+ * of the workload */
+#define CASCADE_STATISTICS_WINDOW   16
+
+/* smallest selectivity used by the cost model */
+#define CASCADE_MIN_SELECTIVITY     1e-9
+
+/* selectivity observed at one level of the index */
+typedef struct
+{
+	double selectivity;		/* fraction of the vectors of a table within epsilon at the level */
+	double epsilon;			/* epsilon of the queries that were observed */
+	long observations;		/* number of tables observed, 0 if the level was never scanned */
+} cascade_level_stats;
+
+/* statistics gathered by the queries over the current index */
+typedef struct
+{
+	int num_levels;					/* NUM_PROJECTIONS + 1 */
+	cascade_level_stats *levels;
+	long index_version;				/* INDEX_VERSION when the statistics were reset */
+} cascade_statistics;
+
+/* levels evaluated by a query, from the level scanned first to the original data */
+typedef struct
+{
+	int num_levels;				/* number of levels evaluated, 1 for brute force */
+	int *levels;				/* the last level is always 0 */
+	double cost;				/* estimated cost, in values read per vector of a table */
+	double full_cascade_cost;	/* estimated cost of evaluating every level */
+	double brute_force_cost;	/* estimated cost of scanning the original data */
+} cascade_plan;
+
+/*
+* get_cascade_statistics: returns the statistics of the current index. They are reset when
+*				the index changes
+*/
+cascade_statistics *get_cascade_statistics();
+
+/*
+* cascade_statistics_update: records how many vectors of a table were within epsilon at a level
+*
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* epsilon - radius of the query
+*		* num_scanned - number of vectors of the table
+*		* num_passed - number of vectors within epsilon at the level
+*/
+void cascade_statistics_update(int level, double epsilon, long num_scanned, long num_passed);
+
+/*
+* cascade_estimate_selectivity: returns the expected fraction of the vectors within epsilon at
+*				a level, or a negative value when no level was observed and the index has no
+*				statistics
+*
+*		* query - matrix containing the query vector and all of its projections
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* epsilon - radius of the query
+*/
+double cascade_estimate_selectivity(gsl_matrix *query, int level, double epsilon);
+
+/*
+* cascade_plan_build: chooses the cheapest sequence of levels for a query with radius epsilon.
+*				Without statistics, every level is evaluated
+*
+*		* query - matrix containing the query vector and all of its projections
+*		* epsilon - radius of the query
+*/
+cascade_plan *cascade_plan_build(gsl_matrix *query, double epsilon);
+
+/*
+* cascade_plan_free: deallocates a plan
+*
+*		* plan - the plan to deallocate
+*/
+void cascade_plan_free(cascade_plan *plan);
+
+/*
+* print_cascade_plan: displays the levels of a plan and its estimated costs. used for
+*				debugging purposes
+*
+*		* plan - the plan to display
+*/
+void print_cascade_plan(cascade_plan *plan);
+
+#endif /* defined(__Heidi__cascade_planner__) */
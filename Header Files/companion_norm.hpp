@@ -0,0 +1,60 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* companion_norm.hpp
+* This file contains the definition of the companion norm. The tables and the files of an index
+* are named after its norm, so an index for the L1 norm and one for the L2 norm are usually
+* built by two runs over the whole dataset. Both norms reduce the same windows of the same
+* projections, so a single run can keep, next to every level of its norm, the level of the
+* other one. The companion levels are stored in the tables that a build with the other norm
+* would create, the original data is shared through a view, and the side files that do not
+* depend on the norm are copied, so a query chooses its norm with the norm type of its input.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__companion_norm__
+#define __Heidi__companion_norm__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* companion_norm_type: returns the norm that is not NORM_TYPE, L1 or L2
+*/
+const char *companion_norm_type();
+
+/*
+* companion_norm_swap: exchanges NORM_TYPE with the companion norm, so that the names of the
+*				tables and of the files refer to the other hierarchy. A second call restores it
+*/
+void companion_norm_swap();
+
+/*
+* companion_norm_share_table: shows the original data, in the current table, under the name of
+*				the original data of the companion norm
+*
+*		* hdbc - an  opened SQL connection
+*/
+void companion_norm_share_table(HDBC hdbc);
+
+/*
+* companion_norm_share_files: copies the files of the index that do not depend on the norm (the
+*				order of the IDs and of the columns, the duplicates and the attributes) to the
+*				names of the companion norm, and removes the files of the companion norm that
+*				the build does not produce for it
+*/
+void companion_norm_share_files();
+
+#endif /* defined(__Heidi__companion_norm__) */
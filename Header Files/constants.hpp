@@ -33,6 +33,125 @@
 /* size of each chunk of data */
 #define CHUNK_SIZE              10000
 
+/* position of the table index inside the IDs returned by a query over several tables */
+#define SHARD_ID_SHIFT          40
+
+/* 1 to keep the results of the queries in memory, so that a repeated query, or one contained
+ * in an earlier query, is answered without the database */
+#define QUERY_CACHE             1
+
+/* memory budget of the cache of query results */
+#define QUERY_CACHE_MAX_BYTES   (64 * 1024 * 1024)
+
+/* number of candidates refined by each query of the cascade */
+#define CASCADE_PARTITION_SIZE  4096
+
+/* default time budget of a query in milliseconds, 0 for no limit */
+#define QUERY_TIME_BUDGET       0
+
+/* 1 to scale the distances of each level with the constants calibrated on the data, which
+ * prune more candidates but may lose results, 0 to use the constants that never lose results */
+#define APPROXIMATE_CONSTANTS   0
+
+/* fraction of the results kept by the calibrated constants */
+#define CALIBRATION_TARGET_RECALL	0.99
+
+/* factor applied to the radius of a k-NN search each time it finds too few vectors */
+#define KNN_RADIUS_GROWTH       2.0
+
+/* number of neighbours returned when no epsilon is given */
+#define KNN_DEFAULT_K           10
+
+/* 1 to build an inverted file over the lowest level while the index is built */
+#define BUILD_IVF_INDEX         0
+
+/* number of clusters of the inverted file */
+#define IVF_NUM_LISTS           256
+
+/* number of closest clusters probed by a query, 0 to probe every cluster that can hold a match */
+#define IVF_NPROBE              0
+
+/* 1 to build a navigable small world graph over one level while the index is built */
+#define BUILD_HNSW_INDEX        0
+
+/* level of the graph, from 0 to NUM_PROJECTIONS, or -1 for the lowest level */
+#define HNSW_LEVEL              -1
+
+/* number of vectors kept while searching the graph; the k-NN queries re-rank this many vectors */
+#define HNSW_EF_SEARCH          64
+
+/* number of threads that build the graph, 0 for one per processor */
+#define HNSW_BUILD_THREADS      0
+
+/* 1 to index one representative of every group of identical lines of the dataset file, whose
+ * matches are expanded to every line of the group */
+#define COLLAPSE_DUPLICATES     0
+
+/* 0 to build the index with the windows given in input, 1 to only display the windows that
+ * the tuner finds cheapest on a sample of the data, 2 to build the index with them */
+#define TUNE_WINDOWS            0
+
+/* order of the IDs of the index: 0 keeps the order of the dataset file, 1 sorts the vectors along
+ * a Z-order curve and 2 along a Hilbert curve of their coordinates at the lowest level */
+#define REORDER_IDS             0
+
+/* 1 to group the columns of the original data into the windows of the first projection step by
+ * their correlation, 0 to reduce the columns in the order of the dataset file */
+#define GROUP_CORRELATED_DIMENSIONS 0
+
+/* 1 to build a bit approximation (VA-file) of the lowest level while the index is built */
+#define BUILD_VA_FILE           0
+
+/* number of bits of each coordinate in the VA-file: 1, 2, 4 or 8 */
+#define VA_FILE_BITS            4
+
+/* 1 to build a product quantization of one level while the index is built */
+#define BUILD_PQ_INDEX          0
+
+/* level of the product quantization, from 0 to NUM_PROJECTIONS, or -1 for the lowest level */
+#define PQ_LEVEL                -1
+
+/* number of subspaces of the product quantization, which is the number of bytes of a vector */
+#define PQ_NUM_SUBSPACES        8
+
+/* number of vectors, taken at regular intervals of the IDs, that train the codebooks */
+#define PQ_TRAINING_SAMPLE      65536
+
+/* 1 to also store all the levels of every vector in one record while the index is built; the
+ * candidates are then refined from the records instead of the level tables */
+#define INTERLEAVED_LAYOUT      0
+
+/* precision of the projected levels in the interleaved records: 0 keeps doubles, 1 stores
+ * half-precision floats and 2 stores one byte per coordinate with a scale and an offset per
+ * coordinate. The largest error of every level is subtracted from its distances, so the
+ * pruning stays exact */
+#define INTERLEAVED_PRECISION   0
+
+/* 1 to add to every level table an indexed NORM column with the norm of each vector, so that
+ * the scans only read the vectors whose norm is within epsilon of the norm of the query */
+#define NORM_INDEX              0
+
+/* the norm of the query is compared with the norms stored in the database, which are computed
+ * in floating point, so the range of the norms is widened by this fraction of the norm */
+#define NORM_INDEX_SLACK        1e-6
+
+/* 1 to build, in the same pass, the levels of the other norm as well. The queries of either
+ * norm are then answered by the index, chosen by the norm type given in input */
+#define BUILD_BOTH_NORMS        0
+
+/* 1 to store the original data in integer columns when every value of the dataset file is a
+ * small non-negative integer */
+#define NARROW_INTEGER_STORAGE  1
+
+/* types of the values of the original data */
+#define VALUE_TYPE_FLOAT        0		/* any value, stored as FLOAT */
+#define VALUE_TYPE_UINT8        1		/* integers from 0 to 255, stored as TINYINT */
+#define VALUE_TYPE_INT16        2		/* integers from 0 to 32767, stored as SMALLINT */
+
+/* largest value of each integer type. SMALLINT is signed, so it holds 15 bits */
+#define VALUE_TYPE_UINT8_MAX    255
+#define VALUE_TYPE_INT16_MAX    32767
+
 #define DELIMITER "\\"
 
 #ifdef  MAIN_FILE
@@ -88,6 +207,12 @@ int NUM_ITEMS;
 /* double value representing the maximum distance acceptable to find nearest neighbours  */
 double EPSILON;
 
+/* counter incremented every time a table of the index is modified */
+long INDEX_VERSION;
+
+/* type of the values of the original data, detected when the dataset is indexed */
+int ORIGINAL_VALUE_TYPE;
+
 #else // ===================================================================================
 
 /* path where the dataset file is located */
@@ -141,5 +266,11 @@ extern double EPSILON;
 /* double value representing the maximum distance acceptable to find nearest neighbours  */
 extern int NUM_ITEMS;
 
+/* counter incremented every time a table of the index is modified */
+extern long INDEX_VERSION;
+
+/* type of the values of the original data, detected when the dataset is indexed */
+extern int ORIGINAL_VALUE_TYPE;
+
 #endif /* defined(__Main__file__) */
 #endif /* defined(__Heidi__constants__) */
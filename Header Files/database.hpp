@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <windows.h>
 #include <sql.h>
@@ -27,6 +28,29 @@
 
 #include <gsl/gsl_matrix.h>
 
+/* number of rows fetched from the database in each round trip of a distance cursor */
+#define RESULT_BATCH_SIZE       1024
+
+/* a vector returned by a query: its ID and its distance to the query vector */
+typedef struct
+{
+	double distance;
+	long long id;
+} query_match;
+
+/* open SQL statement computing distances. The matches are fetched RESULT_BATCH_SIZE rows
+ * at a time directly into the batch array, so the memory is constant for any result size */
+typedef struct
+{
+	SQLHSTMT hstmt;
+	SQLWCHAR *query;
+	query_match *batch;
+	SQLULEN rows_fetched;
+	int finished;
+	int failed;			/* 1 if a fetch returned an error instead of the end of the rows */
+	int squared;		/* 1 if the query returns squared L2 distances */
+} sql_distance_cursor;
+
 #include "query.hpp"
 
 /* 
@@ -57,15 +81,31 @@ SQLHDBC sql_connect_database(SQLHDBC hdbc, SQLHENV henv, char *driver, char *ser
 void sql_transfer_data_to_database(SQLHDBC hdbc);
 
 /*
- * sql_compute_distances: computes the distance between each vector of the database with a 
- *						query vector. The distances can be computed using the L1 norm or L2 norm
+ * sql_open_distance_cursor: executes a query returning the columns DIST and ID and returns a 
+ *						cursor over its results. The cursor takes ownership of the query
  *
  *		* hdbc - an opened SQL connection
- *		* query_matrix - matrix containing the query vector and all of its projections
- *		* chunk - index of the current chunk of data being processed
- *		* dimensions - number of dimensions of the current projection
+ *		* query - a distance query, such as the ones of build_query_to_scan_level and
+ *				build_query_to_sort_level
+*/
+sql_distance_cursor *sql_open_distance_cursor(SQLHDBC hdbc, SQLWCHAR *query );
+
+/*
+ * sql_fetch_distance_batch: fetches the next rows of a distance cursor. Returns the number of
+ *						matches written in cursor->batch, or zero when there are no more rows.
+ *						A failed fetch is reported as any other failed statement
+ *
+ *		* cursor - an opened distance cursor
+*/
+long sql_fetch_distance_batch(sql_distance_cursor *cursor);
+
+/*
+ * sql_close_distance_cursor: closes the SQL statement of a distance cursor, discarding the rows
+ *						that were not fetched, and deallocates the cursor
+ *
+ *		* cursor - an opened distance cursor
 */
-long *sql_compute_distances(SQLHDBC hdbc, gsl_matrix *query_matrix, int chunk, int dimensions );
+void sql_close_distance_cursor(sql_distance_cursor *cursor);
 
 /* 
 * sql_fill_database: performs a bulk insert into the database
@@ -99,6 +139,15 @@ SQLHSTMT sql_allocate_stmt(SQLHDBC hdbc);
 */
 SQLSMALLINT sql_make_prepared_query(SQLHDBC hdbc, SQLWCHAR *query, SQLHSTMT hstmt);
 
+/*
+* sql_execute_statement: performs an SQL statement that returns no rows and deallocates it
+*
+*		* hdbc - an  opened SQL connection
+*		* query - the statement to be performed in the SQLWCHAR * type
+*		* function - name of the calling function, reported if the statement fails
+*/
+void sql_execute_statement(SQLHDBC hdbc, SQLWCHAR *query, char *function);
+
 /* 
 * sql_get_database: returns a chunk of data from an SQL table
 *
@@ -135,6 +184,26 @@ void sql_index_table(SQLHDBC hdbc);
 */
 void sql_add_primary_key(SQLHDBC hdbc);
 
+/*
+* sql_add_norm_index: adds to the current table a column with the norm of each vector and
+*					sorts the vectors by it
+*
+*		* hdbc - an  opened SQL connection
+*		* dims - number of columns of the current table
+*/
+void sql_add_norm_index(SQLHDBC hdbc, int dims);
+
+/*
+* sql_share_table: shows the current table under the name the queries of another norm read,
+*					without copying its vectors
+*
+*		* hdbc - an  opened SQL connection
+*		* view_name - name of the table for the other norm
+*		* dims - number of columns of the current table
+*		* norm_type - the other norm, L1 or L2
+*/
+void sql_share_table(SQLHDBC hdbc, char *view_name, int dims, const char *norm_type);
+
 /*
 * sql_close_connection: Closes an opened connection to a database
 *
@@ -0,0 +1,77 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* dimension_order.hpp
+* This file contains the definition of the order of the dimensions. The first projection step
+* reduces consecutive columns of the original data, so a window of columns that rise and fall
+* together keeps most of their distance, while a window of unrelated columns cancels it. Before
+* the dataset is projected, the columns are grouped into windows by their correlation on a
+* sample of the data, and the first step, for the data and for the queries, reads the columns
+* in that order. The original data keeps the order of the dataset file.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__dimension_order__
+#define __Heidi__dimension_order__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_blas.h>
+
+/* maximum number of vectors used to compute the correlations of the columns */
+#define DIMENSION_ORDER_SAMPLE      8192
+
+/* magic number written at the beginning of a dimension order file */
+#define DIMENSION_ORDER_MAGIC       0x524D4944
+
+/* order in which the first projection step reads the columns of the original data */
+typedef struct
+{
+	int dims;					/* TOTAL_DIMENSIONS */
+	int window;					/* window of the first projection step */
+	int *columns;				/* columns[k] is the column read at position k */
+} dimension_order;
+
+/*
+* dimension_order_build: groups the columns of the original data into windows of correlated
+*				columns and saves the order next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.dimorder
+*				Without group_columns, the order of a previous index is removed
+*
+*		* hdbc - an opened SQL connection
+*		* group_columns - 1 to group the columns, 0 to keep the order of the dataset file
+*/
+void dimension_order_build(HDBC hdbc, int group_columns);
+
+/*
+* get_dimension_order: returns the order of the columns of the current index, read from the
+*				file the first time it is needed. Returns NULL if the columns were not grouped
+*/
+dimension_order *get_dimension_order();
+
+/*
+* dimension_order_apply: returns a copy of a chunk of the original data with its columns in
+*				the order of the index
+*
+*		* order - order of the columns
+*		* data - chunk of the original data, one vector per row
+*		* num_rows - number of vectors of the chunk
+*/
+gsl_matrix *dimension_order_apply(const dimension_order *order, gsl_matrix *data, long num_rows);
+
+#endif /* defined(__Heidi__dimension_order__) */
@@ -0,0 +1,82 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* duplicate_set.hpp
+* This file contains the definition of the exact duplicates of the dataset. Before the dataset
+* is loaded, its lines are hashed and every line equal to an earlier one is dropped, so only
+* one representative of each group of identical vectors is projected, stored at every level
+* and refined by the queries. The posting list of each representative, saved next to the
+* dataset, holds the lines of the dataset file of all the members of its group, and the
+* results of the queries are expanded back to them.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__duplicate_set__
+#define __Heidi__duplicate_set__
+
+#include "constants.hpp"
+#include "id_set.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* maximum length of a line of the dataset file */
+#define DUPLICATE_MAX_LINE          (1 << 20)
+
+/* magic number written at the beginning of a duplicates file */
+#define DUPLICATE_MAGIC             0x50554444
+
+/* groups of identical vectors. Representative r is the vector r + 1 of the loaded data,
+ * before its IDs are reordered */
+typedef struct
+{
+	long num_rows;				/* lines of the dataset file */
+	long num_representatives;	/* vectors of the index */
+	long long *first;			/* num_representatives + 1 positions in members */
+	long long *members;			/* lines of the dataset file, from 1, of every group */
+} duplicate_set;
+
+/*
+* collapse_duplicates: writes the first occurrence of every line of the dataset file to
+*				<DATASET_PATH>.unique, with the attributes of those lines when the dataset has
+*				them, saves the posting lists in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.dup
+*				and makes DATASET_PATH and TOTAL_VECTORS refer to the unique lines. Nothing
+*				changes when the dataset has no duplicates. Without collapse, the posting lists
+*				of a previous index are removed
+*
+*		* collapse - 1 to collapse the duplicates, 0 to index every line
+*/
+void collapse_duplicates(int collapse);
+
+/*
+* duplicate_set_assign_vectors: when the index was built with collapsed duplicates, assigns
+*				to TOTAL_VECTORS the number of vectors of the index
+*/
+void duplicate_set_assign_vectors();
+
+/*
+* get_duplicate_set: returns the groups of identical vectors of the current index, read from
+*				the file the first time they are needed. Returns NULL if no line was collapsed
+*/
+duplicate_set *get_duplicate_set();
+
+/*
+* duplicate_set_add_members: adds to a set the lines of the dataset file, from 1, of every
+*				vector identical to a vector of the index
+*
+*		* set - the set that will receive the IDs
+*		* id - ID of the vector in the tables of the index
+*/
+void duplicate_set_add_members(id_set *set, long long id);
+
+#endif /* defined(__Heidi__duplicate_set__) */
@@ -0,0 +1,127 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* hnsw_index.hpp
+* This file contains the definition of the hierarchical navigable small world graph built over
+* one level of the index. Every vector of the level is a node linked to its closest nodes,
+* and a few nodes are also linked in sparser upper layers, so a greedy walk from the entry
+* point reaches the neighbourhood of a query in a logarithmic number of steps. The graph is
+* built in parallel when the index is built and gives the candidates of the k-NN queries,
+* which are then re-ranked with their exact distances.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__hnsw_index__
+#define __Heidi__hnsw_index__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <windows.h>
+#include <gsl/gsl_matrix.h>
+
+/* number of links of a node in the upper layers */
+#define HNSW_M                      16
+
+/* number of links of a node in the bottom layer */
+#define HNSW_M0                     (2 * HNSW_M)
+
+/* number of vectors kept while searching the neighbours of a new node */
+#define HNSW_EF_CONSTRUCTION        100
+
+/* maximum number of layers of the graph */
+#define HNSW_MAX_LAYERS             16
+
+/* magic number written at the beginning of a graph file */
+#define HNSW_MAGIC                  0x57534E48
+
+/* graph over one level. Node n is the vector with ID n + 1. The links of a node at a layer
+ * are stored as their number followed by the linked nodes */
+typedef struct
+{
+	int level;					/* level of the index the graph is built on */
+	int dims;					/* dimension of the level */
+	long num_nodes;
+	long capacity;				/* number of vectors allocated while building */
+	double *vectors;			/* num_nodes x dims */
+	int *node_layers;			/* top layer of each node */
+	int *links0;				/* num_nodes x (HNSW_M0 + 1) links of the bottom layer */
+	int **upper_links;			/* per node, node_layers[n] x (HNSW_M + 1) links of the upper layers */
+	int entry_point;			/* node where every search starts, -1 if the graph is empty */
+	int max_layer;				/* top layer of the entry point */
+	CRITICAL_SECTION *locks;	/* one lock per node, only while building */
+	CRITICAL_SECTION entry_lock;	/* protects the entry point while building */
+} hnsw_index;
+
+/*
+* hnsw_index_alloc: allocates an empty graph over a level
+*
+*		* level - level of the index, from 0 to NUM_PROJECTIONS
+*		* dims - dimension of the level
+*/
+hnsw_index *hnsw_index_alloc(int level, int dims);
+
+/*
+* hnsw_index_free: deallocates a graph
+*
+*		* hnsw - the graph to deallocate
+*/
+void hnsw_index_free(hnsw_index *hnsw);
+
+/*
+* hnsw_index_add_vectors: appends the next chunk of vectors of the level. The chunks must be
+*				added in the order of their IDs
+*
+*		* hnsw - graph being built
+*		* data - chunk of vectors, one per row
+*		* num_rows - number of vectors of the chunk
+*/
+void hnsw_index_add_vectors(hnsw_index *hnsw, gsl_matrix *data, long num_rows);
+
+/*
+* hnsw_index_build: links every vector of the graph, inserting them from several threads
+*
+*		* hnsw - graph being built
+*		* num_threads - number of threads, 0 for one per processor
+*/
+void hnsw_index_build(hnsw_index *hnsw, int num_threads);
+
+/*
+* hnsw_index_write: saves the graph next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.hnsw
+*
+*		* hnsw - built graph
+*/
+void hnsw_index_write(hnsw_index *hnsw);
+
+/*
+* get_hnsw_index: returns the graph of the current index, read from the file the first time
+*				it is needed. Returns NULL if the index has no graph
+*/
+hnsw_index *get_hnsw_index();
+
+/*
+* hnsw_index_search: writes in results the ef vectors of the level closest to the query found
+*				in the graph, sorted by their distance at the level, and returns their number
+*
+*		* hnsw - graph of the index
+*		* query_vec - projection of the query at the level of the graph
+*		* ef - number of vectors kept during the search
+*		* results - output array with room for ef matches
+*/
+long hnsw_index_search(hnsw_index *hnsw, const double *query_vec, int ef, query_match *results);
+
+#endif /* defined(__Heidi__hnsw_index__) */
@@ -0,0 +1,73 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* id_order.hpp
+* This file contains the definition of the locality preserving order of the IDs. Before the
+* dataset is projected, its vectors are sorted along a Z-order or Hilbert curve of their
+* coordinates at the lowest level and the original data is copied in that order, so that
+* every level is stored in it. Vectors that are close at the lowest level get close IDs, so
+* the candidates of a query form runs of consecutive IDs. A permutation table, saved in the
+* database and next to the dataset, maps the new IDs back to the original ones.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__id_order__
+#define __Heidi__id_order__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* orders of the IDs */
+#define ID_ORDER_LOAD               0		/* order of the dataset file */
+#define ID_ORDER_MORTON             1		/* Z-order curve */
+#define ID_ORDER_HILBERT            2		/* Hilbert curve */
+
+/* maximum number of bits of each coordinate in the key of a vector */
+#define ID_ORDER_MAX_BITS           16
+
+/* magic number written at the beginning of a permutation file */
+#define ID_ORDER_MAGIC              0x4D524550
+
+/* original ID of every reordered ID */
+typedef struct
+{
+	long num_ids;
+	long long *original_ids;		/* original_ids[id - 1] is the original ID of id */
+} id_permutation;
+
+/*
+* reorder_database: sorts the original data along a curve of the lowest level and stores it
+*				in that order, together with the permutation of its IDs. With ID_ORDER_LOAD,
+*				the data keeps its order and the permutation of a previous index is removed
+*
+*		* hdbc - an opened SQL connection
+*		* curve - ID_ORDER_LOAD, ID_ORDER_MORTON or ID_ORDER_HILBERT
+*/
+void reorder_database(HDBC hdbc, int curve);
+
+/*
+* get_id_permutation: returns the permutation of the IDs of the current index, read from the
+*				file the first time it is needed. Returns NULL if the IDs were not reordered
+*/
+id_permutation *get_id_permutation();
+
+/*
+* map_to_original_id: returns the original ID of a vector of the index
+*
+*		* id - ID of the vector in the tables of the index
+*/
+long long map_to_original_id(long long id);
+
+#endif /* defined(__Heidi__id_order__) */
@@ -0,0 +1,206 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* id_set.hpp
+* This file contains the definition of a compressed set of vector IDs. The set follows the
+* layout of a Roaring bitmap: the IDs are split by their high bits into containers and each
+* container stores the low 16 bits either as a sorted array (sparse) or as a bitmap (dense).
+* It is used to move candidate sets between the levels of the cascade, between shards and
+* as a pre-mask for filters.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__id_set__
+#define __Heidi__id_set__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* maximum number of IDs kept in an array container before it becomes a bitmap */
+#define ID_SET_ARRAY_MAX        4096
+
+/* number of 64 bit words of a bitmap container (2^16 bits) */
+#define ID_SET_BITMAP_WORDS     1024
+
+/* magic number written at the beginning of a serialized set */
+#define ID_SET_MAGIC            0x53444948
+
+/* a container holds every ID of the set that shares the same high bits (key) */
+typedef struct
+{
+	long long key;					/* id >> 16 */
+	int cardinality;				/* number of IDs stored in the container */
+	int capacity;					/* allocated entries of the array container */
+	unsigned short *array;			/* sorted low 16 bits, NULL for bitmap containers */
+	unsigned long long *bitmap;		/* ID_SET_BITMAP_WORDS words, NULL for array containers */
+} id_container;
+
+/* compressed set of 64 bit IDs. The containers are kept sorted by key */
+typedef struct
+{
+	id_container *containers;
+	int num_containers;
+	int capacity;
+} id_set;
+
+/* cursor used to walk the IDs of a set in increasing order */
+typedef struct
+{
+	const id_set *set;
+	int container_indx;
+	int position;
+} id_set_iterator;
+
+/*
+* id_set_alloc: allocates an empty set of IDs
+*/
+id_set *id_set_alloc();
+
+/*
+* id_set_free: deallocates a set of IDs and all of its containers
+*
+*		* set - the set to be deallocated
+*/
+void id_set_free(id_set *set);
+
+/*
+* id_set_add: inserts an ID in the set. Inserting an existing ID has no effect
+*
+*		* set - the set that will receive the ID
+*		* id - the vector ID
+*/
+void id_set_add(id_set *set, long long id);
+
+/*
+* id_set_add_many: inserts an array of IDs in the set. Sorted input is inserted faster
+*
+*		* set - the set that will receive the IDs
+*		* ids - array of vector IDs
+*		* num_ids - number of elements of the array
+*/
+void id_set_add_many(id_set *set, long long *ids, long num_ids);
+
+/*
+* id_set_contains: returns 1 if the ID belongs to the set and 0 otherwise
+*
+*		* set - the set to be searched
+*		* id - the vector ID
+*/
+int id_set_contains(const id_set *set, long long id);
+
+/*
+* id_set_cardinality: returns the number of IDs stored in the set
+*
+*		* set - the set of IDs
+*/
+long long id_set_cardinality(const id_set *set);
+
+/*
+* id_set_size_in_bytes: returns the memory used by the containers of the set
+*
+*		* set - the set of IDs
+*/
+size_t id_set_size_in_bytes(const id_set *set);
+
+/*
+* id_set_intersect: returns a new set with the IDs that belong to both sets
+*
+*		* set_a - first set
+*		* set_b - second set
+*/
+id_set *id_set_intersect(const id_set *set_a, const id_set *set_b);
+
+/*
+* id_set_union: returns a new set with the IDs that belong to at least one of the sets
+*
+*		* set_a - first set
+*		* set_b - second set
+*/
+id_set *id_set_union(const id_set *set_a, const id_set *set_b);
+
+/*
+* id_set_iterator_init: places the iterator before the smallest ID of the set
+*
+*		* it - the iterator
+*		* set - the set to walk
+*/
+void id_set_iterator_init(id_set_iterator *it, const id_set *set);
+
+/*
+* id_set_iterator_next: writes the next ID of the set in id. Returns 0 when there are no
+*				more IDs to visit
+*
+*		* it - an initialized iterator
+*		* id - output variable for the ID
+*/
+int id_set_iterator_next(id_set_iterator *it, long long *id);
+
+/*
+* id_set_iterator_next_batch: writes up to max_ids IDs of the set in the buffer ids and
+*				returns how many were written
+*
+*		* it - an initialized iterator
+*		* ids - buffer with room for max_ids IDs
+*		* max_ids - size of the buffer
+*/
+long id_set_iterator_next_batch(id_set_iterator *it, long long *ids, long max_ids);
+
+/*
+* id_set_serialized_size: returns the number of bytes needed to serialize the set
+*
+*		* set - the set of IDs
+*/
+size_t id_set_serialized_size(const id_set *set);
+
+/*
+* id_set_serialize: writes the set in the buffer and returns the number of bytes written.
+*				The buffer must have at least id_set_serialized_size bytes
+*
+*		* set - the set of IDs
+*		* buffer - output buffer
+*/
+size_t id_set_serialize(const id_set *set, char *buffer);
+
+/*
+* id_set_deserialize: rebuilds a set from a buffer written by id_set_serialize. Returns NULL
+*				if the buffer does not contain a valid set
+*
+*		* buffer - serialized set
+*		* size - number of bytes of the buffer
+*/
+id_set *id_set_deserialize(const char *buffer, size_t size);
+
+/*
+* id_set_write: serializes the set to an opened file
+*
+*		* file - an opened file
+*		* set - the set of IDs
+*/
+void id_set_write(FILE *file, const id_set *set);
+
+/*
+* id_set_read: reads a set written by id_set_write from an opened file
+*
+*		* file - an opened file
+*/
+id_set *id_set_read(FILE *file);
+
+/*
+* id_set_to_sql_predicate: builds a predicate over the ID column that selects the IDs of the
+*				set. Runs of consecutive IDs are written as ID BETWEEN a AND b and the
+*				remaining IDs as ID IN ( ... ). The returned string must be freed
+*
+*		* set - the set of IDs
+*/
+char *id_set_to_sql_predicate(const id_set *set);
+
+#endif /* defined(__Heidi__id_set__) */
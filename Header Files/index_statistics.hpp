@@ -0,0 +1,163 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* index_statistics.hpp
+* This file contains the definition of the statistics collected while the index is built.
+* For every level, a sample of the vectors is kept and summarized by the quantiles of the
+* distance between pairs of sampled vectors and by the quantiles of the distance of each
+* sampled vector to the centroid of the level. The file also holds the constant that scales the
+* distances of each level into a lower bound of the distance in the original data, and the
+* ratios between both distances measured on the sample, from which an approximate constant is
+* calibrated for a target recall. The statistics are saved next to the dataset and are used to
+* estimate how many vectors a query will find at each level.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__index_statistics__
+#define __Heidi__index_statistics__
+
+#include "constants.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_matrix.h>
+
+/* number of vectors sampled at each level */
+#define INDEX_STATS_SAMPLE_SIZE     1024
+
+/* number of pairs of sampled vectors whose distance is measured */
+#define INDEX_STATS_NUM_PAIRS       32768
+
+/* number of buckets of the equi-depth histograms */
+#define INDEX_STATS_BINS            64
+
+/* magic number written at the beginning of a statistics file */
+#define INDEX_STATS_MAGIC           0x54534948
+
+/* version of the layout of the statistics file */
+#define INDEX_STATS_VERSION         2
+
+/* statistics of one level of the index. Distances are measured with the norm of the index
+ * (L1 or L2), as the queries do, before the constant of the level is applied */
+typedef struct
+{
+	int dims;										/* dimension of the level */
+	long num_vectors;								/* number of vectors of the level */
+	double *centroid;								/* mean of the sampled vectors */
+	double pair_quantiles[INDEX_STATS_BINS + 1];		/* quantiles of the distance between pairs */
+	double centroid_quantiles[INDEX_STATS_BINS + 1];	/* quantiles of the distance to the centroid */
+	double bound_constant;							/* constant that never loses results */
+	double ratio_quantiles[INDEX_STATS_BINS + 1];		/* quantiles of the distance in the original 
+													 * data over the distance at the level */
+	double *sample;									/* sampled vectors, only while the index is built */
+	long sample_size;
+} level_statistics;
+
+/* statistics of every level of the index */
+typedef struct
+{
+	int num_levels;					/* NUM_PROJECTIONS + 1 */
+	level_statistics *levels;
+	long index_version;				/* INDEX_VERSION when the statistics were loaded */
+} index_statistics;
+
+/*
+* index_statistics_alloc: allocates empty statistics for the levels of the index
+*/
+index_statistics *index_statistics_alloc();
+
+/*
+* index_statistics_free: deallocates the statistics
+*
+*		* statistics - the statistics to deallocate
+*/
+void index_statistics_free(index_statistics *statistics);
+
+/*
+* index_statistics_add_vectors: offers a chunk of vectors of a level to the sample of the level
+*
+*		* statistics - statistics being built
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* data - chunk of vectors, one per row
+*		* num_rows - number of vectors of the chunk
+*		* dims - dimension of the level
+*/
+void index_statistics_add_vectors(index_statistics *statistics, int level, gsl_matrix *data, long num_rows, int dims);
+
+/*
+* index_statistics_finish: computes the centroids, the histograms and the constants of every
+*				level from the samples and releases the samples
+*
+*		* statistics - statistics being built
+*/
+void index_statistics_finish(index_statistics *statistics);
+
+/*
+* index_statistics_calibrated_constant: returns the largest constant of a level that keeps the
+*				target recall on the sampled pairs. It is never smaller than the constant that
+*				never loses results
+*
+*		* statistics - statistics of the index
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* recall - fraction of the results to keep, between 0 and 1
+*/
+double index_statistics_calibrated_constant(index_statistics *statistics, int level, double recall);
+
+/*
+* index_statistics_write: saves the statistics next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.stats
+*
+*		* statistics - finished statistics
+*/
+void index_statistics_write(index_statistics *statistics);
+
+/*
+* get_index_statistics: returns the statistics of the current index, read from the file the
+*				first time they are needed. Returns NULL if the index has no statistics
+*/
+index_statistics *get_index_statistics();
+
+/*
+* index_statistics_estimate: returns the expected number of vectors of a level within epsilon
+*				of the query
+*
+*		* statistics - statistics of the index
+*		* query - matrix containing the query vector and all of its projections
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* epsilon - radius of the query
+*/
+double index_statistics_estimate(index_statistics *statistics, gsl_matrix *query, int level, double epsilon);
+
+/*
+* index_statistics_estimate_levels: writes in counts the expected number of candidates of the
+*				query at every level
+*
+*		* statistics - statistics of the index
+*		* query - matrix containing the query vector and all of its projections
+*		* epsilon - radius of the query
+*		* counts - output array with NUM_PROJECTIONS + 1 values
+*/
+void index_statistics_estimate_levels(index_statistics *statistics, gsl_matrix *query, double epsilon, double *counts);
+
+/*
+* index_statistics_recommend_epsilon: returns the epsilon for which the query is expected to
+*				return target_count vectors
+*
+*		* statistics - statistics of the index
+*		* query - matrix containing the query vector and all of its projections
+*		* target_count - number of vectors the query should return
+*/
+double index_statistics_recommend_epsilon(index_statistics *statistics, gsl_matrix *query, long target_count);
+
+#endif /* defined(__Heidi__index_statistics__) */
@@ -112,6 +112,12 @@ void assign_table_name();
 */
 void assign_dataset_dimensions( );
 
+/*
+* assign_value_type: reads every value of the dataset file and assigns to the global variable
+*					ORIGINAL_VALUE_TYPE the narrowest type that holds all of them without loss
+*/
+void assign_value_type( );
+
 /*
 * assign_norm_type: assigns the user argument to the NORM_TYPE global variable
 *
@@ -0,0 +1,111 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* interleaved_store.hpp
+* This file contains the definition of the level-interleaved layout of the index. Besides
+* the table of every level, each vector is stored in one record that holds all of its levels,
+* from the lowest level to the original data. A candidate is then refined through the whole
+* cascade by reading a single record, instead of one row of every level table, and the record
+* of the next candidate is prefetched while the current one is evaluated. The original data of
+* an integer-valued dataset is kept in its narrow integer type, and its distances are computed
+* on the integers. The projected levels, which only prune candidates, may be stored in half
+* precision or in bytes; the largest error of each level is then kept and subtracted from its
+* distances, which remain lower bounds of the distances of the original data.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__interleaved_store__
+#define __Heidi__interleaved_store__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <emmintrin.h>
+#include <gsl/gsl_matrix.h>
+
+/* size of a cache line; every record starts at a multiple of it */
+#define INTERLEAVED_ALIGNMENT       64
+
+/* precisions of the projected levels in the records */
+#define LEVEL_PRECISION_DOUBLE      0
+#define LEVEL_PRECISION_FP16        1		/* IEEE half-precision floats */
+#define LEVEL_PRECISION_INT8        2		/* bytes, with a scale and an offset per coordinate */
+
+/* magic number written at the beginning of an interleaved file */
+#define INTERLEAVED_MAGIC           0x5641454C
+
+/* records of every vector. Record v holds the vector with ID v + 1: its projected levels in
+ * their precision, then its original data in the type of the original data */
+typedef struct
+{
+	int num_levels;				/* NUM_PROJECTIONS + 1 */
+	int *offsets;				/* position of each projected level in a record, in values;
+								 * offsets[0] is the number of projected values */
+	int precision;				/* LEVEL_PRECISION_DOUBLE, _FP16 or _INT8 of the projected levels */
+	int value_bytes;			/* size of a projected value */
+	double *scales;				/* per projected value, step of its bytes, only with _INT8 */
+	double *shifts;				/* per projected value, value of its byte 0, only with _INT8 */
+	double *errors;				/* per level, largest distance between a projection and its
+								 * stored values */
+	int value_type;				/* type of the original data, VALUE_TYPE_FLOAT, _UINT8 or _INT16 */
+	long original_offset;		/* position of the original data in a record, in bytes */
+	long record_size;			/* bytes of a record, padded to a multiple of a cache line */
+	long num_vectors;
+	unsigned char *records;		/* num_vectors x record_size bytes, aligned to a cache line */
+	void *allocation;			/* block that holds the records */
+} interleaved_store;
+
+/*
+* interleaved_store_build: writes the record of every vector next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.ilv
+*				The levels are computed from the original data with the projection plan
+*
+*		* hdbc - an opened SQL connection
+*/
+void interleaved_store_build(HDBC hdbc);
+
+/*
+* interleaved_store_free: deallocates the records
+*
+*		* store - the records to deallocate
+*/
+void interleaved_store_free(interleaved_store *store);
+
+/*
+* get_interleaved_store: returns the records of the current index, read from the file the
+*				first time they are needed. Returns NULL if the index has no records
+*/
+interleaved_store *get_interleaved_store();
+
+/*
+* interleaved_store_refine: computes the distance of every candidate at a sequence of levels,
+*				stopping at the first level where it exceeds epsilon, and writes the candidates
+*				within epsilon at every level, with their distance at the last level, in matches.
+*				Returns the number of matches
+*
+*		* store - records of the index
+*		* query - matrix containing the query vector and all of its projections
+*		* levels - levels to evaluate, in order
+*		* num_levels - number of levels to evaluate
+*		* epsilon - radius of the query
+*		* candidates - candidates to refine
+*		* num_candidates - number of candidates
+*		* matches - output array with room for num_candidates matches
+*/
+long interleaved_store_refine(interleaved_store *store, gsl_matrix *query, const int *levels, int num_levels, double epsilon,
+	const query_match *candidates, long num_candidates, query_match *matches);
+
+#endif /* defined(__Heidi__interleaved_store__) */
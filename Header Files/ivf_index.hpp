@@ -0,0 +1,125 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* ivf_index.hpp
+* This file contains the definition of the inverted file over the lowest level of the index.
+* The vectors of the lowest level are clustered with k-means when the index is built and are
+* stored grouped by cluster, together with the centroid and the radius of each cluster. A
+* query only reads the clusters that can hold a vector within epsilon, or its IVF_NPROBE
+* closest clusters, and their vectors become the candidates refined by the other levels.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__ivf_index__
+#define __Heidi__ivf_index__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_matrix.h>
+
+/* maximum number of vectors used to train the centroids */
+#define IVF_TRAINING_SAMPLE         65536
+
+/* maximum number of iterations of k-means */
+#define IVF_KMEANS_ITERATIONS       20
+
+/* the projected levels are written to the database with six decimal places, so a coordinate
+ * stored in the database differs from the one kept in the inverted file by at most this much */
+#define IVF_ROUNDING                5e-7
+
+/* magic number written at the beginning of an inverted file */
+#define IVF_MAGIC                   0x20465649
+
+/* inverted file over one level. While it is built, the vectors are kept in the order of their
+ * IDs; once trained, they are grouped by cluster */
+typedef struct
+{
+	int dims;				/* dimension of the level */
+	long num_vectors;
+	long capacity;			/* number of vectors allocated while building */
+	int num_lists;			/* number of clusters */
+	double *centroids;		/* num_lists x dims */
+	double *radii;			/* largest distance from a centroid to the vectors of its cluster */
+	long *list_offsets;		/* the vectors of cluster i are from list_offsets[i] to list_offsets[i+1] */
+	long long *ids;			/* ID of each vector */
+	double *vectors;		/* num_vectors x dims */
+} ivf_index;
+
+/*
+* ivf_index_alloc: allocates an empty inverted file for a level
+*
+*		* dims - dimension of the level
+*/
+ivf_index *ivf_index_alloc(int dims);
+
+/*
+* ivf_index_free: deallocates an inverted file
+*
+*		* ivf - the inverted file to deallocate
+*/
+void ivf_index_free(ivf_index *ivf);
+
+/*
+* ivf_index_add_vectors: appends the next chunk of vectors of the level. The chunks must be
+*				added in the order of their IDs
+*
+*		* ivf - inverted file being built
+*		* data - chunk of vectors, one per row
+*		* num_rows - number of vectors of the chunk
+*/
+void ivf_index_add_vectors(ivf_index *ivf, gsl_matrix *data, long num_rows);
+
+/*
+* ivf_index_train: clusters the vectors with k-means and groups them by cluster
+*
+*		* ivf - inverted file being built
+*		* num_lists - number of clusters
+*/
+void ivf_index_train(ivf_index *ivf, int num_lists);
+
+/*
+* ivf_index_write: saves the inverted file next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.ivf
+*
+*		* ivf - trained inverted file
+*/
+void ivf_index_write(ivf_index *ivf);
+
+/*
+* get_ivf_index: returns the inverted file of the current index, read from the file the first
+*				time it is needed. Returns NULL if the index has no inverted file
+*/
+ivf_index *get_ivf_index();
+
+/*
+* ivf_index_search: appends to the candidates the vectors of the probed clusters within
+*				epsilon of the query, and returns the new number of candidates
+*
+*		* ivf - inverted file of the lowest level
+*		* query_vec - projection of the query at the lowest level
+*		* constant_c - constant that multiplies the distances of the level
+*		* epsilon - radius of the query
+*		* nprobe - number of closest clusters probed, 0 to probe every cluster that can hold
+*				  a vector within epsilon
+*		* candidates - array of candidates, reallocated when it is full
+*		* num_candidates - number of candidates already in the array
+*		* capacity - number of candidates allocated
+*/
+long ivf_index_search(ivf_index *ivf, const double *query_vec, double constant_c, double epsilon, int nprobe,
+	query_match **candidates, long num_candidates, long *capacity);
+
+#endif /* defined(__Heidi__ivf_index__) */
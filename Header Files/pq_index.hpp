@@ -0,0 +1,117 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* pq_index.hpp
+* This file contains the definition of the product quantization of one level of the index.
+* The coordinates of the level are split into subspaces and every subspace of a vector is
+* replaced by the closest of 256 centroids, so a vector is stored in one byte per subspace.
+* The distance from a query to the quantized vectors is summed from one table per subspace.
+* Each vector also keeps a bound on its distance to its quantized vector, so the quantized
+* distance minus that bound is a lower bound of its distance at the level, and the scan
+* discards vectors without losing any match.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__pq_index__
+#define __Heidi__pq_index__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <tmmintrin.h>
+
+#include <gsl/gsl_matrix.h>
+
+/* number of centroids of every subspace, so a subspace is coded in one byte */
+#define PQ_CENTROIDS                256
+
+/* maximum number of iterations of k-means on the training sample */
+#define PQ_KMEANS_ITERATIONS        20
+
+/* the projected levels are written to the database with six decimal places, so a coordinate
+ * stored in the database differs from the one quantized by at most this much */
+#define PQ_ROUNDING                 5e-7
+
+/* number of vectors whose codes are looked up together by one shuffle of the scan */
+#define PQ_BLOCK_SIZE               16
+
+/* magic number written at the beginning of a product quantization file */
+#define PQ_MAGIC                    0x20205150
+
+/* product quantization of one level. Vector v has the ID v + 1 */
+typedef struct
+{
+	int level;					/* level of the index that is quantized */
+	int dims;					/* dimension of the level */
+	int num_subspaces;			/* bytes of every vector */
+	int *subspace_offsets;		/* first coordinate of each subspace, num_subspaces + 1 values */
+	int num_centroids;			/* centroids of every subspace, at most PQ_CENTROIDS */
+	double *codebooks;			/* subspace s holds num_centroids x (its dimension) values,
+								 * starting at num_centroids x subspace_offsets[s] */
+	long num_vectors;
+	unsigned char *codes;		/* num_vectors x num_subspaces centroids, while the index is
+								 * built */
+	unsigned char *blocks;		/* the same codes once read, PQ_BLOCK_SIZE vectors at a time:
+								 * the codes of subspace s of block b start at
+								 * (b x num_subspaces + s) x PQ_BLOCK_SIZE */
+	unsigned char *residuals;	/* per vector, its distance to its quantized vector in steps,
+								 * rounded up */
+	double residual_step;		/* distance of one step of the residuals */
+} pq_index;
+
+/*
+* pq_index_build: trains the codebooks on a sample of the level, quantizes every vector of the
+*				level and saves the result next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.pq
+*				The level is computed from the original data, which is read twice
+*
+*		* hdbc - an opened SQL connection
+*		* level - level of the index, from 0 to NUM_PROJECTIONS
+*		* num_subspaces - number of subspaces, at most the dimension of the level
+*/
+void pq_index_build(HDBC hdbc, int level, int num_subspaces);
+
+/*
+* pq_index_free: deallocates a product quantization
+*
+*		* pq - the product quantization to deallocate
+*/
+void pq_index_free(pq_index *pq);
+
+/*
+* get_pq_index: returns the product quantization of the current index, read from the file
+*				the first time it is needed. Returns NULL if the index has none
+*/
+pq_index *get_pq_index();
+
+/*
+* pq_index_scan: appends to the candidates the vectors whose lower bound is within epsilon of
+*				the query, with their lower bounds, and returns the new number of candidates.
+*				The tables of the query are quantized to one byte per centroid and summed for
+*				PQ_BLOCK_SIZE vectors at a time with byte shuffles; only the vectors that this
+*				smaller bound does not prune are summed with the exact tables
+*
+*		* pq - product quantization of a level
+*		* query_vec - projection of the query at the level of the quantization
+*		* constant_c - constant that multiplies the distances of the level
+*		* epsilon - radius of the query
+*		* candidates - array of candidates, reallocated when it is full
+*		* num_candidates - number of candidates already in the array
+*		* capacity - number of candidates allocated
+*/
+long pq_index_scan(pq_index *pq, const double *query_vec, double constant_c, double epsilon,
+	query_match **candidates, long num_candidates, long *capacity);
+
+#endif /* defined(__Heidi__pq_index__) */
@@ -22,14 +22,67 @@
 #include "constants.hpp"
 #include "database.hpp"
 #include "input_manipulation.hpp"
+#include "id_set.hpp"
+#include "query_cache.hpp"
+#include "projection_plan.hpp"
+#include "cascade_planner.hpp"
+#include "index_statistics.hpp"
+#include "zone_map.hpp"
+#include "ivf_index.hpp"
+#include "hnsw_index.hpp"
+#include "id_order.hpp"
+#include "va_file.hpp"
+#include "pq_index.hpp"
+#include "interleaved_store.hpp"
+#include "dimension_order.hpp"
+#include "window_tuner.hpp"
+#include "attribute_store.hpp"
+#include "duplicate_set.hpp"
+#include "companion_norm.hpp"
 
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_eigen.h>
 #include <gsl/gsl_blas.h>
 #include <gsl/gsl_vector.h>
 
+#include <time.h>
+
+/* state of a query whose matches are returned in batches, table by table. The first level
+ * of the plan is scanned and the candidates it returns are refined through the other levels 
+ * of the plan in partitions of CASCADE_PARTITION_SIZE vectors */
+typedef struct
+{
+	HDBC hdbc;
+	gsl_matrix *query_matrix;		/* query vector and all of its projections */
+	cascade_plan *plan;				/* levels evaluated by the query */
+	int table_indx;					/* table currently being read, starting at 1 */
+	int num_tables;					/* number of tables holding the dataset */
+	sql_distance_cursor *cursor;	/* open cursor over the current partition */
+	query_match *candidates;		/* candidates of the table with their lower bound distances */
+	long num_candidates;
+	long candidates_capacity;
+	long next_candidate;			/* first candidate that was not refined yet */
+	int refine_from;				/* first level of the plan evaluated by the refinement */
+	const attribute_filter *filter;	/* vectors the query may return, NULL for every vector */
+	query_match *refined;			/* matches of a partition refined from the interleaved records */
+	clock_t refine_time;			/* time spent refining the candidates */
+	long table_matches;				/* matches returned by the current table */
+	clock_t deadline;				/* the query stops at this time, 0 if it has no deadline */
+	int partial;					/* 1 if the deadline expired before the query finished */
+	int finished;					/* 1 once every table has been read */
+} query_stream;
+
+/*
+ * get_projection_plan: returns the projection plan of the index. The plan is built by the
+ *				first query and rebuilt only when the index changes
+ */
+projection_plan *get_projection_plan();
+
 /* 
+ * compute_subspace: projects the query through every level and returns a matrix whose row l
+ *				holds the projection of the query at level l (row 0 is the query itself)
  *
+ *		* query - the query vector with TOTAL_DIMENSIONS values
  */
 gsl_matrix *compute_subspace( double *query );
 /*
@@ -49,12 +102,81 @@ void project_database(HDBC hdbc);
 
 int flength_ids( long *IDs );
 
-long *perform_query(HDBC hdbc);
+/*
+ * perform_query: reads the query vector from QUERY_PATH and returns the set of IDs of the
+ *				vectors within EPSILON of it, or of its KNN_DEFAULT_K nearest neighbours when
+ *				EPSILON is not positive. When the deadline of the query expires, the set only
+ *				holds the matches confirmed so far
+ *
+ *		* hdbc - an opened SQL connection
+ *		* partial - output 1 if the deadline expired before every candidate was refined,
+ *				or NULL
+ *		* unrefined - output set of the candidates that were not refined, allocated only
+ *				when the result is partial and NULL otherwise, or NULL
+ */
+id_set *perform_query(HDBC hdbc, int *partial, id_set **unrefined);
+
+/*
+ * perform_query_clear_cache: forgets the results kept by the previous queries, so that the
+ *				next query is answered by the index
+ */
+void perform_query_clear_cache();
+
+/*
+ * perform_query_open: starts a query and returns a stream over its matches
+ *
+ *		* hdbc - an opened SQL connection
+ *		* query - the query vector with TOTAL_DIMENSIONS values
+ *		* time_budget - maximum running time of the query in milliseconds, 0 for no limit
+ *		* filter - vectors the query may return, NULL for every vector
+ */
+query_stream *perform_query_open(HDBC hdbc, double *query, double time_budget, const attribute_filter *filter);
+
+/*
+ * perform_query_next: returns the number of matches of the next batch, or zero when every
+ *				table has been read or the deadline expired. The batch is valid until the 
+ *				next call
+ *
+ *		* stream - a stream returned by perform_query_open
+ *		* batch - output pointer to the (ID, distance) pairs of the batch
+ */
+long perform_query_next(query_stream *stream, query_match **batch);
+
+/*
+ * perform_query_unrefined: after the deadline of a query expired (stream->partial is set),
+ *				returns the number of candidates that were not refined. Their distances are
+ *				the lower bounds computed at the first level of the plan
+ *
+ *		* stream - a stream returned by perform_query_open
+ *		* candidates - output pointer to the (ID, lower bound) pairs
+ */
+long perform_query_unrefined(query_stream *stream, query_match **candidates);
+
+/*
+ * perform_query_close: stops a query, even if not all of its matches were read, and
+ *				deallocates the stream
+ *
+ *		* stream - a stream returned by perform_query_open
+ */
+void perform_query_close(query_stream *stream);
+
+/*
+ * perform_knn_query: returns the k vectors closest to the query, sorted by distance, without
+ *				an epsilon. The array must be freed by the caller
+ *
+ *		* hdbc - an opened SQL connection
+ *		* query - the query vector with TOTAL_DIMENSIONS values
+ *		* k - number of neighbours to return
+ *		* filter - vectors the query may return, NULL for every vector
+ *		* num_results - output number of vectors returned, smaller than k only if the dataset
+ *				has fewer vectors that the filter allows
+ */
+query_match *perform_knn_query(HDBC hdbc, double *query, int k, const attribute_filter *filter, long *num_results);
 
 /*
  *
  */
-void compute_norm(gsl_matrix *projected_data, gsl_matrix **projected_data_full, int row_indx, int window_size, int column_indx);
+void compute_norm(gsl_matrix *projected_data, gsl_matrix **projected_data_full, int row_indx, int window_size, int column_indx, int norm_l2);
 
 /*
  *
@@ -87,14 +209,11 @@ gsl_matrix * orthogonal_projection_matrix(int dims1, int dims2);
 void write_projection_data(FILE *file, gsl_matrix *projected_data, long num_rows, long num_columns);
 
 /*
- *
- */
-void compute_orthogonal_projection(gsl_matrix *projection_matrix, gsl_matrix *matrix_database, gsl_matrix **projected_data, int dim, int window, int chunk_indx, int number_chunks_to_read, long number_remaining_vectors);
-
-/*
- *
+ * compute_orthogonal_projection: projects every window of a chunk and stores its norm, L1 or
+ *				L2, in the projected data. The companion data, when given, receives the other
+ *				norm of the same projections
  */
-void compute_orthogonal_projection_query(gsl_matrix *projection_matrix, gsl_matrix *query, gsl_matrix **projected_data, int dim, int window );
+void compute_orthogonal_projection(gsl_matrix *projection_matrix, gsl_matrix *matrix_database, gsl_matrix **projected_data, int norm_l2, gsl_matrix **companion_data, int dim, int window, int chunk_indx, int number_chunks_to_read, long number_remaining_vectors);
 
 /*
  *
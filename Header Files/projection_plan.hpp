@@ -0,0 +1,103 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* projection_plan.hpp
+* This file contains the definition of the projection plan. The plan is built once per index
+* and holds everything needed to project a query through all the levels of the hierarchy:
+* the dimension of each level, the order in which the first step reads the original columns,
+* the flattened projection matrices (or a closed form when a matrix has all its entries equal)
+* and the memory that receives the projected query.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__projection_plan__
+#define __Heidi__projection_plan__
+
+#include "constants.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* precomputed projection of a query through every level of the index. Level 0 is the original
+ * space and level l is obtained from level l-1 with the window windows[l-1] */
+typedef struct
+{
+	int num_levels;			/* NUM_PROJECTIONS + 1 */
+	int *dims;				/* dimension of each level */
+	int *windows;			/* window used to compute each level from the previous one */
+	double **matrices;		/* window x window projection matrix of each step, row major */
+	int *uniform;			/* 1 if all the entries of the matrix of the step are equal */
+	double *uniform_value;	/* value of the entries of a uniform matrix */
+	int norm_l2;			/* 1 for the L2 norm and distance, 0 for the L1 norm and distance */
+	double *lower_bound_constants;	/* c of each level: the distance at level 0 is at least
+									 * c times the distance at the level */
+	int *columns;			/* order in which the first step reads the columns of level 0,
+							 * or NULL to read them in order */
+	double *ordered;		/* level 0 of the query in the order of columns */
+	int *offsets;			/* position of each level in the values array */
+	double *values;			/* projected query: all levels, one after the other */
+	long index_version;		/* INDEX_VERSION when the plan was built */
+} projection_plan;
+
+/*
+* projection_plan_build: builds the plan for the current WINDOWS, TOTAL_DIMENSIONS and NORM_TYPE
+*/
+projection_plan *projection_plan_build();
+
+/*
+* projection_plan_free: deallocates a projection plan
+*
+*		* plan - the plan to deallocate
+*/
+void projection_plan_free(projection_plan *plan);
+
+/*
+* projection_plan_project: projects a query through all the levels without allocating memory.
+*				Returns plan->values, where level l starts at plan->offsets[l]. The values are
+*				overwritten by the next call
+*
+*		* plan - a projection plan
+*		* query - the query vector with TOTAL_DIMENSIONS values
+*/
+const double *projection_plan_project(projection_plan *plan, const double *query);
+
+/*
+* projection_plan_project_window: projects one window of a vector with the matrix of a step
+*				and returns its norm. This is the value of one coordinate of the next level
+*
+*		* plan - a projection plan
+*		* step - projection step, from 0 to NUM_PROJECTIONS - 1
+*		* window_values - the window of the vector, with plan->windows[step] values
+*/
+double projection_plan_project_window(const projection_plan *plan, int step, const double *window_values);
+
+/*
+* projection_plan_distance: returns the distance between two vectors of a level, L1 or L2
+*				following the norm of the plan
+*
+*		* plan - a projection plan
+*		* a - first vector
+*		* b - second vector
+*		* dims - dimension of the vectors
+*/
+double projection_plan_distance(const projection_plan *plan, const double *a, const double *b, int dims);
+
+/*
+* projection_plan_level: returns the projection of the last query at a level
+*
+*		* plan - a projection plan
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*/
+const double *projection_plan_level(const projection_plan *plan, int level);
+
+#endif /* defined(__Heidi__projection_plan__) */
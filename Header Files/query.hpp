@@ -25,6 +25,8 @@
 #include "constants.hpp"
 #include "database.hpp"
 #include "projection.hpp"
+#include "id_set.hpp"
+#include "attribute_store.hpp"
 
 
 
@@ -40,19 +42,56 @@ SQLWCHAR *build_query_to_index_table();
 
 SQLWCHAR *build_query_to_add_pkey();
 
+SQLWCHAR *build_query_to_add_norm_column( char *table_name, const char *column, int dims, int norm_l2 );
+
+SQLWCHAR *build_query_to_index_norm( char *table_name, const char *column );
+
+SQLWCHAR *build_query_to_create_view( char *view_name, char *table_name, int dims, const char *norm_column );
+
+SQLWCHAR *build_query_to_drop_view( char *view_name );
+
+SQLWCHAR *build_query_to_create_permutation_table( char *permutation_table );
+
+SQLWCHAR *build_query_to_import_file( char *table_name, char *path );
+
+SQLWCHAR *build_query_to_create_ordered_table( char *table_name, int dims );
+
+SQLWCHAR *build_query_to_copy_in_order( char *source_table, char *target_table, char *permutation_table, int dims );
+
+SQLWCHAR *build_query_to_drop_table( char *table_name );
+
+SQLWCHAR *build_query_to_rename_table( char *old_name, char *new_name );
+
 SQLWCHAR *build_query_to_compute_distance( gsl_matrix *query, int chunk, int dimensions );
 
-char *build_query_to_compute_L1_distance( char *previous_query, double *query_vec, int dimensions, int proj_step, double constant_c  );
+char *build_table_name( int chunk, int dims );
 
-SQLWCHAR *build_query_to_compute_L2_distance(double *query_vec, int dimensions, long *IDs, int length_ids);
+double compute_constant_c( int level );
+
+char *build_query_to_compute_level_distance( char *previous_query, double *query_vec, int dimensions, int level, double constant_c, char *table_name, char *id_predicate, double epsilon );
+
+SQLWCHAR *build_query_to_scan_level( gsl_matrix *query, int chunk, int level, double epsilon, const attribute_filter *filter );
+
+SQLWCHAR *build_query_to_refine_candidates( gsl_matrix *query, int chunk, id_set *candidates, const int *levels, int num_levels, double epsilon );
+
+SQLWCHAR *build_query_to_sort_level( gsl_matrix *query, int chunk, int level, id_set *candidates );
+
+SQLWCHAR *convert_to_sqlwchar( char *query_str );
 
 char *concat_L1_norm( double *query_vec, int dims );
 
-char *concat_L2_norm( char *query_str, double *query_vec, int dims );
+char *concat_squared_L2_norm( double *query_vec, int dims );
+
+char *build_distance_expression( double *query_vec, int dimensions, double constant_c );
+
+char *build_norm_predicate( double *query_vec, int dims, double constant_c, double epsilon );
+
+double compute_level_epsilon( double epsilon );
+
 
-char *concat_IDs( char *query_str, long *IDs, int length_ids );
+char *concat_query(char *query, int dims, const char *type);
 
-char *concat_query(char *query, int dims);
+const char *column_type(int dims);
 
 int length( long number );
 
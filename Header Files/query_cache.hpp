@@ -0,0 +1,119 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* query_cache.hpp
+* This file contains the definition of the cache of query results. The entries are keyed on
+* the query vector, the norm, the window configuration and epsilon, and are evicted in least
+* recently used order when the cache exceeds its memory budget. A result computed with radius
+* r also answers any query with the same vector and a radius smaller than r, by filtering the
+* cached matches by distance.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__query_cache__
+#define __Heidi__query_cache__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+/* number of hash chains of the cache */
+#define QUERY_CACHE_BUCKETS     1024
+
+/* a cached query and its matches */
+typedef struct query_cache_entry
+{
+	unsigned long hash;					/* hash of the vector, norm, windows and table name */
+	double *query;						/* query vector with TOTAL_DIMENSIONS values */
+	int dims;
+	char *norm;
+	char *table_root;
+	int *windows;
+	int num_windows;
+	double epsilon;						/* radius used to compute the matches */
+	query_match *matches;
+	long num_matches;
+	size_t bytes;						/* memory used by the entry */
+	struct query_cache_entry *prev;		/* more recently used entry */
+	struct query_cache_entry *next;		/* less recently used entry */
+	struct query_cache_entry *chain;	/* next entry of the same hash chain */
+} query_cache_entry;
+
+/* LRU cache of query results */
+typedef struct
+{
+	query_cache_entry **buckets;
+	query_cache_entry *head;			/* most recently used entry */
+	query_cache_entry *tail;			/* least recently used entry */
+	size_t bytes;
+	size_t max_bytes;
+	long index_version;					/* INDEX_VERSION of the cached results */
+	long hits;
+	long containment_hits;
+	long misses;
+} query_cache;
+
+/*
+* query_cache_alloc: allocates an empty cache that will use at most max_bytes of memory
+*
+*		* max_bytes - memory budget of the cache
+*/
+query_cache *query_cache_alloc(size_t max_bytes);
+
+/*
+* query_cache_free: deallocates the cache and all of its entries
+*
+*		* cache - the cache to deallocate
+*/
+void query_cache_free(query_cache *cache);
+
+/*
+* query_cache_clear: removes every entry of the cache
+*
+*		* cache - the cache to clear
+*/
+void query_cache_clear(query_cache *cache);
+
+/*
+* query_cache_lookup: searches the cache for the query with the current NORM_TYPE, WINDOWS
+*				and table name. An entry with the same epsilon is returned as is and an
+*				entry with a larger epsilon is filtered by distance. Returns 1 and a newly
+*				allocated array of matches on a hit and 0 on a miss. The cache is cleared if
+*				the index changed since the results were cached
+*
+*		* cache - the cache
+*		* query - the query vector with TOTAL_DIMENSIONS values
+*		* epsilon - radius of the query
+*		* matches - output array of matches, must be freed by the caller
+*		* num_matches - output number of matches
+*/
+int query_cache_lookup(query_cache *cache, double *query, double epsilon, query_match **matches, long *num_matches);
+
+/*
+* query_cache_insert: stores a copy of the matches of a query, evicting the least recently
+*				used entries until the cache fits in its memory budget
+*
+*		* cache - the cache
+*		* query - the query vector with TOTAL_DIMENSIONS values
+*		* epsilon - radius used to compute the matches
+*		* matches - the matches of the query
+*		* num_matches - number of matches
+*/
+void query_cache_insert(query_cache *cache, double *query, double epsilon, query_match *matches, long num_matches);
+
+/*
+* print_query_cache_statistics: displays the number of hits and misses of the cache.
+*				used for debugging purposes
+*
+*		* cache - the cache
+*/
+void print_query_cache_statistics(query_cache *cache);
+
+#endif /* defined(__Heidi__query_cache__) */
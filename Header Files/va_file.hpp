@@ -0,0 +1,134 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* va_file.hpp
+* This file contains the definition of the vector approximation file, an extra level below the
+* lowest level of the index. Each coordinate of the lowest level is replaced by the index of the
+* cell that holds it, among cells bounded by quantiles of the coordinate, and the cells of a
+* vector are packed into a few bytes. The distance from the query to the cells of a vector
+* bounds its distance at the lowest level from below and from above, so the vectors whose
+* lower bound exceeds epsilon are discarded before any level is read from the database.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__va_file__
+#define __Heidi__va_file__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <tmmintrin.h>
+
+#include <gsl/gsl_matrix.h>
+
+/* maximum number of values of a coordinate used to compute the boundaries of its cells */
+#define VA_FILE_SAMPLE              65536
+
+/* the projected levels are written to the database with six decimal places, so a coordinate
+ * stored in the database differs from the one approximated by at most this much */
+#define VA_FILE_ROUNDING            5e-7
+
+/* number of vectors whose bytes are looked up together by one shuffle of the scan */
+#define VA_FILE_BLOCK_SIZE          16
+
+/* magic number written at the beginning of a VA-file */
+#define VA_FILE_MAGIC               0x454C4956
+
+/* approximation of one level. While it is built, the vectors are kept in the order of their
+ * IDs; once encoded, only the packed cells are kept. Vector v has the ID v + 1 */
+typedef struct
+{
+	int dims;					/* dimension of the level */
+	int bits;					/* bits of each coordinate */
+	int cells_per_byte;			/* 8 / bits */
+	int bytes_per_vector;
+	long num_vectors;
+	long capacity;				/* number of vectors allocated while building */
+	double *vectors;			/* num_vectors x dims, only while building */
+	double *boundaries;			/* dims x (2^bits + 1) boundaries of the cells of each coordinate */
+	unsigned char *codes;		/* num_vectors x bytes_per_vector packed cells, while the
+								 * VA-file is built */
+	unsigned char *blocks;		/* the same cells once read, VA_FILE_BLOCK_SIZE vectors at a
+								 * time: byte j of block b starts at
+								 * (b x bytes_per_vector + j) x VA_FILE_BLOCK_SIZE */
+} va_file;
+
+/*
+* va_file_alloc: allocates an empty VA-file for a level
+*
+*		* dims - dimension of the level
+*		* bits - bits of each coordinate: 1, 2, 4 or 8
+*/
+va_file *va_file_alloc(int dims, int bits);
+
+/*
+* va_file_free: deallocates a VA-file
+*
+*		* va - the VA-file to deallocate
+*/
+void va_file_free(va_file *va);
+
+/*
+* va_file_add_vectors: appends the next chunk of vectors of the level. The chunks must be
+*				added in the order of their IDs
+*
+*		* va - VA-file being built
+*		* data - chunk of vectors, one per row
+*		* num_rows - number of vectors of the chunk
+*/
+void va_file_add_vectors(va_file *va, gsl_matrix *data, long num_rows);
+
+/*
+* va_file_encode: computes the boundaries of the cells of every coordinate and packs the cells
+*				of every vector
+*
+*		* va - VA-file being built
+*/
+void va_file_encode(va_file *va);
+
+/*
+* va_file_write: saves the VA-file next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.va
+*
+*		* va - encoded VA-file
+*/
+void va_file_write(va_file *va);
+
+/*
+* get_va_file: returns the VA-file of the current index, read from the file the first time it
+*				is needed. Returns NULL if the index has no VA-file
+*/
+va_file *get_va_file();
+
+/*
+* va_file_scan: appends to the candidates the vectors whose lower bound is within epsilon of
+*				the query, with their lower bounds, and returns the new number of candidates.
+*				The lower bound tables of the query are quantized to one byte per value and
+*				summed for VA_FILE_BLOCK_SIZE vectors at a time with byte shuffles; only the
+*				vectors that this smaller bound does not prune are summed with the exact tables
+*
+*		* va - VA-file of the lowest level
+*		* query_vec - projection of the query at the lowest level
+*		* constant_c - constant that multiplies the distances of the level
+*		* epsilon - radius of the query
+*		* candidates - array of candidates, reallocated when it is full
+*		* num_candidates - number of candidates already in the array
+*		* capacity - number of candidates allocated
+*		* num_certain - output number of candidates whose upper bound is also within epsilon
+*/
+long va_file_scan(va_file *va, const double *query_vec, double constant_c, double epsilon,
+	query_match **candidates, long num_candidates, long *capacity, long *num_certain);
+
+#endif /* defined(__Heidi__va_file__) */
@@ -0,0 +1,55 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* window_tuner.hpp
+* This file contains the definition of the tuner of the windows. Instead of the windows given
+* in input, the tuner projects a sample of the original data through every sequence of windows
+* and measures, for a set of queries taken from the sample, how many vectors each sequence
+* prunes. Each sequence is given the cost used by the cascade planner, the values read per
+* vector when every level is evaluated, and the cheapest one is reported or used to build the
+* index.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__window_tuner__
+#define __Heidi__window_tuner__
+
+#include "constants.hpp"
+#include "database.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* maximum number of vectors of the sample */
+#define WINDOW_TUNER_SAMPLE         4096
+
+/* number of vectors of the sample used as queries */
+#define WINDOW_TUNER_QUERIES        32
+
+/* the windows of a sequence are taken from 2 to this value */
+#define WINDOW_TUNER_MAX_WINDOW     8
+
+/* maximum number of projection steps of a sequence */
+#define WINDOW_TUNER_MAX_LEVELS     10
+
+/*
+* tune_windows: evaluates every sequence of windows on a sample of the original data, which
+*				must already be in the database, and displays the cheapest one. Returns 1 if a
+*				sequence was found
+*
+*		* hdbc - an opened SQL connection
+*		* apply - 1 to replace WINDOWS and NUM_PROJECTIONS with the cheapest sequence
+*/
+int tune_windows(HDBC hdbc, int apply);
+
+#endif /* defined(__Heidi__window_tuner__) */
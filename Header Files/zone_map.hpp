@@ -0,0 +1,125 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* zone_map.hpp
+* This file contains the definition of the zone maps of the index. The vectors of every level
+* are grouped in blocks of ZONE_MAP_BLOCK_SIZE consecutive IDs, and the minimum and maximum of
+* each coordinate of a block are kept. The distance from the query to the bounding box of a
+* block is a lower bound of its distance to every vector of the block, so the scan of a level
+* skips the blocks whose box is farther than epsilon. The zone maps are built while the index
+* is projected and saved next to the dataset.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#ifndef __Heidi__zone_map__
+#define __Heidi__zone_map__
+
+#include "constants.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_matrix.h>
+
+/* number of consecutive IDs summarized by one bounding box */
+#define ZONE_MAP_BLOCK_SIZE         4096
+
+/* the boxes are widened by this amount, since the projected levels are written to the
+ * database with six decimal places */
+#define ZONE_MAP_SLACK              1e-6
+
+/* magic number written at the beginning of a zone map file */
+#define ZONE_MAP_MAGIC              0x454E4F5A
+
+/* bounding boxes of the blocks of one level. Block b holds the IDs from
+ * b*ZONE_MAP_BLOCK_SIZE + 1 to (b+1)*ZONE_MAP_BLOCK_SIZE */
+typedef struct
+{
+	int dims;				/* dimension of the level */
+	long num_vectors;		/* number of vectors added to the level */
+	long num_blocks;
+	long capacity;			/* number of blocks allocated */
+	double *min;			/* num_blocks x dims minimum of each coordinate */
+	double *max;			/* num_blocks x dims maximum of each coordinate */
+} level_zone_map;
+
+/* zone maps of every level of the index */
+typedef struct
+{
+	int num_levels;			/* NUM_PROJECTIONS + 1 */
+	level_zone_map *levels;
+} zone_map;
+
+/*
+* zone_map_alloc: allocates empty zone maps for the levels of the index
+*/
+zone_map *zone_map_alloc();
+
+/*
+* zone_map_free: deallocates the zone maps
+*
+*		* zones - the zone maps to deallocate
+*/
+void zone_map_free(zone_map *zones);
+
+/*
+* zone_map_add_vectors: extends the boxes of a level with the next chunk of vectors. The
+*				chunks of a level must be added in the order of their IDs
+*
+*		* zones - zone maps being built
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* data - chunk of vectors, one per row
+*		* num_rows - number of vectors of the chunk
+*		* dims - dimension of the level
+*/
+void zone_map_add_vectors(zone_map *zones, int level, gsl_matrix *data, long num_rows, int dims);
+
+/*
+* zone_map_write: saves the zone maps next to the dataset, in the file
+*				<ROOT_DIR><DATASET_ROOT_NAME>_<TOTAL_DIMENSIONS>_<NORM_TYPE>.zones
+*
+*		* zones - zone maps of every level
+*/
+void zone_map_write(zone_map *zones);
+
+/*
+* get_zone_map: returns the zone maps of the current index, read from the file the first time
+*				they are needed. Returns NULL if the index has no zone maps
+*/
+zone_map *get_zone_map();
+
+/*
+* zone_map_min_distance: returns the distance from a vector to the bounding box of a block,
+*				measured with the norm of the index
+*
+*		* zones - zone maps of the index
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* block - index of the block
+*		* query_vec - projection of the query at the level
+*/
+double zone_map_min_distance(zone_map *zones, int level, long block, const double *query_vec);
+
+/*
+* zone_map_build_predicate: builds a predicate over the ID column that selects the blocks of a
+*				level whose box is within epsilon of the query. Returns NULL when no block is
+*				skipped, so that the level is scanned without a predicate
+*
+*		* zones - zone maps of the index
+*		* level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*		* query_vec - projection of the query at the level
+*		* constant_c - constant that multiplies the distances of the level
+*		* epsilon - radius of the query
+*/
+char *zone_map_build_predicate(zone_map *zones, int level, const double *query_vec, double constant_c, double epsilon);
+
+#endif /* defined(__Heidi__zone_map__) */
@@ -0,0 +1,437 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* attribute_store.cpp
+* This file contains the implementation of the attributes of the vectors and of the filters
+* over them. The attributes are kept column by column, so compiling a filter reads only the
+* attributes it constrains, in the order of the IDs, and produces the set of IDs already
+* sorted.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "attribute_store.hpp"
+#include "id_order.hpp"
+
+/* attributes of the current index, read by the first query */
+static attribute_store *ATTRIBUTE_STORE = NULL;
+
+/* number of IDs inserted at once in the set of a filter */
+#define ATTRIBUTE_ID_BATCH          4096
+
+/* ======================================================================================
+*
+* build_attribute_path: returns the path of the attributes of the index
+*
+* ====================================================================================== */
+static char *build_attribute_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.attr", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* attribute_store_free: deallocates the attributes of an index
+*
+*      * store - the attributes to deallocate
+*
+* ====================================================================================== */
+static void attribute_store_free(attribute_store *store)
+{
+	if (store == NULL)
+		return;
+
+	free(store->values);
+	free(store);
+}
+
+/* ======================================================================================
+*
+* count_attributes: returns the number of integers on the first line of a text file and
+*				places the file back at its beginning
+*
+*      * file - an opened text file
+*
+* ====================================================================================== */
+static int count_attributes(FILE *file)
+{
+	char *line = (char *)malloc(sizeof(char)*10000);
+	int num_attributes = 0;
+
+	if (fgets(line, 10000, file) != NULL)
+	{
+		char *token;
+		for (token = strtok(line, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n"))
+			num_attributes++;
+	}
+
+	free(line);
+	rewind(file);
+
+	return num_attributes;
+}
+
+/* ======================================================================================
+*
+* attribute_store_build: reads the attributes of the dataset in the order of the dataset file
+*				and saves them in the order of the IDs of the index
+*
+* ====================================================================================== */
+void attribute_store_build()
+{
+	char *path = build_attribute_path();
+
+	/* the attributes of a previous index are no longer valid */
+	remove(path);
+
+	char *text_path = (char *)malloc(sizeof(char)*(strlen(DATASET_PATH) + 10));
+	sprintf(text_path, "%s.attr", DATASET_PATH);
+
+	FILE *text_file = fopen(text_path, "r");
+	if (text_file == NULL || TOTAL_VECTORS == 0)
+	{
+		if (text_file != NULL) fclose(text_file);
+		free(text_path);
+		free(path);
+		return;
+	}
+
+	int num_attributes = count_attributes(text_file), a;
+	if (num_attributes == 0 || num_attributes > ATTRIBUTE_MAX_COLUMNS)
+	{
+		printf("[ERROR] The attributes of %s must have between 1 and %d columns\n", text_path, ATTRIBUTE_MAX_COLUMNS);
+		fclose(text_file);
+		free(text_path);
+		free(path);
+		return;
+	}
+
+	long num_vectors = TOTAL_VECTORS, v, id;
+	long long *file_values = (long long *)malloc(sizeof(long long)*num_attributes*num_vectors);
+
+	/* the text file has one line per vector, in the order of the dataset file */
+	int valid = 1;
+	for (v = 0; v < num_vectors && valid; v++)
+		for (a = 0; a < num_attributes && valid; a++)
+			valid = (fscanf(text_file, "%lld", &file_values[a*num_vectors + v]) == 1);
+
+	fclose(text_file);
+
+	if (!valid)
+	{
+		printf("[ERROR] %s does not have %d attributes for each of the %ld vectors\n", text_path, num_attributes, num_vectors);
+		free(file_values);
+		free(text_path);
+		free(path);
+		return;
+	}
+
+	/* the attributes of a vector follow it to its ID in the index */
+	id_permutation *permutation = get_id_permutation();
+	long long *values = (long long *)malloc(sizeof(long long)*num_attributes*num_vectors);
+
+	for (id = 1; id <= num_vectors; id++)
+	{
+		long long original_id = (permutation != NULL && id <= permutation->num_ids) ? permutation->original_ids[id - 1] : id;
+
+		for (a = 0; a < num_attributes; a++)
+			values[a*num_vectors + id - 1] = file_values[a*num_vectors + original_id - 1];
+	}
+	free(file_values);
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		printf("[ERROR] Unable to write the attributes to %s\n", path);
+	else
+	{
+		int magic = ATTRIBUTE_MAGIC;
+		fwrite(&magic, sizeof(int), 1, file);
+		fwrite(&num_attributes, sizeof(int), 1, file);
+		fwrite(&num_vectors, sizeof(long), 1, file);
+		fwrite(values, sizeof(long long), num_attributes*num_vectors, file);
+		fclose(file);
+	}
+
+	if (DEBUG_OPTION > 0)
+		printf("\nAttributes: %d per vector, %ld vectors\n", num_attributes, num_vectors);
+
+	/* the queries read the new attributes */
+	INDEX_VERSION++;
+
+	free(values);
+	free(text_path);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* attribute_store_read: reads the attributes of the index, or returns NULL if the file does
+*				not exist or does not match the index
+*
+* ====================================================================================== */
+static attribute_store *attribute_store_read()
+{
+	char *path = build_attribute_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, num_attributes = 0;
+	long num_vectors = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != ATTRIBUTE_MAGIC
+		|| fread(&num_attributes, sizeof(int), 1, file) != 1 || num_attributes < 1 || num_attributes > ATTRIBUTE_MAX_COLUMNS
+		|| fread(&num_vectors, sizeof(long), 1, file) != 1 || num_vectors != TOTAL_VECTORS)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	attribute_store *store = (attribute_store *)malloc(sizeof(attribute_store));
+	store->num_attributes = num_attributes;
+	store->num_vectors = num_vectors;
+
+	size_t num_values = (size_t)num_attributes*num_vectors;
+	store->values = (long long *)malloc(sizeof(long long)*num_values);
+
+	int valid = fread(store->values, sizeof(long long), num_values, file) == num_values;
+	fclose(file);
+
+	if (!valid)
+	{
+		attribute_store_free(store);
+		return NULL;
+	}
+
+	return store;
+}
+
+/* ======================================================================================
+*
+* get_attribute_store: returns the attributes of the current index, read from the file the
+*				first time they are needed. Returns NULL if the vectors have no attributes
+*
+* ====================================================================================== */
+attribute_store *get_attribute_store()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the attributes were read */
+	if (checked_version != INDEX_VERSION)
+	{
+		attribute_store_free(ATTRIBUTE_STORE);
+		ATTRIBUTE_STORE = (BILLION_DATASET == 0) ? attribute_store_read() : NULL;
+		checked_version = INDEX_VERSION;
+	}
+
+	return ATTRIBUTE_STORE;
+}
+
+/* ======================================================================================
+*
+* build_block_predicate: builds a predicate over the ID column that selects the blocks with at
+*				least one ID of the filter. Consecutive blocks are merged into a single
+*				ID BETWEEN a AND b. Returns NULL when no block is skipped and 1 = 0 when every
+*				block is skipped
+*
+*      * occupied - 1 for the blocks with at least one ID of the filter
+*	   * num_blocks - number of blocks of the index
+*	   * num_vectors - number of vectors of the index
+*
+* ====================================================================================== */
+static char *build_block_predicate(const char *occupied, long num_blocks, long num_vectors)
+{
+	long block, run_begin = -1, num_runs = 0, num_skipped = 0;
+
+	for (block = 0; block < num_blocks; block++)
+		num_skipped += !occupied[block];
+
+	if (num_skipped == 0)
+		return NULL;
+
+	char *predicate = (char *)malloc(sizeof(char)*(16 + 64 * num_blocks));
+
+	if (num_skipped == num_blocks)
+	{
+		sprintf(predicate, "1 = 0");
+		return predicate;
+	}
+
+	char *p = predicate;
+	p += sprintf(p, "( ");
+
+	for (block = 0; block <= num_blocks; block++)
+	{
+		int keep = (block < num_blocks) && occupied[block];
+
+		if (keep && run_begin < 0)
+			run_begin = block;
+
+		/* close the run of blocks that ends before this one */
+		if (!keep && run_begin >= 0)
+		{
+			long first_id = run_begin * ATTRIBUTE_BLOCK_SIZE + 1;
+			long last_id = (block == num_blocks) ? num_vectors : block * ATTRIBUTE_BLOCK_SIZE;
+
+			p += sprintf(p, "%sID BETWEEN %ld AND %ld", (num_runs > 0) ? " OR " : "", first_id, last_id);
+			num_runs++;
+			run_begin = -1;
+		}
+	}
+	sprintf(p, " )");
+
+	return predicate;
+}
+
+/* ======================================================================================
+*
+* attribute_filter_compile: returns the filter that keeps the vectors whose attributes are
+*				within every range. A condition over an attribute the index does not have is
+*				an invalid input
+*
+*      * store - attributes of the index
+*	   * conditions - ranges of the attributes
+*	   * num_conditions - number of ranges
+*
+* ====================================================================================== */
+attribute_filter *attribute_filter_compile(const attribute_store *store, const attribute_condition *conditions, int num_conditions)
+{
+	int c;
+	for (c = 0; c < num_conditions; c++)
+		if (conditions[c].attribute < 0 || conditions[c].attribute >= store->num_attributes)
+		{
+			printf("\n[attribute_filter_compile] Error: the vectors have no attribute %d\n", conditions[c].attribute);
+			exit(-1);
+		}
+
+	long num_vectors = store->num_vectors, v;
+	long num_blocks = (num_vectors + ATTRIBUTE_BLOCK_SIZE - 1) / ATTRIBUTE_BLOCK_SIZE;
+
+	attribute_filter *filter = (attribute_filter *)malloc(sizeof(attribute_filter));
+	filter->ids = id_set_alloc();
+	filter->num_ids = 0;
+
+	char *occupied = (char *)calloc(num_blocks + 1, sizeof(char));
+	long long *batch = (long long *)malloc(sizeof(long long)*ATTRIBUTE_ID_BATCH);
+	long batch_size = 0;
+
+	for (v = 0; v < num_vectors; v++)
+	{
+		int keep = 1;
+		for (c = 0; c < num_conditions && keep; c++)
+		{
+			long long value = store->values[(long)conditions[c].attribute*num_vectors + v];
+			keep = (value >= conditions[c].min && value <= conditions[c].max);
+		}
+
+		if (!keep)
+			continue;
+
+		/* the IDs are found in increasing order, which the set inserts fastest */
+		batch[batch_size++] = v + 1;
+		if (batch_size == ATTRIBUTE_ID_BATCH)
+		{
+			id_set_add_many(filter->ids, batch, batch_size);
+			batch_size = 0;
+		}
+
+		occupied[v / ATTRIBUTE_BLOCK_SIZE] = 1;
+		filter->num_ids++;
+	}
+	id_set_add_many(filter->ids, batch, batch_size);
+
+	filter->block_predicate = build_block_predicate(occupied, num_blocks, num_vectors);
+
+	free(batch);
+	free(occupied);
+
+	return filter;
+}
+
+/* ======================================================================================
+*
+* attribute_filter_load: reads the filter of a query and compiles it. Returns NULL if the
+*				query has no filter or the index has no attributes
+*
+*      * query_path - path of the query
+*
+* ====================================================================================== */
+attribute_filter *attribute_filter_load(const char *query_path)
+{
+	attribute_store *store = get_attribute_store();
+	if (store == NULL)
+		return NULL;
+
+	char *path = (char *)malloc(sizeof(char)*(strlen(query_path) + 10));
+	sprintf(path, "%s.filter", query_path);
+
+	FILE *file = fopen(path, "r");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int capacity = 8, num_conditions = 0;
+	attribute_condition *conditions = (attribute_condition *)malloc(sizeof(attribute_condition)*capacity);
+
+	attribute_condition condition;
+	while (fscanf(file, "%d %lld %lld", &condition.attribute, &condition.min, &condition.max) == 3)
+	{
+		if (num_conditions == capacity)
+		{
+			capacity *= 2;
+			conditions = (attribute_condition *)realloc(conditions, sizeof(attribute_condition)*capacity);
+		}
+		conditions[num_conditions++] = condition;
+	}
+	fclose(file);
+
+	attribute_filter *filter = attribute_filter_compile(store, conditions, num_conditions);
+	free(conditions);
+
+	if (DEBUG_OPTION >= 1)
+		printf("\nFilter: %d conditions, %lld of %ld vectors\n", num_conditions, filter->num_ids, store->num_vectors);
+
+	return filter;
+}
+
+/* ======================================================================================
+*
+* attribute_filter_free: deallocates a filter
+*
+*      * filter - the filter to deallocate
+*
+* ====================================================================================== */
+void attribute_filter_free(attribute_filter *filter)
+{
+	if (filter == NULL)
+		return;
+
+	id_set_free(filter->ids);
+	free(filter->block_predicate);
+	free(filter);
+}
+
+/* ======================================================================================
+*
+* attribute_filter_contains: returns 1 if the vector satisfies the filter and 0 otherwise
+*
+*      * filter - a compiled filter, or NULL
+*	   * id - ID of the vector in the tables of the index
+*
+* ====================================================================================== */
+int attribute_filter_contains(const attribute_filter *filter, long long id)
+{
+	return (filter == NULL) || id_set_contains(filter->ids, id);
+}
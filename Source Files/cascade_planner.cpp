@@ -0,0 +1,304 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* cascade_planner.cpp
+* This file contains the implementation of the cascade planner. A plan is a subset of the
+* projected levels followed by the original data. Its cost is the number of values read per
+* vector of a table: the first level is scanned entirely and every other level only reads the
+* vectors that passed the previous ones.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "cascade_planner.hpp"
+#include "projection.hpp"
+#include "index_statistics.hpp"
+
+/* statistics of the current index */
+static cascade_statistics *CASCADE_STATISTICS = NULL;
+
+/* ======================================================================================
+*
+* get_cascade_statistics: returns the statistics of the current index. They are reset when
+*				the index changes
+*
+* ====================================================================================== */
+cascade_statistics *get_cascade_statistics()
+{
+	/* the index was rebuilt since the statistics were gathered */
+	if (CASCADE_STATISTICS != NULL && (CASCADE_STATISTICS->index_version != INDEX_VERSION
+		|| CASCADE_STATISTICS->num_levels != NUM_PROJECTIONS + 1))
+	{
+		free(CASCADE_STATISTICS->levels);
+		free(CASCADE_STATISTICS);
+		CASCADE_STATISTICS = NULL;
+	}
+
+	if (CASCADE_STATISTICS == NULL)
+	{
+		CASCADE_STATISTICS = (cascade_statistics *)malloc(sizeof(cascade_statistics));
+		CASCADE_STATISTICS->num_levels = NUM_PROJECTIONS + 1;
+		CASCADE_STATISTICS->levels = (cascade_level_stats *)calloc(NUM_PROJECTIONS + 1, sizeof(cascade_level_stats));
+		CASCADE_STATISTICS->index_version = INDEX_VERSION;
+	}
+
+	return CASCADE_STATISTICS;
+}
+
+/* ======================================================================================
+*
+* scale_selectivity: converts the selectivity observed at a level to another epsilon. The
+*				number of vectors within a ball grows with the radius to the power of the
+*				dimension of the space
+*
+*      * stats - statistics of an observed level
+*	   * dims - dimension of the level
+*	   * epsilon - radius of the query
+*
+* ====================================================================================== */
+static double scale_selectivity(const cascade_level_stats *stats, int dims, double epsilon)
+{
+	double selectivity = stats->selectivity;
+
+	if (stats->epsilon > 0 && epsilon != stats->epsilon)
+		selectivity *= pow(epsilon / stats->epsilon, dims);
+
+	if (selectivity < CASCADE_MIN_SELECTIVITY) selectivity = CASCADE_MIN_SELECTIVITY;
+	if (selectivity > 1) selectivity = 1;
+
+	return selectivity;
+}
+
+/* ======================================================================================
+*
+* cascade_statistics_update: records how many vectors of a table were within epsilon at a level
+*
+*      * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * epsilon - radius of the query
+*	   * num_scanned - number of vectors of the table
+*	   * num_passed - number of vectors within epsilon at the level
+*
+* ====================================================================================== */
+void cascade_statistics_update(int level, double epsilon, long num_scanned, long num_passed)
+{
+	if (num_scanned <= 0)
+		return;
+
+	cascade_level_stats *stats = &get_cascade_statistics()->levels[level];
+	double observed = (double)num_passed / (double)num_scanned;
+
+	if (stats->observations == 0)
+		stats->selectivity = observed;
+	else
+	{
+		/* bring the past observations to the current epsilon before averaging */
+		double previous = scale_selectivity(stats, get_projection_plan()->dims[level], epsilon);
+		long weight = (stats->observations < CASCADE_STATISTICS_WINDOW) ? stats->observations : CASCADE_STATISTICS_WINDOW;
+
+		stats->selectivity = (previous*weight + observed) / (weight + 1);
+	}
+
+	stats->epsilon = epsilon;
+	stats->observations++;
+}
+
+/* ======================================================================================
+*
+* cascade_estimate_selectivity: returns the expected fraction of the vectors within epsilon at
+*				a level, or a negative value when no level was observed and the index has no
+*				statistics. A level that was not observed is estimated from the statistics of
+*				the index or, without them, interpolated from the closest observed levels
+*
+*      * query - matrix containing the query vector and all of its projections
+*      * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * epsilon - radius of the query
+*
+* ====================================================================================== */
+double cascade_estimate_selectivity(gsl_matrix *query, int level, double epsilon)
+{
+	cascade_statistics *statistics = get_cascade_statistics();
+	projection_plan *projection = get_projection_plan();
+
+	if (statistics->levels[level].observations > 0)
+		return scale_selectivity(&statistics->levels[level], projection->dims[level], epsilon);
+
+	/* estimate for this query from the histograms collected when the index was built */
+	index_statistics *index_stats = get_index_statistics();
+	if (index_stats != NULL && index_stats->levels[level].num_vectors > 0)
+	{
+		double selectivity = index_statistics_estimate(index_stats, query, level, epsilon) / index_stats->levels[level].num_vectors;
+		return (selectivity < CASCADE_MIN_SELECTIVITY) ? CASCADE_MIN_SELECTIVITY : selectivity;
+	}
+
+	/* closest observed level with more dimensions (above) and with fewer dimensions (below) */
+	int above = level - 1, below = level + 1;
+	while (above >= 0 && statistics->levels[above].observations == 0) above--;
+	while (below <= NUM_PROJECTIONS && statistics->levels[below].observations == 0) below++;
+
+	if (above < 0 && below > NUM_PROJECTIONS)
+		return -1;
+
+	/* a level prunes at least as much as the levels with fewer dimensions */
+	if (above < 0)
+		return scale_selectivity(&statistics->levels[below], projection->dims[below], epsilon);
+	if (below > NUM_PROJECTIONS)
+		return scale_selectivity(&statistics->levels[above], projection->dims[above], epsilon);
+
+	/* interpolate the logarithm of the selectivity on the logarithm of the dimension */
+	double log_above = log(scale_selectivity(&statistics->levels[above], projection->dims[above], epsilon));
+	double log_below = log(scale_selectivity(&statistics->levels[below], projection->dims[below], epsilon));
+	double t = (log((double)projection->dims[above]) - log((double)projection->dims[level]))
+		/ (log((double)projection->dims[above]) - log((double)projection->dims[below]));
+
+	return exp(log_above + t*(log_below - log_above));
+}
+
+/* ======================================================================================
+*
+* compute_plan_cost: returns the cost of evaluating a subset of the levels followed by the
+*				original data. The vectors left after a set of levels are the ones that pass
+*				the most selective of them, since every level is a lower bound of the distance
+*
+*      * mask - bit l-1 is set if level l is evaluated
+*	   * selectivity - expected selectivity of each level
+*	   * row_cost - cost of reading one vector at each level
+*	   * levels - output array for the evaluated levels, or NULL
+*
+* ====================================================================================== */
+static double compute_plan_cost(unsigned long mask, const double *selectivity, const double *row_cost, int *levels)
+{
+	double cost = 0, survivors = 1;
+	int level, num_levels = 0;
+
+	for (level = NUM_PROJECTIONS; level >= 0; level--)
+	{
+		if (level > 0 && !(mask & (1UL << (level - 1))))
+			continue;
+
+		/* only the first level is read sequentially */
+		cost += survivors * row_cost[level] * ((num_levels == 0) ? 1 : CASCADE_LOOKUP_FACTOR);
+
+		if (selectivity[level] < survivors)
+			survivors = selectivity[level];
+
+		if (levels != NULL)
+			levels[num_levels] = level;
+		num_levels++;
+	}
+
+	return cost;
+}
+
+/* ======================================================================================
+*
+* cascade_plan_build: chooses the cheapest sequence of levels for a query with radius epsilon.
+*				Without statistics, every level is evaluated
+*
+*      * query - matrix containing the query vector and all of its projections
+*	   * epsilon - radius of the query
+*
+* ====================================================================================== */
+cascade_plan *cascade_plan_build(gsl_matrix *query, double epsilon)
+{
+	projection_plan *projection = get_projection_plan();
+
+	cascade_plan *plan = (cascade_plan *)malloc(sizeof(cascade_plan));
+	plan->levels = (int *)malloc(sizeof(int)*(NUM_PROJECTIONS + 1));
+
+	double *selectivity = (double *)malloc(sizeof(double)*(NUM_PROJECTIONS + 1));
+	double *row_cost = (double *)malloc(sizeof(double)*(NUM_PROJECTIONS + 1));
+
+	int level, observed = 1;
+	for (level = 0; level <= NUM_PROJECTIONS; level++)
+	{
+		selectivity[level] = cascade_estimate_selectivity(query, level, epsilon);
+		row_cost[level] = projection->dims[level] + CASCADE_ROW_COST;
+
+		if (selectivity[level] < 0)
+		{
+			observed = 0;
+			selectivity[level] = 1;
+		}
+	}
+
+	unsigned long full_mask = (NUM_PROJECTIONS <= CASCADE_PLANNER_MAX_LEVELS) ? (1UL << NUM_PROJECTIONS) - 1 : ~0UL;
+	unsigned long best_mask = full_mask;
+
+	plan->full_cascade_cost = compute_plan_cost(full_mask, selectivity, row_cost, NULL);
+	plan->brute_force_cost = compute_plan_cost(0, selectivity, row_cost, NULL);
+	plan->cost = plan->full_cascade_cost;
+
+	/* without statistics, or with too many subsets to enumerate, evaluate every level */
+	if (observed && NUM_PROJECTIONS <= CASCADE_PLANNER_MAX_LEVELS)
+	{
+		unsigned long mask;
+		for (mask = 0; mask <= full_mask; mask++)
+		{
+			double cost = compute_plan_cost(mask, selectivity, row_cost, NULL);
+			if (cost < plan->cost)
+			{
+				plan->cost = cost;
+				best_mask = mask;
+			}
+		}
+	}
+
+	/* write the levels of the chosen subset */
+	plan->num_levels = 0;
+	for (level = NUM_PROJECTIONS; level >= 0; level--)
+		if (level == 0 || (best_mask & (1UL << (level - 1))))
+			plan->levels[plan->num_levels++] = level;
+
+	free(selectivity);
+	free(row_cost);
+
+	return plan;
+}
+
+/* ======================================================================================
+*
+* cascade_plan_free: deallocates a plan
+*
+*      * plan - the plan to deallocate
+*
+* ====================================================================================== */
+void cascade_plan_free(cascade_plan *plan)
+{
+	if (plan == NULL)
+		return;
+
+	free(plan->levels);
+	free(plan);
+}
+
+/* ======================================================================================
+*
+* print_cascade_plan: displays the levels of a plan and its estimated costs. used for
+*				debugging purposes
+*
+*      * plan - the plan to display
+*
+* ====================================================================================== */
+void print_cascade_plan(cascade_plan *plan)
+{
+	if (plan->num_levels == 1)
+		printf("\nCascade plan: brute force over the original data");
+	else
+	{
+		printf("\nCascade plan: levels");
+
+		int i;
+		for (i = 0; i < plan->num_levels; i++)
+			printf("%s%d", (i == 0) ? " " : " -> ", plan->levels[i]);
+	}
+
+	printf(" (estimated cost %.2f, full cascade %.2f, brute force %.2f)\n",
+		plan->cost, plan->full_cascade_cost, plan->brute_force_cost);
+}
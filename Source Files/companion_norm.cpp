@@ -0,0 +1,164 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* companion_norm.cpp
+* This file contains the implementation of the companion norm. The levels of the companion
+* norm are computed by the projection of the index; this file names their tables and files.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "companion_norm.hpp"
+#include "projection.hpp"
+
+/* the norm that is not NORM_TYPE, while NORM_TYPE is swapped with it */
+static char *SWAPPED_NORM_TYPE = NULL;
+
+/* files of the index computed from the original data only */
+static const char *SHARED_EXTENSIONS[] = { "perm", "dimorder", "dup", "attr" };
+
+/* files of the index built for the norm of the build only */
+static const char *UNSHARED_EXTENSIONS[] = { "pq", "ilv", "hnsw", "ivf", "va" };
+
+/* ======================================================================================
+*
+* build_side_path: returns the path of a file of the index for a norm
+*
+*      * norm_type - L1 or L2
+*	   * extension - extension of the file
+*
+* ====================================================================================== */
+static char *build_side_path(const char *norm_type, const char *extension)
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(norm_type) + strlen(extension)));
+	sprintf(path, "%s%s_%d_%s.%s", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, norm_type, extension);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* copy_file: copies a file, or removes the copy if the file does not exist. Returns 0 if the
+*				copy could not be written
+*
+*      * source_path - path of the file
+*	   * target_path - path of the copy
+*
+* ====================================================================================== */
+static int copy_file(const char *source_path, const char *target_path)
+{
+	remove(target_path);
+
+	FILE *source = fopen(source_path, "rb");
+	if (source == NULL)
+		return 1;
+
+	FILE *target = fopen(target_path, "wb");
+	if (target == NULL)
+	{
+		fclose(source);
+		return 0;
+	}
+
+	char buffer[65536];
+	size_t num_bytes;
+	int valid = 1;
+	while (valid && (num_bytes = fread(buffer, 1, sizeof(buffer), source)) > 0)
+		valid = fwrite(buffer, 1, num_bytes, target) == num_bytes;
+
+	fclose(source);
+	fclose(target);
+
+	if (!valid)
+		remove(target_path);
+
+	return valid;
+}
+
+/* ======================================================================================
+*
+* companion_norm_type: returns the norm that is not NORM_TYPE, L1 or L2
+*
+* ====================================================================================== */
+const char *companion_norm_type()
+{
+	return (strcmp(NORM_TYPE, "L2") == 0) ? "L1" : "L2";
+}
+
+/* ======================================================================================
+*
+* companion_norm_swap: exchanges NORM_TYPE with the companion norm
+*
+* ====================================================================================== */
+void companion_norm_swap()
+{
+	if (SWAPPED_NORM_TYPE == NULL)
+	{
+		const char *companion = companion_norm_type();
+		SWAPPED_NORM_TYPE = (char *)malloc(sizeof(char)*(strlen(companion) + 1));
+		strcpy(SWAPPED_NORM_TYPE, companion);
+	}
+
+	char *norm_type = NORM_TYPE;
+	NORM_TYPE = SWAPPED_NORM_TYPE;
+	SWAPPED_NORM_TYPE = norm_type;
+}
+
+/* ======================================================================================
+*
+* companion_norm_share_table: shows the original data, in the current table, under the name
+*				of the original data of the companion norm
+*
+*      * hdbc - an  opened SQL connection
+*
+* ====================================================================================== */
+void companion_norm_share_table(HDBC hdbc)
+{
+	companion_norm_swap();
+	char *view_name = build_table_name(1, TOTAL_DIMENSIONS);
+	companion_norm_swap();
+
+	sql_share_table(hdbc, view_name, TOTAL_DIMENSIONS, companion_norm_type());
+
+	free(view_name);
+}
+
+/* ======================================================================================
+*
+* companion_norm_share_files: copies the files of the index that do not depend on the norm to
+*				the names of the companion norm and removes the other files of the companion
+*				norm
+*
+* ====================================================================================== */
+void companion_norm_share_files()
+{
+	const char *companion = companion_norm_type();
+
+	int i;
+	for (i = 0; i < (int)(sizeof(SHARED_EXTENSIONS) / sizeof(SHARED_EXTENSIONS[0])); i++)
+	{
+		char *source_path = build_side_path(NORM_TYPE, SHARED_EXTENSIONS[i]);
+		char *target_path = build_side_path(companion, SHARED_EXTENSIONS[i]);
+
+		if (!copy_file(source_path, target_path))
+			printf("[ERROR] Unable to write %s\n", target_path);
+
+		free(source_path);
+		free(target_path);
+	}
+
+	/* structures of a previous index of the companion norm would not match its new levels */
+	for (i = 0; i < (int)(sizeof(UNSHARED_EXTENSIONS) / sizeof(UNSHARED_EXTENSIONS[0])); i++)
+	{
+		char *path = build_side_path(companion, UNSHARED_EXTENSIONS[i]);
+		remove(path);
+		free(path);
+	}
+}
@@ -127,63 +127,121 @@ void sql_transfer_data_to_database(SQLHDBC hdbc)
 
 /* ======================================================================================
 *
-* sql_compute_distances: computes the distance between each vector of the database with a 
-*						query vector.  The distances can be computed using the L1 norm or L2 norm
+* sql_open_distance_cursor: executes a query returning the columns DIST and ID and returns a 
+*						cursor over its results. The cursor takes ownership of the query
 *
 *		* hdbc - an opened SQL connection
-*		* query_matrix - matrix containing the query vector and all of its projections
-*		* chunk - index of the current chunk of data being processed
-*		* dimensions - number of dimensions of the current projection 
+*		* query - a distance query, such as the ones of build_query_to_scan_level and
+*				build_query_to_sort_level
 *
 * ======================================================================================
 */
-long *sql_compute_distances(SQLHDBC hdbc, gsl_matrix *query_matrix, int chunk, int dimensions )
+sql_distance_cursor *sql_open_distance_cursor(SQLHDBC hdbc, SQLWCHAR *query )
 {
-	/* build query to compute distances between query and dabase vectors */
-	SQLWCHAR* query = build_query_to_compute_distance(query_matrix, chunk, dimensions);
+	sql_distance_cursor *cursor = (sql_distance_cursor *)malloc(sizeof(sql_distance_cursor));
 
-	/* return code of SQL executions; Used to detect function failures */
-	SQLRETURN retcode;
+	cursor->query = query;
+	cursor->batch = (query_match *)malloc(sizeof(query_match)*RESULT_BATCH_SIZE);
+	cursor->rows_fetched = 0;
+	cursor->finished = 0;
+	cursor->failed = 0;
+
+	/* with the L2 norm, the database compares squared distances */
+	cursor->squared = (strcmp(NORM_TYPE, "L2") == 0);
 
 	/* perform SQL query */
-	SQLHSTMT hstmt = sql_allocate_stmt(hdbc);
-	retcode = sql_make_prepared_query(hdbc, query, hstmt);
+	cursor->hstmt = sql_allocate_stmt(hdbc);
+	SQLSMALLINT retcode = sql_make_prepared_query(hdbc, cursor->query, cursor->hstmt);
 
-	/* allocate memory to hold the query output */
-	long *result_temp = (long*)malloc(sizeof(long)*1000000);
+	/* Check if the query was successfull otherwise ,
+	* the function returns an error and exit the program */
+	sql_verify_error(retcode, "sql_open_distance_cursor");
 
-	/* iterate over all retrieved items from the SQL query */
-	int row = 0;
-	while (TRUE)
+	/* fetch RESULT_BATCH_SIZE rows per call, bound row by row into the query_match array */
+	SQLSetStmtAttr(cursor->hstmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)sizeof(query_match), 0);
+	SQLSetStmtAttr(cursor->hstmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)RESULT_BATCH_SIZE, 0);
+	SQLSetStmtAttr(cursor->hstmt, SQL_ATTR_ROWS_FETCHED_PTR, &cursor->rows_fetched, 0);
+
+	/* the query returns the columns DIST and ID. The ID is a BIGINT, so it is read as a
+	 * 64 bit integer and the distance as a double */
+	SQLBindCol(cursor->hstmt, 1, SQL_C_DOUBLE, &cursor->batch[0].distance, sizeof(double), NULL);
+	SQLBindCol(cursor->hstmt, 2, SQL_C_SBIGINT, &cursor->batch[0].id, sizeof(long long), NULL);
+
+	return cursor;
+}
+
+/* ======================================================================================
+*
+* sql_fetch_distance_batch: fetches the next rows of a distance cursor. Returns the number of
+*						matches written in cursor->batch, or zero when there are no more rows.
+*						An error in the middle of the rows (a timeout, a conversion error, a
+*						deadlock) is not the end of the result: it is reported as any other
+*						failed statement
+*
+*		* cursor - an opened distance cursor
+*
+* ======================================================================================
+*/
+long sql_fetch_distance_batch(sql_distance_cursor *cursor)
+{
+	if (cursor->finished)
+		return 0;
+
+	/* fetch the next block of rows of the SQL query */
+	SQLRETURN retcode = SQLFetch(cursor->hstmt);
+
+	/* if there is no more data to fetch, finish */
+	if (retcode == SQL_NO_DATA)
 	{
-		/* fetch the results of the SQL query one by one */
-		retcode = SQLFetch(hstmt);
+		cursor->finished = 1;
+		return 0;
+	}
 
-		/* if there is no more data to fetch, finish */
-		if (retcode != SQL_SUCCESS && retcode != SQL_SUCCESS_WITH_INFO)
-			break;
-		
-		/* temporary variable to hold the featched data */
-		float data;
-		
-		/* Get the data */
-		SQLGetData(hstmt, 2, SQL_C_FLOAT, &data, sizeof(float), NULL);
-		
-		/* store the data */
-		result_temp[row] = data;
-		row++;
+	/* any other failure would truncate the result, so it stops the program */
+	if (retcode != SQL_SUCCESS && retcode != SQL_SUCCESS_WITH_INFO)
+	{
+		cursor->failed = 1;
+		cursor->finished = 1;
+		sql_verify_error(retcode, "sql_fetch_distance_batch");
+		return 0;
 	}
 
-	/* update the global variable,which counts the number of items retrieved by the query */
-	NUM_ITEMS = row;
+	/* only the fetched rows pay for the square root */
+	if (cursor->squared)
+	{
+		SQLULEN i;
+		for (i = 0; i < cursor->rows_fetched; i++)
+			cursor->batch[i].distance = sqrt(cursor->batch[i].distance);
+	}
+
+	return (long)cursor->rows_fetched;
+}
+
+/* ======================================================================================
+*
+* sql_close_distance_cursor: closes the SQL statement of a distance cursor, discarding the rows
+*						that were not fetched, and deallocates the cursor
+*
+*		* cursor - an opened distance cursor
+*
+* ======================================================================================
+*/
+void sql_close_distance_cursor(sql_distance_cursor *cursor)
+{
+	if (cursor == NULL)
+		return;
+
+	/* stop the query if the caller did not read all the rows */
+	if (!cursor->finished)
+		SQLCancel(cursor->hstmt);
 
 	/* close SQL statement */
-	sql_close_stmt_handler(hstmt);
+	sql_close_stmt_handler(cursor->hstmt);
 
 	/* free memory */
-	free( query );
-	
-	return result_temp;
+	free(cursor->query);
+	free(cursor->batch);
+	free(cursor);
 }
 
 
@@ -208,6 +266,9 @@ void sql_fill_database(HDBC hdbc, int dims)
 
 	/* create a primary key */
 	sql_add_primary_key(hdbc);
+
+	/* results computed before this point are no longer valid */
+	INDEX_VERSION++;
 }
 
 /* ======================================================================================
@@ -301,6 +362,36 @@ SQLSMALLINT sql_make_prepared_query(SQLHDBC hdbc, SQLWCHAR *query, SQLHSTMT hstm
 	return retcode;
 }
 
+/* ======================================================================================
+*
+* sql_execute_statement: performs an SQL statement that returns no rows and deallocates it
+*
+*		* hdbc - an  opened SQL connection
+*		* query - the statement to be performed in the SQLWCHAR * type
+*		* function - name of the calling function, reported if the statement fails
+*
+* ======================================================================================
+*/
+void sql_execute_statement(SQLHDBC hdbc, SQLWCHAR *query, char *function)
+{
+	/* return code of SQL executions; Used to detect function failures */
+	SQLRETURN retcode;
+
+	HSTMT hstmt = sql_allocate_stmt(hdbc);
+
+	/* perform SQL query */
+	retcode = sql_make_prepared_query(hdbc, query, hstmt);
+
+	/* if the statement fails, return an error and exit the program */
+	sql_verify_error(retcode, function);
+
+	/* close SQL statement */
+	sql_close_stmt_handler(hstmt);
+
+	/* free memory */
+	free(query);
+}
+
 /* ======================================================================================
 *
 * sql_get_database: returns a chunk of data from an SQL table
@@ -440,6 +531,69 @@ void sql_add_primary_key(SQLHDBC hdbc)
 	free(query);
 }
 
+/* ======================================================================================
+*
+* sql_add_norm_index: adds to the current table a column with the norm of each vector and
+*					sorts the vectors by it, so that the scans read only the vectors whose
+*					norm is close to the norm of the query
+*
+*		* hdbc - an  opened SQL connection
+*		* dims - number of columns of the current table
+*
+* ======================================================================================
+*/
+void sql_add_norm_index(SQLHDBC hdbc, int dims)
+{
+	printf("\n\nSorting table %s by the norm of its vectors\n\n", DB_TABLE_NAME);
+
+	/* ALTER TABLE <table_name> ADD NORM AS ( <norm> ) PERSISTED */
+	sql_execute_statement(hdbc, build_query_to_add_norm_column(DB_TABLE_NAME, "NORM", dims, strcmp(NORM_TYPE, "L2") == 0), "sql_add_norm_index");
+
+	/* CREATE INDEX IX_NORM ON <table_name> ( NORM ) */
+	sql_execute_statement(hdbc, build_query_to_index_norm(DB_TABLE_NAME, "NORM"), "sql_add_norm_index");
+}
+
+/* ======================================================================================
+*
+* sql_share_table: shows the current table under the name the queries of another norm read,
+*					without copying its vectors. With NORM_INDEX, the table receives a second
+*					indexed column, NORM_<norm_type>, with the norm of its vectors in the other
+*					norm, which the view shows as its NORM column
+*
+*		* hdbc - an  opened SQL connection
+*		* view_name - name of the table for the other norm
+*		* dims - number of columns of the current table
+*		* norm_type - the other norm, L1 or L2
+*
+* ======================================================================================
+*/
+void sql_share_table(SQLHDBC hdbc, char *view_name, int dims, const char *norm_type)
+{
+	printf("\n\nSharing table %s as %s\n\n", DB_TABLE_NAME, view_name);
+
+	char *norm_column = NULL;
+	if (NORM_INDEX)
+	{
+		norm_column = (char *)malloc(sizeof(char)*(10 + strlen(norm_type)));
+		sprintf(norm_column, "NORM_%s", norm_type);
+
+		/* ALTER TABLE <table_name> ADD NORM_<norm_type> AS ( <norm> ) PERSISTED */
+		sql_execute_statement(hdbc, build_query_to_add_norm_column(DB_TABLE_NAME, norm_column, dims, strcmp(norm_type, "L2") == 0), "sql_share_table");
+
+		/* CREATE INDEX IX_NORM_<norm_type> ON <table_name> ( NORM_<norm_type> ) */
+		sql_execute_statement(hdbc, build_query_to_index_norm(DB_TABLE_NAME, norm_column), "sql_share_table");
+	}
+
+	/* a previous index may have stored the other norm in a table of its own */
+	sql_execute_statement(hdbc, build_query_to_drop_view(view_name), "sql_share_table");
+	sql_execute_statement(hdbc, build_query_to_drop_table(view_name), "sql_share_table");
+
+	/* CREATE VIEW <view_name> AS SELECT c_0, ..., ID [, NORM_<norm_type> AS NORM] FROM <table_name> */
+	sql_execute_statement(hdbc, build_query_to_create_view(view_name, DB_TABLE_NAME, dims, norm_column), "sql_share_table");
+
+	free(norm_column);
+}
+
 /* ======================================================================================
 *
 * sql_close_connection: Closes an opened connection to a database
@@ -0,0 +1,340 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* dimension_order.cpp
+* This file contains the implementation of the order of the dimensions. The correlations of
+* the columns are computed on a sample of the original data, and the windows are filled one
+* after the other: each column added to a window is the one most correlated with the columns
+* already in it, and each window starts with the column most correlated with the previous
+* window, so that the next levels also reduce related coordinates.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "dimension_order.hpp"
+#include "projection.hpp"
+
+/* order of the columns of the current index, read by the first query */
+static dimension_order *DIMENSION_ORDER = NULL;
+
+/* ======================================================================================
+*
+* build_dimension_order_path: returns the path of the order of the columns of the dataset
+*
+* ====================================================================================== */
+static char *build_dimension_order_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.dimorder", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* dimension_order_free: deallocates an order of the columns
+*
+*      * order - the order to deallocate
+*
+* ====================================================================================== */
+static void dimension_order_free(dimension_order *order)
+{
+	if (order == NULL)
+		return;
+
+	free(order->columns);
+	free(order);
+}
+
+/* ======================================================================================
+*
+* compute_correlations: returns the dims x dims correlation matrix of the columns of at most
+*				DIMENSION_ORDER_SAMPLE vectors taken at regular intervals of the IDs. A
+*				constant column has no correlation with the others
+*
+*      * hdbc - an opened SQL connection
+*
+* ====================================================================================== */
+static gsl_matrix *compute_correlations(HDBC hdbc)
+{
+	int dims = TOTAL_DIMENSIONS, i, j;
+	long num_sample = (TOTAL_VECTORS < DIMENSION_ORDER_SAMPLE) ? TOTAL_VECTORS : DIMENSION_ORDER_SAMPLE;
+
+	gsl_matrix *sample = gsl_matrix_calloc(num_sample, dims);
+
+	int chunks_to_read = compute_num_chunks(), chunk_indx;
+	long first_id, t;
+
+	for (chunk_indx = 0, first_id = 0, t = 0; chunk_indx < chunks_to_read && t < num_sample; chunk_indx++)
+	{
+		long remaining_vecs = compute_num_vecs_to_load(chunk_indx, chunks_to_read);
+		gsl_matrix *database_matrix = load_data_chunk(hdbc, chunk_indx, chunks_to_read, remaining_vecs, dims);
+
+		/* vector t of the sample is the vector t x TOTAL_VECTORS / num_sample */
+		long source;
+		while (t < num_sample && (source = (long)((double)t * TOTAL_VECTORS / num_sample)) < first_id + remaining_vecs)
+		{
+			for (i = 0; i < dims; i++)
+				gsl_matrix_set(sample, t, i, gsl_matrix_get(database_matrix, source - first_id, i));
+			t++;
+		}
+
+		first_id += remaining_vecs;
+		gsl_matrix_free(database_matrix);
+	}
+
+	/* center the columns */
+	for (i = 0; i < dims; i++)
+	{
+		double mean = 0;
+		for (t = 0; t < num_sample; t++)
+			mean += gsl_matrix_get(sample, t, i);
+		mean /= num_sample;
+
+		for (t = 0; t < num_sample; t++)
+			gsl_matrix_set(sample, t, i, gsl_matrix_get(sample, t, i) - mean);
+	}
+
+	/* covariances, then correlations */
+	gsl_matrix *correlations = gsl_matrix_alloc(dims, dims);
+	gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, sample, sample, 0.0, correlations);
+	gsl_matrix_free(sample);
+
+	double *deviations = (double *)malloc(sizeof(double)*dims);
+	for (i = 0; i < dims; i++)
+		deviations[i] = sqrt(gsl_matrix_get(correlations, i, i));
+
+	for (i = 0; i < dims; i++)
+		for (j = 0; j < dims; j++)
+		{
+			double product = deviations[i] * deviations[j];
+			gsl_matrix_set(correlations, i, j, (product > 0) ? gsl_matrix_get(correlations, i, j) / product : 0);
+		}
+
+	free(deviations);
+
+	return correlations;
+}
+
+/* ======================================================================================
+*
+* group_correlated_columns: fills the windows one after the other. A window starts with the
+*				free column most correlated with the previous window (the first window starts
+*				with the column most correlated with all the others) and grows with the free
+*				column whose correlation summed over the columns of the window is the largest.
+*				The correlations are signed: the first step reduces the sum of a window, so
+*				columns that move in opposite directions cancel each other
+*
+*      * correlations - dims x dims correlation matrix of the columns
+*	   * window - window of the first projection step
+*	   * columns - output order of the columns, dims values
+*
+* ====================================================================================== */
+static void group_correlated_columns(gsl_matrix *correlations, int window, int *columns)
+{
+	int dims = (int)correlations->size1, i, k;
+
+	char *used = (char *)calloc(dims, sizeof(char));
+	double *scores = (double *)calloc(dims, sizeof(double));
+
+	/* linkage of every column to all the others, for the first window */
+	for (i = 0; i < dims; i++)
+		for (k = 0; k < dims; k++)
+			scores[i] += gsl_matrix_get(correlations, i, k);
+
+	for (k = 0; k < dims; k++)
+	{
+		int best = -1;
+		for (i = 0; i < dims; i++)
+			if (!used[i] && (best < 0 || scores[i] > scores[best]))
+				best = i;
+
+		columns[k] = best;
+		used[best] = 1;
+
+		/* a new window only scores the columns against its first column */
+		int window_start = (window > 0) && (k % window == 0);
+		for (i = 0; i < dims; i++)
+			scores[i] = (window_start ? 0 : scores[i]) + gsl_matrix_get(correlations, best, i);
+
+		/* the next window scores the columns against the whole window that ends here */
+		if (window > 0 && (k + 1) % window == 0)
+		{
+			for (i = 0; i < dims; i++)
+				scores[i] = 0;
+
+			int m;
+			for (m = k + 1 - window; m <= k; m++)
+				for (i = 0; i < dims; i++)
+					scores[i] += gsl_matrix_get(correlations, columns[m], i);
+		}
+	}
+
+	free(scores);
+	free(used);
+}
+
+/* ======================================================================================
+*
+* dimension_order_build: computes the correlations of the columns on a sample, groups them
+*				into windows and saves the order next to the dataset
+*
+*      * hdbc - an opened SQL connection
+*	   * group_columns - 1 to group the columns, 0 to keep the order of the dataset file
+*
+* ====================================================================================== */
+void dimension_order_build(HDBC hdbc, int group_columns)
+{
+	char *path = build_dimension_order_path();
+
+	/* the order of a previous index is no longer valid */
+	remove(path);
+
+	if (!group_columns || NUM_PROJECTIONS == 0 || TOTAL_VECTORS == 0)
+	{
+		INDEX_VERSION++;
+		free(path);
+		return;
+	}
+
+	dimension_order *order = (dimension_order *)malloc(sizeof(dimension_order));
+	order->dims = TOTAL_DIMENSIONS;
+	order->window = WINDOWS[0];
+	order->columns = (int *)malloc(sizeof(int)*order->dims);
+
+	gsl_matrix *correlations = compute_correlations(hdbc);
+	group_correlated_columns(correlations, order->window, order->columns);
+	gsl_matrix_free(correlations);
+
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+		printf("[ERROR] Unable to write the order of the dimensions to %s\n", path);
+	else
+	{
+		int magic = DIMENSION_ORDER_MAGIC;
+		fwrite(&magic, sizeof(int), 1, file);
+		fwrite(&order->dims, sizeof(int), 1, file);
+		fwrite(&order->window, sizeof(int), 1, file);
+		fwrite(order->columns, sizeof(int), order->dims, file);
+		fclose(file);
+	}
+
+	if (DEBUG_OPTION > 0)
+	{
+		int k;
+		printf("\nOrder of the dimensions:");
+		for (k = 0; k < order->dims; k++)
+			printf("%s%d", (k % order->window == 0) ? " | " : " ", order->columns[k]);
+		printf("\n");
+	}
+
+	/* the projection plan reads the new order */
+	INDEX_VERSION++;
+
+	dimension_order_free(order);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* dimension_order_read: reads the order of the columns of the dataset, or returns NULL if the
+*				file does not exist or does not match the index
+*
+* ====================================================================================== */
+static dimension_order *dimension_order_read()
+{
+	char *path = build_dimension_order_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, dims = 0, window = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != DIMENSION_ORDER_MAGIC
+		|| fread(&dims, sizeof(int), 1, file) != 1 || dims != TOTAL_DIMENSIONS
+		|| fread(&window, sizeof(int), 1, file) != 1 || NUM_PROJECTIONS == 0 || window != WINDOWS[0])
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	dimension_order *order = (dimension_order *)malloc(sizeof(dimension_order));
+	order->dims = dims;
+	order->window = window;
+	order->columns = (int *)malloc(sizeof(int)*dims);
+
+	int valid = fread(order->columns, sizeof(int), dims, file) == (size_t)dims;
+	fclose(file);
+
+	/* every column must appear once */
+	char *seen = (char *)calloc(dims, sizeof(char));
+	int k;
+	for (k = 0; k < dims && valid; k++)
+	{
+		int column = order->columns[k];
+		valid = (column >= 0 && column < dims && !seen[column]);
+		if (valid) seen[column] = 1;
+	}
+	free(seen);
+
+	if (!valid)
+	{
+		dimension_order_free(order);
+		return NULL;
+	}
+
+	return order;
+}
+
+/* ======================================================================================
+*
+* get_dimension_order: returns the order of the columns of the current index, read from the
+*				file the first time it is needed. Returns NULL if the columns were not grouped
+*
+* ====================================================================================== */
+dimension_order *get_dimension_order()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the order was read */
+	if (checked_version != INDEX_VERSION)
+	{
+		dimension_order_free(DIMENSION_ORDER);
+		DIMENSION_ORDER = (BILLION_DATASET == 0) ? dimension_order_read() : NULL;
+		checked_version = INDEX_VERSION;
+	}
+
+	return DIMENSION_ORDER;
+}
+
+/* ======================================================================================
+*
+* dimension_order_apply: returns a copy of a chunk of the original data with its columns in
+*				the order of the index
+*
+*      * order - order of the columns
+*	   * data - chunk of the original data, one vector per row
+*	   * num_rows - number of vectors of the chunk
+*
+* ====================================================================================== */
+gsl_matrix *dimension_order_apply(const dimension_order *order, gsl_matrix *data, long num_rows)
+{
+	gsl_matrix *ordered = gsl_matrix_alloc(data->size1, data->size2);
+
+	long row;
+	int k;
+	for (row = 0; row < num_rows; row++)
+		for (k = 0; k < order->dims; k++)
+			gsl_matrix_set(ordered, row, k, gsl_matrix_get(data, row, order->columns[k]));
+
+	return ordered;
+}
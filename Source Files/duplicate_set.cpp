@@ -0,0 +1,442 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* duplicate_set.cpp
+* This file contains the implementation of the exact duplicates of the dataset. The lines of
+* the dataset file are compared as text, without their trailing spaces, so two vectors are
+* only collapsed when they are written identically. Every line is hashed into an open
+* addressing table of the representatives, and a line whose hash matches a representative is
+* compared with the line of the representative, read again from the file, so a collision of
+* the hashes never merges different vectors.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "duplicate_set.hpp"
+#include "id_order.hpp"
+
+/* groups of identical vectors of the current index, read by the first query */
+static duplicate_set *DUPLICATE_SET = NULL;
+
+/* ======================================================================================
+*
+* build_duplicate_path: returns the path of the posting lists of the dataset
+*
+* ====================================================================================== */
+static char *build_duplicate_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.dup", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* duplicate_set_free: deallocates the groups of identical vectors
+*
+*      * duplicates - the groups to deallocate
+*
+* ====================================================================================== */
+static void duplicate_set_free(duplicate_set *duplicates)
+{
+	if (duplicates == NULL)
+		return;
+
+	free(duplicates->first);
+	free(duplicates->members);
+	free(duplicates);
+}
+
+/* ======================================================================================
+*
+* trimmed_length: returns the length of a line without its trailing spaces and line break
+*
+*      * line - a line read with fgets
+*
+* ====================================================================================== */
+static size_t trimmed_length(const char *line)
+{
+	size_t length = strlen(line);
+
+	while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' || line[length - 1] == ' ' || line[length - 1] == '\t'))
+		length--;
+
+	return length;
+}
+
+/* ======================================================================================
+*
+* hash_line: FNV-1a hash of the first bytes of a line, continuing from a previous hash
+*
+*      * hash - hash of the previous text, or the FNV offset basis
+*	   * line - the line
+*	   * length - number of bytes to hash
+*
+* ====================================================================================== */
+static unsigned long long hash_line(unsigned long long hash, const char *line, size_t length)
+{
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= (unsigned char)line[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/* ======================================================================================
+*
+* same_line: returns 1 if the line of a file at a position is equal to a line, without their
+*				trailing spaces
+*
+*      * file - an opened file
+*	   * position - position of the line in the file
+*	   * line - the line to compare with
+*	   * length - trimmed length of the line
+*	   * buffer - room for DUPLICATE_MAX_LINE characters
+*
+* ====================================================================================== */
+static int same_line(FILE *file, fpos_t *position, const char *line, size_t length, char *buffer)
+{
+	if (fsetpos(file, position) != 0 || fgets(buffer, DUPLICATE_MAX_LINE, file) == NULL)
+		return 0;
+
+	return trimmed_length(buffer) == length && memcmp(buffer, line, length) == 0;
+}
+
+/* ======================================================================================
+*
+* collapse_duplicates: hashes every line of the dataset file, with its attributes, writes the
+*				first occurrence of each one to the unique file and saves the lines of the
+*				dataset file of every group
+*
+*      * collapse - 1 to collapse the duplicates, 0 to index every line
+*
+* ====================================================================================== */
+void collapse_duplicates(int collapse)
+{
+	char *path = build_duplicate_path();
+
+	/* the groups of a previous index are no longer valid */
+	remove(path);
+
+	if (!collapse || TOTAL_VECTORS == 0)
+	{
+		free(path);
+		return;
+	}
+
+	long num_rows = TOTAL_VECTORS, row, r;
+
+	char *attribute_path = (char *)malloc(sizeof(char)*(strlen(DATASET_PATH) + 20));
+	char *unique_path = (char *)malloc(sizeof(char)*(strlen(DATASET_PATH) + 20));
+	char *unique_attribute_path = (char *)malloc(sizeof(char)*(strlen(DATASET_PATH) + 20));
+	sprintf(attribute_path, "%s.attr", DATASET_PATH);
+	sprintf(unique_path, "%s.unique", DATASET_PATH);
+	sprintf(unique_attribute_path, "%s.unique.attr", DATASET_PATH);
+
+	/* each file is read sequentially and, to compare the lines of the representatives, at
+	 * random positions */
+	FILE *data = fopen(DATASET_PATH, "r");
+	FILE *data_check = fopen(DATASET_PATH, "r");
+	FILE *attributes = fopen(attribute_path, "r");
+	FILE *attributes_check = (attributes != NULL) ? fopen(attribute_path, "r") : NULL;
+	FILE *unique = fopen(unique_path, "w");
+	FILE *unique_attributes = (attributes != NULL) ? fopen(unique_attribute_path, "w") : NULL;
+
+	int valid = (data != NULL && data_check != NULL && unique != NULL && (attributes == NULL || (attributes_check != NULL && unique_attributes != NULL)));
+	if (!valid)
+		printf("[ERROR] Unable to collapse the duplicates of %s\n", DATASET_PATH);
+
+	/* open addressing table of the representatives, at most half full */
+	long long table_size = 2;
+	while (table_size < 2 * (long long)num_rows)
+		table_size *= 2;
+
+	long long *table = (long long *)calloc(valid ? table_size : 1, sizeof(long long));		/* r + 1, 0 if empty */
+	unsigned long long *hashes = (unsigned long long *)malloc(sizeof(unsigned long long)*num_rows);
+	fpos_t *positions = (fpos_t *)malloc(sizeof(fpos_t)*num_rows);
+	fpos_t *attribute_positions = (fpos_t *)malloc(sizeof(fpos_t)*num_rows);
+	long long *groups = (long long *)malloc(sizeof(long long)*num_rows);
+
+	char *line = (char *)malloc(sizeof(char)*DUPLICATE_MAX_LINE);
+	char *attribute_line = (char *)malloc(sizeof(char)*DUPLICATE_MAX_LINE);
+	char *buffer = (char *)malloc(sizeof(char)*DUPLICATE_MAX_LINE);
+
+	long num_representatives = 0;
+	attribute_line[0] = '\0';
+
+	for (row = 0; row < num_rows && valid; row++)
+	{
+		fpos_t position, attribute_position;
+
+		valid = fgetpos(data, &position) == 0 && fgets(line, DUPLICATE_MAX_LINE, data) != NULL
+			&& (attributes == NULL || (fgetpos(attributes, &attribute_position) == 0 && fgets(attribute_line, DUPLICATE_MAX_LINE, attributes) != NULL));
+
+		/* a line longer than the buffer would be read in pieces */
+		valid = valid && (strlen(line) < DUPLICATE_MAX_LINE - 1 || line[DUPLICATE_MAX_LINE - 2] == '\n')
+			&& (strlen(attribute_line) < DUPLICATE_MAX_LINE - 1 || attribute_line[DUPLICATE_MAX_LINE - 2] == '\n');
+
+		if (!valid)
+		{
+			printf("[ERROR] %s does not have %ld lines of at most %d characters\n", DATASET_PATH, num_rows, DUPLICATE_MAX_LINE);
+			break;
+		}
+
+		size_t length = trimmed_length(line), attribute_length = trimmed_length(attribute_line);
+
+		/* the attributes are part of the key, so a group shares them too */
+		unsigned long long hash = hash_line(14695981039346656037ULL, line, length);
+		hash = hash_line(hash, "\n", 1);
+		hash = hash_line(hash, attribute_line, attribute_length);
+
+		long long slot = (long long)(hash & (unsigned long long)(table_size - 1));
+		for (r = -1; table[slot] != 0; slot = (slot + 1) & (table_size - 1))
+		{
+			long candidate = (long)(table[slot] - 1);
+
+			if (hashes[candidate] == hash && same_line(data_check, &positions[candidate], line, length, buffer)
+				&& (attributes == NULL || same_line(attributes_check, &attribute_positions[candidate], attribute_line, attribute_length, buffer)))
+			{
+				r = candidate;
+				break;
+			}
+		}
+
+		/* first occurrence: the line becomes a representative and is written as it was read */
+		if (r < 0)
+		{
+			r = num_representatives++;
+			hashes[r] = hash;
+			positions[r] = position;
+			if (attributes != NULL)
+				attribute_positions[r] = attribute_position;
+			table[slot] = r + 1;
+
+			fputs(line, unique);
+			if (line[strlen(line) - 1] != '\n')
+				fputs("\n", unique);
+
+			if (unique_attributes != NULL)
+			{
+				fputs(attribute_line, unique_attributes);
+				if (attribute_line[strlen(attribute_line) - 1] != '\n')
+					fputs("\n", unique_attributes);
+			}
+		}
+
+		groups[row] = r;
+	}
+
+	if (data != NULL) fclose(data);
+	if (data_check != NULL) fclose(data_check);
+	if (attributes != NULL) fclose(attributes);
+	if (attributes_check != NULL) fclose(attributes_check);
+	if (unique != NULL) fclose(unique);
+	if (unique_attributes != NULL) fclose(unique_attributes);
+
+	free(line);
+	free(attribute_line);
+	free(buffer);
+	free(table);
+	free(hashes);
+	free(positions);
+	free(attribute_positions);
+
+	/* without duplicates, the dataset file is loaded as it is */
+	if (!valid || num_representatives == num_rows)
+	{
+		if (valid && DEBUG_OPTION > 0)
+			printf("\nDuplicates: none among %ld vectors\n", num_rows);
+
+		remove(unique_path);
+		remove(unique_attribute_path);
+	}
+	else
+	{
+		/* posting lists: the lines of every group, in the order of the dataset file */
+		long long *first = (long long *)calloc(num_representatives + 1, sizeof(long long));
+		long long *members = (long long *)malloc(sizeof(long long)*num_rows);
+
+		for (row = 0; row < num_rows; row++)
+			first[groups[row] + 1]++;
+		for (r = 0; r < num_representatives; r++)
+			first[r + 1] += first[r];
+
+		long long *next = (long long *)malloc(sizeof(long long)*num_representatives);
+		memcpy(next, first, sizeof(long long)*num_representatives);
+		for (row = 0; row < num_rows; row++)
+			members[next[groups[row]]++] = row + 1;
+		free(next);
+
+		FILE *file = fopen(path, "wb");
+		if (file == NULL)
+		{
+			/* the index must cover every line if the groups cannot be saved */
+			printf("[ERROR] Unable to write the duplicates to %s\n", path);
+			remove(unique_path);
+			remove(unique_attribute_path);
+		}
+		else
+		{
+			int magic = DUPLICATE_MAGIC;
+			fwrite(&magic, sizeof(int), 1, file);
+			fwrite(&num_rows, sizeof(long), 1, file);
+			fwrite(&num_representatives, sizeof(long), 1, file);
+			fwrite(first, sizeof(long long), num_representatives + 1, file);
+			fwrite(members, sizeof(long long), num_rows, file);
+			fclose(file);
+
+			printf("\nDuplicates: %ld vectors collapsed into %ld unique vectors\n", num_rows, num_representatives);
+
+			/* the unique lines are loaded and indexed instead of the dataset file */
+			free(DATASET_PATH);
+			DATASET_PATH = unique_path;
+			unique_path = NULL;
+			TOTAL_VECTORS = num_representatives;
+
+			/* the queries read the new groups */
+			INDEX_VERSION++;
+		}
+
+		free(first);
+		free(members);
+	}
+
+	free(groups);
+	free(unique_path);
+	free(unique_attribute_path);
+	free(attribute_path);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* duplicate_set_read: reads the groups of identical vectors of the dataset, or returns NULL
+*				if the file does not exist or does not match the index
+*
+* ====================================================================================== */
+static duplicate_set *duplicate_set_read()
+{
+	char *path = build_duplicate_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0;
+	long num_rows = 0, num_representatives = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != DUPLICATE_MAGIC
+		|| fread(&num_rows, sizeof(long), 1, file) != 1
+		|| fread(&num_representatives, sizeof(long), 1, file) != 1
+		|| num_representatives != TOTAL_VECTORS || num_rows < num_representatives)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	duplicate_set *duplicates = (duplicate_set *)malloc(sizeof(duplicate_set));
+	duplicates->num_rows = num_rows;
+	duplicates->num_representatives = num_representatives;
+	duplicates->first = (long long *)malloc(sizeof(long long)*(num_representatives + 1));
+	duplicates->members = (long long *)malloc(sizeof(long long)*num_rows);
+
+	int valid = fread(duplicates->first, sizeof(long long), num_representatives + 1, file) == (size_t)(num_representatives + 1)
+		&& fread(duplicates->members, sizeof(long long), num_rows, file) == (size_t)num_rows
+		&& duplicates->first[num_representatives] == num_rows;
+	fclose(file);
+
+	if (!valid)
+	{
+		duplicate_set_free(duplicates);
+		return NULL;
+	}
+
+	return duplicates;
+}
+
+/* ======================================================================================
+*
+* duplicate_set_assign_vectors: when the index was built with collapsed duplicates, assigns
+*				to TOTAL_VECTORS the number of vectors of the index. TOTAL_VECTORS holds the
+*				number of lines of the dataset file, given by its name
+*
+* ====================================================================================== */
+void duplicate_set_assign_vectors()
+{
+	if (BILLION_DATASET != 0)
+		return;
+
+	char *path = build_duplicate_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return;
+
+	int magic = 0;
+	long num_rows = 0, num_representatives = 0;
+	if (fread(&magic, sizeof(int), 1, file) == 1 && magic == DUPLICATE_MAGIC
+		&& fread(&num_rows, sizeof(long), 1, file) == 1 && num_rows == TOTAL_VECTORS
+		&& fread(&num_representatives, sizeof(long), 1, file) == 1 && num_representatives > 0)
+		TOTAL_VECTORS = num_representatives;
+
+	fclose(file);
+}
+
+/* ======================================================================================
+*
+* get_duplicate_set: returns the groups of identical vectors of the current index, read from
+*				the file the first time they are needed. Returns NULL if no line was collapsed
+*
+* ====================================================================================== */
+duplicate_set *get_duplicate_set()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the groups were read */
+	if (checked_version != INDEX_VERSION)
+	{
+		duplicate_set_free(DUPLICATE_SET);
+		DUPLICATE_SET = (BILLION_DATASET == 0) ? duplicate_set_read() : NULL;
+		checked_version = INDEX_VERSION;
+	}
+
+	return DUPLICATE_SET;
+}
+
+/* ======================================================================================
+*
+* duplicate_set_add_members: adds to a set the lines of the dataset file of every vector
+*				identical to a vector of the index
+*
+*      * set - the set that will receive the IDs
+*	   * id - ID of the vector in the tables of the index
+*
+* ====================================================================================== */
+void duplicate_set_add_members(id_set *set, long long id)
+{
+	/* position of the vector among the unique lines */
+	long long representative = map_to_original_id(id);
+
+	duplicate_set *duplicates = get_duplicate_set();
+	if (duplicates == NULL || representative < 1 || representative > duplicates->num_representatives)
+	{
+		id_set_add(set, representative);
+		return;
+	}
+
+	long long m;
+	for (m = duplicates->first[representative - 1]; m < duplicates->first[representative]; m++)
+		id_set_add(set, duplicates->members[m]);
+}
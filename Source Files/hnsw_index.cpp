@@ -0,0 +1,812 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* hnsw_index.cpp
+* This file contains the implementation of the hierarchical navigable small world graph. The
+* nodes are inserted from several threads: each thread takes the next node, searches its
+* neighbours from the entry point and links them, locking one node at a time while its links
+* are read or written. The layers of the nodes are drawn before the threads start, so the
+* links of the upper layers are allocated once.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "hnsw_index.hpp"
+#include "projection.hpp"
+
+/* graph of the current index, read by the first k-NN query */
+static hnsw_index *HNSW_INDEX = NULL;
+
+/* state of the random generator used to draw the layers of the nodes */
+static unsigned long long HNSW_SEED = 7046029254386353131ULL;
+
+/* a node found by a search and its distance to the query */
+typedef struct
+{
+	double distance;
+	int node;
+} hnsw_candidate;
+
+/* binary heap of candidates with the largest sign*distance on top */
+typedef struct
+{
+	hnsw_candidate *items;
+	long size;
+	long capacity;
+	double sign;		/* 1 for the farthest candidate on top, -1 for the closest */
+} hnsw_heap;
+
+/* memory used by the searches of one thread */
+typedef struct
+{
+	unsigned int *visited;		/* tag of the last search that reached each node */
+	unsigned int tag;
+	hnsw_heap candidates;		/* nodes whose links were not followed yet, closest on top */
+	hnsw_heap results;			/* the ef closest nodes found, farthest on top */
+	int *links;					/* copy of the links of the node being expanded */
+} hnsw_context;
+
+/* nodes inserted by the threads that build the graph */
+typedef struct
+{
+	hnsw_index *hnsw;
+	volatile LONG next_node;
+} hnsw_build_task;
+
+/* ======================================================================================
+*
+* next_random: xorshift generator, so that the layers are the same on every build
+*
+* ====================================================================================== */
+static unsigned long long next_random()
+{
+	HNSW_SEED ^= HNSW_SEED << 13;
+	HNSW_SEED ^= HNSW_SEED >> 7;
+	HNSW_SEED ^= HNSW_SEED << 17;
+	return HNSW_SEED;
+}
+
+/* ======================================================================================
+*
+* heap_push, heap_pop: operations of the heap of candidates
+*
+* ====================================================================================== */
+static void heap_push(hnsw_heap *heap, double distance, int node)
+{
+	if (heap->size == heap->capacity)
+	{
+		heap->capacity = (heap->capacity == 0) ? 64 : 2 * heap->capacity;
+		heap->items = (hnsw_candidate *)realloc(heap->items, sizeof(hnsw_candidate)*heap->capacity);
+	}
+
+	long i = heap->size++;
+	while (i > 0)
+	{
+		long parent = (i - 1) / 2;
+		if (heap->sign * heap->items[parent].distance >= heap->sign * distance)
+			break;
+
+		heap->items[i] = heap->items[parent];
+		i = parent;
+	}
+
+	heap->items[i].distance = distance;
+	heap->items[i].node = node;
+}
+
+static hnsw_candidate heap_pop(hnsw_heap *heap)
+{
+	hnsw_candidate top = heap->items[0];
+	hnsw_candidate last = heap->items[--heap->size];
+
+	long i = 0;
+	while (TRUE)
+	{
+		long child = 2 * i + 1;
+		if (child >= heap->size)
+			break;
+
+		if (child + 1 < heap->size && heap->sign * heap->items[child + 1].distance > heap->sign * heap->items[child].distance)
+			child++;
+
+		if (heap->sign * last.distance >= heap->sign * heap->items[child].distance)
+			break;
+
+		heap->items[i] = heap->items[child];
+		i = child;
+	}
+
+	if (heap->size > 0)
+		heap->items[i] = last;
+
+	return top;
+}
+
+/* ======================================================================================
+*
+* context_init, context_free: memory of the searches of one thread
+*
+* ====================================================================================== */
+static void context_init(hnsw_context *context, long num_nodes)
+{
+	context->visited = (unsigned int *)calloc(num_nodes, sizeof(unsigned int));
+	context->tag = 0;
+	memset(&context->candidates, 0, sizeof(hnsw_heap));
+	memset(&context->results, 0, sizeof(hnsw_heap));
+	context->candidates.sign = -1;
+	context->results.sign = 1;
+	context->links = (int *)malloc(sizeof(int)*(HNSW_M0 + 1));
+}
+
+static void context_free(hnsw_context *context)
+{
+	free(context->visited);
+	free(context->candidates.items);
+	free(context->results.items);
+	free(context->links);
+}
+
+/* ======================================================================================
+*
+* node_distance: distance from a vector to a node, with the norm of the index
+*
+* ====================================================================================== */
+static double node_distance(hnsw_index *hnsw, const double *vector, int node)
+{
+	return projection_plan_distance(get_projection_plan(), vector, &hnsw->vectors[(long)node*hnsw->dims], hnsw->dims);
+}
+
+/* ======================================================================================
+*
+* node_links: returns the links of a node at a layer: their number followed by the nodes
+*
+* ====================================================================================== */
+static int *node_links(hnsw_index *hnsw, int node, int layer)
+{
+	if (layer == 0)
+		return &hnsw->links0[(long)node*(HNSW_M0 + 1)];
+
+	return &hnsw->upper_links[node][(layer - 1)*(HNSW_M + 1)];
+}
+
+/* ======================================================================================
+*
+* copy_links: copies the links of a node at a layer, locking the node while the graph is
+*				built, and returns their number
+*
+* ====================================================================================== */
+static int copy_links(hnsw_index *hnsw, int node, int layer, int *links)
+{
+	if (hnsw->locks != NULL)
+		EnterCriticalSection(&hnsw->locks[node]);
+
+	int *node_layer_links = node_links(hnsw, node, layer);
+	int num_links = node_layer_links[0];
+	memcpy(links, node_layer_links + 1, sizeof(int)*num_links);
+
+	if (hnsw->locks != NULL)
+		LeaveCriticalSection(&hnsw->locks[node]);
+
+	return num_links;
+}
+
+/* ======================================================================================
+*
+* greedy_search: moves from a node to its closest link at a layer while it gets closer to the
+*				vector, and returns the last node
+*
+*      * hnsw - graph
+*	   * context - memory of the thread
+*	   * vector - vector searched
+*	   * entry - node where the search starts
+*	   * entry_distance - distance from the vector to the entry, updated with the result
+*	   * layer - layer of the graph
+*
+* ====================================================================================== */
+static int greedy_search(hnsw_index *hnsw, hnsw_context *context, const double *vector, int entry, double *entry_distance, int layer)
+{
+	int changed = TRUE;
+	while (changed)
+	{
+		changed = FALSE;
+
+		int num_links = copy_links(hnsw, entry, layer, context->links), i;
+		for (i = 0; i < num_links; i++)
+		{
+			double distance = node_distance(hnsw, vector, context->links[i]);
+			if (distance < *entry_distance)
+			{
+				*entry_distance = distance;
+				entry = context->links[i];
+				changed = TRUE;
+			}
+		}
+	}
+
+	return entry;
+}
+
+/* ======================================================================================
+*
+* search_layer: best-first search of the ef nodes of a layer closest to a vector. Writes
+*				them in found, sorted by distance, and returns their number
+*
+*      * hnsw - graph
+*	   * context - memory of the thread
+*	   * vector - vector searched
+*	   * entry - node where the search starts
+*	   * entry_distance - distance from the vector to the entry
+*	   * ef - number of nodes kept
+*	   * layer - layer of the graph
+*	   * found - output array with room for ef nodes
+*
+* ====================================================================================== */
+static long search_layer(hnsw_index *hnsw, hnsw_context *context, const double *vector, int entry, double entry_distance,
+	int ef, int layer, hnsw_candidate *found)
+{
+	/* a new tag marks the nodes visited by this search */
+	if (++context->tag == 0)
+	{
+		memset(context->visited, 0, sizeof(unsigned int)*hnsw->num_nodes);
+		context->tag = 1;
+	}
+
+	hnsw_heap *candidates = &context->candidates, *results = &context->results;
+	candidates->size = 0;
+	results->size = 0;
+
+	context->visited[entry] = context->tag;
+	heap_push(candidates, entry_distance, entry);
+	heap_push(results, entry_distance, entry);
+
+	while (candidates->size > 0)
+	{
+		hnsw_candidate closest = heap_pop(candidates);
+
+		/* every node left is farther than the ef nodes found */
+		if (results->size >= ef && closest.distance > results->items[0].distance)
+			break;
+
+		int num_links = copy_links(hnsw, closest.node, layer, context->links), i;
+		for (i = 0; i < num_links; i++)
+		{
+			int node = context->links[i];
+			if (context->visited[node] == context->tag)
+				continue;
+			context->visited[node] = context->tag;
+
+			double distance = node_distance(hnsw, vector, node);
+			if (results->size < ef || distance < results->items[0].distance)
+			{
+				heap_push(candidates, distance, node);
+				heap_push(results, distance, node);
+
+				if (results->size > ef)
+					heap_pop(results);
+			}
+		}
+	}
+
+	/* the farthest node is popped first */
+	long num_found = results->size, j;
+	for (j = num_found - 1; j >= 0; j--)
+		found[j] = heap_pop(results);
+
+	return num_found;
+}
+
+/* ======================================================================================
+*
+* select_neighbours: chooses the links of a node among candidates sorted by distance. A
+*				candidate is kept only if it is closer to the node than to every candidate
+*				already kept, so that the links point in different directions
+*
+*      * hnsw - graph
+*	   * sorted - candidates sorted by their distance to the node
+*	   * num_candidates - number of candidates
+*	   * max_links - maximum number of links
+*	   * exclude - node that must not be linked, the node itself
+*	   * selected - output array with room for max_links nodes
+*
+* ====================================================================================== */
+static int select_neighbours(hnsw_index *hnsw, const hnsw_candidate *sorted, long num_candidates, int max_links, int exclude, int *selected)
+{
+	int num_selected = 0, j;
+	long i;
+
+	for (i = 0; i < num_candidates && num_selected < max_links; i++)
+	{
+		if (sorted[i].node == exclude)
+			continue;
+
+		const double *vector = &hnsw->vectors[(long)sorted[i].node*hnsw->dims];
+
+		int keep = TRUE;
+		for (j = 0; j < num_selected && keep; j++)
+			if (node_distance(hnsw, vector, selected[j]) < sorted[i].distance)
+				keep = FALSE;
+
+		if (keep)
+			selected[num_selected++] = sorted[i].node;
+	}
+
+	return num_selected;
+}
+
+/* ======================================================================================
+*
+* compare_candidates: orders candidates by distance
+*
+* ====================================================================================== */
+static int compare_candidates(const void *a, const void *b)
+{
+	double x = ((const hnsw_candidate *)a)->distance, y = ((const hnsw_candidate *)b)->distance;
+	return (x > y) - (x < y);
+}
+
+/* ======================================================================================
+*
+* connect_node: adds a link from target to node at a layer. When target already has the
+*				maximum number of links, its links are chosen again among the old ones and
+*				the new node
+*
+* ====================================================================================== */
+static void connect_node(hnsw_index *hnsw, int target, int node, int layer)
+{
+	int max_links = (layer == 0) ? HNSW_M0 : HNSW_M;
+
+	EnterCriticalSection(&hnsw->locks[target]);
+
+	int *links = node_links(hnsw, target, layer);
+	if (links[0] < max_links)
+		links[1 + links[0]++] = node;
+	else
+	{
+		const double *vector = &hnsw->vectors[(long)target*hnsw->dims];
+		hnsw_candidate candidates[HNSW_M0 + 1];
+
+		int i;
+		for (i = 0; i < links[0]; i++)
+		{
+			candidates[i].node = links[1 + i];
+			candidates[i].distance = node_distance(hnsw, vector, links[1 + i]);
+		}
+		candidates[i].node = node;
+		candidates[i].distance = node_distance(hnsw, vector, node);
+
+		qsort(candidates, links[0] + 1, sizeof(hnsw_candidate), compare_candidates);
+		links[0] = select_neighbours(hnsw, candidates, links[0] + 1, max_links, target, links + 1);
+	}
+
+	LeaveCriticalSection(&hnsw->locks[target]);
+}
+
+/* ======================================================================================
+*
+* insert_node: links a node to the graph. The entry point stays locked while a node with a
+*				higher layer than the entry point is inserted, since it becomes the new entry
+*
+*      * hnsw - graph being built
+*	   * context - memory of the thread
+*	   * node - node to insert
+*	   * found - buffer with room for HNSW_EF_CONSTRUCTION nodes
+*
+* ====================================================================================== */
+static void insert_node(hnsw_index *hnsw, hnsw_context *context, int node, hnsw_candidate *found)
+{
+	const double *vector = &hnsw->vectors[(long)node*hnsw->dims];
+	int layer = hnsw->node_layers[node];
+
+	EnterCriticalSection(&hnsw->entry_lock);
+
+	int entry = hnsw->entry_point, max_layer = hnsw->max_layer;
+	int new_entry = (layer > max_layer);
+
+	if (!new_entry)
+		LeaveCriticalSection(&hnsw->entry_lock);
+
+	if (entry >= 0)
+	{
+		double entry_distance = node_distance(hnsw, vector, entry);
+
+		int current;
+		for (current = max_layer; current > layer; current--)
+			entry = greedy_search(hnsw, context, vector, entry, &entry_distance, current);
+
+		int selected[HNSW_M0];
+		for (current = (layer < max_layer) ? layer : max_layer; current >= 0; current--)
+		{
+			long num_found = search_layer(hnsw, context, vector, entry, entry_distance, HNSW_EF_CONSTRUCTION, current, found);
+			int num_selected = select_neighbours(hnsw, found, num_found, HNSW_M, node, selected), i;
+
+			EnterCriticalSection(&hnsw->locks[node]);
+			int *links = node_links(hnsw, node, current);
+			links[0] = num_selected;
+			memcpy(links + 1, selected, sizeof(int)*num_selected);
+			LeaveCriticalSection(&hnsw->locks[node]);
+
+			for (i = 0; i < num_selected; i++)
+				connect_node(hnsw, selected[i], node, current);
+
+			entry = found[0].node;
+			entry_distance = found[0].distance;
+		}
+	}
+
+	if (new_entry)
+	{
+		hnsw->entry_point = node;
+		hnsw->max_layer = layer;
+		LeaveCriticalSection(&hnsw->entry_lock);
+	}
+}
+
+/* ======================================================================================
+*
+* build_worker: thread that inserts nodes until every node is in the graph
+*
+* ====================================================================================== */
+static DWORD WINAPI build_worker(LPVOID parameter)
+{
+	hnsw_build_task *task = (hnsw_build_task *)parameter;
+	hnsw_index *hnsw = task->hnsw;
+
+	hnsw_context context;
+	context_init(&context, hnsw->num_nodes);
+	hnsw_candidate *found = (hnsw_candidate *)malloc(sizeof(hnsw_candidate)*HNSW_EF_CONSTRUCTION);
+
+	LONG node;
+	while ((node = InterlockedIncrement(&task->next_node) - 1) < hnsw->num_nodes)
+		insert_node(hnsw, &context, (int)node, found);
+
+	free(found);
+	context_free(&context);
+
+	return 0;
+}
+
+/* ======================================================================================
+*
+* hnsw_index_alloc: allocates an empty graph over a level
+*
+*      * level - level of the index, from 0 to NUM_PROJECTIONS
+*	   * dims - dimension of the level
+*
+* ====================================================================================== */
+hnsw_index *hnsw_index_alloc(int level, int dims)
+{
+	hnsw_index *hnsw = (hnsw_index *)calloc(1, sizeof(hnsw_index));
+
+	hnsw->level = level;
+	hnsw->dims = dims;
+	hnsw->entry_point = -1;
+	hnsw->max_layer = -1;
+
+	return hnsw;
+}
+
+/* ======================================================================================
+*
+* hnsw_index_free: deallocates a graph
+*
+*      * hnsw - the graph to deallocate
+*
+* ====================================================================================== */
+void hnsw_index_free(hnsw_index *hnsw)
+{
+	if (hnsw == NULL)
+		return;
+
+	long node;
+	if (hnsw->upper_links != NULL)
+		for (node = 0; node < hnsw->num_nodes; node++)
+			free(hnsw->upper_links[node]);
+
+	free(hnsw->upper_links);
+	free(hnsw->links0);
+	free(hnsw->node_layers);
+	free(hnsw->vectors);
+	free(hnsw);
+}
+
+/* ======================================================================================
+*
+* hnsw_index_add_vectors: appends the next chunk of vectors of the level. The chunks must be
+*				added in the order of their IDs, which is the order in which they are
+*				inserted in the database
+*
+*      * hnsw - graph being built
+*	   * data - chunk of vectors, one per row
+*	   * num_rows - number of vectors of the chunk
+*
+* ====================================================================================== */
+void hnsw_index_add_vectors(hnsw_index *hnsw, gsl_matrix *data, long num_rows)
+{
+	if (hnsw->num_nodes + num_rows > hnsw->capacity)
+	{
+		while (hnsw->num_nodes + num_rows > hnsw->capacity)
+			hnsw->capacity = (hnsw->capacity == 0) ? CHUNK_SIZE : 2 * hnsw->capacity;
+
+		hnsw->vectors = (double *)realloc(hnsw->vectors, sizeof(double)*hnsw->capacity*hnsw->dims);
+	}
+
+	long row;
+	int i;
+	for (row = 0; row < num_rows; row++)
+		for (i = 0; i < hnsw->dims; i++)
+			hnsw->vectors[(hnsw->num_nodes + row)*hnsw->dims + i] = gsl_matrix_get(data, row, i);
+
+	hnsw->num_nodes += num_rows;
+}
+
+/* ======================================================================================
+*
+* hnsw_index_build: links every vector of the graph. The top layer of each node is drawn with
+*				probability decreasing by a factor of HNSW_M per layer, then the nodes are
+*				inserted by num_threads threads
+*
+*      * hnsw - graph being built
+*	   * num_threads - number of threads, 0 for one per processor
+*
+* ====================================================================================== */
+void hnsw_index_build(hnsw_index *hnsw, int num_threads)
+{
+	long node;
+
+	if (hnsw->num_nodes == 0)
+		return;
+
+	/* the plan is shared by the threads, so it is built before they start */
+	get_projection_plan();
+
+	double layer_factor = 1.0 / log((double)HNSW_M);
+
+	hnsw->node_layers = (int *)malloc(sizeof(int)*hnsw->num_nodes);
+	hnsw->upper_links = (int **)calloc(hnsw->num_nodes, sizeof(int *));
+	hnsw->links0 = (int *)calloc(hnsw->num_nodes*(HNSW_M0 + 1), sizeof(int));
+	hnsw->locks = (CRITICAL_SECTION *)malloc(sizeof(CRITICAL_SECTION)*hnsw->num_nodes);
+
+	for (node = 0; node < hnsw->num_nodes; node++)
+	{
+		/* uniform value in (0, 1] */
+		double uniform = ((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+		int layer = (int)(-log(uniform) * layer_factor);
+
+		hnsw->node_layers[node] = (layer < HNSW_MAX_LAYERS) ? layer : HNSW_MAX_LAYERS - 1;
+		if (hnsw->node_layers[node] > 0)
+			hnsw->upper_links[node] = (int *)calloc(hnsw->node_layers[node] * (HNSW_M + 1), sizeof(int));
+
+		InitializeCriticalSection(&hnsw->locks[node]);
+	}
+	InitializeCriticalSection(&hnsw->entry_lock);
+
+	if (num_threads <= 0)
+	{
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		num_threads = (int)system_info.dwNumberOfProcessors;
+	}
+
+	/* WaitForMultipleObjects waits for at most 64 threads */
+	if (num_threads > 64) num_threads = 64;
+	if (num_threads < 1) num_threads = 1;
+
+	hnsw_build_task task;
+	task.hnsw = hnsw;
+	task.next_node = 0;
+
+	HANDLE *threads = (HANDLE *)malloc(sizeof(HANDLE)*num_threads);
+	int t;
+	for (t = 0; t < num_threads; t++)
+		threads[t] = CreateThread(NULL, 0, build_worker, &task, 0, NULL);
+
+	WaitForMultipleObjects(num_threads, threads, TRUE, INFINITE);
+
+	for (t = 0; t < num_threads; t++)
+		CloseHandle(threads[t]);
+	free(threads);
+
+	for (node = 0; node < hnsw->num_nodes; node++)
+		DeleteCriticalSection(&hnsw->locks[node]);
+	DeleteCriticalSection(&hnsw->entry_lock);
+
+	free(hnsw->locks);
+	hnsw->locks = NULL;
+
+	if (DEBUG_OPTION > 0)
+		printf("\nGraph over level %d: %ld nodes, %d layers, built with %d threads\n",
+			hnsw->level, hnsw->num_nodes, hnsw->max_layer + 1, num_threads);
+}
+
+/* ======================================================================================
+*
+* build_hnsw_path: returns the path of the graph file of the dataset
+*
+* ====================================================================================== */
+static char *build_hnsw_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.hnsw", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* hnsw_index_write: saves the graph next to the dataset
+*
+*      * hnsw - built graph
+*
+* ====================================================================================== */
+void hnsw_index_write(hnsw_index *hnsw)
+{
+	char *path = build_hnsw_path();
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		printf("[ERROR] Unable to write the graph to %s\n", path);
+		free(path);
+		return;
+	}
+
+	int magic = HNSW_MAGIC;
+	long node;
+	fwrite(&magic, sizeof(int), 1, file);
+	fwrite(&hnsw->level, sizeof(int), 1, file);
+	fwrite(&hnsw->dims, sizeof(int), 1, file);
+	fwrite(&hnsw->num_nodes, sizeof(long), 1, file);
+	fwrite(&hnsw->entry_point, sizeof(int), 1, file);
+	fwrite(&hnsw->max_layer, sizeof(int), 1, file);
+	fwrite(hnsw->node_layers, sizeof(int), hnsw->num_nodes, file);
+	fwrite(hnsw->links0, sizeof(int), hnsw->num_nodes*(HNSW_M0 + 1), file);
+
+	for (node = 0; node < hnsw->num_nodes; node++)
+		if (hnsw->node_layers[node] > 0)
+			fwrite(hnsw->upper_links[node], sizeof(int), hnsw->node_layers[node] * (HNSW_M + 1), file);
+
+	fwrite(hnsw->vectors, sizeof(double), hnsw->num_nodes*hnsw->dims, file);
+
+	fclose(file);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* hnsw_index_read: reads the graph of the dataset, or returns NULL if the file does not exist
+*				or does not match the levels of the index
+*
+* ====================================================================================== */
+static hnsw_index *hnsw_index_read()
+{
+	char *path = build_hnsw_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, level = -1, dims = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != HNSW_MAGIC
+		|| fread(&level, sizeof(int), 1, file) != 1 || level < 0 || level > NUM_PROJECTIONS
+		|| fread(&dims, sizeof(int), 1, file) != 1 || dims != get_projection_plan()->dims[level])
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	hnsw_index *hnsw = hnsw_index_alloc(level, dims);
+
+	int valid = fread(&hnsw->num_nodes, sizeof(long), 1, file) == 1
+		&& fread(&hnsw->entry_point, sizeof(int), 1, file) == 1
+		&& fread(&hnsw->max_layer, sizeof(int), 1, file) == 1
+		&& hnsw->num_nodes > 0;
+
+	if (valid)
+	{
+		size_t num_links0 = (size_t)hnsw->num_nodes*(HNSW_M0 + 1);
+		size_t num_values = (size_t)hnsw->num_nodes*dims;
+
+		hnsw->node_layers = (int *)malloc(sizeof(int)*hnsw->num_nodes);
+		hnsw->upper_links = (int **)calloc(hnsw->num_nodes, sizeof(int *));
+		hnsw->links0 = (int *)malloc(sizeof(int)*num_links0);
+		hnsw->vectors = (double *)malloc(sizeof(double)*num_values);
+		hnsw->capacity = hnsw->num_nodes;
+
+		valid = fread(hnsw->node_layers, sizeof(int), hnsw->num_nodes, file) == (size_t)hnsw->num_nodes
+			&& fread(hnsw->links0, sizeof(int), num_links0, file) == num_links0;
+
+		long node;
+		for (node = 0; node < hnsw->num_nodes && valid; node++)
+		{
+			int layers = hnsw->node_layers[node];
+			if (layers <= 0)
+				continue;
+
+			hnsw->upper_links[node] = (int *)malloc(sizeof(int)*layers*(HNSW_M + 1));
+			valid = fread(hnsw->upper_links[node], sizeof(int), layers*(HNSW_M + 1), file) == (size_t)(layers*(HNSW_M + 1));
+		}
+
+		valid = valid && fread(hnsw->vectors, sizeof(double), num_values, file) == num_values;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		hnsw_index_free(hnsw);
+		return NULL;
+	}
+
+	return hnsw;
+}
+
+/* ======================================================================================
+*
+* get_hnsw_index: returns the graph of the current index, read from the file the first time
+*				it is needed. Returns NULL if the index has no graph
+*
+* ====================================================================================== */
+hnsw_index *get_hnsw_index()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the graph was read */
+	if (checked_version != INDEX_VERSION)
+	{
+		hnsw_index_free(HNSW_INDEX);
+		HNSW_INDEX = hnsw_index_read();
+		checked_version = INDEX_VERSION;
+	}
+
+	return HNSW_INDEX;
+}
+
+/* ======================================================================================
+*
+* hnsw_index_search: writes in results the ef vectors of the level closest to the query found
+*				in the graph, sorted by their distance at the level, and returns their number.
+*				The search walks greedily down the upper layers and explores the bottom layer
+*				keeping the ef closest nodes
+*
+*      * hnsw - graph of the index
+*	   * query_vec - projection of the query at the level of the graph
+*	   * ef - number of vectors kept during the search
+*	   * results - output array with room for ef matches
+*
+* ====================================================================================== */
+long hnsw_index_search(hnsw_index *hnsw, const double *query_vec, int ef, query_match *results)
+{
+	if (hnsw->entry_point < 0)
+		return 0;
+
+	hnsw_context context;
+	context_init(&context, hnsw->num_nodes);
+
+	int entry = hnsw->entry_point, layer;
+	double entry_distance = node_distance(hnsw, query_vec, entry);
+
+	for (layer = hnsw->max_layer; layer > 0; layer--)
+		entry = greedy_search(hnsw, &context, query_vec, entry, &entry_distance, layer);
+
+	hnsw_candidate *found = (hnsw_candidate *)malloc(sizeof(hnsw_candidate)*ef);
+	long num_found = search_layer(hnsw, &context, query_vec, entry, entry_distance, ef, 0, found), j;
+
+	for (j = 0; j < num_found; j++)
+	{
+		results[j].id = found[j].node + 1;
+		results[j].distance = found[j].distance;
+	}
+
+	free(found);
+	context_free(&context);
+
+	return num_found;
+}
@@ -0,0 +1,424 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* id_order.cpp
+* This file contains the implementation of the locality preserving order of the IDs. The key
+* of a vector interleaves the bits of its coordinates at the lowest level, quantized over the
+* range of each coordinate. For the Hilbert curve, the coordinates are first transformed with
+* the algorithm of Skilling (Programming the Hilbert curve, 2004), so that consecutive keys
+* are always neighbouring cells.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "id_order.hpp"
+#include "projection.hpp"
+#include "query.hpp"
+
+/* permutation of the current index, read by the first query */
+static id_permutation *ID_PERMUTATION = NULL;
+
+/* a vector and its position on the curve */
+typedef struct
+{
+	unsigned long long key;
+	long long id;
+} curve_entry;
+
+/* ======================================================================================
+*
+* compare_curve_entries: orders vectors by their key, and by ID for equal keys
+*
+* ====================================================================================== */
+static int compare_curve_entries(const void *a, const void *b)
+{
+	const curve_entry *x = (const curve_entry *)a, *y = (const curve_entry *)b;
+
+	if (x->key != y->key)
+		return (x->key > y->key) ? 1 : -1;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/* ======================================================================================
+*
+* hilbert_transpose: converts the coordinates of a cell into the transposed form of its
+*				Hilbert index, in place
+*
+*      * x - coordinates of the cell, each with bits bits
+*	   * bits - number of bits of each coordinate
+*	   * dims - number of coordinates
+*
+* ====================================================================================== */
+static void hilbert_transpose(unsigned int *x, int bits, int dims)
+{
+	unsigned int top = 1U << (bits - 1), q, p, t;
+	int i;
+
+	/* inverse undo */
+	for (q = top; q > 1; q >>= 1)
+	{
+		p = q - 1;
+		for (i = 0; i < dims; i++)
+		{
+			if (x[i] & q)
+				x[0] ^= p;
+			else
+			{
+				t = (x[0] ^ x[i]) & p;
+				x[0] ^= t;
+				x[i] ^= t;
+			}
+		}
+	}
+
+	/* Gray encode */
+	for (i = 1; i < dims; i++)
+		x[i] ^= x[i - 1];
+
+	t = 0;
+	for (q = top; q > 1; q >>= 1)
+		if (x[dims - 1] & q)
+			t ^= q - 1;
+
+	for (i = 0; i < dims; i++)
+		x[i] ^= t;
+}
+
+/* ======================================================================================
+*
+* interleave_bits: returns the key made of the most significant bit of every coordinate,
+*				followed by the next bit of every coordinate, and so on
+*
+*      * x - coordinates of the cell, each with bits bits
+*	   * bits - number of bits of each coordinate
+*	   * dims - number of coordinates
+*
+* ====================================================================================== */
+static unsigned long long interleave_bits(const unsigned int *x, int bits, int dims)
+{
+	unsigned long long key = 0;
+	int bit, i;
+
+	for (bit = bits - 1; bit >= 0; bit--)
+		for (i = 0; i < dims; i++)
+			key = (key << 1) | ((x[i] >> bit) & 1);
+
+	return key;
+}
+
+/* ======================================================================================
+*
+* build_bare_name: returns the name of a table of the original data without the schema and
+*				the brackets, followed by a suffix
+*
+* ====================================================================================== */
+static char *build_bare_name(const char *suffix)
+{
+	char *name = (char *)malloc(sizeof(char)*(50 + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE) + strlen(suffix)));
+	sprintf(name, "%s_%d_%s%s", DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE, suffix);
+
+	return name;
+}
+
+/* ======================================================================================
+*
+* build_permutation_path: returns the path of the permutation file of the dataset
+*
+* ====================================================================================== */
+static char *build_permutation_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.perm", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* compute_curve_order: reads the original data, projects every vector to the lowest level and
+*				returns the vectors sorted by their position on the curve
+*
+*      * hdbc - an opened SQL connection
+*	   * curve - ID_ORDER_MORTON or ID_ORDER_HILBERT
+*	   * num_vectors - output number of vectors
+*
+* ====================================================================================== */
+static curve_entry *compute_curve_order(HDBC hdbc, int curve, long *num_vectors)
+{
+	projection_plan *plan = get_projection_plan();
+	int lowest_dims = plan->dims[NUM_PROJECTIONS], i;
+
+	/* the key holds 64 bits, so at most 64 coordinates take part in it */
+	int key_dims = (lowest_dims < 64) ? lowest_dims : 64;
+	int bits = 64 / key_dims;
+	if (bits > ID_ORDER_MAX_BITS) bits = ID_ORDER_MAX_BITS;
+
+	/* coordinates of every vector at the lowest level */
+	int chunks_to_read = compute_num_chunks(), chunk_indx;
+	long capacity = CHUNK_SIZE, count = 0, row;
+	double *coordinates = (double *)malloc(sizeof(double)*capacity*key_dims);
+
+	double *min = (double *)malloc(sizeof(double)*key_dims);
+	double *max = (double *)malloc(sizeof(double)*key_dims);
+	for (i = 0; i < key_dims; i++)
+	{
+		min[i] = GSL_POSINF;
+		max[i] = GSL_NEGINF;
+	}
+
+	double *vector = (double *)malloc(sizeof(double)*TOTAL_DIMENSIONS);
+
+	for (chunk_indx = 0; chunk_indx < chunks_to_read; chunk_indx++)
+	{
+		long remaining_vecs = compute_num_vecs_to_load(chunk_indx, chunks_to_read);
+		gsl_matrix *database_matrix = load_data_chunk(hdbc, chunk_indx, chunks_to_read, remaining_vecs, TOTAL_DIMENSIONS);
+
+		if (count + remaining_vecs > capacity)
+		{
+			while (count + remaining_vecs > capacity)
+				capacity *= 2;
+			coordinates = (double *)realloc(coordinates, sizeof(double)*capacity*key_dims);
+		}
+
+		for (row = 0; row < remaining_vecs; row++, count++)
+		{
+			for (i = 0; i < TOTAL_DIMENSIONS; i++)
+				vector[i] = gsl_matrix_get(database_matrix, row, i);
+
+			const double *lowest = projection_plan_project(plan, vector) + plan->offsets[NUM_PROJECTIONS];
+
+			for (i = 0; i < key_dims; i++)
+			{
+				coordinates[count*key_dims + i] = lowest[i];
+				if (lowest[i] < min[i]) min[i] = lowest[i];
+				if (lowest[i] > max[i]) max[i] = lowest[i];
+			}
+		}
+
+		gsl_matrix_free(database_matrix);
+	}
+
+	/* quantize every coordinate over its range and compute the keys */
+	curve_entry *entries = (curve_entry *)malloc(sizeof(curve_entry)*(count + 1));
+	unsigned int *cell = (unsigned int *)malloc(sizeof(unsigned int)*key_dims);
+	unsigned int max_cell = (1U << bits) - 1;
+
+	for (row = 0; row < count; row++)
+	{
+		for (i = 0; i < key_dims; i++)
+		{
+			double range = max[i] - min[i];
+			cell[i] = (range > 0) ? (unsigned int)((coordinates[row*key_dims + i] - min[i]) / range * max_cell + 0.5) : 0;
+		}
+
+		if (curve == ID_ORDER_HILBERT && bits > 1)
+			hilbert_transpose(cell, bits, key_dims);
+
+		entries[row].key = interleave_bits(cell, bits, key_dims);
+		entries[row].id = row + 1;
+	}
+
+	qsort(entries, count, sizeof(curve_entry), compare_curve_entries);
+
+	free(cell);
+	free(vector);
+	free(min);
+	free(max);
+	free(coordinates);
+
+	*num_vectors = count;
+	return entries;
+}
+
+/* ======================================================================================
+*
+* reorder_database: sorts the original data along a curve of the lowest level and stores it
+*				in that order. The permutation is written to a file and loaded into a table,
+*				the original data is copied in the new order into a new table with a fresh
+*				ID column, and the new table replaces the old one
+*
+*      * hdbc - an opened SQL connection
+*	   * curve - ID_ORDER_LOAD, ID_ORDER_MORTON or ID_ORDER_HILBERT
+*
+* ====================================================================================== */
+void reorder_database(HDBC hdbc, int curve)
+{
+	char *permutation_path = build_permutation_path();
+
+	/* IDs of a previous index are no longer valid */
+	remove(permutation_path);
+
+	if (curve == ID_ORDER_LOAD)
+	{
+		free(permutation_path);
+		return;
+	}
+
+	long num_vectors, j;
+	curve_entry *entries = compute_curve_order(hdbc, curve, &num_vectors);
+
+	/* file loaded into the permutation table: NEW_ID ORIGINAL_ID */
+	char *text_path = (char *)malloc(sizeof(char)*(strlen(permutation_path) + 10));
+	sprintf(text_path, "%s.txt", permutation_path);
+
+	FILE *text_file = fopen(text_path, "w");
+	FILE *permutation_file = fopen(permutation_path, "wb");
+
+	if (text_file == NULL || permutation_file == NULL)
+	{
+		printf("[ERROR] Unable to write the permutation of the IDs to %s\n", permutation_path);
+		if (text_file != NULL) fclose(text_file);
+		if (permutation_file != NULL) fclose(permutation_file);
+		remove(permutation_path);
+		free(text_path);
+		free(permutation_path);
+		free(entries);
+		return;
+	}
+
+	int magic = ID_ORDER_MAGIC;
+	fwrite(&magic, sizeof(int), 1, permutation_file);
+	fwrite(&num_vectors, sizeof(long), 1, permutation_file);
+
+	for (j = 0; j < num_vectors; j++)
+	{
+		fprintf(text_file, "%ld %lld\n", j + 1, entries[j].id);
+		fwrite(&entries[j].id, sizeof(long long), 1, permutation_file);
+	}
+
+	fclose(text_file);
+	fclose(permutation_file);
+	free(entries);
+
+	char *table_name = build_bare_name("");
+	char *ordered_name = build_bare_name("_ORDERED");
+	char *permutation_name = build_bare_name("_PERM");
+
+	char *table = (char *)malloc(sizeof(char)*(20 + strlen(ordered_name)));
+	char *ordered_table = (char *)malloc(sizeof(char)*(20 + strlen(ordered_name)));
+	char *permutation_table = (char *)malloc(sizeof(char)*(20 + strlen(permutation_name)));
+	sprintf(table, "[dbo].[%s]", table_name);
+	sprintf(ordered_table, "[dbo].[%s]", ordered_name);
+	sprintf(permutation_table, "[dbo].[%s]", permutation_name);
+
+	printf("\n\nReordering table %s along a %s curve\n\n", table, (curve == ID_ORDER_HILBERT) ? "Hilbert" : "Z-order");
+
+	/* the tables left by a previous index are replaced */
+	sql_execute_statement(hdbc, build_query_to_drop_table(permutation_table), "reorder_database");
+	sql_execute_statement(hdbc, build_query_to_drop_table(ordered_table), "reorder_database");
+
+	sql_execute_statement(hdbc, build_query_to_create_permutation_table(permutation_table), "reorder_database");
+	sql_execute_statement(hdbc, build_query_to_import_file(permutation_table, text_path), "reorder_database");
+
+	/* copy the original data in the new order and replace the original table */
+	sql_execute_statement(hdbc, build_query_to_create_ordered_table(ordered_table, TOTAL_DIMENSIONS), "reorder_database");
+	sql_execute_statement(hdbc, build_query_to_copy_in_order(table, ordered_table, permutation_table, TOTAL_DIMENSIONS), "reorder_database");
+	sql_execute_statement(hdbc, build_query_to_drop_table(table), "reorder_database");
+	sql_execute_statement(hdbc, build_query_to_rename_table(ordered_name, table_name), "reorder_database");
+
+	remove(text_path);
+
+	/* results computed before this point are no longer valid */
+	INDEX_VERSION++;
+
+	free(permutation_table);
+	free(ordered_table);
+	free(table);
+	free(permutation_name);
+	free(ordered_name);
+	free(table_name);
+	free(text_path);
+	free(permutation_path);
+}
+
+/* ======================================================================================
+*
+* id_permutation_read: reads the permutation of the dataset, or returns NULL if the file does
+*				not exist
+*
+* ====================================================================================== */
+static id_permutation *id_permutation_read()
+{
+	char *path = build_permutation_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0;
+	long num_ids = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != ID_ORDER_MAGIC
+		|| fread(&num_ids, sizeof(long), 1, file) != 1 || num_ids <= 0)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	id_permutation *permutation = (id_permutation *)malloc(sizeof(id_permutation));
+	permutation->num_ids = num_ids;
+	permutation->original_ids = (long long *)malloc(sizeof(long long)*num_ids);
+
+	int valid = fread(permutation->original_ids, sizeof(long long), num_ids, file) == (size_t)num_ids;
+	fclose(file);
+
+	if (!valid)
+	{
+		free(permutation->original_ids);
+		free(permutation);
+		return NULL;
+	}
+
+	return permutation;
+}
+
+/* ======================================================================================
+*
+* get_id_permutation: returns the permutation of the IDs of the current index, read from the
+*				file the first time it is needed. Returns NULL if the IDs were not reordered
+*
+* ====================================================================================== */
+id_permutation *get_id_permutation()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the permutation was read */
+	if (checked_version != INDEX_VERSION)
+	{
+		if (ID_PERMUTATION != NULL)
+		{
+			free(ID_PERMUTATION->original_ids);
+			free(ID_PERMUTATION);
+		}
+
+		ID_PERMUTATION = (BILLION_DATASET == 0) ? id_permutation_read() : NULL;
+		checked_version = INDEX_VERSION;
+	}
+
+	return ID_PERMUTATION;
+}
+
+/* ======================================================================================
+*
+* map_to_original_id: returns the original ID of a vector of the index
+*
+*      * id - ID of the vector in the tables of the index
+*
+* ====================================================================================== */
+long long map_to_original_id(long long id)
+{
+	id_permutation *permutation = get_id_permutation();
+
+	if (permutation == NULL || id < 1 || id > permutation->num_ids)
+		return id;
+
+	return permutation->original_ids[id - 1];
+}
@@ -0,0 +1,1031 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* id_set.cpp
+* This file contains the implementation of the compressed set of vector IDs. Sparse containers
+* are sorted arrays of 16 bit values and dense containers are 8KB bitmaps. Operations between
+* bitmaps are performed 128 bits at a time with SSE2 instructions.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "id_set.hpp"
+
+#include <emmintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* ======================================================================================
+*
+* popcount64: returns the number of bits set in a 64 bit word
+*
+*      * word - a 64 bit word
+*
+* ====================================================================================== */
+static int popcount64(unsigned long long word)
+{
+#ifdef _MSC_VER
+	return __popcnt((unsigned int)word) + __popcnt((unsigned int)(word >> 32));
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+/* ======================================================================================
+*
+* trailing_zeros64: returns the index of the lowest bit set of a non zero 64 bit word
+*
+*      * word - a 64 bit word different from zero
+*
+* ====================================================================================== */
+static int trailing_zeros64(unsigned long long word)
+{
+#ifdef _MSC_VER
+	unsigned long indx;
+	if (_BitScanForward(&indx, (unsigned long)word))
+		return (int)indx;
+
+	_BitScanForward(&indx, (unsigned long)(word >> 32));
+	return (int)indx + 32;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+/* ======================================================================================
+*
+* container_init_array: initializes an empty array container
+*
+*      * container - the container to initialize
+*	   * key - high bits shared by the IDs of the container
+*	   * capacity - initial number of entries of the array
+*
+* ====================================================================================== */
+static void container_init_array(id_container *container, long long key, int capacity)
+{
+	if (capacity < 4)
+		capacity = 4;
+
+	container->key = key;
+	container->cardinality = 0;
+	container->capacity = capacity;
+	container->array = (unsigned short *)malloc(sizeof(unsigned short)*capacity);
+	container->bitmap = NULL;
+}
+
+/* ======================================================================================
+*
+* container_init_bitmap: initializes an empty bitmap container
+*
+*      * container - the container to initialize
+*	   * key - high bits shared by the IDs of the container
+*
+* ====================================================================================== */
+static void container_init_bitmap(id_container *container, long long key)
+{
+	container->key = key;
+	container->cardinality = 0;
+	container->capacity = 0;
+	container->array = NULL;
+	container->bitmap = (unsigned long long *)calloc(ID_SET_BITMAP_WORDS, sizeof(unsigned long long));
+}
+
+/* ======================================================================================
+*
+* container_free: deallocates the memory of a container
+*
+*      * container - the container to deallocate
+*
+* ====================================================================================== */
+static void container_free(id_container *container)
+{
+	free(container->array);
+	free(container->bitmap);
+
+	container->array = NULL;
+	container->bitmap = NULL;
+}
+
+/* ======================================================================================
+*
+* container_array_to_bitmap: converts an array container into a bitmap container
+*
+*      * container - an array container
+*
+* ====================================================================================== */
+static void container_array_to_bitmap(id_container *container)
+{
+	unsigned long long *bitmap = (unsigned long long *)calloc(ID_SET_BITMAP_WORDS, sizeof(unsigned long long));
+
+	int i;
+	for (i = 0; i < container->cardinality; i++)
+		bitmap[container->array[i] >> 6] |= 1ULL << (container->array[i] & 63);
+
+	free(container->array);
+	container->array = NULL;
+	container->capacity = 0;
+	container->bitmap = bitmap;
+}
+
+/* ======================================================================================
+*
+* container_bitmap_to_array: converts a bitmap container with few IDs into an array container
+*
+*      * container - a bitmap container
+*
+* ====================================================================================== */
+static void container_bitmap_to_array(id_container *container)
+{
+	unsigned short *array = (unsigned short *)malloc(sizeof(unsigned short)*(container->cardinality + 1));
+
+	int w, n = 0;
+	for (w = 0; w < ID_SET_BITMAP_WORDS; w++)
+	{
+		unsigned long long word = container->bitmap[w];
+		while (word != 0)
+		{
+			array[n++] = (unsigned short)(w*64 + trailing_zeros64(word));
+			word &= word - 1;
+		}
+	}
+
+	free(container->bitmap);
+	container->bitmap = NULL;
+	container->array = array;
+	container->capacity = container->cardinality + 1;
+}
+
+/* ======================================================================================
+*
+* container_array_find: binary search of a low value in an array container. Returns the
+*				position of the value, or the position where it should be inserted
+*
+*      * container - an array container
+*	   * low - low 16 bits of the ID
+*
+* ====================================================================================== */
+static int container_array_find(const id_container *container, unsigned short low)
+{
+	int begin = 0, end = container->cardinality;
+	while (begin < end)
+	{
+		int middle = (begin + end) / 2;
+		if (container->array[middle] < low)
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+	return begin;
+}
+
+/* ======================================================================================
+*
+* container_add: inserts the low 16 bits of an ID in a container
+*
+*      * container - the container
+*	   * low - low 16 bits of the ID
+*
+* ====================================================================================== */
+static void container_add(id_container *container, unsigned short low)
+{
+	/* bitmap containers only need to set a bit */
+	if (container->bitmap != NULL)
+	{
+		unsigned long long mask = 1ULL << (low & 63);
+		if ((container->bitmap[low >> 6] & mask) == 0)
+		{
+			container->bitmap[low >> 6] |= mask;
+			container->cardinality++;
+		}
+		return;
+	}
+
+	/* appending at the end of the array is the common case for sorted input */
+	int pos;
+	if (container->cardinality == 0 || container->array[container->cardinality - 1] < low)
+		pos = container->cardinality;
+	else
+	{
+		pos = container_array_find(container, low);
+		if (container->array[pos] == low)
+			return;
+	}
+
+	/* a full array container becomes a bitmap */
+	if (container->cardinality == ID_SET_ARRAY_MAX)
+	{
+		container_array_to_bitmap(container);
+		container_add(container, low);
+		return;
+	}
+
+	if (container->cardinality == container->capacity)
+	{
+		container->capacity = (container->capacity * 2 > ID_SET_ARRAY_MAX) ? ID_SET_ARRAY_MAX : container->capacity * 2;
+		container->array = (unsigned short *)realloc(container->array, sizeof(unsigned short)*container->capacity);
+	}
+
+	memmove(container->array + pos + 1, container->array + pos, sizeof(unsigned short)*(container->cardinality - pos));
+	container->array[pos] = low;
+	container->cardinality++;
+}
+
+/* ======================================================================================
+*
+* container_contains: returns 1 if the low 16 bits belong to the container
+*
+*      * container - the container
+*	   * low - low 16 bits of the ID
+*
+* ====================================================================================== */
+static int container_contains(const id_container *container, unsigned short low)
+{
+	if (container->bitmap != NULL)
+		return (container->bitmap[low >> 6] >> (low & 63)) & 1;
+
+	int pos = container_array_find(container, low);
+	return pos < container->cardinality && container->array[pos] == low;
+}
+
+/* ======================================================================================
+*
+* container_copy: copies a container into an uninitialized container
+*
+*      * dest - uninitialized container
+*	   * src - container to be copied
+*
+* ====================================================================================== */
+static void container_copy(id_container *dest, const id_container *src)
+{
+	if (src->bitmap != NULL)
+	{
+		container_init_bitmap(dest, src->key);
+		memcpy(dest->bitmap, src->bitmap, sizeof(unsigned long long)*ID_SET_BITMAP_WORDS);
+	}
+	else
+	{
+		container_init_array(dest, src->key, src->cardinality);
+		memcpy(dest->array, src->array, sizeof(unsigned short)*src->cardinality);
+	}
+	dest->cardinality = src->cardinality;
+}
+
+/* ======================================================================================
+*
+* bitmap_and: computes dest = a AND b with SSE2 and returns the number of bits set
+*
+*      * dest - output bitmap
+*	   * a - first bitmap
+*	   * b - second bitmap
+*
+* ====================================================================================== */
+static int bitmap_and(unsigned long long *dest, const unsigned long long *a, const unsigned long long *b)
+{
+	int w, cardinality = 0;
+	for (w = 0; w < ID_SET_BITMAP_WORDS; w += 2)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + w));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + w));
+		_mm_storeu_si128((__m128i *)(dest + w), _mm_and_si128(va, vb));
+
+		cardinality += popcount64(dest[w]) + popcount64(dest[w + 1]);
+	}
+	return cardinality;
+}
+
+/* ======================================================================================
+*
+* bitmap_or: computes dest = a OR b with SSE2 and returns the number of bits set
+*
+*      * dest - output bitmap
+*	   * a - first bitmap
+*	   * b - second bitmap
+*
+* ====================================================================================== */
+static int bitmap_or(unsigned long long *dest, const unsigned long long *a, const unsigned long long *b)
+{
+	int w, cardinality = 0;
+	for (w = 0; w < ID_SET_BITMAP_WORDS; w += 2)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + w));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + w));
+		_mm_storeu_si128((__m128i *)(dest + w), _mm_or_si128(va, vb));
+
+		cardinality += popcount64(dest[w]) + popcount64(dest[w + 1]);
+	}
+	return cardinality;
+}
+
+/* ======================================================================================
+*
+* container_intersect: intersects two containers with the same key into an uninitialized
+*				container
+*
+*      * dest - uninitialized container
+*	   * a - first container
+*	   * b - second container
+*
+* ====================================================================================== */
+static void container_intersect(id_container *dest, const id_container *a, const id_container *b)
+{
+	/* bitmap AND bitmap */
+	if (a->bitmap != NULL && b->bitmap != NULL)
+	{
+		container_init_bitmap(dest, a->key);
+		dest->cardinality = bitmap_and(dest->bitmap, a->bitmap, b->bitmap);
+
+		if (dest->cardinality <= ID_SET_ARRAY_MAX)
+			container_bitmap_to_array(dest);
+		return;
+	}
+
+	/* array AND bitmap: probe the bitmap with every value of the array */
+	if (a->bitmap != NULL || b->bitmap != NULL)
+	{
+		const id_container *array = (a->bitmap == NULL) ? a : b;
+		const id_container *bitmap = (a->bitmap == NULL) ? b : a;
+
+		container_init_array(dest, a->key, array->cardinality);
+
+		int i;
+		for (i = 0; i < array->cardinality; i++)
+			if (container_contains(bitmap, array->array[i]))
+				dest->array[dest->cardinality++] = array->array[i];
+		return;
+	}
+
+	/* array AND array: merge, or binary search when one array is much smaller */
+	const id_container *small = (a->cardinality <= b->cardinality) ? a : b;
+	const id_container *large = (a->cardinality <= b->cardinality) ? b : a;
+
+	container_init_array(dest, a->key, small->cardinality);
+
+	int i = 0, j = 0;
+	if (small->cardinality * 64 < large->cardinality)
+	{
+		for (i = 0; i < small->cardinality; i++)
+			if (container_contains(large, small->array[i]))
+				dest->array[dest->cardinality++] = small->array[i];
+		return;
+	}
+
+	while (i < small->cardinality && j < large->cardinality)
+	{
+		if (small->array[i] < large->array[j])
+			i++;
+		else if (small->array[i] > large->array[j])
+			j++;
+		else
+		{
+			dest->array[dest->cardinality++] = small->array[i];
+			i++; j++;
+		}
+	}
+}
+
+/* ======================================================================================
+*
+* container_union: merges two containers with the same key into an uninitialized container
+*
+*      * dest - uninitialized container
+*	   * a - first container
+*	   * b - second container
+*
+* ====================================================================================== */
+static void container_union(id_container *dest, const id_container *a, const id_container *b)
+{
+	/* bitmap OR bitmap */
+	if (a->bitmap != NULL && b->bitmap != NULL)
+	{
+		container_init_bitmap(dest, a->key);
+		dest->cardinality = bitmap_or(dest->bitmap, a->bitmap, b->bitmap);
+		return;
+	}
+
+	/* array OR bitmap: copy the bitmap and set the bits of the array */
+	if (a->bitmap != NULL || b->bitmap != NULL)
+	{
+		const id_container *array = (a->bitmap == NULL) ? a : b;
+		const id_container *bitmap = (a->bitmap == NULL) ? b : a;
+
+		container_copy(dest, bitmap);
+
+		int i;
+		for (i = 0; i < array->cardinality; i++)
+			container_add(dest, array->array[i]);
+		return;
+	}
+
+	/* array OR array: merge both sorted arrays */
+	if (a->cardinality + b->cardinality > ID_SET_ARRAY_MAX)
+	{
+		container_copy(dest, a);
+		container_array_to_bitmap(dest);
+
+		int i;
+		for (i = 0; i < b->cardinality; i++)
+			container_add(dest, b->array[i]);
+
+		if (dest->cardinality <= ID_SET_ARRAY_MAX)
+			container_bitmap_to_array(dest);
+		return;
+	}
+
+	container_init_array(dest, a->key, a->cardinality + b->cardinality);
+
+	int i = 0, j = 0;
+	while (i < a->cardinality || j < b->cardinality)
+	{
+		if (j == b->cardinality || (i < a->cardinality && a->array[i] < b->array[j]))
+			dest->array[dest->cardinality++] = a->array[i++];
+		else if (i == a->cardinality || b->array[j] < a->array[i])
+			dest->array[dest->cardinality++] = b->array[j++];
+		else
+		{
+			dest->array[dest->cardinality++] = a->array[i];
+			i++; j++;
+		}
+	}
+}
+
+/* ======================================================================================
+*
+* id_set_append_container: reserves room for one more container at the end of the set and
+*				returns a pointer to it
+*
+*      * set - the set of IDs
+*
+* ====================================================================================== */
+static id_container *id_set_append_container(id_set *set)
+{
+	if (set->num_containers == set->capacity)
+	{
+		set->capacity = (set->capacity == 0) ? 4 : set->capacity * 2;
+		set->containers = (id_container *)realloc(set->containers, sizeof(id_container)*set->capacity);
+	}
+	return &set->containers[set->num_containers++];
+}
+
+/* ======================================================================================
+*
+* id_set_find_container: returns the position of the container with the given key, or the
+*				position where it should be inserted
+*
+*      * set - the set of IDs
+*	   * key - high bits of the ID
+*
+* ====================================================================================== */
+static int id_set_find_container(const id_set *set, long long key)
+{
+	int begin = 0, end = set->num_containers;
+	while (begin < end)
+	{
+		int middle = (begin + end) / 2;
+		if (set->containers[middle].key < key)
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+	return begin;
+}
+
+/* ======================================================================================
+*
+* id_set_alloc: allocates an empty set of IDs
+*
+* ====================================================================================== */
+id_set *id_set_alloc()
+{
+	id_set *set = (id_set *)malloc(sizeof(id_set));
+
+	set->containers = NULL;
+	set->num_containers = 0;
+	set->capacity = 0;
+
+	return set;
+}
+
+/* ======================================================================================
+*
+* id_set_free: deallocates a set of IDs and all of its containers
+*
+*      * set - the set to be deallocated
+*
+* ====================================================================================== */
+void id_set_free(id_set *set)
+{
+	if (set == NULL)
+		return;
+
+	int i;
+	for (i = 0; i < set->num_containers; i++)
+		container_free(&set->containers[i]);
+
+	free(set->containers);
+	free(set);
+}
+
+/* ======================================================================================
+*
+* id_set_add: inserts an ID in the set. Inserting an existing ID has no effect
+*
+*      * set - the set that will receive the ID
+*	   * id - the vector ID
+*
+* ====================================================================================== */
+void id_set_add(id_set *set, long long id)
+{
+	long long key = id >> 16;
+	unsigned short low = (unsigned short)(id & 0xFFFF);
+
+	/* IDs usually arrive in increasing order, so try the last container first */
+	int pos;
+	if (set->num_containers > 0 && set->containers[set->num_containers - 1].key <= key)
+		pos = (set->containers[set->num_containers - 1].key == key) ? set->num_containers - 1 : set->num_containers;
+	else
+		pos = id_set_find_container(set, key);
+
+	if (pos == set->num_containers || set->containers[pos].key != key)
+	{
+		id_set_append_container(set);
+		memmove(set->containers + pos + 1, set->containers + pos, sizeof(id_container)*(set->num_containers - 1 - pos));
+		container_init_array(&set->containers[pos], key, 4);
+	}
+
+	container_add(&set->containers[pos], low);
+}
+
+/* ======================================================================================
+*
+* id_set_add_many: inserts an array of IDs in the set
+*
+*      * set - the set that will receive the IDs
+*	   * ids - array of vector IDs
+*	   * num_ids - number of elements of the array
+*
+* ====================================================================================== */
+void id_set_add_many(id_set *set, long long *ids, long num_ids)
+{
+	long i;
+	for (i = 0; i < num_ids; i++)
+		id_set_add(set, ids[i]);
+}
+
+/* ======================================================================================
+*
+* id_set_contains: returns 1 if the ID belongs to the set and 0 otherwise
+*
+*      * set - the set to be searched
+*	   * id - the vector ID
+*
+* ====================================================================================== */
+int id_set_contains(const id_set *set, long long id)
+{
+	long long key = id >> 16;
+
+	int pos = id_set_find_container(set, key);
+	if (pos == set->num_containers || set->containers[pos].key != key)
+		return 0;
+
+	return container_contains(&set->containers[pos], (unsigned short)(id & 0xFFFF));
+}
+
+/* ======================================================================================
+*
+* id_set_cardinality: returns the number of IDs stored in the set
+*
+*      * set - the set of IDs
+*
+* ====================================================================================== */
+long long id_set_cardinality(const id_set *set)
+{
+	long long cardinality = 0;
+
+	int i;
+	for (i = 0; i < set->num_containers; i++)
+		cardinality += set->containers[i].cardinality;
+
+	return cardinality;
+}
+
+/* ======================================================================================
+*
+* id_set_size_in_bytes: returns the memory used by the containers of the set
+*
+*      * set - the set of IDs
+*
+* ====================================================================================== */
+size_t id_set_size_in_bytes(const id_set *set)
+{
+	size_t size = sizeof(id_set) + sizeof(id_container)*set->capacity;
+
+	int i;
+	for (i = 0; i < set->num_containers; i++)
+		if (set->containers[i].bitmap != NULL)
+			size += sizeof(unsigned long long)*ID_SET_BITMAP_WORDS;
+		else
+			size += sizeof(unsigned short)*set->containers[i].capacity;
+
+	return size;
+}
+
+/* ======================================================================================
+*
+* id_set_intersect: returns a new set with the IDs that belong to both sets
+*
+*      * set_a - first set
+*	   * set_b - second set
+*
+* ====================================================================================== */
+id_set *id_set_intersect(const id_set *set_a, const id_set *set_b)
+{
+	id_set *result = id_set_alloc();
+
+	/* only containers with the same key can share IDs */
+	int i = 0, j = 0;
+	while (i < set_a->num_containers && j < set_b->num_containers)
+	{
+		if (set_a->containers[i].key < set_b->containers[j].key)
+			i++;
+		else if (set_a->containers[i].key > set_b->containers[j].key)
+			j++;
+		else
+		{
+			id_container *dest = id_set_append_container(result);
+			container_intersect(dest, &set_a->containers[i], &set_b->containers[j]);
+
+			/* drop empty containers */
+			if (dest->cardinality == 0)
+			{
+				container_free(dest);
+				result->num_containers--;
+			}
+			i++; j++;
+		}
+	}
+
+	return result;
+}
+
+/* ======================================================================================
+*
+* id_set_union: returns a new set with the IDs that belong to at least one of the sets
+*
+*      * set_a - first set
+*	   * set_b - second set
+*
+* ====================================================================================== */
+id_set *id_set_union(const id_set *set_a, const id_set *set_b)
+{
+	id_set *result = id_set_alloc();
+
+	int i = 0, j = 0;
+	while (i < set_a->num_containers || j < set_b->num_containers)
+	{
+		id_container *dest = id_set_append_container(result);
+
+		if (j == set_b->num_containers || (i < set_a->num_containers && set_a->containers[i].key < set_b->containers[j].key))
+			container_copy(dest, &set_a->containers[i++]);
+		else if (i == set_a->num_containers || set_b->containers[j].key < set_a->containers[i].key)
+			container_copy(dest, &set_b->containers[j++]);
+		else
+			container_union(dest, &set_a->containers[i++], &set_b->containers[j++]);
+	}
+
+	return result;
+}
+
+/* ======================================================================================
+*
+* id_set_iterator_init: places the iterator before the smallest ID of the set
+*
+*      * it - the iterator
+*	   * set - the set to walk
+*
+* ====================================================================================== */
+void id_set_iterator_init(id_set_iterator *it, const id_set *set)
+{
+	it->set = set;
+	it->container_indx = 0;
+	it->position = 0;
+}
+
+/* ======================================================================================
+*
+* id_set_iterator_next: writes the next ID of the set in id. Returns 0 when there are no
+*				more IDs to visit
+*
+*      * it - an initialized iterator
+*	   * id - output variable for the ID
+*
+* ====================================================================================== */
+int id_set_iterator_next(id_set_iterator *it, long long *id)
+{
+	while (it->container_indx < it->set->num_containers)
+	{
+		const id_container *container = &it->set->containers[it->container_indx];
+
+		/* for arrays, position is the index of the next element */
+		if (container->bitmap == NULL)
+		{
+			if (it->position < container->cardinality)
+			{
+				*id = (container->key << 16) | container->array[it->position++];
+				return 1;
+			}
+		}
+		/* for bitmaps, position is the next bit to test */
+		else
+		{
+			while (it->position < ID_SET_BITMAP_WORDS * 64)
+			{
+				unsigned long long word = container->bitmap[it->position >> 6] >> (it->position & 63);
+				if (word != 0)
+				{
+					it->position += trailing_zeros64(word);
+					*id = (container->key << 16) | it->position++;
+					return 1;
+				}
+				it->position = ((it->position >> 6) + 1) << 6;
+			}
+		}
+
+		it->container_indx++;
+		it->position = 0;
+	}
+
+	return 0;
+}
+
+/* ======================================================================================
+*
+* id_set_iterator_next_batch: writes up to max_ids IDs of the set in the buffer ids and
+*				returns how many were written
+*
+*      * it - an initialized iterator
+*	   * ids - buffer with room for max_ids IDs
+*	   * max_ids - size of the buffer
+*
+* ====================================================================================== */
+long id_set_iterator_next_batch(id_set_iterator *it, long long *ids, long max_ids)
+{
+	long n = 0;
+	while (n < max_ids && id_set_iterator_next(it, &ids[n]))
+		n++;
+
+	return n;
+}
+
+/* ======================================================================================
+*
+* id_set_serialized_size: returns the number of bytes needed to serialize the set
+*
+*      * set - the set of IDs
+*
+* ====================================================================================== */
+size_t id_set_serialized_size(const id_set *set)
+{
+	/* header: magic number and number of containers */
+	size_t size = 2 * sizeof(int);
+
+	/* each container: key, cardinality, type and payload */
+	int i;
+	for (i = 0; i < set->num_containers; i++)
+	{
+		size += sizeof(long long) + sizeof(int) + sizeof(char);
+
+		if (set->containers[i].bitmap != NULL)
+			size += sizeof(unsigned long long)*ID_SET_BITMAP_WORDS;
+		else
+			size += sizeof(unsigned short)*set->containers[i].cardinality;
+	}
+
+	return size;
+}
+
+/* ======================================================================================
+*
+* id_set_serialize: writes the set in the buffer and returns the number of bytes written
+*
+*      * set - the set of IDs
+*	   * buffer - output buffer with at least id_set_serialized_size bytes
+*
+* ====================================================================================== */
+size_t id_set_serialize(const id_set *set, char *buffer)
+{
+	char *p = buffer;
+
+	int magic = ID_SET_MAGIC;
+	memcpy(p, &magic, sizeof(int)); p += sizeof(int);
+	memcpy(p, &set->num_containers, sizeof(int)); p += sizeof(int);
+
+	int i;
+	for (i = 0; i < set->num_containers; i++)
+	{
+		const id_container *container = &set->containers[i];
+		char type = (container->bitmap != NULL) ? 1 : 0;
+
+		memcpy(p, &container->key, sizeof(long long)); p += sizeof(long long);
+		memcpy(p, &container->cardinality, sizeof(int)); p += sizeof(int);
+		memcpy(p, &type, sizeof(char)); p += sizeof(char);
+
+		if (type == 1)
+		{
+			memcpy(p, container->bitmap, sizeof(unsigned long long)*ID_SET_BITMAP_WORDS);
+			p += sizeof(unsigned long long)*ID_SET_BITMAP_WORDS;
+		}
+		else
+		{
+			memcpy(p, container->array, sizeof(unsigned short)*container->cardinality);
+			p += sizeof(unsigned short)*container->cardinality;
+		}
+	}
+
+	return p - buffer;
+}
+
+/* ======================================================================================
+*
+* id_set_deserialize: rebuilds a set from a buffer written by id_set_serialize. Returns NULL
+*				if the buffer does not contain a valid set
+*
+*      * buffer - serialized set
+*	   * size - number of bytes of the buffer
+*
+* ====================================================================================== */
+id_set *id_set_deserialize(const char *buffer, size_t size)
+{
+	const char *p = buffer, *end = buffer + size;
+
+	int magic, num_containers;
+	if (size < 2 * sizeof(int))
+		return NULL;
+
+	memcpy(&magic, p, sizeof(int)); p += sizeof(int);
+	memcpy(&num_containers, p, sizeof(int)); p += sizeof(int);
+
+	if (magic != ID_SET_MAGIC || num_containers < 0)
+		return NULL;
+
+	id_set *set = id_set_alloc();
+
+	int i;
+	for (i = 0; i < num_containers; i++)
+	{
+		long long key; int cardinality; char type;
+
+		if (end - p < (long)(sizeof(long long) + sizeof(int) + sizeof(char)))
+			break;
+
+		memcpy(&key, p, sizeof(long long)); p += sizeof(long long);
+		memcpy(&cardinality, p, sizeof(int)); p += sizeof(int);
+		memcpy(&type, p, sizeof(char)); p += sizeof(char);
+
+		size_t payload = (type == 1) ? sizeof(unsigned long long)*ID_SET_BITMAP_WORDS : sizeof(unsigned short)*cardinality;
+		if (cardinality < 0 || (size_t)(end - p) < payload)
+			break;
+
+		id_container *container = id_set_append_container(set);
+		if (type == 1)
+		{
+			container_init_bitmap(container, key);
+			memcpy(container->bitmap, p, payload);
+		}
+		else
+		{
+			container_init_array(container, key, cardinality);
+			memcpy(container->array, p, payload);
+		}
+		container->cardinality = cardinality;
+		p += payload;
+	}
+
+	/* truncated buffer */
+	if (i < num_containers)
+	{
+		id_set_free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+/* ======================================================================================
+*
+* id_set_write: serializes the set to an opened file
+*
+*      * file - an opened file
+*	   * set - the set of IDs
+*
+* ====================================================================================== */
+void id_set_write(FILE *file, const id_set *set)
+{
+	size_t size = id_set_serialized_size(set);
+	char *buffer = (char *)malloc(size);
+
+	id_set_serialize(set, buffer);
+
+	fwrite(&size, sizeof(size_t), 1, file);
+	fwrite(buffer, 1, size, file);
+
+	free(buffer);
+}
+
+/* ======================================================================================
+*
+* id_set_read: reads a set written by id_set_write from an opened file
+*
+*      * file - an opened file
+*
+* ====================================================================================== */
+id_set *id_set_read(FILE *file)
+{
+	size_t size;
+	if (fread(&size, sizeof(size_t), 1, file) != 1)
+		return NULL;
+
+	char *buffer = (char *)malloc(size);
+	if (fread(buffer, 1, size, file) != size)
+	{
+		free(buffer);
+		return NULL;
+	}
+
+	id_set *set = id_set_deserialize(buffer, size);
+	free(buffer);
+
+	return set;
+}
+
+/* ======================================================================================
+*
+* id_set_to_sql_predicate: builds a predicate over the ID column that selects the IDs of the
+*				set. Runs of consecutive IDs are written as ID BETWEEN a AND b and the
+*				remaining IDs as ID IN ( ... )
+*
+*      * set - the set of IDs
+*
+* ====================================================================================== */
+char *id_set_to_sql_predicate(const id_set *set)
+{
+	long long cardinality = id_set_cardinality(set);
+
+	/* an empty set selects nothing */
+	if (cardinality == 0)
+	{
+		char *predicate = (char *)malloc(sizeof(char)*8);
+		strcpy(predicate, "1 = 0");
+		return predicate;
+	}
+
+	/* each ID needs at most 20 digits plus a separator, each range two IDs plus the keywords */
+	size_t size = 64 + 45 * (size_t)cardinality;
+	char *ranges = (char *)malloc(sizeof(char)*size);
+	char *singles = (char *)malloc(sizeof(char)*size);
+	char *r = ranges, *s = singles;
+	ranges[0] = '\0'; singles[0] = '\0';
+
+	id_set_iterator it;
+	id_set_iterator_init(&it, set);
+
+	long long id, run_begin, run_end;
+	int has_more = id_set_iterator_next(&it, &id);
+	while (has_more)
+	{
+		run_begin = run_end = id;
+		while ((has_more = id_set_iterator_next(&it, &id)) != 0 && id == run_end + 1)
+			run_end = id;
+
+		/* runs of three or more IDs are cheaper as a range scan over the primary key */
+		if (run_end - run_begin >= 2)
+			r += sprintf(r, "%sID BETWEEN %lld AND %lld", (r == ranges) ? "" : " OR ", run_begin, run_end);
+		else
+		{
+			long long k;
+			for (k = run_begin; k <= run_end; k++)
+				s += sprintf(s, "%s%lld", (s == singles) ? "" : ",", k);
+		}
+	}
+
+	char *predicate = (char *)malloc(sizeof(char)*((r - ranges) + (s - singles) + 32));
+	if (r != ranges && s != singles)
+		sprintf(predicate, "( %s OR ID IN (%s) )", ranges, singles);
+	else if (r != ranges)
+		sprintf(predicate, "( %s )", ranges);
+	else
+		sprintf(predicate, "ID IN (%s)", singles);
+
+	free(ranges);
+	free(singles);
+
+	return predicate;
+}
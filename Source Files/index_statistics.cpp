@@ -0,0 +1,577 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* index_statistics.cpp
+* This file contains the implementation of the statistics of the index. The vectors of each
+* level are sampled with a reservoir while the chunks are projected; the histograms are
+* equi-depth, so that they keep the same precision for skewed distances.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "index_statistics.hpp"
+#include "projection.hpp"
+#include "query.hpp"
+
+/* statistics of the current index, read by the first query */
+static index_statistics *INDEX_STATISTICS = NULL;
+
+/* state of the random generator used for sampling */
+static unsigned long long SAMPLE_SEED = 88172645463325252ULL;
+
+/* ======================================================================================
+*
+* next_random: xorshift generator, so that the samples are the same on every build
+*
+* ====================================================================================== */
+static unsigned long long next_random()
+{
+	SAMPLE_SEED ^= SAMPLE_SEED << 13;
+	SAMPLE_SEED ^= SAMPLE_SEED >> 7;
+	SAMPLE_SEED ^= SAMPLE_SEED << 17;
+	return SAMPLE_SEED;
+}
+
+/* ======================================================================================
+*
+* level_distance: distance between two vectors, with the norm of the index
+*
+* ====================================================================================== */
+static double level_distance(const double *a, const double *b, int dims)
+{
+	return projection_plan_distance(get_projection_plan(), a, b, dims);
+}
+
+/* ======================================================================================
+*
+* compare_doubles: comparison function used to sort distances
+*
+* ====================================================================================== */
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* ======================================================================================
+*
+* compute_quantiles: sorts the values and writes INDEX_STATS_BINS + 1 equally spaced
+*				quantiles, from the minimum to the maximum
+*
+*      * values - array of values, sorted by this function
+*	   * num_values - number of values
+*	   * quantiles - output array
+*
+* ====================================================================================== */
+static void compute_quantiles(double *values, long num_values, double *quantiles)
+{
+	int b;
+
+	if (num_values == 0)
+	{
+		for (b = 0; b <= INDEX_STATS_BINS; b++)
+			quantiles[b] = 0;
+		return;
+	}
+
+	qsort(values, num_values, sizeof(double), compare_doubles);
+
+	for (b = 0; b <= INDEX_STATS_BINS; b++)
+		quantiles[b] = values[(long)((double)b / INDEX_STATS_BINS * (num_values - 1))];
+}
+
+/* ======================================================================================
+*
+* quantile_cdf: fraction of the values smaller than x, interpolated between the quantiles.
+*				When dims is positive, the first bucket follows the growth of a ball of that
+*				dimension from zero instead of a straight line, which matters for small radius
+*
+*      * quantiles - INDEX_STATS_BINS + 1 quantiles
+*	   * x - value
+*	   * dims - dimension of the space of the distances, or 0
+*
+* ====================================================================================== */
+static double quantile_cdf(const double *quantiles, double x, int dims)
+{
+	if (x >= quantiles[INDEX_STATS_BINS])
+		return 1;
+
+	if (dims > 0 && x < quantiles[1])
+		return (x <= 0) ? 0 : pow(x / quantiles[1], dims) / INDEX_STATS_BINS;
+
+	if (x < quantiles[0])
+		return 0;
+
+	/* find the bucket of x */
+	int low = 0, high = INDEX_STATS_BINS;
+	while (high - low > 1)
+	{
+		int middle = (low + high) / 2;
+		if (quantiles[middle] <= x) low = middle;
+		else high = middle;
+	}
+
+	double width = quantiles[high] - quantiles[low];
+	double fraction = (width > 0) ? (x - quantiles[low]) / width : 1;
+
+	return (low + fraction) / INDEX_STATS_BINS;
+}
+
+/* ======================================================================================
+*
+* index_statistics_alloc: allocates empty statistics for the levels of the index
+*
+* ====================================================================================== */
+index_statistics *index_statistics_alloc()
+{
+	index_statistics *statistics = (index_statistics *)malloc(sizeof(index_statistics));
+
+	statistics->num_levels = NUM_PROJECTIONS + 1;
+	statistics->levels = (level_statistics *)calloc(statistics->num_levels, sizeof(level_statistics));
+	statistics->index_version = INDEX_VERSION;
+
+	return statistics;
+}
+
+/* ======================================================================================
+*
+* index_statistics_free: deallocates the statistics
+*
+*      * statistics - the statistics to deallocate
+*
+* ====================================================================================== */
+void index_statistics_free(index_statistics *statistics)
+{
+	if (statistics == NULL)
+		return;
+
+	int level;
+	for (level = 0; level < statistics->num_levels; level++)
+	{
+		free(statistics->levels[level].centroid);
+		free(statistics->levels[level].sample);
+	}
+
+	free(statistics->levels);
+	free(statistics);
+}
+
+/* ======================================================================================
+*
+* index_statistics_add_vectors: offers a chunk of vectors of a level to the sample of the
+*				level. Every vector seen so far has the same probability of being sampled
+*
+*      * statistics - statistics being built
+*	   * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * data - chunk of vectors, one per row
+*	   * num_rows - number of vectors of the chunk
+*	   * dims - dimension of the level
+*
+* ====================================================================================== */
+void index_statistics_add_vectors(index_statistics *statistics, int level, gsl_matrix *data, long num_rows, int dims)
+{
+	level_statistics *stats = &statistics->levels[level];
+
+	if (stats->sample == NULL)
+	{
+		stats->dims = dims;
+		stats->sample = (double *)malloc(sizeof(double)*INDEX_STATS_SAMPLE_SIZE*dims);
+	}
+
+	long row;
+	int i;
+	for (row = 0; row < num_rows; row++)
+	{
+		/* reservoir sampling */
+		long slot = (stats->num_vectors < INDEX_STATS_SAMPLE_SIZE) ? stats->num_vectors
+			: (long)(next_random() % (unsigned long long)(stats->num_vectors + 1));
+
+		stats->num_vectors++;
+
+		if (slot >= INDEX_STATS_SAMPLE_SIZE)
+			continue;
+
+		for (i = 0; i < dims; i++)
+			stats->sample[slot*dims + i] = gsl_matrix_get(data, row, i);
+
+		if (slot == stats->sample_size)
+			stats->sample_size++;
+	}
+}
+
+/* ======================================================================================
+*
+* calibrate_constants: stores the constant of every level and measures, on pairs of vectors 
+*				of the sample of the original data, the ratio between their distance in the
+*				original data and their distance at each level
+*
+*      * statistics - statistics being built, with the sample of the original data
+*	   * distances - buffer with room for INDEX_STATS_NUM_PAIRS values
+*
+* ====================================================================================== */
+static void calibrate_constants(index_statistics *statistics, double *distances)
+{
+	projection_plan *plan = get_projection_plan();
+	level_statistics *original = &statistics->levels[0];
+	long n = original->sample_size, k;
+
+	int level;
+	for (level = 0; level < statistics->num_levels; level++)
+	{
+		statistics->levels[level].bound_constant = plan->lower_bound_constants[level];
+		compute_quantiles(distances, 0, statistics->levels[level].ratio_quantiles);
+	}
+
+	if (n < 2)
+		return;
+
+	/* project the sample through every level, as the index does */
+	int values_per_vector = plan->offsets[plan->num_levels - 1] + plan->dims[plan->num_levels - 1];
+	double *projections = (double *)malloc(sizeof(double)*n*values_per_vector);
+
+	for (k = 0; k < n; k++)
+		memcpy(projections + k*values_per_vector, projection_plan_project(plan, original->sample + k*original->dims),
+			sizeof(double)*values_per_vector);
+
+	for (level = 0; level < statistics->num_levels; level++)
+	{
+		long num_pairs = 0, pair;
+		for (pair = 0; pair < INDEX_STATS_NUM_PAIRS; pair++)
+		{
+			long a = (long)(next_random() % n);
+			long b = (long)(next_random() % (n - 1));
+			if (b >= a) b++;
+
+			const double *vector_a = projections + a*values_per_vector;
+			const double *vector_b = projections + b*values_per_vector;
+
+			double distance = level_distance(vector_a + plan->offsets[level], vector_b + plan->offsets[level], plan->dims[level]);
+
+			/* pairs that are not separated at the level do not constrain the constant */
+			if (distance > 0)
+				distances[num_pairs++] = level_distance(vector_a, vector_b, plan->dims[0]) / distance;
+		}
+
+		compute_quantiles(distances, num_pairs, statistics->levels[level].ratio_quantiles);
+	}
+
+	free(projections);
+}
+
+/* ======================================================================================
+*
+* index_statistics_finish: computes the centroids, the histograms and the constants of every
+*				level from the samples and releases the samples
+*
+*      * statistics - statistics being built
+*
+* ====================================================================================== */
+void index_statistics_finish(index_statistics *statistics)
+{
+	double *distances = (double *)malloc(sizeof(double)*INDEX_STATS_NUM_PAIRS);
+
+	/* uses the sample of the original data, so it runs before the samples are released */
+	calibrate_constants(statistics, distances);
+
+	int level, i;
+	for (level = 0; level < statistics->num_levels; level++)
+	{
+		level_statistics *stats = &statistics->levels[level];
+		long n = stats->sample_size, k;
+
+		if (n == 0)
+			continue;
+
+		/* centroid of the sample */
+		stats->centroid = (double *)calloc(stats->dims, sizeof(double));
+		for (k = 0; k < n; k++)
+			for (i = 0; i < stats->dims; i++)
+				stats->centroid[i] += stats->sample[k*stats->dims + i] / n;
+
+		/* distance of every sampled vector to the centroid */
+		for (k = 0; k < n; k++)
+			distances[k] = level_distance(stats->sample + k*stats->dims, stats->centroid, stats->dims);
+		compute_quantiles(distances, n, stats->centroid_quantiles);
+
+		/* distance between random pairs of sampled vectors */
+		long num_pairs = 0;
+		if (n > 1)
+			for (num_pairs = 0; num_pairs < INDEX_STATS_NUM_PAIRS; num_pairs++)
+			{
+				long a = (long)(next_random() % n);
+				long b = (long)(next_random() % (n - 1));
+				if (b >= a) b++;
+
+				distances[num_pairs] = level_distance(stats->sample + a*stats->dims, stats->sample + b*stats->dims, stats->dims);
+			}
+		compute_quantiles(distances, num_pairs, stats->pair_quantiles);
+
+		free(stats->sample);
+		stats->sample = NULL;
+		stats->sample_size = 0;
+	}
+
+	free(distances);
+}
+
+/* ======================================================================================
+*
+* index_statistics_calibrated_constant: returns the largest constant of a level that keeps the
+*				target recall on the sampled pairs. A pair is kept at the level while c times
+*				its distance at the level is at most its distance in the original data, so c is
+*				the (1 - recall) quantile of the ratios between both distances
+*
+*      * statistics - statistics of the index
+*	   * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * recall - fraction of the results to keep, between 0 and 1
+*
+* ====================================================================================== */
+double index_statistics_calibrated_constant(index_statistics *statistics, int level, double recall)
+{
+	level_statistics *stats = &statistics->levels[level];
+
+	double position = (1 - recall) * INDEX_STATS_BINS;
+	if (position < 0) position = 0;
+	if (position > INDEX_STATS_BINS) position = INDEX_STATS_BINS;
+
+	/* interpolate between the quantiles around the position */
+	int bin = (int)position;
+	double constant = stats->ratio_quantiles[bin];
+	if (bin < INDEX_STATS_BINS)
+		constant += (position - bin) * (stats->ratio_quantiles[bin + 1] - stats->ratio_quantiles[bin]);
+
+	return (constant > stats->bound_constant) ? constant : stats->bound_constant;
+}
+
+/* ======================================================================================
+*
+* build_statistics_path: returns the path of the statistics file of the dataset
+*
+* ====================================================================================== */
+static char *build_statistics_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.stats", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* index_statistics_write: saves the statistics next to the dataset
+*
+*      * statistics - finished statistics
+*
+* ====================================================================================== */
+void index_statistics_write(index_statistics *statistics)
+{
+	char *path = build_statistics_path();
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		printf("[ERROR] Unable to write the index statistics to %s\n", path);
+		free(path);
+		return;
+	}
+
+	int magic = INDEX_STATS_MAGIC, version = INDEX_STATS_VERSION, level;
+	fwrite(&magic, sizeof(int), 1, file);
+	fwrite(&version, sizeof(int), 1, file);
+	fwrite(&statistics->num_levels, sizeof(int), 1, file);
+
+	for (level = 0; level < statistics->num_levels; level++)
+	{
+		level_statistics *stats = &statistics->levels[level];
+
+		fwrite(&stats->dims, sizeof(int), 1, file);
+		fwrite(&stats->num_vectors, sizeof(long), 1, file);
+		fwrite(stats->centroid, sizeof(double), stats->dims, file);
+		fwrite(stats->pair_quantiles, sizeof(double), INDEX_STATS_BINS + 1, file);
+		fwrite(stats->centroid_quantiles, sizeof(double), INDEX_STATS_BINS + 1, file);
+		fwrite(&stats->bound_constant, sizeof(double), 1, file);
+		fwrite(stats->ratio_quantiles, sizeof(double), INDEX_STATS_BINS + 1, file);
+	}
+
+	fclose(file);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* index_statistics_read: reads the statistics of the dataset, or returns NULL if the file
+*				does not exist or does not match the levels of the index
+*
+* ====================================================================================== */
+static index_statistics *index_statistics_read()
+{
+	char *path = build_statistics_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, version = 0, num_levels = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != INDEX_STATS_MAGIC
+		|| fread(&version, sizeof(int), 1, file) != 1 || version != INDEX_STATS_VERSION
+		|| fread(&num_levels, sizeof(int), 1, file) != 1 || num_levels != NUM_PROJECTIONS + 1)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	index_statistics *statistics = index_statistics_alloc();
+	projection_plan *plan = get_projection_plan();
+
+	int level, valid = 1;
+	for (level = 0; level < num_levels && valid; level++)
+	{
+		level_statistics *stats = &statistics->levels[level];
+
+		valid = fread(&stats->dims, sizeof(int), 1, file) == 1 && stats->dims == plan->dims[level]
+			&& fread(&stats->num_vectors, sizeof(long), 1, file) == 1;
+
+		if (!valid)
+			break;
+
+		stats->centroid = (double *)malloc(sizeof(double)*stats->dims);
+		valid = fread(stats->centroid, sizeof(double), stats->dims, file) == (size_t)stats->dims
+			&& fread(stats->pair_quantiles, sizeof(double), INDEX_STATS_BINS + 1, file) == INDEX_STATS_BINS + 1
+			&& fread(stats->centroid_quantiles, sizeof(double), INDEX_STATS_BINS + 1, file) == INDEX_STATS_BINS + 1
+			&& fread(&stats->bound_constant, sizeof(double), 1, file) == 1
+			&& fread(stats->ratio_quantiles, sizeof(double), INDEX_STATS_BINS + 1, file) == INDEX_STATS_BINS + 1;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		index_statistics_free(statistics);
+		return NULL;
+	}
+
+	return statistics;
+}
+
+/* ======================================================================================
+*
+* get_index_statistics: returns the statistics of the current index, read from the file the
+*				first time they are needed. Returns NULL if the index has no statistics
+*
+* ====================================================================================== */
+index_statistics *get_index_statistics()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the statistics were read */
+	if (checked_version != INDEX_VERSION)
+	{
+		index_statistics_free(INDEX_STATISTICS);
+		INDEX_STATISTICS = index_statistics_read();
+		checked_version = INDEX_VERSION;
+	}
+
+	return INDEX_STATISTICS;
+}
+
+/* ======================================================================================
+*
+* index_statistics_estimate: returns the expected number of vectors of a level within epsilon
+*				of the query. The distribution of the distance between pairs gives the
+*				expected count for a query that looks like the data. By the triangle
+*				inequality, a vector within r of the query is at a distance to the centroid
+*				between d - r and d + r, where d is the distance of the query to the centroid,
+*				which bounds the count of queries far from the data
+*
+*      * statistics - statistics of the index
+*	   * query - matrix containing the query vector and all of its projections
+*	   * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * epsilon - radius of the query
+*
+* ====================================================================================== */
+double index_statistics_estimate(index_statistics *statistics, gsl_matrix *query, int level, double epsilon)
+{
+	level_statistics *stats = &statistics->levels[level];
+
+	if (stats->centroid == NULL)
+		return 0;
+
+	/* radius in the distance of the level, before the constant is applied */
+	double radius = epsilon / compute_constant_c(level);
+
+	double distance_to_centroid = level_distance(gsl_matrix_ptr(query, level, 0), stats->centroid, stats->dims);
+
+	double pair_fraction = quantile_cdf(stats->pair_quantiles, radius, stats->dims);
+	double band_fraction = quantile_cdf(stats->centroid_quantiles, distance_to_centroid + radius, 0)
+		- quantile_cdf(stats->centroid_quantiles, distance_to_centroid - radius, 0);
+
+	double fraction = (band_fraction < pair_fraction) ? band_fraction : pair_fraction;
+
+	return fraction * stats->num_vectors;
+}
+
+/* ======================================================================================
+*
+* index_statistics_estimate_levels: writes in counts the expected number of candidates of the
+*				query at every level
+*
+*      * statistics - statistics of the index
+*	   * query - matrix containing the query vector and all of its projections
+*	   * epsilon - radius of the query
+*	   * counts - output array with NUM_PROJECTIONS + 1 values
+*
+* ====================================================================================== */
+void index_statistics_estimate_levels(index_statistics *statistics, gsl_matrix *query, double epsilon, double *counts)
+{
+	int level;
+	for (level = 0; level < statistics->num_levels; level++)
+		counts[level] = index_statistics_estimate(statistics, query, level, epsilon);
+}
+
+/* ======================================================================================
+*
+* index_statistics_recommend_epsilon: returns the epsilon for which the query is expected to
+*				return target_count vectors, by bisection on the estimate of the original data
+*
+*      * statistics - statistics of the index
+*	   * query - matrix containing the query vector and all of its projections
+*	   * target_count - number of vectors the query should return
+*
+* ====================================================================================== */
+double index_statistics_recommend_epsilon(index_statistics *statistics, gsl_matrix *query, long target_count)
+{
+	level_statistics *stats = &statistics->levels[0];
+
+	if (stats->centroid == NULL)
+		return EPSILON;
+
+	double distance_to_centroid = level_distance(gsl_matrix_ptr(query, 0, 0), stats->centroid, stats->dims);
+
+	/* every vector is within this radius of the query */
+	double low = 0;
+	double high = compute_constant_c(0) * (distance_to_centroid + stats->centroid_quantiles[INDEX_STATS_BINS]);
+
+	if (index_statistics_estimate(statistics, query, 0, high) < target_count)
+		return high;
+
+	int iteration;
+	for (iteration = 0; iteration < 60; iteration++)
+	{
+		double middle = (low + high) / 2;
+
+		if (index_statistics_estimate(statistics, query, 0, middle) < target_count)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	return high;
+}
@@ -18,6 +18,8 @@
 #include "input_manipulation.hpp"
 #include "query.hpp"
 
+#include <math.h>
+
 /* ======================================================================================
 *
 * assign_user_input: takes the input arguments and assigns them to each global variable
@@ -72,6 +74,10 @@ void assign_user_input(char **user_input)
 	/* set epsilon threshold */
 	assign_epsilon(user_input[EPSILON_INDX]);
 
+	/* an index built with collapsed duplicates holds fewer vectors than the dataset file */
+	if (!PERFORM_INDEX_PHASE)
+		duplicate_set_assign_vectors();
+
 	/* display reults if DEBUG_OPTION variable is set */
 	if (DEBUG_OPTION > 1) print_input_variables( );
 }
@@ -356,6 +362,63 @@ void assign_dataset_dimensions()
 	free( temp );
 }
 
+/* ======================================================================================
+*
+* assign_value_type: reads every value of the dataset file and assigns to the global variable
+*					ORIGINAL_VALUE_TYPE the narrowest type that holds all of them without loss:
+*					VALUE_TYPE_UINT8 or VALUE_TYPE_INT16 when they are non-negative integers,
+*					VALUE_TYPE_FLOAT otherwise. The values are classified by their text, since
+*					BULK INSERT only loads a value written with digits alone, such as 3 and not
+*					3.0 or 1e2, into an integer column
+*
+* ======================================================================================
+*/
+void assign_value_type()
+{
+	ORIGINAL_VALUE_TYPE = VALUE_TYPE_FLOAT;
+
+	if (!NARROW_INTEGER_STORAGE)
+		return;
+
+	FILE *file = fopen(DATASET_PATH, "r");
+	if (file == NULL)
+		return;
+
+	char token[64];
+	double largest = 0;
+	int integers = 1;
+	long count = 0;
+
+	while (integers && fscanf(file, "%63s", token) == 1)
+	{
+		/* digits only: no sign, decimal point or exponent */
+		size_t i, length = strlen(token);
+		for (i = 0; i < length && integers; i++)
+			integers = (token[i] >= '0' && token[i] <= '9');
+
+		/* a token of 63 characters may have been cut */
+		integers = integers && length < sizeof(token) - 1;
+
+		double value = atof(token);
+		if (value > largest)
+			largest = value;
+		count++;
+	}
+
+	fclose(file);
+
+	if (!integers || count == 0)
+		return;
+
+	if (largest <= VALUE_TYPE_UINT8_MAX)
+		ORIGINAL_VALUE_TYPE = VALUE_TYPE_UINT8;
+	else if (largest <= VALUE_TYPE_INT16_MAX)
+		ORIGINAL_VALUE_TYPE = VALUE_TYPE_INT16;
+
+	if (DEBUG_OPTION > 0 && ORIGINAL_VALUE_TYPE != VALUE_TYPE_FLOAT)
+		printf("\nThe dataset holds integers from 0 to %.0f, stored as %s\n", largest, column_type(TOTAL_DIMENSIONS));
+}
+
 /* ======================================================================================
 *
 * assign_norm_type: assigns the user argument to the NORM_TYPE global variable
@@ -0,0 +1,739 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* interleaved_store.cpp
+* This file contains the implementation of the level-interleaved layout. The records are
+* written chunk by chunk while the original data is read, and the whole file is read into a
+* block aligned to a cache line by the first query. The distances of integer originals to an
+* integer query are computed with SSE2: the sums of absolute differences of 16 bytes at once
+* for the L1 norm, and the sums of products of 16-bit differences for the L2 norm. Half-
+* precision values are converted in software, so no instruction beyond SSE2 is required.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "interleaved_store.hpp"
+#include "projection.hpp"
+
+/* records of the current index, read by the first query */
+static interleaved_store *INTERLEAVED_STORE = NULL;
+
+/* ======================================================================================
+*
+* value_size: returns the size in bytes of a value of the original data
+*
+*      * value_type - VALUE_TYPE_FLOAT, VALUE_TYPE_UINT8 or VALUE_TYPE_INT16
+*
+* ====================================================================================== */
+static int value_size(int value_type)
+{
+	switch (value_type)
+	{
+		case VALUE_TYPE_UINT8:  return sizeof(unsigned char);
+		case VALUE_TYPE_INT16:  return sizeof(unsigned short);
+		default:                return sizeof(double);
+	}
+}
+
+/* ======================================================================================
+*
+* double_to_half: returns the half-precision float closest to a value. Values beyond the range
+*				of half precision become infinite
+*
+*      * value - the value
+*
+* ====================================================================================== */
+static unsigned short double_to_half(double value)
+{
+	float single = (float)value;
+	unsigned int bits;
+	memcpy(&bits, &single, sizeof(float));
+
+	unsigned int sign = (bits >> 16) & 0x8000, mantissa = bits & 0x7FFFFF;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+
+	if (((bits >> 23) & 0xFF) == 0xFF)
+		return (unsigned short)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7C00);
+
+	unsigned int half, rest, halfway;
+	if (exponent <= 0)
+	{
+		/* subnormal half */
+		if (exponent < -10)
+			return (unsigned short)sign;
+
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		half = mantissa >> shift;
+		rest = mantissa & ((1U << shift) - 1);
+		halfway = 1U << (shift - 1);
+	}
+	else
+	{
+		half = ((unsigned int)exponent << 10) | (mantissa >> 13);
+		rest = mantissa & 0x1FFF;
+		halfway = 0x1000;
+	}
+
+	/* round to nearest even; a carry moves to the next exponent */
+	if (rest > halfway || (rest == halfway && (half & 1)))
+		half++;
+
+	return (unsigned short)(sign | half);
+}
+
+/* ======================================================================================
+*
+* half_to_double: returns the value of a half-precision float
+*
+*      * half - the half-precision float
+*
+* ====================================================================================== */
+static double half_to_double(unsigned short half)
+{
+	unsigned int exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+	double value;
+
+	if (exponent == 0)
+		value = mantissa * (1.0 / 16777216.0);
+	else if (exponent == 31)
+		value = mantissa ? GSL_NAN : GSL_POSINF;
+	else
+	{
+		unsigned int bits = ((exponent - 15 + 127) << 23) | (mantissa << 13);
+		float single;
+		memcpy(&single, &bits, sizeof(float));
+		value = single;
+	}
+
+	return (half & 0x8000) ? -value : value;
+}
+
+
+
+/* ======================================================================================
+*
+* interleaved_store_alloc: allocates the layout of the records of the index, without records.
+*				The levels are stored from the lowest one to the original data
+*
+*      * value_type - type of the original data
+*	   * precision - precision of the projected levels
+*
+* ====================================================================================== */
+static interleaved_store *interleaved_store_alloc(int value_type, int precision)
+{
+	projection_plan *plan = get_projection_plan();
+	interleaved_store *store = (interleaved_store *)calloc(1, sizeof(interleaved_store));
+
+	store->num_levels = NUM_PROJECTIONS + 1;
+	store->offsets = (int *)malloc(sizeof(int)*store->num_levels);
+	store->errors = (double *)calloc(store->num_levels, sizeof(double));
+
+	int level, position = 0;
+	for (level = NUM_PROJECTIONS; level >= 1; level--)
+	{
+		store->offsets[level] = position;
+		position += plan->dims[level];
+	}
+	store->offsets[0] = position;
+
+	store->precision = precision;
+	store->value_bytes = (precision == LEVEL_PRECISION_FP16) ? sizeof(unsigned short)
+		: (precision == LEVEL_PRECISION_INT8) ? sizeof(unsigned char) : sizeof(double);
+
+	if (precision == LEVEL_PRECISION_INT8)
+	{
+		store->scales = (double *)calloc(position, sizeof(double));
+		store->shifts = (double *)calloc(position, sizeof(double));
+	}
+
+	/* the original data starts at a multiple of a double */
+	store->value_type = value_type;
+	store->original_offset = ((position * (long)store->value_bytes + sizeof(double) - 1) / sizeof(double)) * sizeof(double);
+
+	long size = store->original_offset + (long)TOTAL_DIMENSIONS * value_size(value_type);
+	store->record_size = ((size + INTERLEAVED_ALIGNMENT - 1) / INTERLEAVED_ALIGNMENT) * INTERLEAVED_ALIGNMENT;
+
+	return store;
+}
+
+/* ======================================================================================
+*
+* interleaved_store_free: deallocates the records
+*
+*      * store - the records to deallocate
+*
+* ====================================================================================== */
+void interleaved_store_free(interleaved_store *store)
+{
+	if (store == NULL)
+		return;
+
+	free(store->offsets);
+	free(store->scales);
+	free(store->shifts);
+	free(store->errors);
+	free(store->allocation);
+	free(store);
+}
+
+/* ======================================================================================
+*
+* store_value: writes a projected value in a record, in the precision of the records, and
+*				returns the value that is read back
+*
+*      * store - layout of the records
+*	   * record - the record
+*	   * position - position of the value among the projected values
+*	   * value - the value
+*
+* ====================================================================================== */
+static double store_value(interleaved_store *store, unsigned char *record, int position, double value)
+{
+	if (store->precision == LEVEL_PRECISION_FP16)
+	{
+		unsigned short half = double_to_half(value);
+		((unsigned short *)record)[position] = half;
+		return half_to_double(half);
+	}
+
+	if (store->precision == LEVEL_PRECISION_INT8)
+	{
+		double step = (store->scales[position] > 0) ? floor((value - store->shifts[position]) / store->scales[position] + 0.5) : 0;
+		unsigned char code = (unsigned char)((step < 0) ? 0 : (step > 255) ? 255 : step);
+		record[position] = code;
+		return store->shifts[position] + store->scales[position] * code;
+	}
+
+	((double *)record)[position] = value;
+	return value;
+}
+
+/* ======================================================================================
+*
+* build_interleaved_path: returns the path of the records of the dataset
+*
+* ====================================================================================== */
+static char *build_interleaved_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.ilv", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* interleaved_store_build: reads the original data chunk by chunk, projects every vector
+*				through all the levels and writes its record
+*
+*      * hdbc - an opened SQL connection
+*
+* ====================================================================================== */
+void interleaved_store_build(HDBC hdbc)
+{
+	projection_plan *plan = get_projection_plan();
+	interleaved_store *store = interleaved_store_alloc(ORIGINAL_VALUE_TYPE, INTERLEAVED_PRECISION);
+
+	int num_projected = store->offsets[0], chunks_to_read = compute_num_chunks(), chunk_indx, level, i;
+	long row;
+
+	double *vector = (double *)malloc(sizeof(double)*TOTAL_DIMENSIONS);
+
+	/* the bytes of a coordinate cover the range of its values */
+	if (store->precision == LEVEL_PRECISION_INT8)
+	{
+		double *largest = (double *)malloc(sizeof(double)*num_projected);
+		for (i = 0; i < num_projected; i++)
+		{
+			store->shifts[i] = GSL_POSINF;
+			largest[i] = GSL_NEGINF;
+		}
+
+		for (chunk_indx = 0; chunk_indx < chunks_to_read; chunk_indx++)
+		{
+			long remaining_vecs = compute_num_vecs_to_load(chunk_indx, chunks_to_read);
+			gsl_matrix *database_matrix = load_data_chunk(hdbc, chunk_indx, chunks_to_read, remaining_vecs, TOTAL_DIMENSIONS);
+
+			for (row = 0; row < remaining_vecs; row++)
+			{
+				for (i = 0; i < TOTAL_DIMENSIONS; i++)
+					vector[i] = gsl_matrix_get(database_matrix, row, i);
+
+				const double *projected = projection_plan_project(plan, vector);
+
+				for (level = 1; level <= NUM_PROJECTIONS; level++)
+					for (i = 0; i < plan->dims[level]; i++)
+					{
+						double value = projected[plan->offsets[level] + i];
+						int position = store->offsets[level] + i;
+
+						if (value < store->shifts[position]) store->shifts[position] = value;
+						if (value > largest[position]) largest[position] = value;
+					}
+			}
+
+			gsl_matrix_free(database_matrix);
+		}
+
+		for (i = 0; i < num_projected; i++)
+			store->scales[i] = (largest[i] > store->shifts[i]) ? (largest[i] - store->shifts[i]) / 255 : 0;
+
+		free(largest);
+	}
+
+	char *path = build_interleaved_path();
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		printf("[ERROR] Unable to write the interleaved records to %s\n", path);
+		free(path);
+		free(vector);
+		interleaved_store_free(store);
+		return;
+	}
+
+	long num_vectors = TOTAL_VECTORS;
+	int magic = INTERLEAVED_MAGIC;
+	fwrite(&magic, sizeof(int), 1, file);
+	fwrite(&store->num_levels, sizeof(int), 1, file);
+	fwrite(&store->value_type, sizeof(int), 1, file);
+	fwrite(&store->precision, sizeof(int), 1, file);
+	fwrite(&store->record_size, sizeof(long), 1, file);
+	fwrite(&num_vectors, sizeof(long), 1, file);
+
+	if (store->precision == LEVEL_PRECISION_INT8)
+	{
+		fwrite(store->scales, sizeof(double), num_projected, file);
+		fwrite(store->shifts, sizeof(double), num_projected, file);
+	}
+
+	unsigned char *record = (unsigned char *)calloc(store->record_size, sizeof(unsigned char));
+	void *original = record + store->original_offset;
+
+	/* largest error of every projected value */
+	double *value_errors = (double *)calloc(num_projected > 0 ? num_projected : 1, sizeof(double));
+
+	for (chunk_indx = 0; chunk_indx < chunks_to_read; chunk_indx++)
+	{
+		long remaining_vecs = compute_num_vecs_to_load(chunk_indx, chunks_to_read);
+		gsl_matrix *database_matrix = load_data_chunk(hdbc, chunk_indx, chunks_to_read, remaining_vecs, TOTAL_DIMENSIONS);
+
+		for (row = 0; row < remaining_vecs; row++)
+		{
+			for (i = 0; i < TOTAL_DIMENSIONS; i++)
+				vector[i] = gsl_matrix_get(database_matrix, row, i);
+
+			const double *projected = projection_plan_project(plan, vector);
+
+			for (level = 1; level <= NUM_PROJECTIONS; level++)
+				for (i = 0; i < plan->dims[level]; i++)
+				{
+					double value = projected[plan->offsets[level] + i];
+					int position = store->offsets[level] + i;
+
+					double error = fabs(store_value(store, record, position, value) - value);
+					if (error > value_errors[position])
+						value_errors[position] = error;
+				}
+
+			/* the integer values were read exactly, as floats */
+			for (i = 0; i < TOTAL_DIMENSIONS; i++)
+				if (store->value_type == VALUE_TYPE_UINT8)
+					((unsigned char *)original)[i] = (unsigned char)vector[i];
+				else if (store->value_type == VALUE_TYPE_INT16)
+					((unsigned short *)original)[i] = (unsigned short)vector[i];
+				else
+					((double *)original)[i] = vector[i];
+
+			fwrite(record, sizeof(unsigned char), store->record_size, file);
+		}
+
+		gsl_matrix_free(database_matrix);
+	}
+
+	/* the largest error of a level is the norm of the largest errors of its values */
+	for (level = 1; level <= NUM_PROJECTIONS; level++)
+	{
+		double sum = 0;
+		for (i = 0; i < plan->dims[level]; i++)
+		{
+			double error = value_errors[store->offsets[level] + i];
+			sum += plan->norm_l2 ? error*error : error;
+		}
+
+		store->errors[level] = plan->norm_l2 ? sqrt(sum) : sum;
+	}
+
+	/* the errors are only known once every record was written */
+	fwrite(store->errors, sizeof(double), store->num_levels, file);
+
+	if (DEBUG_OPTION > 0)
+		printf("\nInterleaved records: %ld vectors, %ld bytes per record\n", num_vectors, store->record_size);
+
+	fclose(file);
+	free(path);
+	free(record);
+	free(vector);
+	free(value_errors);
+	interleaved_store_free(store);
+}
+
+/* ======================================================================================
+*
+* interleaved_store_read: reads the records of the dataset, or returns NULL if the file does
+*				not exist or does not match the levels of the index
+*
+* ====================================================================================== */
+static interleaved_store *interleaved_store_read()
+{
+	char *path = build_interleaved_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, num_levels = 0, value_type = -1, precision = -1;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != INTERLEAVED_MAGIC
+		|| fread(&num_levels, sizeof(int), 1, file) != 1 || num_levels != NUM_PROJECTIONS + 1
+		|| fread(&value_type, sizeof(int), 1, file) != 1 
+		|| (value_type != VALUE_TYPE_FLOAT && value_type != VALUE_TYPE_UINT8 && value_type != VALUE_TYPE_INT16)
+		|| fread(&precision, sizeof(int), 1, file) != 1
+		|| (precision != LEVEL_PRECISION_DOUBLE && precision != LEVEL_PRECISION_FP16 && precision != LEVEL_PRECISION_INT8))
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	interleaved_store *store = interleaved_store_alloc(value_type, precision);
+	size_t num_projected = store->offsets[0];
+
+	long record_size = 0;
+	int valid = fread(&record_size, sizeof(long), 1, file) == 1 && record_size == store->record_size
+		&& fread(&store->num_vectors, sizeof(long), 1, file) == 1 && store->num_vectors > 0;
+
+	if (valid && precision == LEVEL_PRECISION_INT8)
+		valid = fread(store->scales, sizeof(double), num_projected, file) == num_projected
+			&& fread(store->shifts, sizeof(double), num_projected, file) == num_projected;
+
+	if (valid)
+	{
+		size_t num_bytes = (size_t)store->num_vectors*store->record_size;
+
+		/* align the first record, and so every record, to a cache line */
+		store->allocation = malloc(num_bytes + INTERLEAVED_ALIGNMENT);
+		store->records = (unsigned char *)(((size_t)store->allocation + INTERLEAVED_ALIGNMENT - 1) & ~(size_t)(INTERLEAVED_ALIGNMENT - 1));
+
+		valid = store->allocation != NULL && fread(store->records, sizeof(unsigned char), num_bytes, file) == num_bytes
+			&& fread(store->errors, sizeof(double), store->num_levels, file) == (size_t)store->num_levels;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		interleaved_store_free(store);
+		return NULL;
+	}
+
+	return store;
+}
+
+/* ======================================================================================
+*
+* get_interleaved_store: returns the records of the current index, read from the file the
+*				first time they are needed. Returns NULL if the index has no records
+*
+* ====================================================================================== */
+interleaved_store *get_interleaved_store()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the records were read */
+	if (checked_version != INDEX_VERSION)
+	{
+		interleaved_store_free(INTERLEAVED_STORE);
+		INTERLEAVED_STORE = interleaved_store_read();
+		checked_version = INDEX_VERSION;
+	}
+
+	return INTERLEAVED_STORE;
+}
+
+/* ======================================================================================
+*
+* uint8_distance: returns the L1 distance, or the squared L2 distance, between two vectors of
+*				bytes. 16 coordinates are processed at once
+*
+*      * a, b - the vectors
+*	   * dims - dimension of the vectors
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*
+* ====================================================================================== */
+static double uint8_distance(const unsigned char *a, const unsigned char *b, int dims, int norm_l2)
+{
+	__m128i zero = _mm_setzero_si128(), sum = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= dims; i += 16)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+		if (!norm_l2)
+		{
+			/* two 64-bit sums of absolute differences */
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+			continue;
+		}
+
+		/* the differences fit in 16 bits and the sums of two of their squares in 32 bits */
+		__m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+		__m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+		sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+	}
+
+	long long total = 0;
+	if (norm_l2)
+	{
+		int lanes[4];
+		_mm_storeu_si128((__m128i *)lanes, sum);
+		total = (long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	else
+	{
+		long long lanes[2];
+		_mm_storeu_si128((__m128i *)lanes, sum);
+		total = lanes[0] + lanes[1];
+	}
+
+	for (; i < dims; i++)
+	{
+		int difference = (int)a[i] - (int)b[i];
+		total += norm_l2 ? difference*difference : abs(difference);
+	}
+
+	return (double)total;
+}
+
+/* ======================================================================================
+*
+* uint16_distance: returns the L1 distance, or the squared L2 distance, between two vectors of
+*				16-bit integers
+*
+*      * a, b - the vectors
+*	   * dims - dimension of the vectors
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*
+* ====================================================================================== */
+static double uint16_distance(const unsigned short *a, const unsigned short *b, int dims, int norm_l2)
+{
+	long long total = 0;
+	int i;
+
+	for (i = 0; i < dims; i++)
+	{
+		long long difference = (long long)a[i] - (long long)b[i];
+		total += norm_l2 ? difference*difference : (difference < 0 ? -difference : difference);
+	}
+
+	return (double)total;
+}
+
+/* ======================================================================================
+*
+* original_distance: returns the distance between the query and the original data of a record.
+*				Integer originals are compared on the integers when the query is also made of
+*				integers of their type, and converted to doubles otherwise
+*
+*      * store - records of the index
+*	   * record - the record
+*	   * query_vec - the query
+*	   * integer_query - the query in the type of the original data, or NULL
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*
+* ====================================================================================== */
+static double original_distance(interleaved_store *store, const unsigned char *record, const double *query_vec,
+	const void *integer_query, int norm_l2)
+{
+	const void *original = record + store->original_offset;
+	double sum = 0;
+	int i;
+
+	if (store->value_type == VALUE_TYPE_FLOAT)
+		return projection_plan_distance(get_projection_plan(), query_vec, (const double *)original, TOTAL_DIMENSIONS);
+
+	if (integer_query != NULL)
+	{
+		sum = (store->value_type == VALUE_TYPE_UINT8)
+			? uint8_distance((const unsigned char *)integer_query, (const unsigned char *)original, TOTAL_DIMENSIONS, norm_l2)
+			: uint16_distance((const unsigned short *)integer_query, (const unsigned short *)original, TOTAL_DIMENSIONS, norm_l2);
+	}
+	else
+	{
+		for (i = 0; i < TOTAL_DIMENSIONS; i++)
+		{
+			double value = (store->value_type == VALUE_TYPE_UINT8) ? ((const unsigned char *)original)[i] : ((const unsigned short *)original)[i];
+			double difference = query_vec[i] - value;
+			sum += norm_l2 ? difference*difference : fabs(difference);
+		}
+	}
+
+	return norm_l2 ? sqrt(sum) : sum;
+}
+
+/* ======================================================================================
+*
+* projected_distance: returns a lower bound of the distance between the query and a vector at
+*				a projected level: the distance to its stored values minus the largest error
+*				of the level
+*
+*      * store - records of the index
+*	   * record - record of the vector
+*	   * level - projected level
+*	   * query_vec - projection of the query at the level
+*	   * plan - projection plan of the index
+*
+* ====================================================================================== */
+static double projected_distance(interleaved_store *store, const unsigned char *record, int level, const double *query_vec,
+	projection_plan *plan)
+{
+	int first = store->offsets[level], dims = plan->dims[level], i;
+
+	if (store->precision == LEVEL_PRECISION_DOUBLE)
+		return projection_plan_distance(plan, query_vec, (const double *)record + first, dims);
+
+	double sum = 0;
+	for (i = 0; i < dims; i++)
+	{
+		double value = (store->precision == LEVEL_PRECISION_FP16)
+			? half_to_double(((const unsigned short *)record)[first + i])
+			: store->shifts[first + i] + store->scales[first + i] * record[first + i];
+
+		double difference = query_vec[i] - value;
+		sum += plan->norm_l2 ? difference*difference : fabs(difference);
+	}
+
+	double distance = (plan->norm_l2 ? sqrt(sum) : sum) - store->errors[level];
+	return (distance > 0) ? distance : 0;
+}
+
+/* ======================================================================================
+*
+* build_integer_query: returns the query in the type of the original data, or NULL if the
+*				original data is not made of integers or the query does not fit in their type
+*
+*      * store - records of the index
+*	   * query_vec - the query
+*
+* ====================================================================================== */
+static void *build_integer_query(interleaved_store *store, const double *query_vec)
+{
+	if (store->value_type == VALUE_TYPE_FLOAT)
+		return NULL;
+
+	double largest = (store->value_type == VALUE_TYPE_UINT8) ? VALUE_TYPE_UINT8_MAX : VALUE_TYPE_INT16_MAX;
+	void *integer_query = malloc(value_size(store->value_type)*TOTAL_DIMENSIONS);
+	int i;
+
+	for (i = 0; i < TOTAL_DIMENSIONS; i++)
+	{
+		if (query_vec[i] < 0 || query_vec[i] > largest || query_vec[i] != floor(query_vec[i]))
+		{
+			free(integer_query);
+			return NULL;
+		}
+
+		if (store->value_type == VALUE_TYPE_UINT8)
+			((unsigned char *)integer_query)[i] = (unsigned char)query_vec[i];
+		else
+			((unsigned short *)integer_query)[i] = (unsigned short)query_vec[i];
+	}
+
+	return integer_query;
+}
+
+/* ======================================================================================
+*
+* interleaved_store_refine: computes the distance of every candidate at a sequence of levels,
+*				stopping at the first level where it exceeds epsilon. The record of the next
+*				candidate is prefetched before the current one is evaluated
+*
+*      * store - records of the index
+*	   * query - matrix containing the query vector and all of its projections
+*	   * levels - levels to evaluate, in order
+*	   * num_levels - number of levels to evaluate
+*	   * epsilon - radius of the query
+*	   * candidates - candidates to refine
+*	   * num_candidates - number of candidates
+*	   * matches - output array with room for num_candidates matches
+*
+* ====================================================================================== */
+long interleaved_store_refine(interleaved_store *store, gsl_matrix *query, const int *levels, int num_levels, double epsilon,
+	const query_match *candidates, long num_candidates, query_match *matches)
+{
+	projection_plan *plan = get_projection_plan();
+	long num_matches = 0, j, line;
+	int i;
+
+	double *constants = (double *)malloc(sizeof(double)*num_levels);
+	for (i = 0; i < num_levels; i++)
+		constants[i] = compute_constant_c(levels[i]);
+
+	void *integer_query = build_integer_query(store, gsl_matrix_ptr(query, 0, 0));
+
+	for (j = 0; j < num_candidates; j++)
+	{
+		long long id = candidates[j].id;
+		if (id < 1 || id > store->num_vectors)
+			continue;
+
+		/* the projected levels of the next record are brought into the cache while this one is
+		 * evaluated; the original data is only read by the candidates that reach it */
+		if (j + 1 < num_candidates && candidates[j + 1].id >= 1 && candidates[j + 1].id <= store->num_vectors)
+		{
+			const char *next = (const char *)&store->records[(candidates[j + 1].id - 1)*store->record_size];
+			for (line = 0; line <= store->original_offset; line += INTERLEAVED_ALIGNMENT)
+				_mm_prefetch(next + line, _MM_HINT_T0);
+		}
+
+		const unsigned char *record = &store->records[(id - 1)*store->record_size];
+		double distance = 0;
+
+		for (i = 0; i < num_levels; i++)
+		{
+			int level = levels[i];
+
+			if (level == 0)
+				distance = constants[i] * original_distance(store, record, gsl_matrix_ptr(query, 0, 0), integer_query, plan->norm_l2);
+			else
+				distance = constants[i] * projected_distance(store, record, level, gsl_matrix_ptr(query, level, 0), plan);
+
+			if (distance > epsilon)
+				break;
+		}
+
+		if (i < num_levels)
+			continue;
+
+		matches[num_matches].id = id;
+		matches[num_matches].distance = distance;
+		num_matches++;
+	}
+
+	free(integer_query);
+	free(constants);
+
+	return num_matches;
+}
@@ -0,0 +1,537 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* ivf_index.cpp
+* This file contains the implementation of the inverted file over the lowest level of the
+* index. The distances follow the norm of the index, so the triangle inequality bounds the
+* distance from the query to every vector of a cluster by its distance to the centroid minus
+* the radius of the cluster.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "ivf_index.hpp"
+#include "projection.hpp"
+
+/* inverted file of the current index, read by the first query */
+static ivf_index *IVF_INDEX = NULL;
+
+/* state of the random generator used to seed the centroids */
+static unsigned long long IVF_SEED = 2463534242ULL;
+
+/* ======================================================================================
+*
+* next_random: xorshift generator, so that the clusters are the same on every build
+*
+* ====================================================================================== */
+static unsigned long long next_random()
+{
+	IVF_SEED ^= IVF_SEED << 13;
+	IVF_SEED ^= IVF_SEED >> 7;
+	IVF_SEED ^= IVF_SEED << 17;
+	return IVF_SEED;
+}
+
+/* ======================================================================================
+*
+* level_distance: distance between two vectors, with the norm of the index
+*
+* ====================================================================================== */
+static double level_distance(const double *a, const double *b, int dims)
+{
+	return projection_plan_distance(get_projection_plan(), a, b, dims);
+}
+
+/* ======================================================================================
+*
+* closest_centroid: returns the cluster whose centroid is the closest to a vector
+*
+*      * ivf - inverted file
+*	   * vector - vector of the level
+*	   * distance - output distance to the closest centroid, or NULL
+*
+* ====================================================================================== */
+static int closest_centroid(ivf_index *ivf, const double *vector, double *distance)
+{
+	int list, best = 0;
+	double best_distance = GSL_POSINF;
+
+	for (list = 0; list < ivf->num_lists; list++)
+	{
+		double d = level_distance(vector, &ivf->centroids[list*ivf->dims], ivf->dims);
+		if (d < best_distance)
+		{
+			best_distance = d;
+			best = list;
+		}
+	}
+
+	if (distance != NULL)
+		*distance = best_distance;
+
+	return best;
+}
+
+/* ======================================================================================
+*
+* ivf_index_alloc: allocates an empty inverted file for a level
+*
+*      * dims - dimension of the level
+*
+* ====================================================================================== */
+ivf_index *ivf_index_alloc(int dims)
+{
+	ivf_index *ivf = (ivf_index *)calloc(1, sizeof(ivf_index));
+	ivf->dims = dims;
+
+	return ivf;
+}
+
+/* ======================================================================================
+*
+* ivf_index_free: deallocates an inverted file
+*
+*      * ivf - the inverted file to deallocate
+*
+* ====================================================================================== */
+void ivf_index_free(ivf_index *ivf)
+{
+	if (ivf == NULL)
+		return;
+
+	free(ivf->centroids);
+	free(ivf->radii);
+	free(ivf->list_offsets);
+	free(ivf->ids);
+	free(ivf->vectors);
+	free(ivf);
+}
+
+/* ======================================================================================
+*
+* ivf_index_add_vectors: appends the next chunk of vectors of the level. The chunks must be
+*				added in the order of their IDs, which is the order in which they are
+*				inserted in the database
+*
+*      * ivf - inverted file being built
+*	   * data - chunk of vectors, one per row
+*	   * num_rows - number of vectors of the chunk
+*
+* ====================================================================================== */
+void ivf_index_add_vectors(ivf_index *ivf, gsl_matrix *data, long num_rows)
+{
+	if (ivf->num_vectors + num_rows > ivf->capacity)
+	{
+		while (ivf->num_vectors + num_rows > ivf->capacity)
+			ivf->capacity = (ivf->capacity == 0) ? CHUNK_SIZE : 2 * ivf->capacity;
+
+		ivf->vectors = (double *)realloc(ivf->vectors, sizeof(double)*ivf->capacity*ivf->dims);
+	}
+
+	long row;
+	int i;
+	for (row = 0; row < num_rows; row++)
+		for (i = 0; i < ivf->dims; i++)
+			ivf->vectors[(ivf->num_vectors + row)*ivf->dims + i] = gsl_matrix_get(data, row, i);
+
+	ivf->num_vectors += num_rows;
+}
+
+/* ======================================================================================
+*
+* run_kmeans: computes the centroids of a training set with Lloyd's algorithm. The centroids
+*				start at distinct random vectors and a cluster that becomes empty is moved to
+*				the training vector farthest from its centroid
+*
+*      * ivf - inverted file being built, with num_lists set
+*	   * training - training vectors, num_training x dims
+*	   * num_training - number of training vectors
+*
+* ====================================================================================== */
+static void run_kmeans(ivf_index *ivf, const double *training, long num_training)
+{
+	int dims = ivf->dims, list, i;
+	long t;
+
+	int *assignment = (int *)malloc(sizeof(int)*num_training);
+	double *distances = (double *)malloc(sizeof(double)*num_training);
+	long *counts = (long *)malloc(sizeof(long)*ivf->num_lists);
+
+	/* partial Fisher-Yates shuffle of the training indices to seed the centroids */
+	long *order = (long *)malloc(sizeof(long)*num_training);
+	for (t = 0; t < num_training; t++)
+		order[t] = t;
+	for (list = 0; list < ivf->num_lists; list++)
+	{
+		long pick = list + (long)(next_random() % (unsigned long long)(num_training - list));
+		long swap = order[list]; order[list] = order[pick]; order[pick] = swap;
+
+		memcpy(&ivf->centroids[list*dims], &training[order[list] * dims], sizeof(double)*dims);
+	}
+	free(order);
+
+	for (t = 0; t < num_training; t++)
+		assignment[t] = -1;
+
+	int iteration;
+	for (iteration = 0; iteration < IVF_KMEANS_ITERATIONS; iteration++)
+	{
+		long changed = 0;
+
+		/* assign every training vector to its closest centroid */
+		for (t = 0; t < num_training; t++)
+		{
+			int closest = closest_centroid(ivf, &training[t*dims], &distances[t]);
+			if (closest != assignment[t])
+			{
+				assignment[t] = closest;
+				changed++;
+			}
+		}
+
+		if (changed == 0)
+			break;
+
+		/* move every centroid to the mean of its cluster */
+		memset(ivf->centroids, 0, sizeof(double)*ivf->num_lists*dims);
+		memset(counts, 0, sizeof(long)*ivf->num_lists);
+
+		for (t = 0; t < num_training; t++)
+		{
+			counts[assignment[t]]++;
+			for (i = 0; i < dims; i++)
+				ivf->centroids[assignment[t] * dims + i] += training[t*dims + i];
+		}
+
+		for (list = 0; list < ivf->num_lists; list++)
+		{
+			if (counts[list] > 0)
+			{
+				for (i = 0; i < dims; i++)
+					ivf->centroids[list*dims + i] /= counts[list];
+				continue;
+			}
+
+			/* an empty cluster takes the vector that is worst represented */
+			long farthest = 0;
+			for (t = 1; t < num_training; t++)
+				if (distances[t] > distances[farthest])
+					farthest = t;
+
+			memcpy(&ivf->centroids[list*dims], &training[farthest*dims], sizeof(double)*dims);
+			distances[farthest] = 0;
+		}
+	}
+
+	free(assignment);
+	free(distances);
+	free(counts);
+}
+
+/* ======================================================================================
+*
+* ivf_index_train: clusters the vectors with k-means and groups them by cluster. The
+*				centroids are trained on at most IVF_TRAINING_SAMPLE vectors taken at regular
+*				intervals of the IDs, and every vector is then assigned to its closest centroid
+*
+*      * ivf - inverted file being built
+*	   * num_lists - number of clusters
+*
+* ====================================================================================== */
+void ivf_index_train(ivf_index *ivf, int num_lists)
+{
+	int dims = ivf->dims, list;
+	long v;
+
+	if (ivf->num_vectors == 0)
+		return;
+
+	ivf->num_lists = (num_lists < ivf->num_vectors) ? num_lists : (int)ivf->num_vectors;
+	ivf->centroids = (double *)malloc(sizeof(double)*ivf->num_lists*dims);
+	ivf->radii = (double *)calloc(ivf->num_lists, sizeof(double));
+	ivf->list_offsets = (long *)calloc(ivf->num_lists + 1, sizeof(long));
+
+	/* training set */
+	long num_training = (ivf->num_vectors < IVF_TRAINING_SAMPLE) ? ivf->num_vectors : IVF_TRAINING_SAMPLE;
+	double *training = (double *)malloc(sizeof(double)*num_training*dims);
+
+	long t;
+	for (t = 0; t < num_training; t++)
+	{
+		long source = (long)((double)t * ivf->num_vectors / num_training);
+		memcpy(&training[t*dims], &ivf->vectors[source*dims], sizeof(double)*dims);
+	}
+
+	run_kmeans(ivf, training, num_training);
+	free(training);
+
+	/* assign every vector and measure the radius of every cluster */
+	int *assignment = (int *)malloc(sizeof(int)*ivf->num_vectors);
+	for (v = 0; v < ivf->num_vectors; v++)
+	{
+		double distance;
+		assignment[v] = closest_centroid(ivf, &ivf->vectors[v*dims], &distance);
+
+		ivf->list_offsets[assignment[v] + 1]++;
+		if (distance > ivf->radii[assignment[v]])
+			ivf->radii[assignment[v]] = distance;
+	}
+
+	for (list = 0; list < ivf->num_lists; list++)
+		ivf->list_offsets[list + 1] += ivf->list_offsets[list];
+
+	/* group the vectors by cluster. IDs start at 1, in insertion order */
+	long *next = (long *)malloc(sizeof(long)*ivf->num_lists);
+	memcpy(next, ivf->list_offsets, sizeof(long)*ivf->num_lists);
+
+	double *grouped = (double *)malloc(sizeof(double)*ivf->num_vectors*dims);
+	ivf->ids = (long long *)malloc(sizeof(long long)*ivf->num_vectors);
+
+	for (v = 0; v < ivf->num_vectors; v++)
+	{
+		long position = next[assignment[v]]++;
+
+		ivf->ids[position] = v + 1;
+		memcpy(&grouped[position*dims], &ivf->vectors[v*dims], sizeof(double)*dims);
+	}
+
+	free(ivf->vectors);
+	ivf->vectors = grouped;
+	ivf->capacity = ivf->num_vectors;
+
+	free(next);
+	free(assignment);
+
+	if (DEBUG_OPTION > 0)
+		printf("\nInverted file: %ld vectors in %d clusters\n", ivf->num_vectors, ivf->num_lists);
+}
+
+/* ======================================================================================
+*
+* build_ivf_path: returns the path of the inverted file of the dataset
+*
+* ====================================================================================== */
+static char *build_ivf_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.ivf", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* ivf_index_write: saves the inverted file next to the dataset
+*
+*      * ivf - trained inverted file
+*
+* ====================================================================================== */
+void ivf_index_write(ivf_index *ivf)
+{
+	char *path = build_ivf_path();
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		printf("[ERROR] Unable to write the inverted file to %s\n", path);
+		free(path);
+		return;
+	}
+
+	int magic = IVF_MAGIC;
+	fwrite(&magic, sizeof(int), 1, file);
+	fwrite(&ivf->dims, sizeof(int), 1, file);
+	fwrite(&ivf->num_vectors, sizeof(long), 1, file);
+	fwrite(&ivf->num_lists, sizeof(int), 1, file);
+	fwrite(ivf->centroids, sizeof(double), ivf->num_lists*ivf->dims, file);
+	fwrite(ivf->radii, sizeof(double), ivf->num_lists, file);
+	fwrite(ivf->list_offsets, sizeof(long), ivf->num_lists + 1, file);
+	fwrite(ivf->ids, sizeof(long long), ivf->num_vectors, file);
+	fwrite(ivf->vectors, sizeof(double), ivf->num_vectors*ivf->dims, file);
+
+	fclose(file);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* ivf_index_read: reads the inverted file of the dataset, or returns NULL if the file does not
+*				exist or does not match the lowest level of the index
+*
+* ====================================================================================== */
+static ivf_index *ivf_index_read()
+{
+	char *path = build_ivf_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, dims = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != IVF_MAGIC
+		|| fread(&dims, sizeof(int), 1, file) != 1 || dims != get_projection_plan()->dims[NUM_PROJECTIONS])
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	ivf_index *ivf = ivf_index_alloc(dims);
+
+	int valid = fread(&ivf->num_vectors, sizeof(long), 1, file) == 1
+		&& fread(&ivf->num_lists, sizeof(int), 1, file) == 1 && ivf->num_lists > 0;
+
+	if (valid)
+	{
+		size_t num_centroid_values = (size_t)ivf->num_lists*dims;
+		size_t num_vector_values = (size_t)ivf->num_vectors*dims;
+
+		ivf->centroids = (double *)malloc(sizeof(double)*num_centroid_values);
+		ivf->radii = (double *)malloc(sizeof(double)*ivf->num_lists);
+		ivf->list_offsets = (long *)malloc(sizeof(long)*(ivf->num_lists + 1));
+		ivf->ids = (long long *)malloc(sizeof(long long)*ivf->num_vectors);
+		ivf->vectors = (double *)malloc(sizeof(double)*num_vector_values);
+		ivf->capacity = ivf->num_vectors;
+
+		valid = fread(ivf->centroids, sizeof(double), num_centroid_values, file) == num_centroid_values
+			&& fread(ivf->radii, sizeof(double), ivf->num_lists, file) == (size_t)ivf->num_lists
+			&& fread(ivf->list_offsets, sizeof(long), ivf->num_lists + 1, file) == (size_t)(ivf->num_lists + 1)
+			&& fread(ivf->ids, sizeof(long long), ivf->num_vectors, file) == (size_t)ivf->num_vectors
+			&& fread(ivf->vectors, sizeof(double), num_vector_values, file) == num_vector_values;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		ivf_index_free(ivf);
+		return NULL;
+	}
+
+	return ivf;
+}
+
+/* ======================================================================================
+*
+* get_ivf_index: returns the inverted file of the current index, read from the file the first
+*				time it is needed. Returns NULL if the index has no inverted file
+*
+* ====================================================================================== */
+ivf_index *get_ivf_index()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the inverted file was read */
+	if (checked_version != INDEX_VERSION)
+	{
+		ivf_index_free(IVF_INDEX);
+		IVF_INDEX = (NUM_PROJECTIONS > 0) ? ivf_index_read() : NULL;
+		checked_version = INDEX_VERSION;
+	}
+
+	return IVF_INDEX;
+}
+
+/* ======================================================================================
+*
+* compare_list_distances: orders clusters by the distance from the query to their centroid
+*
+* ====================================================================================== */
+static const double *LIST_DISTANCES = NULL;
+
+static int compare_list_distances(const void *a, const void *b)
+{
+	double x = LIST_DISTANCES[*(const int *)a], y = LIST_DISTANCES[*(const int *)b];
+	return (x > y) - (x < y);
+}
+
+/* ======================================================================================
+*
+* ivf_index_search: appends to the candidates the vectors of the probed clusters within
+*				epsilon of the query, and returns the new number of candidates. Without
+*				nprobe, a cluster is probed if the distance from the query to its centroid
+*				minus its radius is within epsilon, so no match is lost. With nprobe, only the
+*				nprobe closest clusters are probed
+*
+*      * ivf - inverted file of the lowest level
+*	   * query_vec - projection of the query at the lowest level
+*	   * constant_c - constant that multiplies the distances of the level
+*	   * epsilon - radius of the query
+*	   * nprobe - number of closest clusters probed, 0 to probe every cluster that can hold
+*				  a vector within epsilon
+*	   * candidates - array of candidates, reallocated when it is full
+*	   * num_candidates - number of candidates already in the array
+*	   * capacity - number of candidates allocated
+*
+* ====================================================================================== */
+long ivf_index_search(ivf_index *ivf, const double *query_vec, double constant_c, double epsilon, int nprobe,
+	query_match **candidates, long num_candidates, long *capacity)
+{
+	int dims = ivf->dims, list, p;
+
+	/* the vectors read by the query from the database may differ from the ones of the
+	 * inverted file by the rounding of every coordinate */
+	double tolerance = constant_c * IVF_ROUNDING * dims;
+
+	double *list_distances = (double *)malloc(sizeof(double)*ivf->num_lists);
+	int *probed = (int *)malloc(sizeof(int)*ivf->num_lists);
+	int num_probed = 0;
+
+	for (list = 0; list < ivf->num_lists; list++)
+	{
+		list_distances[list] = level_distance(query_vec, &ivf->centroids[list*dims], dims);
+
+		if (nprobe > 0 || constant_c * (list_distances[list] - ivf->radii[list]) <= epsilon + tolerance)
+			probed[num_probed++] = list;
+	}
+
+	/* keep the nprobe closest clusters */
+	if (nprobe > 0 && nprobe < num_probed)
+	{
+		LIST_DISTANCES = list_distances;
+		qsort(probed, num_probed, sizeof(int), compare_list_distances);
+		num_probed = nprobe;
+	}
+
+	long num_read = 0;
+	for (p = 0; p < num_probed; p++)
+	{
+		list = probed[p];
+
+		long v;
+		for (v = ivf->list_offsets[list]; v < ivf->list_offsets[list + 1]; v++)
+		{
+			double distance = constant_c * level_distance(query_vec, &ivf->vectors[v*dims], dims);
+			if (distance > epsilon + tolerance)
+				continue;
+
+			if (num_candidates == *capacity)
+			{
+				*capacity *= 2;
+				*candidates = (query_match *)realloc(*candidates, sizeof(query_match)*(*capacity));
+			}
+
+			(*candidates)[num_candidates].id = ivf->ids[v];
+			(*candidates)[num_candidates].distance = distance;
+			num_candidates++;
+		}
+
+		num_read += ivf->list_offsets[list + 1] - ivf->list_offsets[list];
+	}
+
+	if (DEBUG_OPTION > 0)
+		printf("\nInverted file: %d of %d clusters probed, %ld of %ld vectors read\n",
+			num_probed, ivf->num_lists, num_read, ivf->num_vectors);
+
+	free(list_distances);
+	free(probed);
+
+	return num_candidates;
+}
@@ -80,16 +80,23 @@ int main( int argc, char **argv )
 	double NUM_RUNS = 5;
 	float avg_diffs = 0;
 
-	long *IDs;
+	id_set *IDs = NULL;
+
+	/* set when the deadline of a run expired before its candidates were refined */
+	int partial = 0;
 
 	/* compute each query 10x */
 	for( run = 0; run < NUM_RUNS; run++ )
 	{
+		/* every run repeats the same query, which must not be answered by the cache */
+		perform_query_clear_cache();
+
 		/* save starting time */
 		t1 = clock();   
 
 		/* find more similar vectors */
-		IDs = performQuery(hdbc);
+		id_set_free( IDs );
+		IDs = perform_query(hdbc, &partial, NULL);
   
 		/* save ending time */
 		 t2 = clock();
@@ -105,16 +112,23 @@ int main( int argc, char **argv )
 
 	printf("\nAverage Time for query1 = %f\n", avg_diffs / NUM_RUNS );
 	printf("\nNumber of similar vectors returned = %ld\n", NUM_ITEMS);
+
+	if( partial )
+		printf("\nThe deadline of the query expired: the vectors returned are not complete\n");
 	
 	/* preview the computed vectors */
-	int i;
-	for( i = 0; i < NUM_ITEMS; i++ )
-		if( i >= 10 ) break;
-		else
-			printf("%d\n", IDs[i]);
+	if( IDs != NULL )
+	{
+		id_set_iterator it;
+		id_set_iterator_init( &it, IDs );
+
+		int i; long long id;
+		for( i = 0; i < 10 && id_set_iterator_next( &it, &id ); i++ )
+			printf("%lld\n", id);
+	}
 
 	/* free memory */
-	free( IDs );
+	id_set_free( IDs );
 
 	/* close database connections */
 	sql_close_connection(hdbc);
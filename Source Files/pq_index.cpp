@@ -0,0 +1,709 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* pq_index.cpp
+* This file contains the implementation of the product quantization of one level. The level
+* is computed from the original data with the projection plan, so it can be quantized in two
+* passes over the data: the first one keeps a sample to train the codebooks and the second
+* one codes every vector, without keeping the level in memory.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "pq_index.hpp"
+#include "projection.hpp"
+
+/* product quantization of the current index, read by the first query */
+static pq_index *PQ_INDEX = NULL;
+
+/* state of the random generator used to seed the centroids */
+static unsigned long long PQ_SEED = 88172645463325252ULL;
+
+/* residual code of the vectors whose distance to their quantized vector exceeds every step */
+#define PQ_UNBOUNDED_RESIDUAL       255
+
+/* ======================================================================================
+*
+* next_random: xorshift generator, so that the codebooks are the same on every build
+*
+* ====================================================================================== */
+static unsigned long long next_random()
+{
+	PQ_SEED ^= PQ_SEED << 13;
+	PQ_SEED ^= PQ_SEED >> 7;
+	PQ_SEED ^= PQ_SEED << 17;
+	return PQ_SEED;
+}
+
+/* ======================================================================================
+*
+* partial_distance: returns the part of the distance between two vectors contributed by some
+*				coordinates. With the L2 norm, the squares are not rooted, so the parts of the
+*				subspaces add up
+*
+*      * a, b - the coordinates
+*	   * dims - number of coordinates
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*
+* ====================================================================================== */
+static double partial_distance(const double *a, const double *b, int dims, int norm_l2)
+{
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < dims; i++)
+	{
+		double difference = a[i] - b[i];
+		sum += norm_l2 ? difference*difference : fabs(difference);
+	}
+
+	return sum;
+}
+
+/* ======================================================================================
+*
+* closest_centroid: returns the centroid of a subspace closest to the coordinates of a vector
+*				in that subspace
+*
+*      * pq - product quantization with trained codebooks
+*	   * subspace - the subspace
+*	   * vector - coordinates of the vector in the subspace
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*	   * distance - output partial distance to the centroid
+*
+* ====================================================================================== */
+static int closest_centroid(pq_index *pq, int subspace, const double *vector, int norm_l2, double *distance)
+{
+	int sub_dims = pq->subspace_offsets[subspace + 1] - pq->subspace_offsets[subspace];
+	const double *codebook = &pq->codebooks[pq->num_centroids*pq->subspace_offsets[subspace]];
+
+	int closest = 0, centroid;
+	*distance = partial_distance(vector, codebook, sub_dims, norm_l2);
+
+	for (centroid = 1; centroid < pq->num_centroids; centroid++)
+	{
+		double d = partial_distance(vector, &codebook[centroid*sub_dims], sub_dims, norm_l2);
+		if (d < *distance)
+		{
+			*distance = d;
+			closest = centroid;
+		}
+	}
+
+	return closest;
+}
+
+/* ======================================================================================
+*
+* run_kmeans: trains the codebook of a subspace with k-means. The centroids start at distinct
+*				random training vectors and a centroid that becomes empty is moved to the
+*				training vector farthest from its centroid
+*
+*      * pq - product quantization being built, with num_centroids set
+*	   * subspace - the subspace
+*	   * training - training vectors of the whole level, num_training x dims
+*	   * num_training - number of training vectors
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*
+* ====================================================================================== */
+static void run_kmeans(pq_index *pq, int subspace, const double *training, long num_training, int norm_l2)
+{
+	int first = pq->subspace_offsets[subspace];
+	int sub_dims = pq->subspace_offsets[subspace + 1] - first, centroid, i;
+	double *codebook = &pq->codebooks[pq->num_centroids*first];
+	long t;
+
+	int *assignment = (int *)malloc(sizeof(int)*num_training);
+	double *distances = (double *)malloc(sizeof(double)*num_training);
+	long *counts = (long *)malloc(sizeof(long)*pq->num_centroids);
+
+	/* partial Fisher-Yates shuffle of the training indices to seed the centroids */
+	long *order = (long *)malloc(sizeof(long)*num_training);
+	for (t = 0; t < num_training; t++)
+		order[t] = t;
+	for (centroid = 0; centroid < pq->num_centroids; centroid++)
+	{
+		long pick = centroid + (long)(next_random() % (unsigned long long)(num_training - centroid));
+		long swap = order[centroid]; order[centroid] = order[pick]; order[pick] = swap;
+
+		memcpy(&codebook[centroid*sub_dims], &training[order[centroid] * pq->dims + first], sizeof(double)*sub_dims);
+	}
+	free(order);
+
+	for (t = 0; t < num_training; t++)
+		assignment[t] = -1;
+
+	int iteration;
+	for (iteration = 0; iteration < PQ_KMEANS_ITERATIONS; iteration++)
+	{
+		long changed = 0;
+
+		/* assign every training vector to its closest centroid */
+		for (t = 0; t < num_training; t++)
+		{
+			int closest = closest_centroid(pq, subspace, &training[t*pq->dims + first], norm_l2, &distances[t]);
+			if (closest != assignment[t])
+			{
+				assignment[t] = closest;
+				changed++;
+			}
+		}
+
+		if (changed == 0)
+			break;
+
+		/* move every centroid to the mean of its cluster */
+		memset(codebook, 0, sizeof(double)*pq->num_centroids*sub_dims);
+		memset(counts, 0, sizeof(long)*pq->num_centroids);
+
+		for (t = 0; t < num_training; t++)
+		{
+			counts[assignment[t]]++;
+			for (i = 0; i < sub_dims; i++)
+				codebook[assignment[t] * sub_dims + i] += training[t*pq->dims + first + i];
+		}
+
+		for (centroid = 0; centroid < pq->num_centroids; centroid++)
+		{
+			if (counts[centroid] > 0)
+			{
+				for (i = 0; i < sub_dims; i++)
+					codebook[centroid*sub_dims + i] /= counts[centroid];
+				continue;
+			}
+
+			/* an empty cluster takes the vector that is worst represented */
+			long farthest = 0;
+			for (t = 1; t < num_training; t++)
+				if (distances[t] > distances[farthest])
+					farthest = t;
+
+			memcpy(&codebook[centroid*sub_dims], &training[farthest*pq->dims + first], sizeof(double)*sub_dims);
+			distances[farthest] = 0;
+		}
+	}
+
+	free(assignment);
+	free(distances);
+	free(counts);
+}
+
+/* ======================================================================================
+*
+* load_level_chunk: reads a chunk of the original data and returns its vectors at a level,
+*				num_vecs x dims values
+*
+*      * hdbc - an opened SQL connection
+*	   * plan - projection plan of the index
+*	   * level - level of the index
+*	   * chunk_indx - chunk to read
+*	   * chunks_to_read - number of chunks of the dataset
+*	   * num_vecs - number of vectors of the chunk
+*
+* ====================================================================================== */
+static double *load_level_chunk(HDBC hdbc, projection_plan *plan, int level, int chunk_indx, int chunks_to_read, long num_vecs)
+{
+	int dims = plan->dims[level], i;
+	long row;
+
+	double *level_data = (double *)malloc(sizeof(double)*num_vecs*dims);
+	double *vector = (double *)malloc(sizeof(double)*TOTAL_DIMENSIONS);
+
+	gsl_matrix *database_matrix = load_data_chunk(hdbc, chunk_indx, chunks_to_read, num_vecs, TOTAL_DIMENSIONS);
+
+	for (row = 0; row < num_vecs; row++)
+	{
+		for (i = 0; i < TOTAL_DIMENSIONS; i++)
+			vector[i] = gsl_matrix_get(database_matrix, row, i);
+
+		const double *projected = (level == 0) ? vector : projection_plan_project(plan, vector) + plan->offsets[level];
+		memcpy(&level_data[row*dims], projected, sizeof(double)*dims);
+	}
+
+	gsl_matrix_free(database_matrix);
+	free(vector);
+
+	return level_data;
+}
+
+/* ======================================================================================
+*
+* pq_index_alloc: allocates an empty product quantization of a level, with the coordinates
+*				split into subspaces of equal dimension
+*
+*      * level - level of the index
+*	   * dims - dimension of the level
+*	   * num_subspaces - number of subspaces
+*
+* ====================================================================================== */
+static pq_index *pq_index_alloc(int level, int dims, int num_subspaces)
+{
+	pq_index *pq = (pq_index *)calloc(1, sizeof(pq_index));
+
+	if (num_subspaces > dims) num_subspaces = dims;
+	if (num_subspaces < 1) num_subspaces = 1;
+
+	pq->level = level;
+	pq->dims = dims;
+	pq->num_subspaces = num_subspaces;
+	pq->subspace_offsets = (int *)malloc(sizeof(int)*(num_subspaces + 1));
+
+	int subspace;
+	for (subspace = 0; subspace <= num_subspaces; subspace++)
+		pq->subspace_offsets[subspace] = subspace * dims / num_subspaces;
+
+	return pq;
+}
+
+/* ======================================================================================
+*
+* pq_index_free: deallocates a product quantization
+*
+*      * pq - the product quantization to deallocate
+*
+* ====================================================================================== */
+void pq_index_free(pq_index *pq)
+{
+	if (pq == NULL)
+		return;
+
+	free(pq->subspace_offsets);
+	free(pq->codebooks);
+	free(pq->codes);
+	free(pq->blocks);
+	free(pq->residuals);
+	free(pq);
+}
+
+/* ======================================================================================
+*
+* build_pq_path: returns the path of the product quantization of the dataset
+*
+* ====================================================================================== */
+static char *build_pq_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.pq", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* pq_index_write: saves the product quantization next to the dataset
+*
+*      * pq - the product quantization
+*
+* ====================================================================================== */
+static void pq_index_write(pq_index *pq)
+{
+	char *path = build_pq_path();
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		printf("[ERROR] Unable to write the product quantization to %s\n", path);
+		free(path);
+		return;
+	}
+
+	int magic = PQ_MAGIC;
+	fwrite(&magic, sizeof(int), 1, file);
+	fwrite(&pq->level, sizeof(int), 1, file);
+	fwrite(&pq->dims, sizeof(int), 1, file);
+	fwrite(&pq->num_subspaces, sizeof(int), 1, file);
+	fwrite(&pq->num_centroids, sizeof(int), 1, file);
+	fwrite(&pq->num_vectors, sizeof(long), 1, file);
+	fwrite(&pq->residual_step, sizeof(double), 1, file);
+	fwrite(pq->codebooks, sizeof(double), pq->num_centroids*pq->dims, file);
+	fwrite(pq->codes, sizeof(unsigned char), pq->num_vectors*pq->num_subspaces, file);
+	fwrite(pq->residuals, sizeof(unsigned char), pq->num_vectors, file);
+
+	fclose(file);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* pq_index_build: trains the codebooks on at most PQ_TRAINING_SAMPLE vectors taken at regular
+*				intervals of the IDs, then codes every vector with its closest centroid in
+*				every subspace. The distance of a vector to its quantized vector is stored in
+*				steps of the largest distance of the sample, rounded up
+*
+*      * hdbc - an opened SQL connection
+*	   * level - level of the index
+*	   * num_subspaces - number of subspaces
+*
+* ====================================================================================== */
+void pq_index_build(HDBC hdbc, int level, int num_subspaces)
+{
+	projection_plan *plan = get_projection_plan();
+	int norm_l2 = plan->norm_l2, subspace;
+
+	if (TOTAL_VECTORS == 0)
+		return;
+
+	pq_index *pq = pq_index_alloc(level, plan->dims[level], num_subspaces);
+	int dims = pq->dims;
+
+	int chunks_to_read = compute_num_chunks(), chunk_indx;
+	long first_id, row, t;
+
+	/* first pass: the training sample */
+	long num_training = (TOTAL_VECTORS < PQ_TRAINING_SAMPLE) ? TOTAL_VECTORS : PQ_TRAINING_SAMPLE;
+	double *training = (double *)malloc(sizeof(double)*num_training*dims);
+
+	for (chunk_indx = 0, first_id = 0, t = 0; chunk_indx < chunks_to_read && t < num_training; chunk_indx++)
+	{
+		long remaining_vecs = compute_num_vecs_to_load(chunk_indx, chunks_to_read);
+		double *level_data = load_level_chunk(hdbc, plan, level, chunk_indx, chunks_to_read, remaining_vecs);
+
+		/* vector t of the sample is the vector t x TOTAL_VECTORS / num_training */
+		long source;
+		while (t < num_training && (source = (long)((double)t * TOTAL_VECTORS / num_training)) < first_id + remaining_vecs)
+		{
+			memcpy(&training[t*dims], &level_data[(source - first_id)*dims], sizeof(double)*dims);
+			t++;
+		}
+
+		first_id += remaining_vecs;
+		free(level_data);
+	}
+	num_training = t;
+
+	pq->num_centroids = (num_training < PQ_CENTROIDS) ? (int)num_training : PQ_CENTROIDS;
+	pq->codebooks = (double *)malloc(sizeof(double)*pq->num_centroids*dims);
+
+	for (subspace = 0; subspace < pq->num_subspaces; subspace++)
+		run_kmeans(pq, subspace, training, num_training, norm_l2);
+
+	/* the steps of the residuals cover the largest residual of the sample */
+	double largest_residual = 0;
+
+	for (t = 0; t < num_training; t++)
+	{
+		double sum = 0, distance;
+		for (subspace = 0; subspace < pq->num_subspaces; subspace++)
+		{
+			closest_centroid(pq, subspace, &training[t*dims + pq->subspace_offsets[subspace]], norm_l2, &distance);
+			sum += distance;
+		}
+
+		double residual = norm_l2 ? sqrt(sum) : sum;
+		if (residual > largest_residual)
+			largest_residual = residual;
+	}
+	free(training);
+
+	pq->residual_step = largest_residual / (PQ_UNBOUNDED_RESIDUAL - 1);
+
+	/* second pass: code every vector */
+	pq->num_vectors = TOTAL_VECTORS;
+	pq->codes = (unsigned char *)malloc(sizeof(unsigned char)*pq->num_vectors*pq->num_subspaces);
+	pq->residuals = (unsigned char *)malloc(sizeof(unsigned char)*pq->num_vectors);
+
+	for (chunk_indx = 0, first_id = 0; chunk_indx < chunks_to_read; chunk_indx++)
+	{
+		long remaining_vecs = compute_num_vecs_to_load(chunk_indx, chunks_to_read);
+		double *level_data = load_level_chunk(hdbc, plan, level, chunk_indx, chunks_to_read, remaining_vecs);
+
+		for (row = 0; row < remaining_vecs; row++)
+		{
+			long v = first_id + row;
+			double sum = 0, distance;
+
+			for (subspace = 0; subspace < pq->num_subspaces; subspace++)
+			{
+				pq->codes[v*pq->num_subspaces + subspace] = (unsigned char)closest_centroid(pq, subspace,
+					&level_data[row*dims + pq->subspace_offsets[subspace]], norm_l2, &distance);
+				sum += distance;
+			}
+
+			double residual = norm_l2 ? sqrt(sum) : sum;
+			double steps = (pq->residual_step > 0) ? ceil(residual / pq->residual_step) : (residual > 0) ? PQ_UNBOUNDED_RESIDUAL : 0;
+
+			pq->residuals[v] = (unsigned char)((steps < PQ_UNBOUNDED_RESIDUAL) ? steps : PQ_UNBOUNDED_RESIDUAL);
+		}
+
+		first_id += remaining_vecs;
+		free(level_data);
+	}
+
+	if (DEBUG_OPTION > 0)
+		printf("\nProduct quantization of level %d: %ld vectors, %d bytes per vector\n", level, pq->num_vectors, pq->num_subspaces);
+
+	pq_index_write(pq);
+	pq_index_free(pq);
+}
+
+/* ======================================================================================
+*
+* pq_index_read: reads the product quantization of the dataset, or returns NULL if the file
+*				does not exist or does not match the levels of the index
+*
+* ====================================================================================== */
+static pq_index *pq_index_read()
+{
+	char *path = build_pq_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, level = -1, dims = 0, num_subspaces = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != PQ_MAGIC
+		|| fread(&level, sizeof(int), 1, file) != 1 || level < 0 || level > NUM_PROJECTIONS
+		|| fread(&dims, sizeof(int), 1, file) != 1 || dims != get_projection_plan()->dims[level]
+		|| fread(&num_subspaces, sizeof(int), 1, file) != 1 || num_subspaces < 1 || num_subspaces > dims)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	pq_index *pq = pq_index_alloc(level, dims, num_subspaces);
+
+	int valid = fread(&pq->num_centroids, sizeof(int), 1, file) == 1
+		&& pq->num_centroids > 0 && pq->num_centroids <= PQ_CENTROIDS
+		&& fread(&pq->num_vectors, sizeof(long), 1, file) == 1 && pq->num_vectors > 0
+		&& fread(&pq->residual_step, sizeof(double), 1, file) == 1;
+
+	if (valid)
+	{
+		size_t num_values = (size_t)pq->num_centroids*dims;
+		size_t num_codes = (size_t)pq->num_vectors*num_subspaces;
+
+		pq->codebooks = (double *)malloc(sizeof(double)*num_values);
+		pq->codes = (unsigned char *)malloc(sizeof(unsigned char)*num_codes);
+		pq->residuals = (unsigned char *)malloc(sizeof(unsigned char)*pq->num_vectors);
+
+		valid = fread(pq->codebooks, sizeof(double), num_values, file) == num_values
+			&& fread(pq->codes, sizeof(unsigned char), num_codes, file) == num_codes
+			&& fread(pq->residuals, sizeof(unsigned char), pq->num_vectors, file) == (size_t)pq->num_vectors;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		pq_index_free(pq);
+		return NULL;
+	}
+
+	/* the scan reads the codes of a subspace for a block of vectors at once. The vectors past
+	 * the last one of the last block have the code 0 and are never returned */
+	long num_blocks = (pq->num_vectors + PQ_BLOCK_SIZE - 1) / PQ_BLOCK_SIZE, v;
+	pq->blocks = (unsigned char *)calloc((size_t)num_blocks*num_subspaces*PQ_BLOCK_SIZE, sizeof(unsigned char));
+
+	int subspace;
+	for (v = 0; v < pq->num_vectors; v++)
+		for (subspace = 0; subspace < num_subspaces; subspace++)
+			pq->blocks[((v / PQ_BLOCK_SIZE)*num_subspaces + subspace)*PQ_BLOCK_SIZE + v % PQ_BLOCK_SIZE] = pq->codes[v*num_subspaces + subspace];
+
+	free(pq->codes);
+	pq->codes = NULL;
+
+	return pq;
+}
+
+/* ======================================================================================
+*
+* quantize_tables: quantizes the partial distances of the query to one byte each. Every value
+*				is rounded down, so a sum of quantized values times the step is never larger
+*				than the sum of the values. Values beyond 255 steps are clipped to 255
+*
+*      * tables - partial distances, num_subspaces x PQ_CENTROIDS
+*	   * num_values - number of values of the tables
+*	   * step - distance of one step
+*	   * quantized - output values, num_subspaces x PQ_CENTROIDS
+*
+* ====================================================================================== */
+static void quantize_tables(const double *tables, long num_values, double step, unsigned char *quantized)
+{
+	long i;
+	for (i = 0; i < num_values; i++)
+	{
+		double steps = floor(tables[i] / step);
+
+		/* the division may round up */
+		if (steps > 0 && steps * step > tables[i])
+			steps--;
+
+		quantized[i] = (unsigned char)((steps < 255) ? steps : 255);
+	}
+}
+
+/* ======================================================================================
+*
+* sum_block: sums the quantized values of the codes of a block of PQ_BLOCK_SIZE vectors. A
+*				table of 256 bytes is read as 16 registers: the low 4 bits of a code select
+*				the byte of every register with a shuffle and the high 4 bits select the
+*				register. The sums saturate at 65535, which keeps them lower bounds
+*
+*      * pq - product quantization of a level
+*	   * block - codes of the block
+*	   * quantized - quantized tables of the query, num_subspaces x PQ_CENTROIDS
+*	   * sums - output sum of every vector of the block
+*
+* ====================================================================================== */
+static void sum_block(const pq_index *pq, const unsigned char *block, const unsigned char *quantized, unsigned short *sums)
+{
+	__m128i zero = _mm_setzero_si128(), nibble = _mm_set1_epi8(0x0F);
+	__m128i low_sum = _mm_setzero_si128(), high_sum = _mm_setzero_si128();
+
+	int num_registers = (pq->num_centroids + 15) / 16, subspace, r;
+	for (subspace = 0; subspace < pq->num_subspaces; subspace++, block += PQ_BLOCK_SIZE, quantized += PQ_CENTROIDS)
+	{
+		__m128i codes = _mm_loadu_si128((const __m128i *)block);
+		__m128i low = _mm_and_si128(codes, nibble);
+		__m128i high = _mm_and_si128(_mm_srli_epi16(codes, 4), nibble);
+
+		__m128i values = zero;
+		for (r = 0; r < num_registers; r++)
+		{
+			__m128i table = _mm_loadu_si128((const __m128i *)(quantized + 16 * r));
+			__m128i selected = _mm_cmpeq_epi8(high, _mm_set1_epi8((char)r));
+			values = _mm_or_si128(values, _mm_and_si128(selected, _mm_shuffle_epi8(table, low)));
+		}
+
+		low_sum = _mm_adds_epu16(low_sum, _mm_unpacklo_epi8(values, zero));
+		high_sum = _mm_adds_epu16(high_sum, _mm_unpackhi_epi8(values, zero));
+	}
+
+	_mm_storeu_si128((__m128i *)sums, low_sum);
+	_mm_storeu_si128((__m128i *)(sums + 8), high_sum);
+}
+
+/* ======================================================================================
+*
+* get_pq_index: returns the product quantization of the current index, read from the file
+*				the first time it is needed. Returns NULL if the index has none
+*
+* ====================================================================================== */
+pq_index *get_pq_index()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the product quantization was read */
+	if (checked_version != INDEX_VERSION)
+	{
+		pq_index_free(PQ_INDEX);
+		PQ_INDEX = pq_index_read();
+		checked_version = INDEX_VERSION;
+	}
+
+	return PQ_INDEX;
+}
+
+/* ======================================================================================
+*
+* pq_index_scan: appends to the candidates the vectors whose lower bound is within epsilon of
+*				the query, with their lower bounds, and returns the new number of candidates.
+*				The distance to a quantized vector is the sum of one value per subspace, read
+*				from a table with the partial distance from the query to every centroid. The
+*				tables are also quantized to one byte, so that the codes of a block of vectors
+*				are summed with shuffles, and a vector is only summed with the exact tables when
+*				the quantized sum, a smaller value, does not already prune it
+*
+*      * pq - product quantization of a level
+*	   * query_vec - projection of the query at the level of the quantization
+*	   * constant_c - constant that multiplies the distances of the level
+*	   * epsilon - radius of the query
+*	   * candidates - array of candidates, reallocated when it is full
+*	   * num_candidates - number of candidates already in the array
+*	   * capacity - number of candidates allocated
+*
+* ====================================================================================== */
+long pq_index_scan(pq_index *pq, const double *query_vec, double constant_c, double epsilon,
+	query_match **candidates, long num_candidates, long *capacity)
+{
+	int norm_l2 = get_projection_plan()->norm_l2, subspace, centroid;
+
+	/* partial distance from the query to every centroid of every subspace */
+	double *tables = (double *)calloc(pq->num_subspaces*PQ_CENTROIDS, sizeof(double));
+
+	for (subspace = 0; subspace < pq->num_subspaces; subspace++)
+	{
+		int first = pq->subspace_offsets[subspace];
+		int sub_dims = pq->subspace_offsets[subspace + 1] - first;
+		const double *codebook = &pq->codebooks[pq->num_centroids*first];
+
+		for (centroid = 0; centroid < pq->num_centroids; centroid++)
+			tables[subspace*PQ_CENTROIDS + centroid] = partial_distance(&query_vec[first], &codebook[centroid*sub_dims], sub_dims, norm_l2);
+	}
+
+	/* the vectors read from the database may differ from the quantized ones by the rounding of
+	 * every coordinate */
+	double radius = epsilon / constant_c + PQ_ROUNDING * pq->dims;
+
+	/* one step of the quantized tables: a sum at the radius is about 128 steps per subspace, so
+	 * the quantized sums separate the vectors near the radius and saturate far beyond it */
+	double step = (norm_l2 ? radius*radius : radius) / (128.0 * pq->num_subspaces);
+
+	unsigned char *quantized = (unsigned char *)malloc(sizeof(unsigned char)*pq->num_subspaces*PQ_CENTROIDS);
+	quantize_tables(tables, (long)pq->num_subspaces*PQ_CENTROIDS, step, quantized);
+
+	unsigned short sums[PQ_BLOCK_SIZE];
+	long v, block_indx = -1;
+	const unsigned char *block = NULL;
+
+	for (v = 0; v < pq->num_vectors; v++)
+	{
+		int lane = (int)(v % PQ_BLOCK_SIZE);
+		if (lane == 0)
+		{
+			block_indx++;
+			block = &pq->blocks[block_indx*pq->num_subspaces*PQ_BLOCK_SIZE];
+			sum_block(pq, block, quantized, sums);
+		}
+
+		/* the distance to the vector is at least the distance to its quantized vector minus
+		 * the distance between them, and the quantized sum is at most the sum */
+		if (pq->residuals[v] != PQ_UNBOUNDED_RESIDUAL)
+		{
+			double quantized_sum = sums[lane] * step;
+			if ((norm_l2 ? sqrt(quantized_sum) : quantized_sum) - pq->residuals[v] * pq->residual_step > radius)
+				continue;
+		}
+
+		const double *table = tables;
+		double sum = 0;
+
+		for (subspace = 0; subspace < pq->num_subspaces; subspace++, table += PQ_CENTROIDS)
+			sum += table[block[subspace*PQ_BLOCK_SIZE + lane]];
+
+		double distance = norm_l2 ? sqrt(sum) : sum;
+		double bound = 0;
+
+		if (pq->residuals[v] != PQ_UNBOUNDED_RESIDUAL)
+		{
+			bound = distance - pq->residuals[v] * pq->residual_step;
+			if (bound > radius)
+				continue;
+			if (bound < 0)
+				bound = 0;
+		}
+
+		if (num_candidates == *capacity)
+		{
+			*capacity *= 2;
+			*candidates = (query_match *)realloc(*candidates, sizeof(query_match)*(*capacity));
+		}
+
+		(*candidates)[num_candidates].id = v + 1;
+		(*candidates)[num_candidates].distance = constant_c * bound;
+		num_candidates++;
+	}
+
+	free(quantized);
+	free(tables);
+
+	return num_candidates;
+}
@@ -17,6 +17,37 @@
 
 #include "projection.hpp"
 
+/* cache of query results, created by the first query */
+static query_cache *RESULT_CACHE = NULL;
+
+/* projection plan of the index, created by the first query */
+static projection_plan *QUERY_PLAN = NULL;
+
+/* ======================================================================================
+*
+* load_companion_chunk: returns a chunk of the previous level of the other norm
+*
+*      * hdbc - an  opened SQL connection
+*	   * indx - index of the chunk
+*	   * total_chunks - number of chunks of the level
+*	   * num_vecs - number of vectors of the chunk
+*	   * dims - dimension of the previous level
+*
+* ======================================================================================
+*/
+static gsl_matrix *load_companion_chunk(HDBC hdbc, int indx, int total_chunks, long num_vecs, int dims)
+{
+	companion_norm_swap();
+	update_table_name(dims);
+
+	gsl_matrix *matrix_database = load_data_chunk(hdbc, indx, total_chunks, num_vecs, dims);
+
+	companion_norm_swap();
+	update_table_name(dims);
+
+	return matrix_database;
+}
+
 /* ======================================================================================
 *
 * project_database: performs a bulk insert into the database
@@ -31,8 +62,76 @@ void project_database(HDBC hdbc)
 	if (!PERFORM_INDEX_PHASE)
 		return;
 
+	/* identical vectors are indexed once */
+	collapse_duplicates(COLLAPSE_DUPLICATES && BILLION_DATASET == 0);
+
+	/* integer-valued datasets are stored in narrow integer columns */
+	assign_value_type();
+
 	sql_fill_database(hdbc, TOTAL_DIMENSIONS);
 
+	/* choose the windows on a sample of the original data */
+	if (TUNE_WINDOWS && BILLION_DATASET == 0)
+	{
+		tune_windows(hdbc, TUNE_WINDOWS == 2);
+
+		/* tuning mode: the index is built by a later run with the windows displayed */
+		if (TUNE_WINDOWS == 1)
+		{
+			printf("\nTuning finished. Run again with the windows above to build the index\n");
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	/* group correlated columns into the windows of the first projection step */
+	dimension_order_build(hdbc, GROUP_CORRELATED_DIMENSIONS && BILLION_DATASET == 0);
+
+	/* store the original data along a curve of the lowest level, so that every level is
+	 * projected in that order */
+	reorder_database(hdbc, (BILLION_DATASET == 0) ? REORDER_IDS : ID_ORDER_LOAD);
+
+	/* attributes of the vectors, in the order of their IDs, for the filters of the queries */
+	if (BILLION_DATASET == 0)
+		attribute_store_build();
+
+	/* sort the original data by the norm of its vectors, for the range cuts of the scans */
+	if (NORM_INDEX && BILLION_DATASET == 0)
+		sql_add_norm_index(hdbc, TOTAL_DIMENSIONS);
+
+	/* the levels of the other norm are projected in the same pass, from the same original data */
+	int both_norms = BUILD_BOTH_NORMS && BILLION_DATASET == 0;
+	int norm_l2 = (strcmp(NORM_TYPE, "L2") == 0);
+	if (both_norms)
+		companion_norm_share_table(hdbc);
+
+	/* code one level in a few bytes per vector, from the data in its final order */
+	if (BUILD_PQ_INDEX && BILLION_DATASET == 0)
+		pq_index_build(hdbc, (PQ_LEVEL < 0 || PQ_LEVEL > NUM_PROJECTIONS) ? NUM_PROJECTIONS : PQ_LEVEL, PQ_NUM_SUBSPACES);
+
+	/* store all the levels of every vector in one record, to refine candidates in one read */
+	if (INTERLEAVED_LAYOUT && BILLION_DATASET == 0)
+		interleaved_store_build(hdbc);
+
+	/* sample every level to estimate the selectivity of the queries */
+	index_statistics *statistics = index_statistics_alloc();
+
+	/* bounding boxes of the blocks of every level, to skip blocks during the scans */
+	zone_map *zones = zone_map_alloc();
+
+	/* the same structures for the levels of the other norm */
+	index_statistics *companion_statistics = both_norms ? index_statistics_alloc() : NULL;
+	zone_map *companion_zones = both_norms ? zone_map_alloc() : NULL;
+
+	/* vectors of the level of the graph, linked once the index is built */
+	int hnsw_level = (HNSW_LEVEL < 0 || HNSW_LEVEL > NUM_PROJECTIONS) ? NUM_PROJECTIONS : HNSW_LEVEL;
+	hnsw_index *hnsw = BUILD_HNSW_INDEX ? hnsw_index_alloc(hnsw_level, get_projection_plan()->dims[hnsw_level]) : NULL;
+
+	/* vectors of the lowest level, clustered once the index is built */
+	ivf_index *ivf = (BUILD_IVF_INDEX && NUM_PROJECTIONS > 0) ? ivf_index_alloc(get_projection_plan()->dims[NUM_PROJECTIONS]) : NULL;
+
+	/* vectors of the lowest level, approximated once the index is built */
+	va_file *va = (BUILD_VA_FILE && NUM_PROJECTIONS > 0) ? va_file_alloc(get_projection_plan()->dims[NUM_PROJECTIONS], VA_FILE_BITS) : NULL;
+
 	/* compute the new dimensions according to the window sizes */
 	int prev_dim = TOTAL_DIMENSIONS;
 	int current_dim = TOTAL_DIMENSIONS / WINDOWS[0];
@@ -62,6 +161,16 @@ void project_database(HDBC hdbc)
 		/* create a file to temporarily store the projected data */
 		FILE *projected_dataset_file = open_file();
 
+		/* and another one for the level of the other norm */
+		char *companion_path = NULL;
+		FILE *companion_file = NULL;
+		if (both_norms)
+		{
+			companion_path = (char *)malloc(sizeof(char)*(strlen(DATASET_PATH) + 10));
+			sprintf(companion_path, "%s_%s", DATASET_PATH, companion_norm_type());
+			companion_file = fopen(companion_path, "w");
+		}
+
 		/* compute the number of times we need to partition the dataset according to a CHUNK_SIZE */
 		int chunks_to_read = compute_num_chunks();
 
@@ -79,14 +188,66 @@ void project_database(HDBC hdbc)
 
 			/* structure that will hold the projected data */
 			gsl_matrix * projected_data = gsl_matrix_alloc(remaining_vecs, current_dim);
+			gsl_matrix * companion_data = both_norms ? gsl_matrix_alloc(remaining_vecs, current_dim) : NULL;
 
 			/* load the chunk of data */
 			gsl_matrix *database_matrix = load_data_chunk(hdbc, chunk_indx, chunks_to_read, remaining_vecs, prev_dim );
 
-			/*  multiply this piece of data by the orthogonal projection matrix */
-			compute_orthogonal_projection(projection_matrix, database_matrix, &projected_data, current_dim,
+			/* the first step reads the columns of the original data in the order of the index */
+			dimension_order *order = (proj_step == 0) ? get_dimension_order() : NULL;
+			gsl_matrix *ordered_matrix = (order != NULL) ? dimension_order_apply(order, database_matrix, remaining_vecs) : database_matrix;
+
+			/*  multiply this piece of data by the orthogonal projection matrix. The first step
+			 * reduces the same projections of the original data with both norms */
+			compute_orthogonal_projection(projection_matrix, ordered_matrix, &projected_data, norm_l2,
+				(companion_data != NULL && proj_step == 0) ? &companion_data : NULL, current_dim,
 				window, chunk_indx, chunks_to_read, remaining_vecs);
 
+			if (ordered_matrix != database_matrix)
+				gsl_matrix_free(ordered_matrix);
+
+			/* the next steps of the other norm project its own previous level */
+			if (companion_data != NULL && proj_step > 0)
+			{
+				gsl_matrix *companion_matrix = load_companion_chunk(hdbc, chunk_indx, chunks_to_read, remaining_vecs, prev_dim);
+
+				compute_orthogonal_projection(projection_matrix, companion_matrix, &companion_data, !norm_l2, NULL, current_dim,
+					window, chunk_indx, chunks_to_read, remaining_vecs);
+
+				gsl_matrix_free(companion_matrix);
+			}
+
+			/* the original data is only read by the first projection step */
+			if (proj_step == 0)
+			{
+				index_statistics_add_vectors(statistics, 0, database_matrix, remaining_vecs, prev_dim);
+				zone_map_add_vectors(zones, 0, database_matrix, remaining_vecs, prev_dim);
+				if (hnsw != NULL && hnsw_level == 0)
+					hnsw_index_add_vectors(hnsw, database_matrix, remaining_vecs);
+			}
+			index_statistics_add_vectors(statistics, proj_step + 1, projected_data, remaining_vecs, current_dim);
+			zone_map_add_vectors(zones, proj_step + 1, projected_data, remaining_vecs, current_dim);
+			if (ivf != NULL && proj_step == NUM_PROJECTIONS - 1)
+				ivf_index_add_vectors(ivf, projected_data, remaining_vecs);
+			if (va != NULL && proj_step == NUM_PROJECTIONS - 1)
+				va_file_add_vectors(va, projected_data, remaining_vecs);
+			if (hnsw != NULL && hnsw_level == proj_step + 1)
+				hnsw_index_add_vectors(hnsw, projected_data, remaining_vecs);
+
+			if (companion_data != NULL)
+			{
+				if (proj_step == 0)
+				{
+					index_statistics_add_vectors(companion_statistics, 0, database_matrix, remaining_vecs, prev_dim);
+					zone_map_add_vectors(companion_zones, 0, database_matrix, remaining_vecs, prev_dim);
+				}
+				index_statistics_add_vectors(companion_statistics, proj_step + 1, companion_data, remaining_vecs, current_dim);
+				zone_map_add_vectors(companion_zones, proj_step + 1, companion_data, remaining_vecs, current_dim);
+
+				write_projection_data(companion_file, companion_data, remaining_vecs, current_dim);
+				gsl_matrix_free(companion_data);
+			}
+
 			/* clear the memory */
 			gsl_matrix_free(database_matrix);
 
@@ -99,205 +260,984 @@ void project_database(HDBC hdbc)
 
 		fclose(projected_dataset_file);
 
+		/* transfer the level of the other norm to the table of that norm */
+		if (companion_file != NULL)
+		{
+			fclose(companion_file);
+
+			char *dataset_path = DATASET_PATH;
+			DATASET_PATH = companion_path;
+			companion_norm_swap();
+
+			update_table_name(current_dim);
+			sql_fill_database(hdbc, current_dim);
+
+			if (NORM_INDEX)
+				sql_add_norm_index(hdbc, current_dim);
+
+			companion_norm_swap();
+			DATASET_PATH = dataset_path;
+
+			remove(companion_path);
+			free(companion_path);
+		}
+
 		/* transfer data to database */
 		update_table_name(current_dim);
 		sql_fill_database(hdbc, current_dim);
 
+		if (NORM_INDEX && BILLION_DATASET == 0)
+			sql_add_norm_index(hdbc, current_dim);
+
 		/* delete projected file */
 		remove(DATASET_PATH);
 	}
+
+	/* compute the histograms of every level and save them next to the dataset */
+	index_statistics_finish(statistics);
+	index_statistics_write(statistics);
+	index_statistics_free(statistics);
+
+	zone_map_write(zones);
+	zone_map_free(zones);
+
+	if (ivf != NULL)
+	{
+		ivf_index_train(ivf, IVF_NUM_LISTS);
+		ivf_index_write(ivf);
+		ivf_index_free(ivf);
+	}
+
+	if (va != NULL)
+	{
+		va_file_encode(va);
+		va_file_write(va);
+		va_file_free(va);
+	}
+
+	if (hnsw != NULL)
+	{
+		hnsw_index_build(hnsw, HNSW_BUILD_THREADS);
+		hnsw_index_write(hnsw);
+		hnsw_index_free(hnsw);
+	}
+
+	if (both_norms)
+	{
+		/* the order of the IDs and of the columns is read again with the names of the other norm */
+		companion_norm_share_files();
+
+		/* the statistics are calibrated with the plan of the other norm */
+		companion_norm_swap();
+		INDEX_VERSION++;
+
+		index_statistics_finish(companion_statistics);
+		index_statistics_write(companion_statistics);
+		index_statistics_free(companion_statistics);
+
+		zone_map_write(companion_zones);
+		zone_map_free(companion_zones);
+
+		companion_norm_swap();
+		INDEX_VERSION++;
+	}
 }
 
 /* ======================================================================================
 *
-* project_database: performs a bulk insert into the database
+* perform_query: reads the query vector from QUERY_PATH and returns the set of IDs of the
+*				vectors within EPSILON of it, or of its KNN_DEFAULT_K nearest neighbours when
+*				EPSILON is not positive
 *
 *      * hdbc - an  opened SQL connection
+*	   * partial - output 1 if the deadline expired before every candidate was refined, or NULL
+*	   * unrefined - output set of the candidates that were not refined, or NULL
 *
 * ======================================================================================
 */
-long *perform_query(HDBC hdbc)
+id_set *perform_query(HDBC hdbc, int *partial, id_set **unrefined)
 {
+	if( partial != NULL )
+		*partial = 0;
+	if( unrefined != NULL )
+		*unrefined = NULL;
+
 	/* if the index option is not set, then the program returns without indexing the database */
 	if (!PERFORM_QUERY)
 		return NULL;
 
-	long *IDs;
-	long *final_IDs = NULL;
-
 	/* read the query vector */
 	double *query = assign_query();
 
-	/* compute query subspaces */
-	gsl_matrix *query_matrix = computeSubspace( query );
+	/* compressed set to hold the IDs of the most similar vectors returned by every table */
+	id_set *final_IDs = id_set_alloc();
+
+	/* vectors allowed by the attributes the query is restricted to */
+	attribute_filter *filter = attribute_filter_load( QUERY_PATH );
 
-	/* constant C */
-	int const_c = 2;
+	/* without an epsilon, return the nearest neighbours of the query among those vectors */
+	if( EPSILON <= 0 )
+	{
+		long num_neighbours, j;
+		query_match *neighbours = perform_knn_query(hdbc, query, KNN_DEFAULT_K, filter, &num_neighbours);
 
-	/* total number of similar vectors returned */
-	NUM_ITEMS = 0;
+		for( j = 0; j < num_neighbours; j++ )
+			duplicate_set_add_members( final_IDs, neighbours[j].id );
 
-	/* first projection dimension */
-	int current_dim = TOTAL_DIMENSIONS/WINDOWS[0];
+		NUM_ITEMS = (int)id_set_cardinality( final_IDs );
 
-	/* compute the dimension of the lowest projection */
-	int w;
-	for( w = 1; w < NUM_PROJECTIONS; w++ )
-		current_dim /= WINDOWS[w];
+		attribute_filter_free( filter );
+		free( neighbours );
+		free( query );
 
-	int curr_step = 0;
+		return final_IDs;
+	}
 
-	/* structure to hold the IDs of the most similar vectors returned */
-	long size = 100000;
-	final_IDs = (long *)malloc(sizeof(long)*( size ) );
+	if( QUERY_CACHE && RESULT_CACHE == NULL )
+		RESULT_CACHE = query_cache_alloc( QUERY_CACHE_MAX_BYTES );
 
-	int i = 0; int dataset_tables;
-	( BILLION_DATASET == 0 ) ? dataset_tables = 1 : dataset_tables = 30;
+	/* matches of the query, either from the cache or from the database */
+	query_match *matches;
+	long num_matches, j;
 
-	for( i = 1; i <= dataset_tables; i++ )
+	if( RESULT_CACHE == NULL || !query_cache_lookup( RESULT_CACHE, query, EPSILON, &matches, &num_matches ) )
 	{
+		long capacity = RESULT_BATCH_SIZE;
+		matches = (query_match *)malloc(sizeof(query_match)*capacity);
+		num_matches = 0;
 
-		/* update db_table_name for current dimension */
-		DB_TABLE_NAME = (char *)malloc(sizeof(char)*(40));
+		/* collect every batch of matches of the stream */
+		query_stream *stream = perform_query_open(hdbc, query, QUERY_TIME_BUDGET, filter);
 
-		if( BILLION_DATASET == 0 )
-			sprintf(DB_TABLE_NAME, "[dbo].[%s_%d_%s]", DATASET_ROOT_NAME, current_dim, NORM_TYPE);
-		else
-			sprintf(DB_TABLE_NAME, "[dbo].[%dbillion_%d_%s]", i, current_dim, NORM_TYPE);
+		query_match *batch;
+		long batch_size;
+		while( (batch_size = perform_query_next(stream, &batch)) > 0 )
+		{
+			if( num_matches + batch_size > capacity )
+			{
+				while( num_matches + batch_size > capacity )
+					capacity *= 2;
+				matches = (query_match *)realloc(matches, sizeof(query_match)*capacity);
+			}
+
+			memcpy( matches + num_matches, batch, sizeof(query_match)*batch_size );
+			num_matches += batch_size;
+		}
 
-		printf( "\n%s\n", DB_TABLE_NAME );
+		/* a query stopped by its deadline returns the matches confirmed so far, which must 
+		 * not be reused by other queries, and so do filtered queries */
+		if( stream->partial )
+		{
+			query_match *candidates;
+			long num_unrefined = perform_query_unrefined(stream, &candidates);
+
+			if( partial != NULL )
+				*partial = 1;
+
+			/* the candidates are returned in the numbering of the dataset file, as the matches */
+			if( unrefined != NULL )
+			{
+				*unrefined = id_set_alloc();
+				for( j = 0; j < num_unrefined; j++ )
+					if( attribute_filter_contains( filter, candidates[j].id ) )
+						duplicate_set_add_members( *unrefined, candidates[j].id );
+			}
+
+			if( DEBUG_OPTION >= 1 )
+				printf("\nQuery deadline expired: %ld confirmed matches, %ld candidates not refined\n", num_matches, num_unrefined);
+		}
+		else if( filter == NULL && RESULT_CACHE != NULL )
+			query_cache_insert( RESULT_CACHE, query, EPSILON, matches, num_matches );
 
-		/* compute the most similar vectors to the query vector */
-		IDs = sql_compute_distances(hdbc, query_matrix, i, current_dim);
+		perform_query_close(stream);
+	}
 
-		/* add vectors IDs to final array */
-		int j;
-		for( j = 0; j < NUM_ITEMS; j++, curr_step++ )
-			final_IDs[curr_step] = IDs[j];
+	if( DEBUG_OPTION >= 1 && RESULT_CACHE != NULL )
+		print_query_cache_statistics( RESULT_CACHE );
 
-		curr_step++;
-		
-		/* free temporary vector ID list */
-		free( IDs );
-	}
+	/* add the IDs of the matches to the final set, in the numbering of the dataset file, with
+	 * every line identical to them. The cached matches of a filtered query are not filtered yet */
+	for( j = 0; j < num_matches; j++ )
+		if( attribute_filter_contains( filter, matches[j].id ) )
+			duplicate_set_add_members( final_IDs, matches[j].id );
 
 	/* update the global variable with the toal vectors returned */
-	NUM_ITEMS = curr_step;
+	NUM_ITEMS = (int)id_set_cardinality( final_IDs );
+
+	/* free memory */
+	attribute_filter_free( filter );
+	free( matches );
+	free( query );
 
 	return final_IDs;
 }
 
 /* ======================================================================================
 *
-* project_database: performs a bulk insert into the database
+* perform_query_clear_cache: forgets the results kept by the previous queries, so that the next
+*				query is answered by the index
 *
-*      * hdbc - an  opened SQL connection
+* ======================================================================================
+*/
+void perform_query_clear_cache()
+{
+	if( RESULT_CACHE != NULL )
+		query_cache_clear( RESULT_CACHE );
+}
+
+/* ======================================================================================
+*
+* perform_query_open: starts a query and returns a stream over its matches
+*
+*      * hdbc - an opened SQL connection
+*	   * query - the query vector with TOTAL_DIMENSIONS values
+*	   * time_budget - maximum running time of the query in milliseconds, 0 for no limit
+*	   * filter - vectors the query may return, NULL for every vector
 *
 * ======================================================================================
 */
-int flength_ids( long *IDs )
+query_stream *perform_query_open(HDBC hdbc, double *query, double time_budget, const attribute_filter *filter)
 {
-	int l;
-	while(IDs[l] != NULL )
-		l++;
+	query_stream *stream = (query_stream *)malloc(sizeof(query_stream));
 
-	return l+1;
+	stream->hdbc = hdbc;
+	stream->filter = filter;
+
+	/* the deadline is checked once per partition of candidates */
+	stream->deadline = ( time_budget > 0 ) ? clock() + (clock_t)( time_budget * CLOCKS_PER_SEC / 1000.0 ) : 0;
+	stream->partial = 0;
+
+	/* compute query subspaces */
+	stream->query_matrix = compute_subspace( query );
+
+	/* choose the levels to evaluate from the statistics of the previous queries */
+	stream->plan = cascade_plan_build( stream->query_matrix, EPSILON );
+
+	if( DEBUG_OPTION >= 1 )
+	{
+		/* expected candidates of the query at every level */
+		index_statistics *statistics = get_index_statistics();
+		if( statistics != NULL )
+		{
+			double *counts = (double *)malloc(sizeof(double)*(NUM_PROJECTIONS + 1));
+			index_statistics_estimate_levels( statistics, stream->query_matrix, EPSILON, counts );
+
+			int level;
+			for( level = NUM_PROJECTIONS; level >= 0; level-- )
+				printf( "\nLevel %d: %.0f expected candidates", level, counts[level] );
+			printf( "\n" );
+
+			free( counts );
+		}
+
+		print_cascade_plan( stream->plan );
+	}
+
+	/* the tables are opened one at a time in perform_query_next */
+	stream->table_indx = 0;
+	( BILLION_DATASET == 0 ) ? stream->num_tables = 1 : stream->num_tables = 30;
+	stream->cursor = NULL;
+
+	stream->candidates_capacity = RESULT_BATCH_SIZE;
+	stream->candidates = (query_match *)malloc(sizeof(query_match)*stream->candidates_capacity);
+	stream->num_candidates = 0;
+	stream->next_candidate = 0;
+	stream->refine_from = 1;
+	stream->refined = NULL;
+	stream->refine_time = 0;
+	stream->table_matches = 0;
+	stream->finished = 0;
+
+	return stream;
+}
+
+/* ======================================================================================
+*
+* deadline_expired: returns 1 if the stream has a deadline and it has passed
+*
+*      * stream - a query stream
+*
+* ======================================================================================
+*/
+static int deadline_expired(query_stream *stream)
+{
+	if( stream->deadline == 0 || clock() < stream->deadline )
+		return 0;
+
+	stream->partial = 1;
+	return 1;
 }
 
+/* ======================================================================================
+*
+* table_size: returns the number of vectors of each table of the dataset
+*
+*      * stream - a query stream
+*
+* ======================================================================================
+*/
+static long table_size(query_stream *stream)
+{
+	return TOTAL_VECTORS / stream->num_tables;
+}
 
 /* ======================================================================================
 *
-* computeQuerySubspace: performs a bulk insert into the database
+* generate_candidates: scans the first level of the plan in the current table and stores the 
+*				vectors within EPSILON, with their lower bound distances, as candidates
 *
-*      * hdbc - an  opened SQL connection
+*      * stream - a query stream
 *
 * ======================================================================================
 */
+static void generate_candidates(query_stream *stream)
+{
+	stream->num_candidates = 0;
+	stream->next_candidate = 0;
+	stream->refine_from = 1;
 
+	int level = stream->plan->levels[0];
 
-gsl_matrix *compute_subspace( double *query )
+	/* the inverted file replaces the scan of the lowest level of a single table */
+	ivf_index *ivf = ( stream->num_tables == 1 && level == NUM_PROJECTIONS ) ? get_ivf_index() : NULL;
+	if( ivf != NULL )
+	{
+		stream->num_candidates = ivf_index_search( ivf, gsl_matrix_ptr( stream->query_matrix, level, 0 ), compute_constant_c( level ), 
+			EPSILON, IVF_NPROBE, &stream->candidates, 0, &stream->candidates_capacity );
+
+		/* probing a fixed number of clusters does not measure the selectivity of the level */
+		if( IVF_NPROBE == 0 )
+			cascade_statistics_update( level, EPSILON, table_size( stream ), stream->num_candidates );
+
+		if( DEBUG_OPTION >= 1 )
+			printf( "\nTable %d: %ld candidates at level %d from the inverted file\n", stream->table_indx, stream->num_candidates, level );
+
+		return;
+	}
+
+	/* the VA-file replaces the scan of the lowest level of a single table. Its lower bounds
+	 * are below the distances at the lowest level, so the candidates are refined through
+	 * every level of the plan, the lowest one included */
+	va_file *va = ( stream->num_tables == 1 && level == NUM_PROJECTIONS ) ? get_va_file() : NULL;
+	if( va != NULL )
+	{
+		long num_certain;
+		stream->num_candidates = va_file_scan( va, gsl_matrix_ptr( stream->query_matrix, level, 0 ), compute_constant_c( level ), 
+			EPSILON, &stream->candidates, 0, &stream->candidates_capacity, &num_certain );
+		stream->refine_from = 0;
+
+		if( DEBUG_OPTION >= 1 )
+			printf( "\nTable %d: %ld candidates below level %d from the VA-file, %ld certain at level %d\n", 
+				stream->table_indx, stream->num_candidates, level, num_certain, level );
+
+		return;
+	}
+
+	/* the product quantization replaces the scan of a single table. Its lower bounds are at a
+	 * level of its own, so the candidates are refined through every level of the plan */
+	pq_index *pq = ( stream->num_tables == 1 ) ? get_pq_index() : NULL;
+	if( pq != NULL )
+	{
+		stream->num_candidates = pq_index_scan( pq, gsl_matrix_ptr( stream->query_matrix, pq->level, 0 ), compute_constant_c( pq->level ), 
+			EPSILON, &stream->candidates, 0, &stream->candidates_capacity );
+		stream->refine_from = 0;
+
+		if( DEBUG_OPTION >= 1 )
+			printf( "\nTable %d: %ld candidates at level %d from the product quantization\n", stream->table_indx, stream->num_candidates, pq->level );
+
+		return;
+	}
+
+	sql_distance_cursor *cursor = sql_open_distance_cursor( stream->hdbc, 
+		build_query_to_scan_level( stream->query_matrix, stream->table_indx, level, EPSILON, stream->filter ) );
+
+	long num_rows;
+	while( (num_rows = sql_fetch_distance_batch( cursor )) > 0 )
+	{
+		if( stream->num_candidates + num_rows > stream->candidates_capacity )
+		{
+			while( stream->num_candidates + num_rows > stream->candidates_capacity )
+				stream->candidates_capacity *= 2;
+			stream->candidates = (query_match *)realloc(stream->candidates, sizeof(query_match)*stream->candidates_capacity);
+		}
+
+		memcpy( stream->candidates + stream->num_candidates, cursor->batch, sizeof(query_match)*num_rows );
+		stream->num_candidates += num_rows;
+
+		/* stop the scan; the candidates found so far are returned as unrefined */
+		if( deadline_expired( stream ) )
+			break;
+	}
+
+	sql_close_distance_cursor( cursor );
+
+	if( !stream->partial )
+		cascade_statistics_update( level, EPSILON, table_size( stream ), stream->num_candidates );
+
+	if( DEBUG_OPTION >= 1 )
+		printf( "\nTable %d: %ld candidates at level %d\n", stream->table_indx, stream->num_candidates, level );
+}
+
+/* ======================================================================================
+*
+* filter_matches: keeps, in their order, the matches of a batch that the filter allows and
+*				returns how many were kept
+*
+*      * filter - vectors the query may return
+*	   * matches - the batch, compacted in place
+*	   * num_matches - number of matches of the batch
+*
+* ======================================================================================
+*/
+static long filter_matches(const attribute_filter *filter, query_match *matches, long num_matches)
 {
-	/* convert double *query to gsl_matrix 
-	 * fill just the first line of the matrix
-	 */
-	int i;
-	gsl_matrix *query_matrix = gsl_matrix_alloc( NUM_PROJECTIONS+1, TOTAL_DIMENSIONS );
-	for( i = 0; i < TOTAL_DIMENSIONS; i++ )
-		gsl_matrix_set( query_matrix, 0, i, (double)query[i] );
+	long j, kept = 0;
+	for( j = 0; j < num_matches; j++ )
+		if( attribute_filter_contains( filter, matches[j].id ) )
+			matches[kept++] = matches[j];
 
-	/*  */
-	gsl_matrix *subquery = gsl_matrix_alloc( 1, TOTAL_DIMENSIONS );
-	for( i = 0; i < TOTAL_DIMENSIONS; i++ )
-		gsl_matrix_set( subquery, 0, i, (double)query[i] ); 
+	return kept;
+}
 
-	int query_indx = 1;
+/* ======================================================================================
+*
+* perform_query_next: returns the number of matches of the next batch, or zero when every
+*				table has been read or the deadline expired. The batch is valid until the 
+*				next call
+*
+*      * stream - a stream returned by perform_query_open
+*	   * batch - output pointer to the (ID, distance) pairs of the batch
+*
+* ======================================================================================
+*/
+long perform_query_next(query_stream *stream, query_match **batch)
+{
+	while( TRUE )
+	{
+		/* read the next matches of the current partition */
+		if( stream->cursor != NULL )
+		{
+			clock_t start = clock();
+			long num_fetched = sql_fetch_distance_batch( stream->cursor );
+			stream->refine_time += clock() - start;
 
-	/* compute the new dimensions according to the window sizes */
-	int prev_dim = TOTAL_DIMENSIONS;
-	int current_dim = TOTAL_DIMENSIONS / WINDOWS[0];
+			/* the candidates of the refinement are already filtered, the brute force is not */
+			long num_matches = ( stream->filter != NULL && stream->plan->num_levels == 1 ) 
+				? filter_matches( stream->filter, stream->cursor->batch, num_fetched ) : num_fetched;
 
-	int proj_step;
-	for( proj_step = 0; proj_step < NUM_PROJECTIONS; proj_step++ )
+			if( num_matches > 0 )
+			{
+				/* every table numbers its rows from 1, so the table index is kept in the 
+				 * high bits of the ID */
+				long j;
+				for( j = 0; j < num_matches; j++ )
+					stream->cursor->batch[j].id |= (long long)(stream->table_indx - 1) << SHARD_ID_SHIFT;
+
+				stream->table_matches += num_matches;
+
+				*batch = stream->cursor->batch;
+				return num_matches;
+			}
+
+			if( num_fetched > 0 )
+				continue;
+
+			sql_close_distance_cursor( stream->cursor );
+			stream->cursor = NULL;
+		}
+
+		if( stream->finished || stream->partial || deadline_expired( stream ) )
+			return 0;
+
+		/* refine the next partition of candidates through the other levels */
+		if( stream->next_candidate < stream->num_candidates )
+		{
+			long end = stream->next_candidate + CASCADE_PARTITION_SIZE;
+			if( end > stream->num_candidates )
+				end = stream->num_candidates;
+
+			clock_t start = clock();
+
+			/* the interleaved records hold every level of a candidate in one place */
+			interleaved_store *store = ( stream->num_tables == 1 ) ? get_interleaved_store() : NULL;
+			if( store != NULL )
+			{
+				if( stream->refined == NULL )
+					stream->refined = (query_match *)malloc(sizeof(query_match)*CASCADE_PARTITION_SIZE);
+
+				long num_matches = interleaved_store_refine( store, stream->query_matrix, stream->plan->levels + stream->refine_from, 
+					stream->plan->num_levels - stream->refine_from, EPSILON, stream->candidates + stream->next_candidate, 
+					end - stream->next_candidate, stream->refined );
+
+				stream->next_candidate = end;
+				stream->refine_time += clock() - start;
+
+				if( num_matches > 0 )
+				{
+					stream->table_matches += num_matches;
+
+					*batch = stream->refined;
+					return num_matches;
+				}
+				continue;
+			}
+
+			id_set *partition = id_set_alloc();
+
+			for( ; stream->next_candidate < end; stream->next_candidate++ )
+				id_set_add( partition, stream->candidates[stream->next_candidate].id );
+
+			stream->cursor = sql_open_distance_cursor( stream->hdbc, build_query_to_refine_candidates( 
+				stream->query_matrix, stream->table_indx, partition, 
+				stream->plan->levels + stream->refine_from, stream->plan->num_levels - stream->refine_from, EPSILON ) );
+			stream->refine_time += clock() - start;
+
+			id_set_free( partition );
+			continue;
+		}
+
+		/* the matches of a finished table give the selectivity of the original data, unless the
+		 * filter removed some of them */
+		if( stream->table_indx > 0 && stream->filter == NULL )
+			cascade_statistics_update( 0, EPSILON, table_size( stream ), stream->table_matches );
+
+		/* every table has been read */
+		if( stream->table_indx == stream->num_tables )
+		{
+			stream->finished = 1;
+			return 0;
+		}
+
+		stream->table_indx++;
+		stream->table_matches = 0;
+
+		/* brute force: the scan of the original data returns the matches directly */
+		if( stream->plan->num_levels == 1 )
+		{
+			stream->cursor = sql_open_distance_cursor( stream->hdbc, 
+				build_query_to_scan_level( stream->query_matrix, stream->table_indx, 0, EPSILON, stream->filter ) );
+			continue;
+		}
+
+		/* compute the candidates of the next table, and drop the ones outside the filter before
+		 * they are refined */
+		generate_candidates( stream );
+
+		if( stream->filter != NULL )
+			stream->num_candidates = filter_matches( stream->filter, stream->candidates, stream->num_candidates );
+	}
+}
+
+/* ======================================================================================
+*
+* perform_query_unrefined: returns the number of candidates that were not refined before 
+*				the deadline expired. Their distances are the lower bounds computed at the 
+*				first level of the plan
+*
+*      * stream - a stream returned by perform_query_open
+*	   * candidates - output pointer to the (ID, lower bound) pairs
+*
+* ======================================================================================
+*/
+long perform_query_unrefined(query_stream *stream, query_match **candidates)
+{
+	long j;
+	for( j = stream->next_candidate; j < stream->num_candidates; j++ )
+		stream->candidates[j].id |= (long long)(stream->table_indx - 1) << SHARD_ID_SHIFT;
+
+	/* the candidates are only tagged once */
+	long num_unrefined = stream->num_candidates - stream->next_candidate;
+	*candidates = stream->candidates + stream->next_candidate;
+
+	stream->num_candidates = stream->next_candidate;
+
+	return num_unrefined;
+}
+
+/* ======================================================================================
+*
+* perform_query_close: stops a query, even if not all of its matches were read, and
+*				deallocates the stream
+*
+*      * stream - a stream returned by perform_query_open
+*
+* ======================================================================================
+*/
+void perform_query_close(query_stream *stream)
+{
+	if( stream == NULL )
+		return;
+
+	/* the time of the refinement compares the layouts of the index */
+	if( DEBUG_OPTION >= 1 )
+		printf( "\nRefinement from the %s: %.3f ms\n", ( stream->refined != NULL ) ? "interleaved records" : "level tables", 
+			stream->refine_time * 1000.0 / CLOCKS_PER_SEC );
+
+	sql_close_distance_cursor( stream->cursor );
+	gsl_matrix_free( stream->query_matrix );
+	cascade_plan_free( stream->plan );
+	free( stream->candidates );
+	free( stream->refined );
+	free( stream );
+}
+
+/* ======================================================================================
+*
+* compare_matches: comparison function used to sort matches by distance
+*
+* ======================================================================================
+*/
+static int compare_matches(const void *a, const void *b)
+{
+	double x = ((const query_match *)a)->distance, y = ((const query_match *)b)->distance;
+	return (x > y) - (x < y);
+}
+
+/* ======================================================================================
+*
+* append_matches: appends matches to a growable array
+*
+*      * matches - the array, reallocated when needed
+*	   * num_matches - number of matches in the array
+*	   * capacity - allocated size of the array
+*	   * batch - matches to append
+*	   * batch_size - number of matches to append
+*
+* ======================================================================================
+*/
+static void append_matches(query_match **matches, long *num_matches, long *capacity, query_match *batch, long batch_size)
+{
+	if( *num_matches + batch_size > *capacity )
 	{
-		int window = WINDOWS[proj_step];
+		while( *num_matches + batch_size > *capacity )
+			*capacity *= 2;
+		*matches = (query_match *)realloc(*matches, sizeof(query_match)*(*capacity));
+	}
 
-		/* calculate the dimensions of the current and the previous projections
-		 * if the proj_step is zero, then nothing is computed   */
-		compute_dimensions(proj_step, &prev_dim, &current_dim);
+	memcpy( *matches + *num_matches, batch, sizeof(query_match)*batch_size );
+	*num_matches += batch_size;
+}
 
-		/* Compute orthogonal projection matrix */
-		gsl_matrix *projection_matrix = orthogonal_projection_matrix(window, window);
+/* ======================================================================================
+*
+* refine_knn_partition: computes the exact distance of a partition of candidates within the 
+*				radius and adds the ones within the radius to the confirmed matches
+*
+*      * hdbc - an opened SQL connection
+*	   * query_matrix - query vector and all of its projections
+*	   * table_indx - table of the candidates, starting at 1
+*	   * partition - IDs of the candidates
+*	   * radius - current radius of the search
+*	   * matches - growable array of confirmed matches
+*	   * num_matches - number of confirmed matches
+*	   * capacity - allocated size of the array of matches
+*	   * confirmed - IDs of the confirmed matches
+*
+* ======================================================================================
+*/
+static void refine_knn_partition(HDBC hdbc, gsl_matrix *query_matrix, int table_indx, id_set *partition, double radius,
+		query_match **matches, long *num_matches, long *capacity, id_set *confirmed)
+{
+	/* every level above the lowest one, down to the original data */
+	int *levels = (int *)malloc(sizeof(int)*(NUM_PROJECTIONS + 1));
+	int num_levels = 0, level;
+	for( level = NUM_PROJECTIONS - 1; level >= 0; level-- )
+		levels[num_levels++] = level;
+
+	sql_distance_cursor *cursor = sql_open_distance_cursor( hdbc, 
+		build_query_to_refine_candidates( query_matrix, table_indx, partition, levels, num_levels, radius ) );
+
+	long num_rows, j;
+	while( (num_rows = sql_fetch_distance_batch( cursor )) > 0 )
+	{
+		for( j = 0; j < num_rows; j++ )
+			id_set_add( confirmed, cursor->batch[j].id );
+
+		append_matches( matches, num_matches, capacity, cursor->batch, num_rows );
+	}
 
-		gsl_matrix *projected_data = gsl_matrix_alloc(1, current_dim);
+	sql_close_distance_cursor( cursor );
+	free( levels );
+}
+
+/* ======================================================================================
+*
+* hnsw_search_table: finds k vectors close to the query with the graph of the index. The
+*				ef vectors found in the graph are sorted by their exact distance in the
+*				original data, so the result is exact among them, but a neighbour that the
+*				graph does not reach is lost. With a filter, only the vectors of the graph
+*				that the filter allows are ranked, so fewer than k may be returned
+*
+*      * hdbc - an opened SQL connection
+*	   * query_matrix - query vector and all of its projections
+*	   * hnsw - graph of the index
+*	   * k - number of neighbours
+*	   * filter - vectors the query may return, NULL for every vector
+*	   * results - output array with room for k matches
+*
+* ======================================================================================
+*/
+static long hnsw_search_table(HDBC hdbc, gsl_matrix *query_matrix, hnsw_index *hnsw, int k, const attribute_filter *filter, query_match *results)
+{
+	int ef = ( HNSW_EF_SEARCH > k ) ? HNSW_EF_SEARCH : k;
 
-		/*  multiply this piece of data by the orthogonal projection matrix */
-		compute_orthogonal_projection_query(projection_matrix, subquery, &projected_data, current_dim, window);
+	query_match *candidates = (query_match *)malloc(sizeof(query_match)*ef);
+	long num_candidates = hnsw_index_search( hnsw, gsl_matrix_ptr( query_matrix, hnsw->level, 0 ), ef, candidates ), j;
+	num_candidates = filter_matches( filter, candidates, num_candidates );
+
+	id_set *ids = id_set_alloc();
+	for( j = 0; j < num_candidates; j++ )
+		id_set_add( ids, candidates[j].id );
+
+	/* re-rank the candidates with their distance in the original data */
+	long num_results = 0;
+	if( num_candidates > 0 )
+	{
+		sql_distance_cursor *cursor = sql_open_distance_cursor( hdbc, build_query_to_sort_level( query_matrix, 1, 0, ids ) );
 
-		subquery = gsl_matrix_alloc( 1, current_dim );
+		long num_rows;
+		while( num_results < k && (num_rows = sql_fetch_distance_batch( cursor )) > 0 )
+			for( j = 0; j < num_rows && num_results < k; j++ )
+				results[num_results++] = cursor->batch[j];
 
-		/* update the query to the new projection */
-		for( int q = 0; q < current_dim; q++ )
+		sql_close_distance_cursor( cursor );
+	}
+
+	if( DEBUG_OPTION >= 1 )
+		printf( "\nk-NN over the graph of level %d: %ld candidates, %ld returned\n", hnsw->level, num_candidates, num_results );
+
+	id_set_free( ids );
+	free( candidates );
+
+	return num_results;
+}
+
+/* ======================================================================================
+*
+* knn_search_table: finds the k vectors of a table closest to the query. The lowest projection
+*				is read sorted by distance through a single cursor, so growing the radius only
+*				reads the next rows and every distance of the level is computed once. The 
+*				candidates within the radius are then refined with the radius as epsilon, until
+*				k of them are confirmed. Every vector within the radius is a candidate, since
+*				the distance of the lowest level is a lower bound, so the k closest confirmed
+*				vectors are the exact k nearest neighbours of the table. The rows of the
+*				lowest level that the filter does not allow are dropped as they are read, so
+*				the result is the exact k nearest neighbours among the allowed vectors
+*
+*      * hdbc - an opened SQL connection
+*	   * query_matrix - query vector and all of its projections
+*	   * table_indx - table to search, starting at 1
+*	   * k - number of neighbours
+*	   * radius - initial radius of the search
+*	   * filter - vectors the query may return, NULL for every vector
+*	   * results - output array with room for k matches
+*
+* ======================================================================================
+*/
+static long knn_search_table(HDBC hdbc, gsl_matrix *query_matrix, int table_indx, int k, double radius, const attribute_filter *filter, query_match *results)
+{
+	/* the graph describes the table of a single dataset */
+	hnsw_index *hnsw = ( BILLION_DATASET == 0 ) ? get_hnsw_index() : NULL;
+	if( hnsw != NULL )
+		return hnsw_search_table( hdbc, query_matrix, hnsw, k, filter, results );
+
+	sql_distance_cursor *cursor = sql_open_distance_cursor( hdbc, build_query_to_sort_level( query_matrix, table_indx, NUM_PROJECTIONS, NULL ) );
+
+	/* rows read from the sorted level, with their lower bound distances */
+	long candidates_capacity = RESULT_BATCH_SIZE, num_fetched = 0, num_within = 0;
+	query_match *candidates = (query_match *)malloc(sizeof(query_match)*candidates_capacity);
+
+	/* candidates whose exact distance is within the radius */
+	long matches_capacity = RESULT_BATCH_SIZE, num_matches = 0;
+	query_match *matches = (query_match *)malloc(sizeof(query_match)*matches_capacity);
+	id_set *confirmed = id_set_alloc();
+
+	int round = 0;
+	while( TRUE )
+	{
+		/* grow the radius until k candidates of the lowest level are within it */
+		while( TRUE )
 		{
-			gsl_matrix_set( query_matrix, query_indx, q, gsl_matrix_get(projected_data, 0, q)); 
-			gsl_matrix_set( subquery, 0, q, gsl_matrix_get(projected_data, 0, q));
+			while( num_within < num_fetched && candidates[num_within].distance <= radius )
+				num_within++;
+
+			if( num_within == num_fetched && !cursor->finished )
+			{
+				long num_rows = filter_matches( filter, cursor->batch, sql_fetch_distance_batch( cursor ) );
+				if( num_rows > 0 )
+					append_matches( &candidates, &num_fetched, &candidates_capacity, cursor->batch, num_rows );
+				continue;
+			}
+
+			if( num_within >= k || num_within == num_fetched )
+				break;
+
+			/* a radius of zero does not grow: start from the distance of the k-th candidate */
+			radius = ( radius > 0 ) ? radius * KNN_RADIUS_GROWTH : candidates[( num_fetched < k ? num_fetched : k ) - 1].distance;
 		}
 
-		query_indx++;
+		/* refine the candidates within the radius that were not confirmed yet */
+		id_set *partition = id_set_alloc();
+		long j, partition_size = 0;
+		for( j = 0; j < num_within; j++ )
+		{
+			if( id_set_contains( confirmed, candidates[j].id ) )
+				continue;
+
+			id_set_add( partition, candidates[j].id );
+
+			if( ++partition_size == CASCADE_PARTITION_SIZE )
+			{
+				refine_knn_partition( hdbc, query_matrix, table_indx, partition, radius, &matches, &num_matches, &matches_capacity, confirmed );
+				id_set_free( partition );
+				partition = id_set_alloc();
+				partition_size = 0;
+			}
+		}
+
+		if( partition_size > 0 )
+			refine_knn_partition( hdbc, query_matrix, table_indx, partition, radius, &matches, &num_matches, &matches_capacity, confirmed );
+		id_set_free( partition );
+
+		if( DEBUG_OPTION >= 1 )
+			printf( "\nk-NN table %d, round %d: radius %f, %ld candidates, %ld confirmed\n", table_indx, round, radius, num_within, num_matches );
+		round++;
+
+		/* done when k vectors are confirmed, or when every vector of the table is */
+		if( num_matches >= k || ( cursor->finished && num_matches == num_fetched ) )
+			break;
+
+		radius = ( radius > 0 ) ? radius * KNN_RADIUS_GROWTH : 1;
 	}
 
-	return query_matrix;
+	sql_close_distance_cursor( cursor );
+
+	/* keep the k closest confirmed vectors */
+	qsort( matches, num_matches, sizeof(query_match), compare_matches );
+
+	long num_results = ( num_matches < k ) ? num_matches : k, j;
+	for( j = 0; j < num_results; j++ )
+	{
+		results[j] = matches[j];
+		results[j].id |= (long long)(table_indx - 1) << SHARD_ID_SHIFT;
+	}
+
+	id_set_free( confirmed );
+	free( matches );
+	free( candidates );
+
+	return num_results;
 }
 
-void compute_orthogonal_projection_query(gsl_matrix *projection_matrix, gsl_matrix *query, gsl_matrix **projected_data, int dim, int window )
+/* ======================================================================================
+*
+* perform_knn_query: returns the k vectors closest to the query, sorted by distance, without
+*				an epsilon. The initial radius is the epsilon that the statistics of the index
+*				expect to return k vectors
+*
+*      * hdbc - an opened SQL connection
+*	   * query - the query vector with TOTAL_DIMENSIONS values
+*	   * k - number of neighbours to return
+*	   * filter - vectors the query may return, NULL for every vector
+*	   * num_results - output number of vectors returned
+*
+* ======================================================================================
+*/
+query_match *perform_knn_query(HDBC hdbc, double *query, int k, const attribute_filter *filter, long *num_results)
 {
-	/* get projection matrix */
-	gsl_vector * v = gsl_vector_alloc(window*window);
-	gsl_matrix_get_row(v, projection_matrix, 0);
+	gsl_matrix *query_matrix = compute_subspace( query );
 
-	/* put the projection matrix in the form window x window */
-	gsl_matrix_view B = gsl_matrix_view_vector(v, window, window);
+	int table_indx, num_tables;
+	( BILLION_DATASET == 0 ) ? num_tables = 1 : num_tables = 30;
 
-	int col_end_indx = window;
-	int i = 0, row_begin_indx = 0, row_end_idx = 0;
-	for (i = 0; i < dim; i++)
-	{	
-		int col_begin_indx = i*window;
+	index_statistics *statistics = get_index_statistics();
+	double radius = ( statistics != NULL ) ? index_statistics_recommend_epsilon( statistics, query_matrix, k ) : 0;
 
-		/* get first window of data from the database */
-		gsl_matrix_view A = gsl_matrix_submatrix(query, row_begin_indx, col_begin_indx, 1, col_end_indx);
+	/* the k nearest neighbours of the dataset are among the k nearest of each table */
+	query_match *results = (query_match *)malloc(sizeof(query_match)*((long)k*num_tables + 1));
+	*num_results = 0;
 
-		/* allocate memory to hold the projected data */
-		gsl_matrix *temp_projection = gsl_matrix_alloc(1, window);
+	for( table_indx = 1; table_indx <= num_tables; table_indx++ )
+		*num_results += knn_search_table( hdbc, query_matrix, table_indx, k, radius, filter, results + *num_results );
 
-		/* perform multiplication */
-		gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &A.matrix, &B.matrix, 0.0, temp_projection);
+	qsort( results, *num_results, sizeof(query_match), compare_matches );
+	if( *num_results > k )
+		*num_results = k;
 
-		/* compute norm */
-		compute_norm(temp_projection, projected_data, 0, window, i);
-	
-		/* free everything */
-		gsl_matrix_free(temp_projection);
+	gsl_matrix_free( query_matrix );
+
+	return results;
+}
+
+/* ======================================================================================
+*
+* project_database: performs a bulk insert into the database
+*
+*      * hdbc - an  opened SQL connection
+*
+* ======================================================================================
+*/
+int flength_ids( long *IDs )
+{
+	int l;
+	while(IDs[l] != NULL )
+		l++;
+
+	return l+1;
+}
+
+
+/* ======================================================================================
+*
+* get_projection_plan: returns the projection plan of the index. The plan is built by the
+*				first query and rebuilt only when the index changes
+*
+* ======================================================================================
+*/
+projection_plan *get_projection_plan()
+{
+	/* the index was rebuilt since the plan was computed */
+	if( QUERY_PLAN != NULL && QUERY_PLAN->index_version != INDEX_VERSION )
+	{
+		projection_plan_free( QUERY_PLAN );
+		QUERY_PLAN = NULL;
 	}
+
+	if( QUERY_PLAN == NULL )
+		QUERY_PLAN = projection_plan_build();
+
+	return QUERY_PLAN;
+}
+
+/* ======================================================================================
+*
+* compute_subspace: projects the query through every level and returns a matrix whose row l
+*				holds the projection of the query at level l (row 0 is the query itself)
+*
+*      * query - the query vector with TOTAL_DIMENSIONS values
+*
+* ======================================================================================
+*/
+gsl_matrix *compute_subspace( double *query )
+{
+	projection_plan *plan = get_projection_plan();
+
+	/* project the query through all the levels at once */
+	projection_plan_project( plan, query );
+
+	/* copy each level into a row of the query matrix */
+	gsl_matrix *query_matrix = gsl_matrix_calloc( NUM_PROJECTIONS+1, TOTAL_DIMENSIONS );
+
+	int level, q;
+	for( level = 0; level <= NUM_PROJECTIONS; level++ )
+	{
+		const double *projected_query = projection_plan_level( plan, level );
+
+		for( q = 0; q < plan->dims[level]; q++ )
+			gsl_matrix_set( query_matrix, level, q, projected_query[q] );
+	}
+
+	return query_matrix;
 }
 
 /* ======================================================================================
@@ -308,8 +1248,8 @@ void compute_orthogonal_projection_query(gsl_matrix *projection_matrix, gsl_matr
 *
 * ======================================================================================
 */
-void compute_orthogonal_projection(gsl_matrix *projection_matrix, gsl_matrix *matrix_database, gsl_matrix **projected_data, int dim,
-		int window, int chunk_indx, int number_chunks_to_read, long number_remaining_vectors)
+void compute_orthogonal_projection(gsl_matrix *projection_matrix, gsl_matrix *matrix_database, gsl_matrix **projected_data, int norm_l2,
+		gsl_matrix **companion_data, int dim, int window, int chunk_indx, int number_chunks_to_read, long number_remaining_vectors)
 {
 	/* get projection matrix */
 	gsl_vector * v = gsl_vector_alloc(window*window);
@@ -339,7 +1279,11 @@ void compute_orthogonal_projection(gsl_matrix *projection_matrix, gsl_matrix *ma
 			gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &A.matrix, &B.matrix, 0.0, temp_projection);
 
 			/* compute norm */
-			compute_norm(temp_projection, projected_data, j, window, i);
+			compute_norm(temp_projection, projected_data, j, window, i, norm_l2);
+
+			/* the other norm of the same projection */
+			if (companion_data != NULL)
+				compute_norm(temp_projection, companion_data, j, window, i, !norm_l2);
 
 			/* free everything */
 			gsl_matrix_free(temp_projection);
@@ -456,21 +1400,21 @@ FILE * open_file()
 *
 * ====================================================================================== */
 						
-void compute_norm(gsl_matrix *projected_data, gsl_matrix **projected_data_full, int row_indx, int window_size, int column_indx)
+void compute_norm(gsl_matrix *projected_data, gsl_matrix **projected_data_full, int row_indx, int window_size, int column_indx, int norm_l2)
 {
 	int j = 0, k; 
 
 	float norm = 0;
 
 	/* if normalization_type == L2, then compute L2 norm */
-	if (strcmp(NORM_TYPE, "L2") == 0)
+	if (norm_l2)
 	{
 		gsl_vector_view row = gsl_matrix_row(projected_data, j);
 		norm = gsl_blas_dnrm2(&row.vector);
 	}
 
-	/* if normalization_type == L2, then compute L1 norm */
-	if (strcmp(NORM_TYPE, "L1") == 0)
+	/* if normalization_type == L1, then compute L1 norm */
+	else
 	{
 		gsl_vector_view row = gsl_matrix_row(projected_data, j);
 
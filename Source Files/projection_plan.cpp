@@ -0,0 +1,331 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* projection_plan.cpp
+* This file contains the implementation of the projection plan. Building the plan computes the
+* projection matrices and the level dimensions; projecting a query afterwards only reads the
+* plan and writes in its preallocated memory.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "projection_plan.hpp"
+#include "projection.hpp"
+#include "dimension_order.hpp"
+
+/* ======================================================================================
+*
+* max_row_l1_norm: largest L1 norm of a row of a matrix, which is the largest L1 norm of
+*				a * B for a window a with L1 norm 1
+*
+*      * matrix - window x window matrix, row major
+*	   * window - size of the matrix
+*
+* ====================================================================================== */
+static double max_row_l1_norm(const double *matrix, int window)
+{
+	double max_norm = 0;
+
+	int i, j;
+	for (i = 0; i < window; i++)
+	{
+		double norm = 0;
+		for (j = 0; j < window; j++)
+			norm += fabs(matrix[i*window + j]);
+
+		if (norm > max_norm)
+			max_norm = norm;
+	}
+
+	return max_norm;
+}
+
+/* ======================================================================================
+*
+* spectral_norm: largest singular value of a matrix, which is the largest L2 norm of a * B 
+*				for a window a with L2 norm 1. It is the square root of the largest eigenvalue
+*				of B^T B
+*
+*      * matrix - window x window matrix, row major
+*	   * window - size of the matrix
+*
+* ====================================================================================== */
+static double spectral_norm(const double *matrix, int window)
+{
+	gsl_matrix *gram = gsl_matrix_alloc(window, window);
+
+	int i, j, k;
+	for (i = 0; i < window; i++)
+		for (j = 0; j < window; j++)
+		{
+			double value = 0;
+			for (k = 0; k < window; k++)
+				value += matrix[k*window + i] * matrix[k*window + j];
+			gsl_matrix_set(gram, i, j, value);
+		}
+
+	gsl_vector *eigenvalues = gsl_vector_alloc(window);
+	gsl_eigen_symm_workspace *workspace = gsl_eigen_symm_alloc(window);
+	gsl_eigen_symm(gram, eigenvalues, workspace);
+
+	double max_eigenvalue = 0;
+	for (i = 0; i < window; i++)
+		if (gsl_vector_get(eigenvalues, i) > max_eigenvalue)
+			max_eigenvalue = gsl_vector_get(eigenvalues, i);
+
+	gsl_eigen_symm_free(workspace);
+	gsl_vector_free(eigenvalues);
+	gsl_matrix_free(gram);
+
+	return sqrt(max_eigenvalue);
+}
+
+/* ======================================================================================
+*
+* projection_plan_build: builds the plan for the current WINDOWS, TOTAL_DIMENSIONS and NORM_TYPE
+*
+* ====================================================================================== */
+projection_plan *projection_plan_build()
+{
+	projection_plan *plan = (projection_plan *)malloc(sizeof(projection_plan));
+
+	plan->num_levels = NUM_PROJECTIONS + 1;
+	plan->norm_l2 = (strcmp(NORM_TYPE, "L2") == 0);
+	plan->index_version = INDEX_VERSION;
+
+	plan->dims = (int *)malloc(sizeof(int)*plan->num_levels);
+	plan->offsets = (int *)malloc(sizeof(int)*plan->num_levels);
+	plan->windows = (int *)malloc(sizeof(int)*NUM_PROJECTIONS);
+	plan->matrices = (double **)malloc(sizeof(double *)*NUM_PROJECTIONS);
+	plan->uniform = (int *)malloc(sizeof(int)*NUM_PROJECTIONS);
+	plan->uniform_value = (double *)malloc(sizeof(double)*NUM_PROJECTIONS);
+	plan->lower_bound_constants = (double *)malloc(sizeof(double)*plan->num_levels);
+
+	/* dimensions of every level and their position in the values array */
+	int level, total = TOTAL_DIMENSIONS;
+	plan->dims[0] = TOTAL_DIMENSIONS;
+	plan->offsets[0] = 0;
+	for (level = 1; level < plan->num_levels; level++)
+	{
+		plan->dims[level] = plan->dims[level - 1] / WINDOWS[level - 1];
+		plan->offsets[level] = total;
+		total += plan->dims[level];
+	}
+	plan->values = (double *)malloc(sizeof(double)*total);
+
+	/* columns grouped by their correlation when the index was built */
+	dimension_order *order = (NUM_PROJECTIONS > 0) ? get_dimension_order() : NULL;
+	plan->columns = NULL;
+	plan->ordered = NULL;
+	if (order != NULL)
+	{
+		plan->columns = (int *)malloc(sizeof(int)*TOTAL_DIMENSIONS);
+		plan->ordered = (double *)malloc(sizeof(double)*TOTAL_DIMENSIONS);
+		memcpy(plan->columns, order->columns, sizeof(int)*TOTAL_DIMENSIONS);
+	}
+
+	/* flatten the projection matrix of each step. compute_orthogonal_projection uses the first
+	 * row of the matrix, in the form window x window */
+	int step;
+	plan->lower_bound_constants[0] = 1;
+	for (step = 0; step < NUM_PROJECTIONS; step++)
+	{
+		int window = WINDOWS[step];
+		plan->windows[step] = window;
+		plan->matrices[step] = (double *)malloc(sizeof(double)*window*window);
+
+		gsl_matrix *projection_matrix = orthogonal_projection_matrix(window, window);
+
+		int k;
+		for (k = 0; k < window*window; k++)
+			plan->matrices[step][k] = gsl_matrix_get(projection_matrix, 0, k);
+
+		gsl_matrix_free(projection_matrix);
+
+		/* a matrix with all the entries equal to v maps a window a to v*sum(a) in every
+		 * coordinate, so its norm has a closed form */
+		plan->uniform[step] = 1;
+		plan->uniform_value[step] = plan->matrices[step][0];
+		for (k = 1; k < window*window; k++)
+			if (plan->matrices[step][k] != plan->uniform_value[step])
+				plan->uniform[step] = 0;
+
+		/* a window a is mapped to the norm of a * B, so two windows a and b are mapped to values
+		 * that differ by at most |(a - b) * B| <= K |a - b|. Summed over the windows (or over
+		 * their squares with the L2 distance), the distance of the next level is at most K times
+		 * the distance of this level */
+		double K = plan->norm_l2 ? spectral_norm(plan->matrices[step], window) : max_row_l1_norm(plan->matrices[step], window);
+
+		plan->lower_bound_constants[step + 1] = plan->lower_bound_constants[step];
+		if (K > 0)
+			plan->lower_bound_constants[step + 1] /= K;
+	}
+
+	return plan;
+}
+
+/* ======================================================================================
+*
+* projection_plan_free: deallocates a projection plan
+*
+*      * plan - the plan to deallocate
+*
+* ====================================================================================== */
+void projection_plan_free(projection_plan *plan)
+{
+	if (plan == NULL)
+		return;
+
+	int step;
+	for (step = 0; step < plan->num_levels - 1; step++)
+		free(plan->matrices[step]);
+
+	free(plan->matrices);
+	free(plan->uniform);
+	free(plan->uniform_value);
+	free(plan->lower_bound_constants);
+	free(plan->windows);
+	free(plan->dims);
+	free(plan->offsets);
+	free(plan->columns);
+	free(plan->ordered);
+	free(plan->values);
+	free(plan);
+}
+
+/* ======================================================================================
+*
+* projection_plan_project_window: projects one window of a vector with the matrix of a step
+*				and returns its norm
+*
+*      * plan - a projection plan
+*	   * step - projection step, from 0 to NUM_PROJECTIONS - 1
+*	   * window_values - the window of the vector, with plan->windows[step] values
+*
+* ====================================================================================== */
+double projection_plan_project_window(const projection_plan *plan, int step, const double *window_values)
+{
+	int window = plan->windows[step];
+	int i, j;
+
+	/* closed form: every coordinate of the projection is v*sum(a) */
+	if (plan->uniform[step])
+	{
+		double sum = 0;
+		for (i = 0; i < window; i++)
+			sum += window_values[i];
+
+		double coordinate = fabs(plan->uniform_value[step] * sum);
+		return plan->norm_l2 ? sqrt((double)window) * coordinate : window * coordinate;
+	}
+
+	/* general case: y = a * B, followed by the norm of y */
+	const double *matrix = plan->matrices[step];
+	double norm = 0;
+	for (j = 0; j < window; j++)
+	{
+		double y = 0;
+		for (i = 0; i < window; i++)
+			y += window_values[i] * matrix[i*window + j];
+
+		norm += plan->norm_l2 ? y*y : fabs(y);
+	}
+
+	return plan->norm_l2 ? sqrt(norm) : norm;
+}
+
+/* ======================================================================================
+*
+* projection_plan_project: projects a query through all the levels without allocating memory
+*
+*      * plan - a projection plan
+*	   * query - the query vector with TOTAL_DIMENSIONS values
+*
+* ====================================================================================== */
+const double *projection_plan_project(projection_plan *plan, const double *query)
+{
+	memcpy(plan->values, query, sizeof(double)*plan->dims[0]);
+
+	/* level 0 keeps the order of the dataset; the first step reads it in the order of the index */
+	int level, k;
+	if (plan->columns != NULL)
+		for (k = 0; k < plan->dims[0]; k++)
+			plan->ordered[k] = query[plan->columns[k]];
+
+	/* each level is computed from the previous one, window by window */
+	for (level = 1; level < plan->num_levels; level++)
+	{
+		const double *previous = (level == 1 && plan->columns != NULL) ? plan->ordered : plan->values + plan->offsets[level - 1];
+		double *current = plan->values + plan->offsets[level];
+		int window = plan->windows[level - 1];
+
+		int i;
+		for (i = 0; i < plan->dims[level]; i++)
+			current[i] = projection_plan_project_window(plan, level - 1, previous + i*window);
+	}
+
+	return plan->values;
+}
+
+/* ======================================================================================
+*
+* projection_plan_level: returns the projection of the last query at a level
+*
+*      * plan - a projection plan
+*	   * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*
+* ====================================================================================== */
+const double *projection_plan_level(const projection_plan *plan, int level)
+{
+	return plan->values + plan->offsets[level];
+}
+
+/* ======================================================================================
+*
+* projection_plan_distance: returns the distance between two vectors of a level, L1 or L2
+*				following the norm of the plan. The sums are split in four independent
+*				accumulators so that the compiler can keep them in vector registers
+*
+*      * plan - a projection plan
+*	   * a - first vector
+*	   * b - second vector
+*	   * dims - dimension of the vectors
+*
+* ====================================================================================== */
+double projection_plan_distance(const projection_plan *plan, const double *a, const double *b, int dims)
+{
+	double sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+	int i;
+
+	if (plan->norm_l2)
+	{
+		for (i = 0; i + 4 <= dims; i += 4)
+		{
+			double d0 = a[i] - b[i], d1 = a[i + 1] - b[i + 1], d2 = a[i + 2] - b[i + 2], d3 = a[i + 3] - b[i + 3];
+			sum0 += d0*d0; sum1 += d1*d1; sum2 += d2*d2; sum3 += d3*d3;
+		}
+		for (; i < dims; i++)
+			sum0 += (a[i] - b[i])*(a[i] - b[i]);
+
+		return sqrt((sum0 + sum1) + (sum2 + sum3));
+	}
+
+	for (i = 0; i + 4 <= dims; i += 4)
+	{
+		sum0 += fabs(a[i] - b[i]);
+		sum1 += fabs(a[i + 1] - b[i + 1]);
+		sum2 += fabs(a[i + 2] - b[i + 2]);
+		sum3 += fabs(a[i + 3] - b[i + 3]);
+	}
+	for (; i < dims; i++)
+		sum0 += fabs(a[i] - b[i]);
+
+	return (sum0 + sum1) + (sum2 + sum3);
+}
@@ -80,6 +80,28 @@ SQLWCHAR *build_query_to_import_data(  )
 	return query;
 }
 
+/* ======================================================================================
+*
+* column_type: returns the SQL type of the columns of a table. The original data of a dataset
+*				of small non-negative integers is stored in integer columns; the projected
+*				levels are always stored as FLOAT
+*
+*      * dims - number of columns of the table
+*
+* ====================================================================================== */
+const char *column_type(int dims)
+{
+	if (dims != TOTAL_DIMENSIONS)
+		return "FLOAT";
+
+	switch (ORIGINAL_VALUE_TYPE)
+	{
+		case VALUE_TYPE_UINT8:  return "TINYINT";
+		case VALUE_TYPE_INT16:  return "SMALLINT";
+		default:                return "FLOAT";
+	}
+}
+
 /* ======================================================================================
 *
 * build_query_to_create_table: ceates an SQLWCHAR representation of the string to create an SQL tale.
@@ -91,13 +113,15 @@ SQLWCHAR *build_query_to_import_data(  )
 */
 SQLWCHAR *build_query_to_create_table(int dims)
 {
+	const char *type = column_type(dims);
+
 	/* Allocate memmory for the query */
-	int size = 20 + 15 * dims + strlen(DB_TABLE_NAME) + length(TOTAL_DIMENSIONS);
+	int size = 20 + (10 + strlen(type)) * dims + strlen(DB_TABLE_NAME) + length(TOTAL_DIMENSIONS);
 	char *query_str = (char *)malloc(sizeof(char)*size);
 
 	/* Build string representation of the query */
-	sprintf(query_str, "CREATE TABLE %s ( c_0 FLOAT", DB_TABLE_NAME);
-	query_str = concat_query(query_str, dims);
+	sprintf(query_str, "CREATE TABLE %s ( c_0 %s", DB_TABLE_NAME, type);
+	query_str = concat_query(query_str, dims, type);
 
 	/* Convert string representation of the query to an SQLWCHAR type */
 	SQLWCHAR *query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*(strlen(query_str) + 1));
@@ -120,16 +144,17 @@ SQLWCHAR *build_query_to_create_table(int dims)
 *
 *      * query - the query to be repeated
 *	   * dims - the number of times the query will be repeated
+*	   * type - SQL type of the columns
 *
 * ====================================================================================== */
-char *concat_query( char *query, int dims )
+char *concat_query( char *query, int dims, const char *type )
 {
 	int i;
 	for (i = 1; i < dims; i++)
 	{
 		/* allocate memory for temporary string */
-		char *temp = (char *)malloc(sizeof(char)*( 15 + length(i) ));
-		sprintf(temp, ", c_%d FLOAT", i);
+		char *temp = (char *)malloc(sizeof(char)*( 10 + strlen(type) + length(i) ));
+		sprintf(temp, ", c_%d %s", i, type);
 
 		/* concat the query */
 		strcat(query, temp);
@@ -210,98 +235,401 @@ SQLWCHAR *build_query_to_add_pkey()
 
 /* ======================================================================================
 *
-* build_query_to_add_pkey: creates an SQLWCHAR repreentation of the string:
-*					       ALTER TABLE <table_name> ADD PRIMARY KEY( ID )
+* build_query_to_add_norm_column: creates an SQLWCHAR representation of the query that adds
+*					to a table the norm of its vectors, computed from its columns:
+*						ALTER TABLE <table> ADD <column> AS ( SQRT( c_0*c_0+... ) ) PERSISTED;
+*					with the L2 norm, or ( ABS(c_0)+... ) with the L1 norm. The columns are
+*					cast to FLOAT, since the sums of narrow integer columns are computed in
+*					their own type and would overflow
+*
+*      * table_name - name of the table
+*	   * column - name of the new column
+*	   * dims - number of columns of the table
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_add_norm_column( char *table_name, const char *column, int dims, int norm_l2 )
+{
+	char *query_str = (char *)malloc(sizeof(char)*(100 + 60 * dims + strlen( table_name ) + strlen( column )));
+	char *end = query_str + sprintf( query_str, "ALTER TABLE %s ADD %s AS ( %s", table_name, column, norm_l2 ? "SQRT( " : "" );
+
+	int i;
+	for( i = 0; i < dims; i++ )
+		end += norm_l2 ? sprintf( end, "%sCAST(c_%d AS FLOAT)*CAST(c_%d AS FLOAT)", ( i == 0 ) ? "" : "+", i, i )
+			: sprintf( end, "%sABS(CAST(c_%d AS FLOAT))", ( i == 0 ) ? "" : "+", i );
+
+	sprintf( end, "%s ) PERSISTED;", norm_l2 ? " )" : "" );
+
+	SQLWCHAR *query = convert_to_sqlwchar( query_str );
+	free( query_str );
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_index_norm: creates an SQLWCHAR representation of the query that sorts the
+*					vectors of a table by their norm:
+*						CREATE INDEX IX_<column> ON <table> ( <column> );
+*
+*      * table_name - name of the table
+*	   * column - name of the column with the norm
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_index_norm( char *table_name, const char *column )
+{
+	int size = 50 + strlen( table_name ) + 2 * strlen( column );
+	SQLWCHAR *query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*size);
+
+	swprintf(query, size, L"CREATE INDEX IX_%hs ON %hs ( %hs );", column, table_name, column );
+
+	if (DEBUG_OPTION > 1) printf("%ws\n\n", query);
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_create_view: creates an SQLWCHAR representation of the query that shows the
+*					columns of a level and its ID column under another name, without copying
+*					them:
+*						CREATE VIEW <view> AS SELECT c_0, ..., ID [, <norm> AS NORM] FROM <table>;
+*
+*      * view_name - name of the view
+*	   * table_name - name of the table
+*	   * dims - number of columns of the level
+*	   * norm_column - column of the table shown as the NORM column of the view, or NULL
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_create_view( char *view_name, char *table_name, int dims, const char *norm_column )
+{
+	int norm_length = ( norm_column != NULL ) ? strlen( norm_column ) : 0;
+
+	char *query_str = (char *)malloc(sizeof(char)*(100 + 15 * dims + strlen( view_name ) + strlen( table_name ) + norm_length));
+	char *end = query_str + sprintf( query_str, "CREATE VIEW %s AS SELECT ", view_name );
+
+	/* the columns keep the order of the table, so the rows are read the same way */
+	int i;
+	for( i = 0; i < dims; i++ )
+		end += sprintf( end, "c_%d, ", i );
+	end += sprintf( end, "ID" );
+
+	if( norm_column != NULL )
+		end += sprintf( end, ", %s AS NORM", norm_column );
+
+	sprintf( end, " FROM %s;", table_name );
+
+	SQLWCHAR *query = convert_to_sqlwchar( query_str );
+	free( query_str );
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_drop_view: creates an SQLWCHAR representation of the query that deletes a
+*					view, if it exists
+*
+*      * view_name - name of the view
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_drop_view( char *view_name )
+{
+	int size = 80 + 2 * strlen( view_name );
+	SQLWCHAR *query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*size);
+
+	swprintf(query, size, L"IF OBJECT_ID('%hs', 'V') IS NOT NULL DROP VIEW %hs;", view_name, view_name );
+
+	if (DEBUG_OPTION > 1) printf("%ws\n\n", query);
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_create_permutation_table: creates an SQLWCHAR representation of the query
+*					that creates the table mapping the reordered IDs to the original ones:
+*						CREATE TABLE <table> ( NEW_ID BIGINT, ORIGINAL_ID BIGINT );
+*
+*      * permutation_table - name of the table
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_create_permutation_table( char *permutation_table )
+{
+	char *query_str = (char *)malloc(sizeof(char)*(100 + strlen( permutation_table )));
+	sprintf( query_str, "CREATE TABLE %s ( NEW_ID BIGINT, ORIGINAL_ID BIGINT );", permutation_table );
+
+	SQLWCHAR *query = convert_to_sqlwchar( query_str );
+	free( query_str );
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_import_file: creates an SQLWCHAR representation of the query that performs
+*					a bulk insert of a space separated file into a table
+*
+*      * table_name - name of the table
+*	   * path - path of the file
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_import_file( char *table_name, char *path )
+{
+	int size = 110 + strlen( table_name ) + strlen( path );
+	SQLWCHAR *query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*size);
+
+	swprintf(query, size, L"BULK INSERT %hs FROM '%hs' WITH( FIELDTERMINATOR = ' ', ROWTERMINATOR = '0x0a' );", table_name, path );
+
+	if (DEBUG_OPTION > 1) printf("%ws\n\n", query);
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_create_ordered_table: creates an SQLWCHAR representation of the query that
+*					creates a table with the columns of a level and its ID column:
+*						CREATE TABLE <table> ( c_0 FLOAT, ..., ID BIGINT IDENTITY(1,1) PRIMARY KEY );
+*
+*      * table_name - name of the table
+*	   * dims - number of columns of the level
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_create_ordered_table( char *table_name, int dims )
+{
+	const char *type = column_type( dims );
+
+	char *query_str = (char *)malloc(sizeof(char)*(100 + (10 + strlen( type )) * dims + strlen( table_name )));
+	sprintf( query_str, "CREATE TABLE %s ( c_0 %s", table_name, type );
+
+	int i;
+	for( i = 1; i < dims; i++ )
+		sprintf( query_str + strlen( query_str ), ", c_%d %s", i, type );
+	strcat( query_str, ", ID BIGINT IDENTITY(1,1) PRIMARY KEY );" );
+
+	SQLWCHAR *query = convert_to_sqlwchar( query_str );
+	free( query_str );
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_copy_in_order: creates an SQLWCHAR representation of the query that copies
+*					the vectors of a table into another one in the order of the permutation.
+*					SQL Server assigns the identity values of an INSERT ... SELECT in the 
+*					order of its ORDER BY clause:
+*						INSERT INTO <target> ( c_0, ... ) SELECT t.c_0, ... FROM <source> AS t
+*						JOIN <permutation> AS p ON t.ID = p.ORIGINAL_ID ORDER BY p.NEW_ID
+*
+*      * source_table - table with the vectors in their original order
+*	   * target_table - table created by build_query_to_create_ordered_table
+*	   * permutation_table - table mapping the new IDs to the original ones
+*	   * dims - number of columns of the level
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_copy_in_order( char *source_table, char *target_table, char *permutation_table, int dims )
+{
+	char *columns = (char *)malloc(sizeof(char)*(20 + 15 * dims));
+	char *source_columns = (char *)malloc(sizeof(char)*(20 + 17 * dims));
+	columns[0] = '\0';
+	source_columns[0] = '\0';
+
+	int i;
+	for( i = 0; i < dims; i++ )
+	{
+		sprintf( columns + strlen( columns ), "%sc_%d", ( i > 0 ) ? ", " : "", i );
+		sprintf( source_columns + strlen( source_columns ), "%st.c_%d", ( i > 0 ) ? ", " : "", i );
+	}
+
+	char *query_str = (char *)malloc(sizeof(char)*(200 + strlen( columns ) + strlen( source_columns ) 
+		+ strlen( source_table ) + strlen( target_table ) + strlen( permutation_table )));
+	sprintf( query_str, "INSERT INTO %s ( %s ) SELECT %s FROM %s AS t JOIN %s AS p ON t.ID = p.ORIGINAL_ID ORDER BY p.NEW_ID;",
+		target_table, columns, source_columns, source_table, permutation_table );
+
+	SQLWCHAR *query = convert_to_sqlwchar( query_str );
+
+	free( query_str );
+	free( source_columns );
+	free( columns );
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_drop_table: creates an SQLWCHAR representation of the query that deletes
+*					a table, if it exists
+*
+*      * table_name - name of the table
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_drop_table( char *table_name )
+{
+	int size = 80 + 2 * strlen( table_name );
+	SQLWCHAR *query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*size);
+
+	swprintf(query, size, L"IF OBJECT_ID('%hs', 'U') IS NOT NULL DROP TABLE %hs;", table_name, table_name );
+
+	if (DEBUG_OPTION > 1) printf("%ws\n\n", query);
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_rename_table: creates an SQLWCHAR representation of the query that renames
+*					a table of the dbo schema. The names are given without brackets
+*
+*      * old_name - current name of the table
+*	   * new_name - new name of the table
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_rename_table( char *old_name, char *new_name )
+{
+	int size = 50 + strlen( old_name ) + strlen( new_name );
+	SQLWCHAR *query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*size);
+
+	swprintf(query, size, L"EXEC sp_rename 'dbo.%hs', '%hs';", old_name, new_name );
+
+	if (DEBUG_OPTION > 1) printf("%ws\n\n", query);
+
+	return query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_compute_distance: creates an SQLWCHAR representation of the full cascade of
+*					a table, from the lowest projection to the original data, with the distance
+*					of the index (L1, or squared L2 when NORM_TYPE is L2)
+*
+*      * query - matrix containing the query vector and all of its projections
+*	   * chunk - index of the table, starting at 1
+*	   * dimensions - dimension of the original data
 *
 * ====================================================================================== */
 SQLWCHAR *build_query_to_compute_distance( gsl_matrix *query, int chunk, int dimensions )
 {
-	char *query_str = (char *)malloc( sizeof(char)*( 1000000 ) );
-
-	/* compute constant_c */
-	float constant_c;
-	if( strcmp(NORM_TYPE, "L1") == 0 )
-		constant_c = 2;
-
-	/* get lowest dimension */
-	int w; 
-	int current_dim = TOTAL_DIMENSIONS;
-	for( w = 0; w < NUM_PROJECTIONS; w++ )
-		current_dim /= WINDOWS[w];
-
-	/* select qugery vector from matrix */
-	int proj_step, q;
-	for( proj_step = NUM_PROJECTIONS; proj_step >= 0; proj_step-- )
-	{  
-		/* update db_table_name for current dimension */
-		DB_TABLE_NAME = (char *)malloc(sizeof(char)*(40));
-		
-		if( BILLION_DATASET == 1 )
-			sprintf(DB_TABLE_NAME, "[dbo].[%dbillion_%d_%s]", chunk, current_dim, NORM_TYPE);
-		else
-			sprintf(DB_TABLE_NAME, "[dbo].[%s_%d_%s]", DATASET_ROOT_NAME, current_dim, NORM_TYPE);
+	projection_plan *plan = get_projection_plan();
+	char *query_str = NULL;
+
+	/* start building query here. The final query will be a concatenation of several sql queries */
+	int level, q;
+	for( level = NUM_PROJECTIONS; level >= 0; level-- )
+	{
+		char *table_name = build_table_name( chunk, plan->dims[level] );
 
 		/* get current query */
-		double *query_vec = (double *)malloc(sizeof( double )*(current_dim + 1));
-		for( q = 0; q < current_dim; q++ )
-			query_vec[q] = gsl_matrix_get( query, proj_step, q );
+		double *query_vec = (double *)malloc(sizeof(double)*(plan->dims[level] + 1));
+		for( q = 0; q < plan->dims[level]; q++ )
+			query_vec[q] = gsl_matrix_get( query, level, q );
 
-		/* start building query here. The final query will be a concatenation of several sql queries */
-		if(strcmp( NORM_TYPE, "L1" ) == 0)
-			query_str = build_query_to_compute_L1_distance( query_str, query_vec, current_dim, proj_step, constant_c);
+		query_str = build_query_to_compute_level_distance( query_str, query_vec, plan->dims[level], level, 
+			compute_constant_c( level ), table_name, NULL, EPSILON );
 
-		free( DB_TABLE_NAME );
 		free( query_vec );
-
-		current_dim *= WINDOWS[proj_step-1];
+		free( table_name );
 	}
 
-	SQLWCHAR *sql_query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*(strlen(query_str)+1));
-	swprintf(sql_query, L"%hs", query_str );
-
-	if( DEBUG_OPTION >= 1 )
-		printf( "\n%ws\n", sql_query );
-	//system("PAUSE");
+	SQLWCHAR *sql_query = convert_to_sqlwchar( query_str );
+	free( query_str );
 
 	return sql_query;
 }
 
 /* ======================================================================================
 *
-* build_query_to_compute_L1_distance: creates an SQLWCHAR repreentation of the string:
-*					       SELECT *
-*						   FROM (   
-*						          SELECT ABS( c_033 - q_033 )  + ABS( c_1 - q_1 ) + ABS( c_2 - q_2 ) + ABS( c_3 - q_3 ) as dist, ID
-*								  FROM [dbo].[14billion_4_L1] 
-*								  WHERE ID = 142803 OR ID = 142835 OR ID = 695
-*								) AS temp
-*						   WHERE temp.dist < 1000
+* build_table_name: returns the name of the table holding a projection of the dataset:
+*					[dbo].[<root>_<dims>_<norm>], or [dbo].[<chunk>billion_<dims>_<norm>] 
+*					when the dataset is split in several tables
+*
+*      * chunk - index of the table, starting at 1
+*	   * dims - dimension of the projection
 *
 * ====================================================================================== */
-char *build_query_to_compute_L1_distance( char *previous_query, double *query_vec, int dimensions, int proj_step, double constant_c  )
+char *build_table_name( int chunk, int dims )
 {
-	/* build string of the form 
-	 * ABS( c_0 - 0.5 ) + ABS( c_1 - 0.5 ) + ABS( c_2 - 0.5 ) + ABS( c_3 - 0.5 ) 
-	 */
-	char *distance_str = concat_L1_norm( query_vec, dimensions );
+	char *table_name = (char *)malloc(sizeof(char)*(50 + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
 
-	/* Allocate space */
-	char *new_query = (char *)malloc(sizeof(char)*(1000000));
+	if( BILLION_DATASET == 1 )
+		sprintf(table_name, "[dbo].[%dbillion_%d_%s]", chunk, dims, NORM_TYPE);
+	else
+		sprintf(table_name, "[dbo].[%s_%d_%s]", DATASET_ROOT_NAME, dims, NORM_TYPE);
 
-	if( proj_step == 0 )
-		proj_step = 11;
+	return table_name;
+}
 
-	if( BILLION_DATASET == 0 && strlen( previous_query ) == 0 )
-		constant_c = 4.0/5.0 - 0.1;
+/* ======================================================================================
+*
+* compute_constant_c: returns the constant that multiplies the distances computed at a level
+*					before they are compared with EPSILON. The distance of two vectors in the
+*					original data is at least c times their distance at the level, so that no
+*					result is lost. With APPROXIMATE_CONSTANTS, the larger constant calibrated 
+*					on the data for CALIBRATION_TARGET_RECALL is used instead
+*
+*      * level - level of the hierarchy, from 0 (original data) to NUM_PROJECTIONS
+*
+* ====================================================================================== */
+double compute_constant_c( int level )
+{
+	index_statistics *statistics = get_index_statistics();
+
+	/* constants stored with the index when it was built */
+	if( statistics != NULL )
+	{
+		if( APPROXIMATE_CONSTANTS )
+			return index_statistics_calibrated_constant( statistics, level, CALIBRATION_TARGET_RECALL );
+
+		return statistics->levels[level].bound_constant;
+	}
+
+	return get_projection_plan()->lower_bound_constants[level];
+}
+
+/* ======================================================================================
+*
+* build_query_to_compute_level_distance: adds one level to a cascade of distance queries.
+*					With the L2 norm, <dist> is the squared distance, c is squared and it is
+*					compared with the squared epsilon, so that no square root is computed.
+*					Without a previous query, the string has the form:
+*						SELECT * FROM ( SELECT ( <dist> )*c AS DIST, ID FROM <table> [WHERE <ids>] ) 
+*						AS t<level> WHERE DIST <= <epsilon>
+*					Otherwise, the vectors are joined with the ones returned by the previous query:
+*						SELECT * FROM ( SELECT ( <dist> )*c AS DIST, u<level>.ID FROM <table> AS u<level>, 
+*						( <previous_query> ) AS p<level> WHERE u<level>.ID = p<level>.ID ) AS t<level>
+*						WHERE t<level>.DIST <= <epsilon>
+*
+*      * previous_query - query of the previous level or NULL. It is freed by this function
+*	   * query_vec - projection of the query vector at this level
+*	   * dimensions - dimension of the level
+*	   * level - level of the hierarchy, used to name the subqueries
+*	   * constant_c - constant that multiplies the distances of the level
+*	   * table_name - table holding the level
+*	   * id_predicate - predicate restricting the IDs of the first level or NULL
+*	   * epsilon - radius of the query
+*
+* ====================================================================================== */
+char *build_query_to_compute_level_distance( char *previous_query, double *query_vec, int dimensions, int level, double constant_c, char *table_name, char *id_predicate, double epsilon )
+{
+	/* build string of the form ( ABS( c_0 - 0.5 ) + ABS( c_1 - 0.5 ) + ... )*c */
+	char *distance_str = build_distance_expression( query_vec, dimensions, constant_c );
+
+	size_t size = 300 + strlen( distance_str ) + strlen( table_name );
+	size += ( previous_query != NULL ) ? strlen( previous_query ) : 0;
+	size += ( id_predicate != NULL ) ? strlen( id_predicate ) : 0;
 
-	/* build string */
-	if( strlen( previous_query ) == 0 )
-		sprintf( new_query, "SELECT * FROM ( SELECT ( %s )*%.4f AS DIST, ID FROM %s ) AS t%d WHERE DIST <= %.2f ", distance_str, constant_c, DB_TABLE_NAME, proj_step, EPSILON ); 
+	char *new_query = (char *)malloc(sizeof(char)*size);
+
+	if( previous_query == NULL )
+		sprintf( new_query, "SELECT * FROM ( SELECT %s AS DIST, ID FROM %s%s%s ) AS t%d WHERE DIST <= %.10g",
+			distance_str, table_name, ( id_predicate != NULL ) ? " WHERE " : "", ( id_predicate != NULL ) ? id_predicate : "", level, 
+			compute_level_epsilon( epsilon ) );
 	else
-		sprintf( new_query, "SELECT * FROM ( SELECT ( %s )*%.4f AS DIST, u%d.ID FROM %s AS u%d, (%s) AS u%d WHERE u%d.ID = u%d.ID ) as temp%d WHERE temp%d.DIST <= %.2f", 
-			distance_str, constant_c, proj_step, DB_TABLE_NAME, proj_step, previous_query, proj_step-1, proj_step, proj_step-1, proj_step, proj_step, EPSILON ); 
+		sprintf( new_query, "SELECT * FROM ( SELECT %s AS DIST, u%d.ID FROM %s AS u%d, (%s) AS p%d WHERE u%d.ID = p%d.ID ) AS t%d WHERE t%d.DIST <= %.10g",
+			distance_str, level, table_name, level, previous_query, level, level, level, level, level, compute_level_epsilon( epsilon ) );
 
-	if( DEBUG_OPTION >= 1 )
+	if( DEBUG_OPTION > 1 )
 		printf( "\n%s\n", new_query );
 
 	free( previous_query );
@@ -310,68 +638,283 @@ char *build_query_to_compute_L1_distance( char *previous_query, double *query_ve
 	return new_query;
 }
 
+/* ======================================================================================
+*
+* and_predicates: returns the conjunction of two predicates and frees them. Either of them may
+*					be NULL, which selects every row
+*
+*      * predicate_a - first predicate, or NULL
+*	   * predicate_b - second predicate, or NULL
+*
+* ====================================================================================== */
+static char *and_predicates( char *predicate_a, char *predicate_b )
+{
+	if( predicate_a == NULL )
+		return predicate_b;
+	if( predicate_b == NULL )
+		return predicate_a;
+
+	char *both = (char *)malloc(sizeof(char)*(10 + strlen( predicate_a ) + strlen( predicate_b )));
+	sprintf( both, "%s AND %s", predicate_a, predicate_b );
+
+	free( predicate_a );
+	free( predicate_b );
 
+	return both;
+}
 
 /* ======================================================================================
 *
-* concat_query: concats a query N times. Auxiliary function for function build_query_to_create_table.
-*			Builds a query of the form: c_0 FLOAT, c_1 FLOAT, c_2 FLOAT, ..., c_dims FLOAT
+* build_norm_predicate: returns the condition that selects the vectors whose norm can be within
+*					epsilon of the query. By the triangle inequality, the distance between two
+*					vectors is at least the difference of their norms:
+*						NORM BETWEEN <norm - epsilon / c> AND <norm + epsilon / c>
+*					The norm is computed from the query as it is written in the distance
+*					expressions, so the condition never discards a vector they would return
 *
-*      * query - the query to be repeated
-*	   * dims - the number of times the query will be repeated
+*      * query_vec - the query at the level
+*	   * dims - dimension of the level
+*	   * constant_c - constant that multiplies the distances of the level
+*	   * epsilon - radius of the query
 *
 * ====================================================================================== */
-char *concat_L1_norm( double *query_vec, int dims )
+char *build_norm_predicate( double *query_vec, int dims, double constant_c, double epsilon )
 {
-	char *query_str = (char*)malloc(sizeof(char)*(30*dims));
-	sprintf( query_str, "ABS(c_0-%.2f)", abs(query_vec[0]) );
+	int norm_l2 = ( strcmp( NORM_TYPE, "L2" ) == 0 ), i;
+	double norm = 0;
+	char value[64];
 
-	int i;
-	for (i = 1; i < dims; i++)
+	for( i = 0; i < dims; i++ )
 	{
-		/* allocate memory for temporary string */
-		char *temp = (char *)malloc(sizeof(char)*( dims*30 ));
-		sprintf(temp, "+ABS(c_%d-%.2f )", i, abs(query_vec[i]));
+		/* same formats as concat_squared_L2_norm and concat_L1_norm */
+		if( norm_l2 )
+			sprintf( value, "%f", query_vec[i] );
+		else
+			sprintf( value, "%.2f", fabs( query_vec[i] ) );
 
-		/* concat the query */
-		strcat(query_str, temp);
+		double written = atof( value );
+		norm += norm_l2 ? written*written : fabs( written );
+	}
+	norm = norm_l2 ? sqrt( norm ) : norm;
 
-		/* temporary string is no longer needed for this iteration */
-		free(temp);
+	double radius = epsilon / constant_c + NORM_INDEX_SLACK * ( 1 + norm );
+
+	char *predicate = (char *)malloc(sizeof(char)*100);
+	if( norm - radius > 0 )
+		sprintf( predicate, "NORM BETWEEN %.10g AND %.10g", norm - radius, norm + radius );
+	else
+		sprintf( predicate, "NORM <= %.10g", norm + radius );
+
+	return predicate;
+}
+
+/* ======================================================================================
+*
+* build_query_to_scan_level: creates an SQLWCHAR representation of the query that computes
+*					the distance between the query and every vector of a level of a table,
+*					returning the vectors within epsilon
+*
+*      * query - matrix containing the query vector and all of its projections
+*	   * chunk - index of the table, starting at 1
+*	   * level - level to scan, from 0 (original data) to NUM_PROJECTIONS
+*	   * epsilon - radius of the query
+*	   * filter - vectors the query may return, NULL for every vector
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_scan_level( gsl_matrix *query, int chunk, int level, double epsilon, const attribute_filter *filter )
+{
+	projection_plan *plan = get_projection_plan();
+
+	char *table_name = build_table_name( chunk, plan->dims[level] );
+
+	/* get the query at the scanned level */
+	double *query_vec = (double *)malloc(sizeof(double)*(plan->dims[level] + 1));
+	int q;
+	for( q = 0; q < plan->dims[level]; q++ )
+		query_vec[q] = gsl_matrix_get( query, level, q );
+
+	double constant_c = compute_constant_c( level );
+
+	/* skip the blocks whose bounding box is farther than epsilon. The zone maps describe the
+	 * tables of a single dataset, whose IDs start at 1 */
+	char *id_predicate = NULL;
+	zone_map *zones = ( BILLION_DATASET == 0 ) ? get_zone_map() : NULL;
+	if( zones != NULL )
+		id_predicate = zone_map_build_predicate( zones, level, query_vec, constant_c, epsilon );
+
+	/* read only the vectors whose norm is within epsilon of the norm of the query */
+	if( NORM_INDEX && BILLION_DATASET == 0 )
+		id_predicate = and_predicates( id_predicate, build_norm_predicate( query_vec, plan->dims[level], constant_c, epsilon ) );
+
+	/* skip the blocks without any vector of the filter */
+	if( filter != NULL && filter->block_predicate != NULL )
+	{
+		char *block_predicate = (char *)malloc(sizeof(char)*(strlen( filter->block_predicate ) + 1));
+		strcpy( block_predicate, filter->block_predicate );
+
+		id_predicate = and_predicates( id_predicate, block_predicate );
 	}
-	
-	return query_str;
+
+	char *query_str = build_query_to_compute_level_distance( NULL, query_vec, plan->dims[level], level, 
+		constant_c, table_name, id_predicate, epsilon );
+
+	SQLWCHAR *sql_query = convert_to_sqlwchar( query_str );
+
+	free( id_predicate );
+	free( query_str );
+	free( query_vec );
+	free( table_name );
+
+	return sql_query;
 }
 
 /* ======================================================================================
 *
-* concat_query: concats a query N times. Auxiliary function for function build_query_to_create_table.
-*			Builds a query of the form: c_0 FLOAT, c_1 FLOAT, c_2 FLOAT, ..., c_dims FLOAT
+* build_query_to_refine_candidates: creates an SQLWCHAR representation of the query that 
+*					computes the distances of a set of candidates at a sequence of levels, ending 
+*					with the original data. The first level only reads the rows of the candidates
 *
-*      * query - the query to be repeated
-*	   * dims - the number of times the query will be repeated
+*      * query - matrix containing the query vector and all of its projections
+*	   * chunk - index of the table, starting at 1
+*	   * candidates - IDs of the candidates to refine
+*	   * levels - levels to evaluate, in order
+*	   * num_levels - number of levels to evaluate
+*	   * epsilon - radius of the query
 *
 * ====================================================================================== */
-char *concat_L2_norm( char *query_str, double *query_vec, int dims )
+SQLWCHAR *build_query_to_refine_candidates( gsl_matrix *query, int chunk, id_set *candidates, const int *levels, int num_levels, double epsilon )
 {
-	char *query_str = (char*)malloc(sizeof(char)*(50*dims));
-	sprintf( query_str, "POWER(c_%d-%f,2)", abs(query_vec[0]) );
+	projection_plan *plan = get_projection_plan();
 
-	int i;
-	for (i = 1; i < dims; i++)
+	char *id_predicate = id_set_to_sql_predicate( candidates );
+	char *query_str = NULL;
+
+	int i, q;
+	for( i = 0; i < num_levels; i++ )
 	{
-		/* allocate memory for temporary string */
-		char *temp = (char *)malloc(sizeof(char)*( dims*50 ));
-		sprintf(temp, " +POWER(c_%d-%f,2)", i, abs(query_vec[i]));
+		int level = levels[i];
+		char *table_name = build_table_name( chunk, plan->dims[level] );
 
-		/* concat the query */
-		strcat(query_str, temp);
+		/* get current query */
+		double *query_vec = (double *)malloc(sizeof(double)*(plan->dims[level] + 1));
+		for( q = 0; q < plan->dims[level]; q++ )
+			query_vec[q] = gsl_matrix_get( query, level, q );
 
-		/* temporary string is no longer needed for this iteration */
-		free(temp);
+		query_str = build_query_to_compute_level_distance( query_str, query_vec, plan->dims[level], level, 
+			compute_constant_c( level ), table_name, ( query_str == NULL ) ? id_predicate : NULL, epsilon );
+
+		free( query_vec );
+		free( table_name );
 	}
 
-	return query_str;
+	SQLWCHAR *sql_query = convert_to_sqlwchar( query_str );
+
+	free( query_str );
+	free( id_predicate );
+
+	return sql_query;
+}
+
+/* ======================================================================================
+*
+* build_query_to_sort_level: creates an SQLWCHAR representation of the query that returns
+*					the vectors of a level of a table sorted by their distance to the query:
+*						SELECT ( <dist> )*c AS DIST, ID FROM <table> [WHERE <ids>] ORDER BY DIST
+*
+*      * query - matrix containing the query vector and all of its projections
+*	   * chunk - index of the table, starting at 1
+*	   * level - level to sort, from 0 (original data) to NUM_PROJECTIONS
+*	   * candidates - IDs of the vectors to sort, or NULL for every vector of the level
+*
+* ====================================================================================== */
+SQLWCHAR *build_query_to_sort_level( gsl_matrix *query, int chunk, int level, id_set *candidates )
+{
+	projection_plan *plan = get_projection_plan();
+
+	char *table_name = build_table_name( chunk, plan->dims[level] );
+
+	/* get the query at the sorted level */
+	double *query_vec = (double *)malloc(sizeof(double)*(plan->dims[level] + 1));
+	int q;
+	for( q = 0; q < plan->dims[level]; q++ )
+		query_vec[q] = gsl_matrix_get( query, level, q );
+
+	char *distance_str = build_distance_expression( query_vec, plan->dims[level], compute_constant_c( level ) );
+
+	char *id_predicate = ( candidates != NULL ) ? id_set_to_sql_predicate( candidates ) : NULL;
+
+	char *query_str = (char *)malloc(sizeof(char)*(200 + strlen( distance_str ) + strlen( table_name ) + 
+		(( id_predicate != NULL ) ? strlen( id_predicate ) : 0)));
+	sprintf( query_str, "SELECT %s AS DIST, ID FROM %s%s%s ORDER BY DIST", distance_str, table_name, 
+		( id_predicate != NULL ) ? " WHERE " : "", ( id_predicate != NULL ) ? id_predicate : "" );
+
+	SQLWCHAR *sql_query = convert_to_sqlwchar( query_str );
+
+	free( id_predicate );
+	free( query_str );
+	free( distance_str );
+	free( query_vec );
+	free( table_name );
+
+	return sql_query;
+}
+
+/* ======================================================================================
+*
+* convert_to_sqlwchar: converts the string representation of a query to an SQLWCHAR type
+*
+*      * query_str - string representation of the query
+*
+* ====================================================================================== */
+SQLWCHAR *convert_to_sqlwchar( char *query_str )
+{
+	SQLWCHAR *sql_query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*(strlen(query_str)+1));
+	swprintf(sql_query, L"%hs", query_str );
+
+	/* print the query for debugging purposes */
+	if( DEBUG_OPTION >= 1 )
+		printf( "\n%ws\n", sql_query );
+
+	return sql_query;
+}
+
+/* ======================================================================================
+*
+* build_distance_expression: builds the distance between a level and the query, scaled by the
+*					constant of the level: ( <dist> )*c. With the L1 norm, <dist> is the L1
+*					distance. With the L2 norm, <dist> is the squared distance and the constant
+*					is squared, so that the expression is compared with the squared epsilon
+*
+*      * query_vec - projection of the query vector at the level
+*	   * dimensions - dimension of the level
+*	   * constant_c - constant that multiplies the distances of the level
+*
+* ====================================================================================== */
+char *build_distance_expression( double *query_vec, int dimensions, double constant_c )
+{
+	int norm_l2 = ( strcmp( NORM_TYPE, "L2" ) == 0 );
+
+	char *distance_str = norm_l2 ? concat_squared_L2_norm( query_vec, dimensions ) : concat_L1_norm( query_vec, dimensions );
+
+	char *expression = (char *)malloc(sizeof(char)*(50 + strlen( distance_str )));
+	sprintf( expression, "( %s )*%.10g", distance_str, norm_l2 ? constant_c*constant_c : constant_c );
+
+	free( distance_str );
+
+	return expression;
+}
+
+/* ======================================================================================
+*
+* compute_level_epsilon: returns the value compared with the distance expressions: epsilon,
+*					or its square with the L2 norm
+*
+*      * epsilon - radius of the query
+*
+* ====================================================================================== */
+double compute_level_epsilon( double epsilon )
+{
+	return ( strcmp( NORM_TYPE, "L2" ) == 0 ) ? epsilon*epsilon : epsilon;
 }
 
 /* ======================================================================================
@@ -383,15 +926,17 @@ char *concat_L2_norm( char *query_str, double *query_vec, int dims )
 *	   * dims - the number of times the query will be repeated
 *
 * ====================================================================================== */
-char *concat_IDs( char *query_str, long *IDs, int length_ids )
+char *concat_L1_norm( double *query_vec, int dims )
 {
+	char *query_str = (char*)malloc(sizeof(char)*(30*dims));
+	sprintf( query_str, "ABS(c_0-%.2f)", abs(query_vec[0]) );
+
 	int i;
-	for (i = 1; i < length_ids; i++)
+	for (i = 1; i < dims; i++)
 	{
 		/* allocate memory for temporary string */
-		char *temp = (char *)malloc(sizeof(char)*( 1000 + length( IDs[i] )));
-
-		sprintf(temp, " OR ID = %ld", (long)IDs[i]);
+		char *temp = (char *)malloc(sizeof(char)*( dims*30 ));
+		sprintf(temp, "+ABS(c_%d-%.2f )", i, abs(query_vec[i]));
 
 		/* concat the query */
 		strcat(query_str, temp);
@@ -405,56 +950,28 @@ char *concat_IDs( char *query_str, long *IDs, int length_ids )
 
 /* ======================================================================================
 *
-* build_query_to_compute_L2_distance: creates an SQLWCHAR repreentation of the string:
-*					       ALTER TABLE <table_name> ADD PRIMARY KEY( ID )
+* concat_squared_L2_norm: builds the squared L2 distance between the columns of a table and a
+*			query vector: (c_0-q_0)*(c_0-q_0)+(c_1-q_1)*(c_1-q_1)+ ... Products are used
+*			instead of POWER, and no SQRT is needed since the result is compared with the
+*			squared epsilon
+*
+*      * query_vec - the query vector
+*	   * dims - number of dimensions of the vector
 *
 * ====================================================================================== */
-SQLWCHAR *build_query_to_compute_L2_distance( double *query_vec, int dimensions, long *IDs, int length_ids )
+char *concat_squared_L2_norm( double *query_vec, int dims )
 {
-	/* allocate space for string */
-	char *query_str = (char *)malloc(sizeof(char)*( 200 + strlen(DB_TABLE_NAME) + dimensions*25 + 30*length_ids ));
-
-	/* Build string representation of the query */
-	char *init_str = (char *)malloc(sizeof(char)*100);
-	sprintf(init_str, "SELECT * FROM ( SELECT SQRT( POWER( c_0 - %f, 2 ) + ", query_vec[0]);
-
-	/* add ABS( c_%d - %f ) for each dimension of the table */
-	init_str = concat_L2_norm(init_str, query_vec, dimensions);
-
-	/* add database table name */
-	char *db_name_str;
-	if( length_ids != 0 )
-	{
-		db_name_str = (char *)malloc(sizeof(char)*( 25 + strlen( DB_TABLE_NAME ) + length(IDs[0])) );
-		sprintf(db_name_str, " FROM %s WHERE ID = %ld OR ", DB_TABLE_NAME, IDs[0]);
-
-		db_name_str = concat_IDs( db_name_str, IDs, length_ids );
-	}
-	else
-	{
-		db_name_str = (char *)malloc(sizeof(char)*( 25 + strlen( DB_TABLE_NAME ) ) );
-		sprintf(db_name_str, " FROM %s ", DB_TABLE_NAME);
-	}
+	char *query_str = (char*)malloc(sizeof(char)*(70*dims + 1));
 
-	/* build complete query */
-	sprintf(query_str, "%s%s) As temp WHERE temp.dist <= %f", init_str, db_name_str, EPSILON );
-	
-	/* convert to SQLWCHAR */
-	SQLWCHAR *query = (SQLWCHAR *)malloc(sizeof(SQLWCHAR)*strlen(query_str)+1);
-	swprintf(query, strlen(query_str)+1, L"%hs;", query_str);
-
-//	free( init_str );
-//	free( db_name_str );
-//	free( query_str );
-
-	/* print the query for debugging purposes */
-	if (DEBUG_OPTION > 1) printf("%ws\n\n", query);
-
-	return query;
+	/* write each term at the end of the string instead of concatenating temporary strings */
+	char *end = query_str;
+	int i;
+	for (i = 0; i < dims; i++)
+		end += sprintf( end, "%s(c_%d-%f)*(c_%d-%f)", ( i == 0 ) ? "" : "+", i, query_vec[i], i, query_vec[i] );
 
+	return query_str;
 }
 
-
 /* ======================================================================================
 *
 * length: auxiliary function that computes the number of digits of an integer
@@ -0,0 +1,370 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* query_cache.cpp
+* This file contains the implementation of the LRU cache of query results. Entries are found
+* through a hash table of chains and ordered by a doubly linked list, from the most recently
+* used to the least recently used.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "query_cache.hpp"
+
+/* ======================================================================================
+*
+* hash_bytes: FNV-1a hash of a block of memory, combined with a previous hash value
+*
+*      * hash - previous hash value
+*	   * data - block of memory
+*	   * size - number of bytes
+*
+* ====================================================================================== */
+static unsigned long hash_bytes(unsigned long hash, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	size_t i;
+	for (i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+/* ======================================================================================
+*
+* query_cache_hash: hash of the part of the key that must match exactly: the query vector,
+*				the norm, the window sizes and the table name. Epsilon is left out so that
+*				entries with other radius are found in the same chain
+*
+*      * query - the query vector with TOTAL_DIMENSIONS values
+*
+* ====================================================================================== */
+static unsigned long query_cache_hash(double *query)
+{
+	unsigned long hash = 2166136261UL;
+
+	hash = hash_bytes(hash, query, sizeof(double)*TOTAL_DIMENSIONS);
+	hash = hash_bytes(hash, NORM_TYPE, strlen(NORM_TYPE));
+	hash = hash_bytes(hash, WINDOWS, sizeof(int)*NUM_PROJECTIONS);
+	hash = hash_bytes(hash, DATASET_ROOT_NAME, strlen(DATASET_ROOT_NAME));
+
+	return hash;
+}
+
+/* ======================================================================================
+*
+* query_cache_same_key: returns 1 if the entry was computed for the query vector with the
+*				current norm, windows and table name
+*
+*      * entry - a cache entry
+*	   * hash - hash of the query
+*	   * query - the query vector with TOTAL_DIMENSIONS values
+*
+* ====================================================================================== */
+static int query_cache_same_key(query_cache_entry *entry, unsigned long hash, double *query)
+{
+	return entry->hash == hash
+		&& entry->dims == TOTAL_DIMENSIONS
+		&& entry->num_windows == NUM_PROJECTIONS
+		&& memcmp(entry->query, query, sizeof(double)*TOTAL_DIMENSIONS) == 0
+		&& memcmp(entry->windows, WINDOWS, sizeof(int)*NUM_PROJECTIONS) == 0
+		&& strcmp(entry->norm, NORM_TYPE) == 0
+		&& strcmp(entry->table_root, DATASET_ROOT_NAME) == 0;
+}
+
+/* ======================================================================================
+*
+* query_cache_unlink: removes an entry from the LRU list
+*
+*      * cache - the cache
+*	   * entry - an entry of the cache
+*
+* ====================================================================================== */
+static void query_cache_unlink(query_cache *cache, query_cache_entry *entry)
+{
+	if (entry->prev != NULL) entry->prev->next = entry->next;
+	else cache->head = entry->next;
+
+	if (entry->next != NULL) entry->next->prev = entry->prev;
+	else cache->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+/* ======================================================================================
+*
+* query_cache_push_front: places an entry at the head of the LRU list
+*
+*      * cache - the cache
+*	   * entry - an entry that is not in the list
+*
+* ====================================================================================== */
+static void query_cache_push_front(query_cache *cache, query_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	if (cache->head != NULL) cache->head->prev = entry;
+	cache->head = entry;
+
+	if (cache->tail == NULL) cache->tail = entry;
+}
+
+/* ======================================================================================
+*
+* query_cache_entry_free: deallocates the memory of an entry
+*
+*      * entry - a cache entry
+*
+* ====================================================================================== */
+static void query_cache_entry_free(query_cache_entry *entry)
+{
+	free(entry->query);
+	free(entry->norm);
+	free(entry->table_root);
+	free(entry->windows);
+	free(entry->matches);
+	free(entry);
+}
+
+/* ======================================================================================
+*
+* query_cache_remove: removes an entry from its hash chain and from the LRU list and
+*				deallocates it
+*
+*      * cache - the cache
+*	   * entry - an entry of the cache
+*
+* ====================================================================================== */
+static void query_cache_remove(query_cache *cache, query_cache_entry *entry)
+{
+	query_cache_entry **link = &cache->buckets[entry->hash % QUERY_CACHE_BUCKETS];
+	while (*link != entry)
+		link = &(*link)->chain;
+	*link = entry->chain;
+
+	query_cache_unlink(cache, entry);
+
+	cache->bytes -= entry->bytes;
+	query_cache_entry_free(entry);
+}
+
+/* ======================================================================================
+*
+* query_cache_alloc: allocates an empty cache that will use at most max_bytes of memory
+*
+*      * max_bytes - memory budget of the cache
+*
+* ====================================================================================== */
+query_cache *query_cache_alloc(size_t max_bytes)
+{
+	query_cache *cache = (query_cache *)malloc(sizeof(query_cache));
+
+	cache->buckets = (query_cache_entry **)calloc(QUERY_CACHE_BUCKETS, sizeof(query_cache_entry *));
+	cache->head = cache->tail = NULL;
+	cache->bytes = 0;
+	cache->max_bytes = max_bytes;
+	cache->index_version = INDEX_VERSION;
+	cache->hits = cache->containment_hits = cache->misses = 0;
+
+	return cache;
+}
+
+/* ======================================================================================
+*
+* query_cache_clear: removes every entry of the cache
+*
+*      * cache - the cache to clear
+*
+* ====================================================================================== */
+void query_cache_clear(query_cache *cache)
+{
+	while (cache->head != NULL)
+		query_cache_remove(cache, cache->head);
+}
+
+/* ======================================================================================
+*
+* query_cache_free: deallocates the cache and all of its entries
+*
+*      * cache - the cache to deallocate
+*
+* ====================================================================================== */
+void query_cache_free(query_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	query_cache_clear(cache);
+
+	free(cache->buckets);
+	free(cache);
+}
+
+/* ======================================================================================
+*
+* query_cache_lookup: searches the cache for the query with the current NORM_TYPE, WINDOWS
+*				and table name. Returns 1 and a newly allocated array of matches on a hit
+*				and 0 on a miss
+*
+*      * cache - the cache
+*	   * query - the query vector with TOTAL_DIMENSIONS values
+*	   * epsilon - radius of the query
+*	   * matches - output array of matches, must be freed by the caller
+*	   * num_matches - output number of matches
+*
+* ====================================================================================== */
+int query_cache_lookup(query_cache *cache, double *query, double epsilon, query_match **matches, long *num_matches)
+{
+	/* the index was rebuilt since the results were cached */
+	if (cache->index_version != INDEX_VERSION)
+	{
+		query_cache_clear(cache);
+		cache->index_version = INDEX_VERSION;
+	}
+
+	unsigned long hash = query_cache_hash(query);
+
+	/* among the entries with the same key, prefer the exact epsilon, otherwise the smallest
+	 * epsilon that contains the query, since it has the fewest matches to filter */
+	query_cache_entry *entry, *best = NULL;
+	for (entry = cache->buckets[hash % QUERY_CACHE_BUCKETS]; entry != NULL; entry = entry->chain)
+	{
+		if (!query_cache_same_key(entry, hash, query) || entry->epsilon < epsilon)
+			continue;
+
+		if (best == NULL || entry->epsilon < best->epsilon)
+			best = entry;
+	}
+
+	if (best == NULL)
+	{
+		cache->misses++;
+		return 0;
+	}
+
+	/* mark the entry as the most recently used */
+	query_cache_unlink(cache, best);
+	query_cache_push_front(cache, best);
+
+	*matches = (query_match *)malloc(sizeof(query_match)*(best->num_matches + 1));
+
+	if (best->epsilon == epsilon)
+	{
+		memcpy(*matches, best->matches, sizeof(query_match)*best->num_matches);
+		*num_matches = best->num_matches;
+		cache->hits++;
+	}
+	else
+	{
+		/* containment: the matches of a smaller radius are the cached matches within it */
+		long i, n = 0;
+		for (i = 0; i < best->num_matches; i++)
+			if (best->matches[i].distance <= epsilon)
+				(*matches)[n++] = best->matches[i];
+
+		*num_matches = n;
+		cache->containment_hits++;
+	}
+
+	return 1;
+}
+
+/* ======================================================================================
+*
+* query_cache_insert: stores a copy of the matches of a query, evicting the least recently
+*				used entries until the cache fits in its memory budget
+*
+*      * cache - the cache
+*	   * query - the query vector with TOTAL_DIMENSIONS values
+*	   * epsilon - radius used to compute the matches
+*	   * matches - the matches of the query
+*	   * num_matches - number of matches
+*
+* ====================================================================================== */
+void query_cache_insert(query_cache *cache, double *query, double epsilon, query_match *matches, long num_matches)
+{
+	if (cache->index_version != INDEX_VERSION)
+	{
+		query_cache_clear(cache);
+		cache->index_version = INDEX_VERSION;
+	}
+
+	size_t bytes = sizeof(query_cache_entry) + sizeof(double)*TOTAL_DIMENSIONS + sizeof(int)*NUM_PROJECTIONS
+		+ strlen(NORM_TYPE) + strlen(DATASET_ROOT_NAME) + 2 + sizeof(query_match)*num_matches;
+
+	/* results larger than the whole cache are not stored */
+	if (bytes > cache->max_bytes)
+		return;
+
+	unsigned long hash = query_cache_hash(query);
+
+	/* replace an entry with the same key and epsilon */
+	query_cache_entry *entry;
+	for (entry = cache->buckets[hash % QUERY_CACHE_BUCKETS]; entry != NULL; entry = entry->chain)
+		if (query_cache_same_key(entry, hash, query) && entry->epsilon == epsilon)
+		{
+			query_cache_remove(cache, entry);
+			break;
+		}
+
+	/* evict the least recently used entries */
+	while (cache->bytes + bytes > cache->max_bytes && cache->tail != NULL)
+		query_cache_remove(cache, cache->tail);
+
+	entry = (query_cache_entry *)malloc(sizeof(query_cache_entry));
+	entry->hash = hash;
+	entry->dims = TOTAL_DIMENSIONS;
+	entry->num_windows = NUM_PROJECTIONS;
+	entry->epsilon = epsilon;
+	entry->num_matches = num_matches;
+	entry->bytes = bytes;
+
+	entry->query = (double *)malloc(sizeof(double)*TOTAL_DIMENSIONS);
+	memcpy(entry->query, query, sizeof(double)*TOTAL_DIMENSIONS);
+
+	entry->windows = (int *)malloc(sizeof(int)*NUM_PROJECTIONS);
+	memcpy(entry->windows, WINDOWS, sizeof(int)*NUM_PROJECTIONS);
+
+	entry->norm = (char *)malloc(sizeof(char)*(strlen(NORM_TYPE) + 1));
+	strcpy(entry->norm, NORM_TYPE);
+
+	entry->table_root = (char *)malloc(sizeof(char)*(strlen(DATASET_ROOT_NAME) + 1));
+	strcpy(entry->table_root, DATASET_ROOT_NAME);
+
+	entry->matches = (query_match *)malloc(sizeof(query_match)*(num_matches + 1));
+	memcpy(entry->matches, matches, sizeof(query_match)*num_matches);
+
+	/* add the entry to its hash chain and to the head of the LRU list */
+	entry->chain = cache->buckets[hash % QUERY_CACHE_BUCKETS];
+	cache->buckets[hash % QUERY_CACHE_BUCKETS] = entry;
+
+	entry->prev = entry->next = NULL;
+	query_cache_push_front(cache, entry);
+
+	cache->bytes += bytes;
+}
+
+/* ======================================================================================
+*
+* print_query_cache_statistics: displays the number of hits and misses of the cache.
+*				used for debugging purposes
+*
+*      * cache - the cache
+*
+* ====================================================================================== */
+void print_query_cache_statistics(query_cache *cache)
+{
+	printf("\nQuery cache: %ld hits, %ld containment hits, %ld misses, %lu bytes used\n",
+		cache->hits, cache->containment_hits, cache->misses, (unsigned long)cache->bytes);
+}
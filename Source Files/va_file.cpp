@@ -0,0 +1,548 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* va_file.cpp
+* This file contains the implementation of the vector approximation file. The cells of a
+* vector are packed from the lowest bits of each byte, so a byte holds the cells of 8 / bits
+* consecutive coordinates. For each query, a table gives the bound contributed by every value
+* of every byte of the approximation, so the scan reads one byte and adds one value from the
+* table per 8 / bits coordinates. Once read, the bytes are grouped by blocks of vectors, so
+* that a byte of a whole block is looked up at once with shuffles.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "va_file.hpp"
+#include "projection.hpp"
+
+/* VA-file of the current index, read by the first query */
+static va_file *VA_FILE = NULL;
+
+/* ======================================================================================
+*
+* compare_doubles: comparison function used to sort the values of a coordinate
+*
+* ====================================================================================== */
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* ======================================================================================
+*
+* va_file_alloc: allocates an empty VA-file for a level
+*
+*      * dims - dimension of the level
+*	   * bits - bits of each coordinate: 1, 2, 4 or 8
+*
+* ====================================================================================== */
+va_file *va_file_alloc(int dims, int bits)
+{
+	va_file *va = (va_file *)calloc(1, sizeof(va_file));
+
+	/* the cells of a coordinate never cross a byte */
+	if (bits != 1 && bits != 2 && bits != 4 && bits != 8)
+		bits = 4;
+
+	va->dims = dims;
+	va->bits = bits;
+	va->cells_per_byte = 8 / bits;
+	va->bytes_per_vector = (dims + va->cells_per_byte - 1) / va->cells_per_byte;
+
+	return va;
+}
+
+/* ======================================================================================
+*
+* va_file_free: deallocates a VA-file
+*
+*      * va - the VA-file to deallocate
+*
+* ====================================================================================== */
+void va_file_free(va_file *va)
+{
+	if (va == NULL)
+		return;
+
+	free(va->vectors);
+	free(va->boundaries);
+	free(va->codes);
+	free(va->blocks);
+	free(va);
+}
+
+/* ======================================================================================
+*
+* va_file_add_vectors: appends the next chunk of vectors of the level. The chunks must be
+*				added in the order of their IDs, which is the order in which they are
+*				inserted in the database
+*
+*      * va - VA-file being built
+*	   * data - chunk of vectors, one per row
+*	   * num_rows - number of vectors of the chunk
+*
+* ====================================================================================== */
+void va_file_add_vectors(va_file *va, gsl_matrix *data, long num_rows)
+{
+	if (va->num_vectors + num_rows > va->capacity)
+	{
+		while (va->num_vectors + num_rows > va->capacity)
+			va->capacity = (va->capacity == 0) ? CHUNK_SIZE : 2 * va->capacity;
+
+		va->vectors = (double *)realloc(va->vectors, sizeof(double)*va->capacity*va->dims);
+	}
+
+	long row;
+	int i;
+	for (row = 0; row < num_rows; row++)
+		for (i = 0; i < va->dims; i++)
+			va->vectors[(va->num_vectors + row)*va->dims + i] = gsl_matrix_get(data, row, i);
+
+	va->num_vectors += num_rows;
+}
+
+/* ======================================================================================
+*
+* va_file_encode: computes the boundaries of the cells of every coordinate and packs the cells
+*				of every vector. The inner boundaries are quantiles of the coordinate, so every
+*				cell holds about the same number of vectors, and the outer boundaries are the
+*				minimum and the maximum of the coordinate, so every vector lies in its cells
+*
+*      * va - VA-file being built
+*
+* ====================================================================================== */
+void va_file_encode(va_file *va)
+{
+	int num_cells = 1 << va->bits, i, k;
+	long v;
+
+	if (va->num_vectors == 0)
+		return;
+
+	va->boundaries = (double *)malloc(sizeof(double)*va->dims*(num_cells + 1));
+
+	long sample_size = (va->num_vectors < VA_FILE_SAMPLE) ? va->num_vectors : VA_FILE_SAMPLE;
+	double *sample = (double *)malloc(sizeof(double)*sample_size);
+
+	for (i = 0; i < va->dims; i++)
+	{
+		double *boundaries = &va->boundaries[i*(num_cells + 1)];
+
+		for (v = 0; v < sample_size; v++)
+			sample[v] = va->vectors[(long)((double)v * va->num_vectors / sample_size)*va->dims + i];
+
+		qsort(sample, sample_size, sizeof(double), compare_doubles);
+
+		for (k = 1; k < num_cells; k++)
+			boundaries[k] = sample[(long)k * sample_size / num_cells];
+
+		boundaries[0] = GSL_POSINF;
+		boundaries[num_cells] = GSL_NEGINF;
+		for (v = 0; v < va->num_vectors; v++)
+		{
+			double value = va->vectors[v*va->dims + i];
+			if (value < boundaries[0]) boundaries[0] = value;
+			if (value > boundaries[num_cells]) boundaries[num_cells] = value;
+		}
+	}
+
+	free(sample);
+
+	/* pack the cell of every coordinate */
+	va->codes = (unsigned char *)calloc(va->num_vectors*va->bytes_per_vector, sizeof(unsigned char));
+
+	for (v = 0; v < va->num_vectors; v++)
+	{
+		unsigned char *code = &va->codes[v*va->bytes_per_vector];
+
+		for (i = 0; i < va->dims; i++)
+		{
+			const double *boundaries = &va->boundaries[i*(num_cells + 1)];
+			double value = va->vectors[v*va->dims + i];
+
+			/* last cell whose lower boundary is not above the value */
+			int low = 0, high = num_cells - 1;
+			while (low < high)
+			{
+				int middle = (low + high + 1) / 2;
+				if (boundaries[middle] <= value)
+					low = middle;
+				else
+					high = middle - 1;
+			}
+
+			code[i / va->cells_per_byte] |= (unsigned char)(low << ((i % va->cells_per_byte) * va->bits));
+		}
+	}
+
+	free(va->vectors);
+	va->vectors = NULL;
+	va->capacity = 0;
+
+	if (DEBUG_OPTION > 0)
+		printf("\nVA-file: %ld vectors, %d bytes per vector\n", va->num_vectors, va->bytes_per_vector);
+}
+
+/* ======================================================================================
+*
+* build_va_file_path: returns the path of the VA-file of the dataset
+*
+* ====================================================================================== */
+static char *build_va_file_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.va", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* va_file_write: saves the VA-file next to the dataset
+*
+*      * va - encoded VA-file
+*
+* ====================================================================================== */
+void va_file_write(va_file *va)
+{
+	char *path = build_va_file_path();
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		printf("[ERROR] Unable to write the VA-file to %s\n", path);
+		free(path);
+		return;
+	}
+
+	int magic = VA_FILE_MAGIC;
+	fwrite(&magic, sizeof(int), 1, file);
+	fwrite(&va->dims, sizeof(int), 1, file);
+	fwrite(&va->bits, sizeof(int), 1, file);
+	fwrite(&va->num_vectors, sizeof(long), 1, file);
+	fwrite(va->boundaries, sizeof(double), va->dims*((1 << va->bits) + 1), file);
+	fwrite(va->codes, sizeof(unsigned char), va->num_vectors*va->bytes_per_vector, file);
+
+	fclose(file);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* va_file_read: reads the VA-file of the dataset, or returns NULL if the file does not exist
+*				or does not match the lowest level of the index
+*
+* ====================================================================================== */
+static va_file *va_file_read()
+{
+	char *path = build_va_file_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, dims = 0, bits = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != VA_FILE_MAGIC
+		|| fread(&dims, sizeof(int), 1, file) != 1 || dims != get_projection_plan()->dims[NUM_PROJECTIONS]
+		|| fread(&bits, sizeof(int), 1, file) != 1 || (bits != 1 && bits != 2 && bits != 4 && bits != 8))
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	va_file *va = va_file_alloc(dims, bits);
+
+	int valid = fread(&va->num_vectors, sizeof(long), 1, file) == 1 && va->num_vectors > 0;
+
+	if (valid)
+	{
+		size_t num_boundaries = (size_t)dims*((1 << bits) + 1);
+		size_t num_bytes = (size_t)va->num_vectors*va->bytes_per_vector;
+
+		va->boundaries = (double *)malloc(sizeof(double)*num_boundaries);
+		va->codes = (unsigned char *)malloc(sizeof(unsigned char)*num_bytes);
+
+		valid = fread(va->boundaries, sizeof(double), num_boundaries, file) == num_boundaries
+			&& fread(va->codes, sizeof(unsigned char), num_bytes, file) == num_bytes;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		va_file_free(va);
+		return NULL;
+	}
+
+	/* the scan reads a byte of a block of vectors at once. The vectors past the last one of
+	 * the last block have the cells 0 and are never returned */
+	long num_blocks = (va->num_vectors + VA_FILE_BLOCK_SIZE - 1) / VA_FILE_BLOCK_SIZE, v;
+	va->blocks = (unsigned char *)calloc((size_t)num_blocks*va->bytes_per_vector*VA_FILE_BLOCK_SIZE, sizeof(unsigned char));
+
+	int byte;
+	for (v = 0; v < va->num_vectors; v++)
+		for (byte = 0; byte < va->bytes_per_vector; byte++)
+			va->blocks[((v / VA_FILE_BLOCK_SIZE)*va->bytes_per_vector + byte)*VA_FILE_BLOCK_SIZE + v % VA_FILE_BLOCK_SIZE] = va->codes[v*va->bytes_per_vector + byte];
+
+	free(va->codes);
+	va->codes = NULL;
+
+	return va;
+}
+
+/* ======================================================================================
+*
+* get_va_file: returns the VA-file of the current index, read from the file the first time it
+*				is needed. Returns NULL if the index has no VA-file
+*
+* ====================================================================================== */
+va_file *get_va_file()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the VA-file was read */
+	if (checked_version != INDEX_VERSION)
+	{
+		va_file_free(VA_FILE);
+		VA_FILE = (NUM_PROJECTIONS > 0) ? va_file_read() : NULL;
+		checked_version = INDEX_VERSION;
+	}
+
+	return VA_FILE;
+}
+
+/* ======================================================================================
+*
+* build_bound_tables: fills, for every byte of the approximation and every value of the byte,
+*				the sum of the lower and of the upper bounds contributed by its coordinates.
+*				The bounds of a coordinate are the distances from the query to the closest
+*				and to the farthest boundary of its cell, squared with the L2 norm
+*
+*      * va - VA-file
+*	   * query_vec - projection of the query at the lowest level
+*	   * norm_l2 - 1 for the L2 norm, 0 for the L1 norm
+*	   * lower - output table with bytes_per_vector x 256 values
+*	   * upper - output table with bytes_per_vector x 256 values
+*
+* ====================================================================================== */
+static void build_bound_tables(va_file *va, const double *query_vec, int norm_l2, double *lower, double *upper)
+{
+	int num_cells = 1 << va->bits, mask = num_cells - 1, i, cell, byte, value, j;
+
+	/* bounds of every cell of every coordinate */
+	double *cell_lower = (double *)malloc(sizeof(double)*va->dims*num_cells);
+	double *cell_upper = (double *)malloc(sizeof(double)*va->dims*num_cells);
+
+	for (i = 0; i < va->dims; i++)
+	{
+		const double *boundaries = &va->boundaries[i*(num_cells + 1)];
+
+		for (cell = 0; cell < num_cells; cell++)
+		{
+			double low = boundaries[cell], high = boundaries[cell + 1], q = query_vec[i];
+
+			double gap = (q < low) ? low - q : (q > high) ? q - high : 0;
+			double reach = (q - low > high - q) ? q - low : high - q;
+
+			cell_lower[i*num_cells + cell] = norm_l2 ? gap*gap : gap;
+			cell_upper[i*num_cells + cell] = norm_l2 ? reach*reach : reach;
+		}
+	}
+
+	/* combine the coordinates of each byte */
+	for (byte = 0; byte < va->bytes_per_vector; byte++)
+	{
+		for (value = 0; value < 256; value++)
+		{
+			double low = 0, high = 0;
+
+			for (j = 0; j < va->cells_per_byte; j++)
+			{
+				i = byte * va->cells_per_byte + j;
+				if (i >= va->dims)
+					break;
+
+				cell = (value >> (j * va->bits)) & mask;
+				low += cell_lower[i*num_cells + cell];
+				high += cell_upper[i*num_cells + cell];
+			}
+
+			lower[byte * 256 + value] = low;
+			upper[byte * 256 + value] = high;
+		}
+	}
+
+	free(cell_lower);
+	free(cell_upper);
+}
+
+/* ======================================================================================
+*
+* quantize_table: quantizes the lower bounds of the query to one byte each. Every value is
+*				rounded down, so a sum of quantized values times the step is never larger than
+*				the sum of the values. Values beyond 255 steps are clipped to 255
+*
+*      * lower - lower bounds, bytes_per_vector x 256
+*	   * num_values - number of values of the table
+*	   * step - bound of one step
+*	   * quantized - output values, bytes_per_vector x 256
+*
+* ====================================================================================== */
+static void quantize_table(const double *lower, long num_values, double step, unsigned char *quantized)
+{
+	long i;
+	for (i = 0; i < num_values; i++)
+	{
+		double steps = floor(lower[i] / step);
+
+		/* the division may round up */
+		if (steps > 0 && steps * step > lower[i])
+			steps--;
+
+		quantized[i] = (unsigned char)((steps < 255) ? steps : 255);
+	}
+}
+
+/* ======================================================================================
+*
+* sum_block: sums the quantized lower bounds of the bytes of a block of VA_FILE_BLOCK_SIZE
+*				vectors. The 256 values of a byte are read as 16 registers: the low 4 bits of
+*				the byte select the value of every register with a shuffle and the high 4 bits
+*				select the register. The sums saturate at 65535, which keeps them lower bounds
+*
+*      * va - VA-file of the lowest level
+*	   * block - bytes of the block
+*	   * quantized - quantized lower bounds of the query, bytes_per_vector x 256
+*	   * sums - output sum of every vector of the block
+*
+* ====================================================================================== */
+static void sum_block(const va_file *va, const unsigned char *block, const unsigned char *quantized, unsigned short *sums)
+{
+	__m128i zero = _mm_setzero_si128(), nibble = _mm_set1_epi8(0x0F);
+	__m128i low_sum = _mm_setzero_si128(), high_sum = _mm_setzero_si128();
+
+	int byte, r;
+	for (byte = 0; byte < va->bytes_per_vector; byte++, block += VA_FILE_BLOCK_SIZE, quantized += 256)
+	{
+		__m128i codes = _mm_loadu_si128((const __m128i *)block);
+		__m128i low = _mm_and_si128(codes, nibble);
+		__m128i high = _mm_and_si128(_mm_srli_epi16(codes, 4), nibble);
+
+		__m128i values = zero;
+		for (r = 0; r < 16; r++)
+		{
+			__m128i table = _mm_loadu_si128((const __m128i *)(quantized + 16 * r));
+			__m128i selected = _mm_cmpeq_epi8(high, _mm_set1_epi8((char)r));
+			values = _mm_or_si128(values, _mm_and_si128(selected, _mm_shuffle_epi8(table, low)));
+		}
+
+		low_sum = _mm_adds_epu16(low_sum, _mm_unpacklo_epi8(values, zero));
+		high_sum = _mm_adds_epu16(high_sum, _mm_unpackhi_epi8(values, zero));
+	}
+
+	_mm_storeu_si128((__m128i *)sums, low_sum);
+	_mm_storeu_si128((__m128i *)(sums + 8), high_sum);
+}
+
+/* ======================================================================================
+*
+* va_file_scan: appends to the candidates the vectors whose lower bound is within epsilon of
+*				the query, with their lower bounds, and returns the new number of candidates.
+*				The lower bounds are also quantized to one byte, so that the bytes of a block
+*				of vectors are summed with shuffles, and a vector is only summed with the exact
+*				tables when the quantized sum, a smaller value, does not already prune it
+*
+*      * va - VA-file of the lowest level
+*	   * query_vec - projection of the query at the lowest level
+*	   * constant_c - constant that multiplies the distances of the level
+*	   * epsilon - radius of the query
+*	   * candidates - array of candidates, reallocated when it is full
+*	   * num_candidates - number of candidates already in the array
+*	   * capacity - number of candidates allocated
+*	   * num_certain - output number of candidates whose upper bound is also within epsilon
+*
+* ====================================================================================== */
+long va_file_scan(va_file *va, const double *query_vec, double constant_c, double epsilon,
+	query_match **candidates, long num_candidates, long *capacity, long *num_certain)
+{
+	int norm_l2 = get_projection_plan()->norm_l2, byte;
+
+	double *lower = (double *)malloc(sizeof(double)*va->bytes_per_vector * 256);
+	double *upper = (double *)malloc(sizeof(double)*va->bytes_per_vector * 256);
+	build_bound_tables(va, query_vec, norm_l2, lower, upper);
+
+	/* the vectors read from the database may differ from the approximated ones by the
+	 * rounding of every coordinate */
+	double radius = epsilon / constant_c + VA_FILE_ROUNDING * va->dims;
+	double certain_radius = epsilon / constant_c - VA_FILE_ROUNDING * va->dims;
+	double limit = norm_l2 ? radius*radius : radius;
+	double certain_limit = (certain_radius <= 0) ? -1 : norm_l2 ? certain_radius*certain_radius : certain_radius;
+
+	/* one step of the quantized table: a sum at the limit is about 128 steps per byte, so the
+	 * quantized sums separate the vectors near the limit and saturate far beyond it */
+	double step = limit / (128.0 * va->bytes_per_vector);
+
+	unsigned char *quantized = (unsigned char *)malloc(sizeof(unsigned char)*va->bytes_per_vector * 256);
+	quantize_table(lower, (long)va->bytes_per_vector * 256, step, quantized);
+
+	*num_certain = 0;
+
+	unsigned short sums[VA_FILE_BLOCK_SIZE];
+	long v, block_indx = -1;
+	const unsigned char *block = NULL;
+
+	for (v = 0; v < va->num_vectors; v++)
+	{
+		int lane = (int)(v % VA_FILE_BLOCK_SIZE);
+		if (lane == 0)
+		{
+			block_indx++;
+			block = &va->blocks[block_indx*va->bytes_per_vector*VA_FILE_BLOCK_SIZE];
+			sum_block(va, block, quantized, sums);
+		}
+
+		if (sums[lane] * step > limit)
+			continue;
+
+		const double *table = lower;
+		double bound = 0;
+
+		for (byte = 0; byte < va->bytes_per_vector; byte++, table += 256)
+			bound += table[block[byte*VA_FILE_BLOCK_SIZE + lane]];
+
+		if (bound > limit)
+			continue;
+
+		double upper_bound = 0;
+		for (byte = 0, table = upper; byte < va->bytes_per_vector; byte++, table += 256)
+			upper_bound += table[block[byte*VA_FILE_BLOCK_SIZE + lane]];
+
+		if (upper_bound <= certain_limit)
+			(*num_certain)++;
+
+		if (num_candidates == *capacity)
+		{
+			*capacity *= 2;
+			*candidates = (query_match *)realloc(*candidates, sizeof(query_match)*(*capacity));
+		}
+
+		(*candidates)[num_candidates].id = v + 1;
+		(*candidates)[num_candidates].distance = constant_c * (norm_l2 ? sqrt(bound) : bound);
+		num_candidates++;
+	}
+
+	free(quantized);
+	free(lower);
+	free(upper);
+
+	return num_candidates;
+}
@@ -0,0 +1,343 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* window_tuner.cpp
+* This file contains the implementation of the tuner of the windows. The sequences of windows
+* are enumerated depth first, so a sequence shares the projections of the sample with the
+* sequences it extends. For every pair of a query and a vector of the sample, the tuner keeps
+* the deepest level of the current sequence where the vector is farther than epsilon from the
+* query. A vector is read at level l only if it passed every level below l, so the number of
+* vectors read at each level follows from a histogram of those deepest levels.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "window_tuner.hpp"
+#include "projection.hpp"
+
+/* state of the enumeration of the sequences of windows */
+typedef struct
+{
+	long num_sample;
+	int num_queries;
+	long num_pairs;							/* num_queries x num_sample */
+	long *query_rows;						/* row of the sample of each query */
+	double *epsilons;						/* radius of each query */
+
+	projection_plan *steps[WINDOW_TUNER_MAX_WINDOW + 1];	/* plan of one step with each window */
+
+	/* current sequence: level 0 is the sample and level l is projected with path[l-1] */
+	int path[WINDOW_TUNER_MAX_LEVELS];
+	int dims[WINDOW_TUNER_MAX_LEVELS + 1];
+	double constants[WINDOW_TUNER_MAX_LEVELS + 1];
+	double *levels[WINDOW_TUNER_MAX_LEVELS + 1];			/* num_sample x dims values */
+	unsigned char *deepest_failure[WINDOW_TUNER_MAX_LEVELS + 1];	/* per pair, the deepest level
+															 * where the vector is farther than
+															 * epsilon, 0 if none */
+	long *histogram;
+
+	/* cheapest sequence */
+	int best_windows[WINDOW_TUNER_MAX_LEVELS];
+	int best_num_levels;
+	double best_cost;
+	double best_pruned;						/* fraction of the pairs pruned by the sequence */
+	double given_cost;						/* cost of the windows given in input, if evaluated */
+	long num_evaluated;
+} window_tuner;
+
+/* ======================================================================================
+*
+* load_sample: reads at most WINDOW_TUNER_SAMPLE vectors of the original data taken at regular
+*				intervals of the IDs, num_sample x TOTAL_DIMENSIONS values
+*
+*      * hdbc - an opened SQL connection
+*	   * num_sample - output number of vectors of the sample
+*
+* ====================================================================================== */
+static double *load_sample(HDBC hdbc, long *num_sample)
+{
+	int dims = TOTAL_DIMENSIONS, i;
+	long size = (TOTAL_VECTORS < WINDOW_TUNER_SAMPLE) ? TOTAL_VECTORS : WINDOW_TUNER_SAMPLE;
+
+	double *sample = (double *)malloc(sizeof(double)*size*dims);
+
+	int chunks_to_read = compute_num_chunks(), chunk_indx;
+	long first_id, t;
+
+	for (chunk_indx = 0, first_id = 0, t = 0; chunk_indx < chunks_to_read && t < size; chunk_indx++)
+	{
+		long remaining_vecs = compute_num_vecs_to_load(chunk_indx, chunks_to_read);
+		gsl_matrix *database_matrix = load_data_chunk(hdbc, chunk_indx, chunks_to_read, remaining_vecs, dims);
+
+		/* vector t of the sample is the vector t x TOTAL_VECTORS / size */
+		long source;
+		while (t < size && (source = (long)((double)t * TOTAL_VECTORS / size)) < first_id + remaining_vecs)
+		{
+			for (i = 0; i < dims; i++)
+				sample[t*dims + i] = gsl_matrix_get(database_matrix, source - first_id, i);
+			t++;
+		}
+
+		first_id += remaining_vecs;
+		gsl_matrix_free(database_matrix);
+	}
+
+	*num_sample = t;
+	return sample;
+}
+
+/* ======================================================================================
+*
+* build_step_plan: returns the plan of a single projection step with a window. The plan is
+*				built from the globals, which are restored afterwards
+*
+*      * window - window of the step
+*
+* ====================================================================================== */
+static projection_plan *build_step_plan(int window)
+{
+	int *windows = WINDOWS, num_projections = NUM_PROJECTIONS;
+
+	WINDOWS = &window;
+	NUM_PROJECTIONS = 1;
+
+	projection_plan *plan = projection_plan_build();
+
+	WINDOWS = windows;
+	NUM_PROJECTIONS = num_projections;
+
+	return plan;
+}
+
+/* ======================================================================================
+*
+* record_sequence: computes the cost of the current sequence, which ends at a level, and keeps
+*				it if it is the cheapest. The last level is scanned entirely and every other
+*				level reads, with the lookup factor of the cascade planner, the vectors that
+*				passed the levels below it
+*
+*      * tuner - state of the enumeration
+*	   * depth - last level of the sequence
+*
+* ====================================================================================== */
+static void record_sequence(window_tuner *tuner, int depth)
+{
+	long pair;
+	int level;
+
+	memset(tuner->histogram, 0, sizeof(long)*(depth + 1));
+	for (pair = 0; pair < tuner->num_pairs; pair++)
+		tuner->histogram[tuner->deepest_failure[depth][pair]]++;
+
+	double cost = tuner->dims[depth] + CASCADE_ROW_COST;
+	long passed = 0;
+
+	for (level = depth - 1; level >= 0; level--)
+	{
+		/* the vectors read at this level did not fail any deeper level */
+		passed += tuner->histogram[level];
+		cost += ((double)passed / tuner->num_pairs) * (tuner->dims[level] + CASCADE_ROW_COST) * CASCADE_LOOKUP_FACTOR;
+	}
+
+	tuner->num_evaluated++;
+
+	if (DEBUG_OPTION > 1)
+	{
+		printf("Windows");
+		for (level = 0; level < depth; level++)
+			printf("%s%d", (level == 0) ? " " : ",", tuner->path[level]);
+		printf(": cost %.2f\n", cost);
+	}
+
+	/* the windows given in input */
+	int given = (depth == NUM_PROJECTIONS);
+	for (level = 0; level < depth && given; level++)
+		given = (tuner->path[level] == WINDOWS[level]);
+	if (given)
+		tuner->given_cost = cost;
+
+	if (tuner->best_num_levels == 0 || cost < tuner->best_cost)
+	{
+		tuner->best_cost = cost;
+		tuner->best_num_levels = depth;
+		tuner->best_pruned = 1 - (double)tuner->histogram[0] / tuner->num_pairs;
+		memcpy(tuner->best_windows, tuner->path, sizeof(int)*depth);
+	}
+}
+
+/* ======================================================================================
+*
+* evaluate_level: finds the pairs pruned by the last level of the current sequence, records
+*				the sequence and extends it with every window
+*
+*      * tuner - state of the enumeration
+*	   * depth - last level of the sequence, already projected
+*
+* ====================================================================================== */
+static void evaluate_level(window_tuner *tuner, int depth)
+{
+	int dims = tuner->dims[depth], q, i, window;
+	long v;
+
+	if (depth > 0)
+	{
+		const double *level = tuner->levels[depth];
+		projection_plan *plan = tuner->steps[2];
+
+		for (q = 0; q < tuner->num_queries; q++)
+		{
+			const double *query_vec = &level[tuner->query_rows[q]*dims];
+			long first_pair = q*tuner->num_sample;
+
+			for (v = 0; v < tuner->num_sample; v++)
+			{
+				double distance = tuner->constants[depth] * projection_plan_distance(plan, query_vec, &level[v*dims], dims);
+
+				tuner->deepest_failure[depth][first_pair + v] = (distance > tuner->epsilons[q])
+					? (unsigned char)depth : tuner->deepest_failure[depth - 1][first_pair + v];
+			}
+		}
+
+		record_sequence(tuner, depth);
+	}
+
+	if (depth == WINDOW_TUNER_MAX_LEVELS)
+		return;
+
+	for (window = 2; window <= WINDOW_TUNER_MAX_WINDOW; window++)
+	{
+		int next_dims = dims / window;
+		if (next_dims < 1)
+			break;
+
+		/* project the sample one step further */
+		const double *level = tuner->levels[depth];
+		double *next = tuner->levels[depth + 1];
+
+		for (v = 0; v < tuner->num_sample; v++)
+			for (i = 0; i < next_dims; i++)
+				next[v*next_dims + i] = projection_plan_project_window(tuner->steps[window], 0, &level[v*dims + i*window]);
+
+		tuner->path[depth] = window;
+		tuner->dims[depth + 1] = next_dims;
+		tuner->constants[depth + 1] = tuner->constants[depth] * tuner->steps[window]->lower_bound_constants[1];
+
+		evaluate_level(tuner, depth + 1);
+	}
+}
+
+/* ======================================================================================
+*
+* tune_windows: evaluates every sequence of windows on a sample of the original data and
+*				displays the cheapest one. The queries are vectors of the sample; without an
+*				epsilon, the radius of a query is the distance to its closest vector of the
+*				sample. The columns are taken in the order of the dataset file
+*
+*      * hdbc - an opened SQL connection
+*	   * apply - 1 to replace WINDOWS and NUM_PROJECTIONS with the cheapest sequence
+*
+* ====================================================================================== */
+int tune_windows(HDBC hdbc, int apply)
+{
+	if (TOTAL_VECTORS == 0 || TOTAL_DIMENSIONS < 2)
+		return 0;
+
+	window_tuner *tuner = (window_tuner *)calloc(1, sizeof(window_tuner));
+	int q, level, window;
+	long v;
+
+	tuner->levels[0] = load_sample(hdbc, &tuner->num_sample);
+	tuner->num_queries = (tuner->num_sample < WINDOW_TUNER_QUERIES) ? (int)tuner->num_sample : WINDOW_TUNER_QUERIES;
+	tuner->num_pairs = tuner->num_queries*tuner->num_sample;
+
+	for (window = 2; window <= WINDOW_TUNER_MAX_WINDOW; window++)
+		tuner->steps[window] = build_step_plan(window);
+
+	/* the sample at every level: each window is at least 2, so level l has at most
+	 * TOTAL_DIMENSIONS / 2^l dimensions */
+	tuner->dims[0] = TOTAL_DIMENSIONS;
+	tuner->constants[0] = 1;
+	for (level = 1; level <= WINDOW_TUNER_MAX_LEVELS; level++)
+	{
+		int max_dims = TOTAL_DIMENSIONS >> level;
+		tuner->levels[level] = (double *)malloc(sizeof(double)*tuner->num_sample*((max_dims > 0) ? max_dims : 1));
+	}
+	for (level = 0; level <= WINDOW_TUNER_MAX_LEVELS; level++)
+		tuner->deepest_failure[level] = (unsigned char *)calloc(tuner->num_pairs, sizeof(unsigned char));
+	tuner->histogram = (long *)malloc(sizeof(long)*(WINDOW_TUNER_MAX_LEVELS + 1));
+
+	/* the queries and their radius */
+	tuner->query_rows = (long *)malloc(sizeof(long)*tuner->num_queries);
+	tuner->epsilons = (double *)malloc(sizeof(double)*tuner->num_queries);
+	for (q = 0; q < tuner->num_queries; q++)
+	{
+		tuner->query_rows[q] = (long)((double)q * tuner->num_sample / tuner->num_queries);
+		tuner->epsilons[q] = EPSILON;
+
+		if (EPSILON > 0)
+			continue;
+
+		const double *query_vec = &tuner->levels[0][tuner->query_rows[q]*TOTAL_DIMENSIONS];
+		tuner->epsilons[q] = -1;
+		for (v = 0; v < tuner->num_sample; v++)
+		{
+			if (v == tuner->query_rows[q])
+				continue;
+
+			double distance = projection_plan_distance(tuner->steps[2], query_vec, &tuner->levels[0][v*TOTAL_DIMENSIONS], TOTAL_DIMENSIONS);
+			if (tuner->epsilons[q] < 0 || distance < tuner->epsilons[q])
+				tuner->epsilons[q] = distance;
+		}
+		if (tuner->epsilons[q] < 0)
+			tuner->epsilons[q] = 0;
+	}
+
+	tuner->given_cost = -1;
+	evaluate_level(tuner, 0);
+
+	int found = (tuner->best_num_levels > 0);
+	if (found)
+	{
+		printf("\n\nWindows tuned on %ld vectors and %d queries, %ld sequences evaluated\n", tuner->num_sample, tuner->num_queries, tuner->num_evaluated);
+		printf("Best windows: ");
+		for (level = 0; level < tuner->best_num_levels; level++)
+			printf("%s%d", (level == 0) ? "" : ",", tuner->best_windows[level]);
+		printf("\nEstimated cost: %.2f values per vector (%.2f for the original data), %.2f%% of the vectors pruned\n",
+			tuner->best_cost, TOTAL_DIMENSIONS + CASCADE_ROW_COST, 100 * tuner->best_pruned);
+		if (tuner->given_cost >= 0)
+			printf("Estimated cost of the windows given in input: %.2f\n", tuner->given_cost);
+	}
+
+	/* build the index with the cheapest sequence */
+	if (found && apply)
+	{
+		free(WINDOWS);
+		WINDOWS = (int *)malloc(sizeof(int)*tuner->best_num_levels);
+		memcpy(WINDOWS, tuner->best_windows, sizeof(int)*tuner->best_num_levels);
+		NUM_PROJECTIONS = tuner->best_num_levels;
+
+		/* the plans of the previous windows are no longer valid */
+		INDEX_VERSION++;
+	}
+
+	for (window = 2; window <= WINDOW_TUNER_MAX_WINDOW; window++)
+		projection_plan_free(tuner->steps[window]);
+	for (level = 0; level <= WINDOW_TUNER_MAX_LEVELS; level++)
+	{
+		free(tuner->levels[level]);
+		free(tuner->deepest_failure[level]);
+	}
+	free(tuner->histogram);
+	free(tuner->query_rows);
+	free(tuner->epsilons);
+	free(tuner);
+
+	return found;
+}
@@ -0,0 +1,363 @@
+/* ======================================================================================
+* This software is in the public domain, furnished "as is", without technical
+* support, and with no warranty, express or implied, as to its usefulness for
+* any purpose.
+*
+* zone_map.cpp
+* This file contains the implementation of the zone maps of the index. A block is a range of
+* consecutive IDs, so the blocks that may hold results are selected with a range predicate
+* over the primary key of the table of the level.
+*
+* Author: Catarina Moreira
+* Personal Page: http://web.ist.utl.pt/~catarina.p.moreira/index.html
+*
+* Supervisor: Andreas Wichert
+* Personal Page: http://web.ist.utl.pt/~andreas.wichert/
+*
+* ====================================================================================== */
+
+#include "zone_map.hpp"
+#include "projection.hpp"
+
+/* zone maps of the current index, read by the first query */
+static zone_map *ZONE_MAP = NULL;
+
+/* ======================================================================================
+*
+* zone_map_alloc: allocates empty zone maps for the levels of the index
+*
+* ====================================================================================== */
+zone_map *zone_map_alloc()
+{
+	zone_map *zones = (zone_map *)malloc(sizeof(zone_map));
+
+	zones->num_levels = NUM_PROJECTIONS + 1;
+	zones->levels = (level_zone_map *)calloc(zones->num_levels, sizeof(level_zone_map));
+
+	return zones;
+}
+
+/* ======================================================================================
+*
+* zone_map_free: deallocates the zone maps
+*
+*      * zones - the zone maps to deallocate
+*
+* ====================================================================================== */
+void zone_map_free(zone_map *zones)
+{
+	if (zones == NULL)
+		return;
+
+	int level;
+	for (level = 0; level < zones->num_levels; level++)
+	{
+		free(zones->levels[level].min);
+		free(zones->levels[level].max);
+	}
+
+	free(zones->levels);
+	free(zones);
+}
+
+/* ======================================================================================
+*
+* zone_map_add_vectors: extends the boxes of a level with the next chunk of vectors. The
+*				chunks of a level must be added in the order of their IDs, which is the
+*				order in which they are inserted in the database
+*
+*      * zones - zone maps being built
+*	   * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * data - chunk of vectors, one per row
+*	   * num_rows - number of vectors of the chunk
+*	   * dims - dimension of the level
+*
+* ====================================================================================== */
+void zone_map_add_vectors(zone_map *zones, int level, gsl_matrix *data, long num_rows, int dims)
+{
+	level_zone_map *map = &zones->levels[level];
+	map->dims = dims;
+
+	long row;
+	int i;
+	for (row = 0; row < num_rows; row++)
+	{
+		long block = map->num_vectors / ZONE_MAP_BLOCK_SIZE;
+
+		/* the first vector of a block starts its box */
+		if (map->num_vectors % ZONE_MAP_BLOCK_SIZE == 0)
+		{
+			if (block == map->capacity)
+			{
+				map->capacity = (map->capacity == 0) ? 64 : 2 * map->capacity;
+				map->min = (double *)realloc(map->min, sizeof(double)*map->capacity*dims);
+				map->max = (double *)realloc(map->max, sizeof(double)*map->capacity*dims);
+			}
+
+			for (i = 0; i < dims; i++)
+			{
+				map->min[block*dims + i] = GSL_POSINF;
+				map->max[block*dims + i] = GSL_NEGINF;
+			}
+
+			map->num_blocks = block + 1;
+		}
+
+		double *min = &map->min[block*dims];
+		double *max = &map->max[block*dims];
+
+		for (i = 0; i < dims; i++)
+		{
+			double value = gsl_matrix_get(data, row, i);
+
+			if (value < min[i]) min[i] = value;
+			if (value > max[i]) max[i] = value;
+		}
+
+		map->num_vectors++;
+	}
+}
+
+/* ======================================================================================
+*
+* build_zone_map_path: returns the path of the zone map file of the dataset
+*
+* ====================================================================================== */
+static char *build_zone_map_path()
+{
+	char *path = (char *)malloc(sizeof(char)*(50 + strlen(ROOT_DIR) + strlen(DATASET_ROOT_NAME) + strlen(NORM_TYPE)));
+	sprintf(path, "%s%s_%d_%s.zones", ROOT_DIR, DATASET_ROOT_NAME, TOTAL_DIMENSIONS, NORM_TYPE);
+
+	return path;
+}
+
+/* ======================================================================================
+*
+* zone_map_write: saves the zone maps next to the dataset. The boxes are widened by
+*				ZONE_MAP_SLACK so that the rounding of the stored coordinates never moves a
+*				vector outside of its box
+*
+*      * zones - zone maps of every level
+*
+* ====================================================================================== */
+void zone_map_write(zone_map *zones)
+{
+	char *path = build_zone_map_path();
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		printf("[ERROR] Unable to write the zone maps to %s\n", path);
+		free(path);
+		return;
+	}
+
+	int magic = ZONE_MAP_MAGIC, level;
+	long i;
+	fwrite(&magic, sizeof(int), 1, file);
+	fwrite(&zones->num_levels, sizeof(int), 1, file);
+
+	for (level = 0; level < zones->num_levels; level++)
+	{
+		level_zone_map *map = &zones->levels[level];
+		long num_values = map->num_blocks * map->dims;
+
+		for (i = 0; i < num_values; i++)
+		{
+			map->min[i] -= ZONE_MAP_SLACK;
+			map->max[i] += ZONE_MAP_SLACK;
+		}
+
+		fwrite(&map->dims, sizeof(int), 1, file);
+		fwrite(&map->num_vectors, sizeof(long), 1, file);
+		fwrite(&map->num_blocks, sizeof(long), 1, file);
+		fwrite(map->min, sizeof(double), num_values, file);
+		fwrite(map->max, sizeof(double), num_values, file);
+	}
+
+	fclose(file);
+	free(path);
+}
+
+/* ======================================================================================
+*
+* zone_map_read: reads the zone maps of the dataset, or returns NULL if the file does not
+*				exist or does not match the levels of the index
+*
+* ====================================================================================== */
+static zone_map *zone_map_read()
+{
+	char *path = build_zone_map_path();
+	FILE *file = fopen(path, "rb");
+	free(path);
+
+	if (file == NULL)
+		return NULL;
+
+	int magic = 0, num_levels = 0;
+	if (fread(&magic, sizeof(int), 1, file) != 1 || magic != ZONE_MAP_MAGIC
+		|| fread(&num_levels, sizeof(int), 1, file) != 1 || num_levels != NUM_PROJECTIONS + 1)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	zone_map *zones = zone_map_alloc();
+	projection_plan *plan = get_projection_plan();
+
+	int level, valid = 1;
+	for (level = 0; level < num_levels && valid; level++)
+	{
+		level_zone_map *map = &zones->levels[level];
+
+		valid = fread(&map->dims, sizeof(int), 1, file) == 1 && map->dims == plan->dims[level]
+			&& fread(&map->num_vectors, sizeof(long), 1, file) == 1
+			&& fread(&map->num_blocks, sizeof(long), 1, file) == 1
+			&& map->num_blocks == (map->num_vectors + ZONE_MAP_BLOCK_SIZE - 1) / ZONE_MAP_BLOCK_SIZE;
+
+		if (!valid)
+			break;
+
+		size_t num_values = (size_t)(map->num_blocks * map->dims);
+		map->capacity = map->num_blocks;
+		map->min = (double *)malloc(sizeof(double)*num_values);
+		map->max = (double *)malloc(sizeof(double)*num_values);
+
+		valid = fread(map->min, sizeof(double), num_values, file) == num_values
+			&& fread(map->max, sizeof(double), num_values, file) == num_values;
+	}
+
+	fclose(file);
+
+	if (!valid)
+	{
+		zone_map_free(zones);
+		return NULL;
+	}
+
+	return zones;
+}
+
+/* ======================================================================================
+*
+* get_zone_map: returns the zone maps of the current index, read from the file the first time
+*				they are needed. Returns NULL if the index has no zone maps
+*
+* ====================================================================================== */
+zone_map *get_zone_map()
+{
+	static long checked_version = -1;
+
+	/* the index was rebuilt since the zone maps were read */
+	if (checked_version != INDEX_VERSION)
+	{
+		zone_map_free(ZONE_MAP);
+		ZONE_MAP = zone_map_read();
+		checked_version = INDEX_VERSION;
+	}
+
+	return ZONE_MAP;
+}
+
+/* ======================================================================================
+*
+* zone_map_min_distance: returns the distance from a vector to the bounding box of a block.
+*				Only the coordinates of the vector outside of the box contribute, by their
+*				distance to the closest face of the box
+*
+*      * zones - zone maps of the index
+*	   * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * block - index of the block
+*	   * query_vec - projection of the query at the level
+*
+* ====================================================================================== */
+double zone_map_min_distance(zone_map *zones, int level, long block, const double *query_vec)
+{
+	level_zone_map *map = &zones->levels[level];
+	const double *min = &map->min[block*map->dims];
+	const double *max = &map->max[block*map->dims];
+
+	int norm_l2 = get_projection_plan()->norm_l2;
+	double distance = 0;
+
+	int i;
+	for (i = 0; i < map->dims; i++)
+	{
+		double gap = 0;
+
+		if (query_vec[i] < min[i])
+			gap = min[i] - query_vec[i];
+		else if (query_vec[i] > max[i])
+			gap = query_vec[i] - max[i];
+
+		distance += norm_l2 ? gap*gap : gap;
+	}
+
+	return norm_l2 ? sqrt(distance) : distance;
+}
+
+/* ======================================================================================
+*
+* zone_map_build_predicate: builds a predicate over the ID column that selects the blocks of a
+*				level whose box is within epsilon of the query. Consecutive blocks are merged
+*				into a single ID BETWEEN a AND b. Returns NULL when no block is skipped, so that
+*				the level is scanned without a predicate, and 1 = 0 when every block is skipped
+*
+*      * zones - zone maps of the index
+*	   * level - level of the hierarchy, from 0 to NUM_PROJECTIONS
+*	   * query_vec - projection of the query at the level
+*	   * constant_c - constant that multiplies the distances of the level
+*	   * epsilon - radius of the query
+*
+* ====================================================================================== */
+char *zone_map_build_predicate(zone_map *zones, int level, const double *query_vec, double constant_c, double epsilon)
+{
+	level_zone_map *map = &zones->levels[level];
+
+	if (map->num_blocks == 0)
+		return NULL;
+
+	/* each range needs two IDs of at most 20 digits plus the keywords */
+	char *predicate = (char *)malloc(sizeof(char)*(16 + 64 * map->num_blocks));
+	char *p = predicate;
+	p += sprintf(p, "( ");
+
+	long block, run_begin = -1, num_skipped = 0, num_runs = 0;
+	for (block = 0; block <= map->num_blocks; block++)
+	{
+		int keep = (block < map->num_blocks)
+			&& constant_c * zone_map_min_distance(zones, level, block, query_vec) <= epsilon;
+
+		if (block < map->num_blocks && !keep)
+			num_skipped++;
+
+		if (keep && run_begin < 0)
+			run_begin = block;
+
+		/* close the run of blocks that ends before this one */
+		if (!keep && run_begin >= 0)
+		{
+			long first_id = run_begin * ZONE_MAP_BLOCK_SIZE + 1;
+			long last_id = (block == map->num_blocks) ? map->num_vectors : block * ZONE_MAP_BLOCK_SIZE;
+
+			p += sprintf(p, "%sID BETWEEN %ld AND %ld", (num_runs > 0) ? " OR " : "", first_id, last_id);
+			num_runs++;
+			run_begin = -1;
+		}
+	}
+	sprintf(p, " )");
+
+	if (DEBUG_OPTION > 0)
+		printf("\nZone maps of level %d: %ld of %ld blocks skipped\n", level, num_skipped, map->num_blocks);
+
+	if (num_skipped == 0)
+	{
+		free(predicate);
+		return NULL;
+	}
+
+	if (num_runs == 0)
+		strcpy(predicate, "1 = 0");
+
+	return predicate;
+}